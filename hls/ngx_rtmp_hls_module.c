@@ -9,13 +9,17 @@
 #include <ngx_rtmp.h>
 #include <ngx_rtmp_cmd_module.h>
 #include <ngx_rtmp_codec_module.h>
+#include <ngx_rtmp_live_module.h>
 #include "ngx_rtmp_mpegts.h"
+#include "mpegts/ngx_mpegts_live_module.h"
 
 
 static ngx_rtmp_publish_pt              next_publish;
 static ngx_rtmp_close_stream_pt         next_close_stream;
 static ngx_rtmp_stream_begin_pt         next_stream_begin;
 static ngx_rtmp_stream_eof_pt           next_stream_eof;
+static ngx_mpegts_video_pt              next_mpegts_video;
+static ngx_mpegts_audio_pt              next_mpegts_audio;
 
 
 static char * ngx_rtmp_hls_variant(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -78,6 +82,10 @@ typedef struct {
     ngx_buf_t                          *aframe;
     uint64_t                            aframe_pts;
 
+    /* timed ID3 latency probe */
+    ngx_uint_t                          id3_cc;
+    ngx_msec_t                          probe_time;
+
     ngx_rtmp_hls_variant_t             *var;
 } ngx_rtmp_hls_ctx_t;
 
@@ -993,6 +1001,7 @@ ngx_rtmp_hls_open_fragment(ngx_rtmp_session_t *s, uint64_t ts,
     ngx_rtmp_hls_ctx_t       *ctx;
     ngx_rtmp_hls_frag_t      *f;
     ngx_rtmp_hls_app_conf_t  *hacf;
+    ngx_rtmp_live_app_conf_t *lacf;
 
     ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_hls_module);
 
@@ -1086,8 +1095,11 @@ ngx_rtmp_hls_open_fragment(ngx_rtmp_session_t *s, uint64_t ts,
         return NGX_ERROR;
     }
 
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
+
     ctx->file.acodec = s->acodec;
     ctx->file.vcodec = s->vcodec;
+    ctx->file.id3 = lacf && lacf->latency_probe;
     if (ngx_rtmp_mpegts_open_file(&ctx->file, ctx->stream.data,
                                   s->log)
         != NGX_OK)
@@ -1820,6 +1832,45 @@ ngx_rtmp_hls_flush_audio(ngx_rtmp_session_t *s)
 }
 
 
+/* timed ID3 with wallclock at pts, as onFI probe of rtmp live */
+static ngx_int_t
+ngx_rtmp_hls_write_probe(ngx_rtmp_session_t *s, uint64_t pts)
+{
+    ngx_rtmp_hls_ctx_t             *ctx;
+    ngx_rtmp_mpegts_frame_t         frame;
+    ngx_int_t                       rc;
+    ngx_buf_t                       b;
+    u_char                          id3[NGX_RTMP_MPEGTS_ID3_PROBE_SIZE];
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_hls_module);
+
+    ngx_memzero(&b, sizeof(b));
+    b.start = id3;
+    b.pos = id3;
+    b.last = ngx_rtmp_mpegts_id3_probe(id3);
+    b.end = id3 + sizeof(id3);
+
+    ngx_memzero(&frame, sizeof(frame));
+
+    frame.dts = pts;
+    frame.pts = pts;
+    frame.cc = ctx->id3_cc;
+    frame.pid = NGX_RTMP_MPEGTS_ID3_PID;
+    frame.sid = NGX_RTMP_MPEGTS_ID3_SID;
+
+    rc = ngx_rtmp_mpegts_write_frame(&ctx->file, &frame, &b);
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "hls: id3 probe failed");
+    }
+
+    ctx->id3_cc = frame.cc;
+
+    return rc;
+}
+
+
 static ngx_int_t
 ngx_rtmp_hls_audio(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     ngx_chain_t *in)
@@ -1858,6 +1909,11 @@ ngx_rtmp_hls_audio(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         return NGX_OK;
     }
 
+    /* write ts packets muxed by mpegts live in ngx_rtmp_hls_mpegts_av */
+    if (ngx_mpegts_live_shared(s)) {
+        return NGX_OK;
+    }
+
     b = ctx->aframe;
 
     if (b == NULL) {
@@ -2036,6 +2092,7 @@ ngx_rtmp_hls_video(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     ngx_int_t                       aud_sent, sps_pps_sent, boundary;
     static u_char                   buffer[NGX_RTMP_HLS_BUFSIZE];
     ngx_rtmp_core_app_conf_t       *cacf;
+    ngx_rtmp_live_app_conf_t       *lacf;
 
     cacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_core_module);
 
@@ -2062,6 +2119,10 @@ ngx_rtmp_hls_video(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         return NGX_OK;
     }
 
+    if (ngx_mpegts_live_shared(s)) {
+        return NGX_OK;
+    }
+
     p = in->buf->pos;
     if (ngx_rtmp_hls_copy(s, &fmt, &p, 1, &in) != NGX_OK) {
         return NGX_ERROR;
@@ -2297,10 +2358,67 @@ ngx_rtmp_hls_video(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     ctx->video_cc = frame.cc;
 
+    /* ID3 stream is declared in PMT when fragment opened */
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
+    if (ctx->file.id3 && lacf->latency_probe
+        && ngx_current_msec - ctx->probe_time >= lacf->latency_probe)
+    {
+        ctx->probe_time = ngx_current_msec;
+        ngx_rtmp_hls_write_probe(s, frame.dts);
+    }
+
     return NGX_OK;
 }
 
 
+static ngx_int_t
+ngx_rtmp_hls_mpegts_av(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
+{
+    ngx_rtmp_hls_app_conf_t        *hacf;
+    ngx_rtmp_hls_ctx_t             *ctx;
+
+    hacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_hls_module);
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_hls_module);
+
+    if (hacf == NULL || !hacf->hls || ctx == NULL
+        || !ngx_mpegts_live_shared(s))
+    {
+        goto next;
+    }
+
+    /*
+     * audio is buffered and flushed by mpegts live before video frame,
+     * so fragment could always start at video key frame
+     */
+    if (frame->type == NGX_MPEGTS_MSG_VIDEO) {
+        ngx_rtmp_hls_update_fragment(s, frame->dts, frame->key, 1);
+    } else {
+        ngx_rtmp_hls_update_fragment(s, frame->dts, 0, 2);
+    }
+
+    if (!ctx->opened) {
+        goto next;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                   "hls: shared frame type=%ui pts=%uL, dts=%uL",
+                   frame->type, frame->pts, frame->dts);
+
+    if (ngx_rtmp_mpegts_write_chain(&ctx->file, frame->chain) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "hls: shared frame failed");
+    }
+
+next:
+    if (frame->type == NGX_MPEGTS_MSG_VIDEO) {
+        return next_mpegts_video(s, frame);
+    }
+
+    return next_mpegts_audio(s, frame);
+}
+
+
 static ngx_int_t
 ngx_rtmp_hls_stream_begin(ngx_rtmp_session_t *s, ngx_rtmp_stream_begin_t *v)
 {
@@ -2709,5 +2827,11 @@ ngx_rtmp_hls_postconfiguration(ngx_conf_t *cf)
     next_stream_eof = ngx_rtmp_stream_eof;
     ngx_rtmp_stream_eof = ngx_rtmp_hls_stream_eof;
 
+    next_mpegts_video = ngx_mpegts_video;
+    ngx_mpegts_video = ngx_rtmp_hls_mpegts_av;
+
+    next_mpegts_audio = ngx_mpegts_audio;
+    ngx_mpegts_audio = ngx_rtmp_hls_mpegts_av;
+
     return NGX_OK;
 }
@@ -8,6 +8,7 @@
 #include <ngx_core.h>
 #include "ngx_rtmp.h"
 #include "ngx_rtmp_mpegts.h"
+#include "ngx_rtmp_mpegts_pes.h"
 
 
 u_char ngx_rtmp_mpegts_pat[] = {
@@ -69,6 +70,20 @@ static u_char ngx_mpegts_pid[4][5] = {
     {0x03, 0xe1, 0x01, 0xf0, 0x00}  /* mp3 */
 };
 
+/* timed ID3 as Apple Timed Metadata for HTTP Live Streaming */
+static u_char ngx_mpegts_id3_pointer[] = {
+    /* metadata_pointer_descriptor in program info */
+    0x25, 0x0f, 0xff, 0xff, 0x49, 0x44, 0x33, 0x20,
+    0xff, 0x49, 0x44, 0x33, 0x20, 0x00, 0x1f, 0x00, 0x01
+};
+
+static u_char ngx_mpegts_id3_pid[] = {
+    0x15, 0xe1, 0x02, 0xf0, 0x0f,
+    /* metadata_descriptor, format ID3 */
+    0x26, 0x0d, 0xff, 0xff, 0x49, 0x44, 0x33, 0x20,
+    0xff, 0x49, 0x44, 0x33, 0x20, 0x00, 0x0f
+};
+
 /* 700 ms PCR delay */
 #define NGX_RTMP_HLS_DELAY  63000
 
@@ -139,7 +154,7 @@ ngx_rtmp_mpegts_crc32(u_char *crc_buf, const u_char *data, int len)
 
 
 ngx_int_t
-ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec,
+ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec, ngx_flag_t id3,
     ngx_log_t *log, u_char *pmt)
 {
     u_char      *p, crc_buf[4], *pmt_pos;
@@ -159,6 +174,16 @@ ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec,
 
     p = ngx_cpymem(p, ngx_mpegts_pmt_header, sizeof(ngx_mpegts_pmt_header));
 
+    section_length = 13;
+
+    if (id3) {
+        /* program_info_length */
+        p[-1] = sizeof(ngx_mpegts_id3_pointer);
+        p = ngx_cpymem(p, ngx_mpegts_id3_pointer,
+                       sizeof(ngx_mpegts_id3_pointer));
+        section_length += sizeof(ngx_mpegts_id3_pointer);
+    }
+
     if (vcodec == 0) {
         // ignore
     } else if (vcodec ==  NGX_RTMP_VIDEO_H264) {
@@ -189,7 +214,6 @@ ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec,
             }
     }
 
-    section_length = 13;
     if (vpid != -1) {
         p = ngx_cpymem(p, ngx_mpegts_pid[vpid], 5);
         section_length += 5;
@@ -200,6 +224,11 @@ ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec,
         section_length += 5;
     }
 
+    if (id3) {
+        p = ngx_cpymem(p, ngx_mpegts_id3_pid, sizeof(ngx_mpegts_id3_pid));
+        section_length += sizeof(ngx_mpegts_id3_pid);
+    }
+
     pmt_pos[2] = section_length;
 
     ngx_rtmp_mpegts_crc32(crc_buf, pmt_pos, p - pmt_pos);
@@ -312,7 +341,7 @@ ngx_rtmp_mpegts_write_header(ngx_rtmp_mpegts_file_t *file)
     }
 
     if (ngx_rtmp_mpegts_gen_pmt(file->vcodec,
-        file->acodec, file->log, pmt) != NGX_OK)
+        file->acodec, file->id3, file->log, pmt) != NGX_OK)
     {
         return NGX_ERROR;
     }
@@ -321,47 +350,13 @@ ngx_rtmp_mpegts_write_header(ngx_rtmp_mpegts_file_t *file)
 }
 
 
-static u_char *
-ngx_rtmp_mpegts_write_pcr(u_char *p, uint64_t pcr)
-{
-    *p++ = (u_char) (pcr >> 25);
-    *p++ = (u_char) (pcr >> 17);
-    *p++ = (u_char) (pcr >> 9);
-    *p++ = (u_char) (pcr >> 1);
-    *p++ = (u_char) (pcr << 7 | 0x7e);
-    *p++ = 0;
-
-    return p;
-}
-
-
-static u_char *
-ngx_rtmp_mpegts_write_pts(u_char *p, ngx_uint_t fb, uint64_t pts)
-{
-    ngx_uint_t val;
-
-    val = fb << 4 | (((pts >> 30) & 0x07) << 1) | 1;
-    *p++ = (u_char) val;
-
-    val = (((pts >> 15) & 0x7fff) << 1) | 1;
-    *p++ = (u_char) (val >> 8);
-    *p++ = (u_char) val;
-
-    val = (((pts) & 0x7fff) << 1) | 1;
-    *p++ = (u_char) (val >> 8);
-    *p++ = (u_char) val;
-
-    return p;
-}
-
-
 ngx_int_t
 ngx_rtmp_mpegts_write_frame(ngx_rtmp_mpegts_file_t *file,
     ngx_rtmp_mpegts_frame_t *f, ngx_buf_t *b)
 {
-    ngx_uint_t  pes_size, header_size, body_size, in_size, stuff_size, flags;
-    u_char      packet[188], *p, *base;
-    ngx_int_t   first, rc;
+    ngx_rtmp_mpegts_pes_t   pes;
+    u_char                  packets[NGX_RTMP_MPEGTS_PACKET_SIZE * 16], *last;
+    ngx_int_t               rc;
 
     ngx_log_debug6(NGX_LOG_DEBUG_CORE, file->log, 0,
                    "mpegts: pid=%ui, sid=%ui, pts=%uL, "
@@ -369,110 +364,64 @@ ngx_rtmp_mpegts_write_frame(ngx_rtmp_mpegts_file_t *file,
                    f->pid, f->sid, f->pts, f->dts,
                    (ngx_uint_t) f->key, (size_t) (b->last - b->pos));
 
-    first = 1;
-
-    while (b->pos < b->last) {
-        p = packet;
-
-        f->cc++;
-
-        *p++ = 0x47;
-        *p++ = (u_char) (f->pid >> 8);
-
-        if (first) {
-            p[-1] |= 0x40;
-        }
+    ngx_rtmp_mpegts_pes_init(&pes, f->pid, f->sid, f->key,
+                             f->dts - NGX_RTMP_HLS_DELAY,
+                             f->pts + NGX_RTMP_HLS_DELAY,
+                             f->dts + NGX_RTMP_HLS_DELAY, b->last - b->pos);
 
-        *p++ = (u_char) f->pid;
-        *p++ = 0x10 | (f->cc & 0x0f); /* payload */
+    while (pes.packet < pes.packets) {
+        last = ngx_rtmp_mpegts_pes_write(&pes, packets,
+                                         packets + sizeof(packets), b, &f->cc);
 
-        if (first) {
-
-            if (f->key) {
-                packet[3] |= 0x20; /* adaptation */
-
-                *p++ = 7;    /* size */
-                *p++ = 0x50; /* random access + PCR */
-
-                p = ngx_rtmp_mpegts_write_pcr(p, f->dts - NGX_RTMP_HLS_DELAY);
-            }
-
-            /* PES header */
-
-            *p++ = 0x00;
-            *p++ = 0x00;
-            *p++ = 0x01;
-            *p++ = (u_char) f->sid;
-
-            header_size = 5;
-            flags = 0x80; /* PTS */
-
-            if (f->dts != f->pts) {
-                header_size += 5;
-                flags |= 0x40; /* DTS */
-            }
-
-            pes_size = (b->last - b->pos) + header_size + 3;
-            if (pes_size > 0xffff) {
-                pes_size = 0;
-            }
-
-            *p++ = (u_char) (pes_size >> 8);
-            *p++ = (u_char) pes_size;
-            *p++ = 0x80; /* H222 */
-            *p++ = (u_char) flags;
-            *p++ = (u_char) header_size;
-
-            p = ngx_rtmp_mpegts_write_pts(p, flags >> 6, f->pts +
-                                                         NGX_RTMP_HLS_DELAY);
-
-            if (f->dts != f->pts) {
-                p = ngx_rtmp_mpegts_write_pts(p, 1, f->dts +
-                                                    NGX_RTMP_HLS_DELAY);
-            }
-
-            first = 0;
+        rc = ngx_rtmp_mpegts_write_file(file, packets, last - packets);
+        if (rc != NGX_OK) {
+            return rc;
         }
+    }
 
-        body_size = (ngx_uint_t) (packet + sizeof(packet) - p);
-        in_size = (ngx_uint_t) (b->last - b->pos);
+    return NGX_OK;
+}
 
-        if (body_size <= in_size) {
-            ngx_memcpy(p, b->pos, body_size);
-            b->pos += body_size;
 
-        } else {
-            stuff_size = (body_size - in_size);
+u_char *
+ngx_rtmp_mpegts_id3_probe(u_char *p)
+{
+    ngx_time_t     *tp;
+    u_char         *frame, *last;
+    size_t          size;
 
-            if (packet[3] & 0x20) {
+    tp = ngx_timeofday();
 
-                /* has adaptation */
+    /* ID3v2.4 header, size filled after frame written */
+    p = ngx_cpymem(p, "ID3\x04\x00\x00\x00\x00\x00\x00", 10);
+    frame = p;
 
-                base = &packet[5] + packet[4];
-                p = ngx_movemem(base + stuff_size, base, p - base);
-                ngx_memset(base, 0xff, stuff_size);
-                packet[4] += (u_char) stuff_size;
+    /* TXXX frame, UTF-8 description and value */
+    p = ngx_cpymem(p, "TXXX\x00\x00\x00\x00\x00\x00\x03" "epoch", 16);
+    last = ngx_sprintf(p, "%Z%uL", (uint64_t) tp->sec * 1000 + tp->msec);
 
-            } else {
+    /* sizes are syncsafe, less than 128 fits in last byte */
+    size = last - frame;
+    frame[-1] = (u_char) size;
+    frame[7] = (u_char) (size - 10);
 
-                /* no adaptation */
+    return last;
+}
 
-                packet[3] |= 0x20;
-                p = ngx_movemem(&packet[4] + stuff_size, &packet[4],
-                                p - &packet[4]);
 
-                packet[4] = (u_char) (stuff_size - 1);
-                if (stuff_size >= 2) {
-                    packet[5] = 0;
-                    ngx_memset(&packet[6], 0xff, stuff_size - 2);
-                }
-            }
+ngx_int_t
+ngx_rtmp_mpegts_write_chain(ngx_rtmp_mpegts_file_t *file, ngx_chain_t *in)
+{
+    ngx_int_t   rc;
 
-            ngx_memcpy(p, b->pos, in_size);
-            b->pos = b->last;
+    /* packets in chain may be shared with others, do not move buf pos */
+    for (/* void */; in; in = in->next) {
+        if (in->buf->last == in->buf->pos) {
+            continue;
         }
 
-        rc = ngx_rtmp_mpegts_write_file(file, packet, sizeof(packet));
+        rc = ngx_rtmp_mpegts_write_file(file, in->buf->pos,
+                                        in->buf->last - in->buf->pos);
         if (rc != NGX_OK) {
             return rc;
         }
@@ -13,6 +13,12 @@
 #include <openssl/aes.h>
 
 
+/* timed ID3 metadata stream carrying latency probe */
+#define NGX_RTMP_MPEGTS_ID3_PID         0x102
+#define NGX_RTMP_MPEGTS_ID3_SID         0xbd
+#define NGX_RTMP_MPEGTS_ID3_PROBE_SIZE  64
+
+
 typedef struct ngx_rtmp_mpegts_file_s  ngx_rtmp_mpegts_file_t;
 
 
@@ -25,6 +31,7 @@ struct ngx_rtmp_mpegts_file_s {
     ngx_log_t  *log;
     off_t       file_size;
     unsigned    encrypt:1;
+    unsigned    id3:1;      /* declare ID3 stream in PMT */
     unsigned    size:4;
     u_char      buf[16];
     u_char      iv[16];
@@ -54,5 +61,17 @@ ngx_int_t ngx_rtmp_mpegts_close_file(ngx_rtmp_mpegts_file_t *file);
 ngx_int_t ngx_rtmp_mpegts_write_header(ngx_rtmp_mpegts_file_t *file);
 ngx_int_t ngx_rtmp_mpegts_write_frame(ngx_rtmp_mpegts_file_t *file,
     ngx_rtmp_mpegts_frame_t *f, ngx_buf_t *b);
+/*
+ * paras:
+ *      p: buffer of at least NGX_RTMP_MPEGTS_ID3_PROBE_SIZE bytes
+ *
+ * return:
+ *      end of ID3 tag written, a TXXX frame "epoch" with wallclock in msec,
+ *      for PES payload on NGX_RTMP_MPEGTS_ID3_PID
+ */
+u_char *ngx_rtmp_mpegts_id3_probe(u_char *p);
+/* write ts packets already muxed, such as chain of ngx_mpegts_frame_t */
+ngx_int_t ngx_rtmp_mpegts_write_chain(ngx_rtmp_mpegts_file_t *file,
+    ngx_chain_t *in);
 
 #endif /* _NGX_RTMP_MPEGTS_H_INCLUDED_ */
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include "ngx_rtmp_mpegts_pes.h"
+
+
+#define NGX_RTMP_MPEGTS_PAYLOAD_SIZE    (NGX_RTMP_MPEGTS_PACKET_SIZE - 4)
+
+
+static u_char *
+ngx_rtmp_mpegts_pes_write_pcr(u_char *p, uint64_t pcr)
+{
+    *p++ = (u_char) (pcr >> 25);
+    *p++ = (u_char) (pcr >> 17);
+    *p++ = (u_char) (pcr >> 9);
+    *p++ = (u_char) (pcr >> 1);
+    *p++ = (u_char) (pcr << 7 | 0x7e);
+    *p++ = 0;
+
+    return p;
+}
+
+
+static u_char *
+ngx_rtmp_mpegts_pes_write_pts(u_char *p, ngx_uint_t fb, uint64_t pts)
+{
+    ngx_uint_t val;
+
+    val = fb << 4 | (((pts >> 30) & 0x07) << 1) | 1;
+    *p++ = (u_char) val;
+
+    val = (((pts >> 15) & 0x7fff) << 1) | 1;
+    *p++ = (u_char) (val >> 8);
+    *p++ = (u_char) val;
+
+    val = (((pts) & 0x7fff) << 1) | 1;
+    *p++ = (u_char) (val >> 8);
+    *p++ = (u_char) val;
+
+    return p;
+}
+
+
+void
+ngx_rtmp_mpegts_pes_init(ngx_rtmp_mpegts_pes_t *pes, ngx_uint_t pid,
+    ngx_uint_t sid, ngx_flag_t key, uint64_t pcr, uint64_t pts, uint64_t dts,
+    size_t size)
+{
+    ngx_uint_t  pes_size, header_size, flags;
+    size_t      first;
+    u_char     *p;
+
+    pes->ts[0] = 0x47;
+    pes->ts[1] = (u_char) (pid >> 8);
+    pes->ts[2] = (u_char) pid;
+    pes->ts[3] = 0x10; /* payload */
+
+    pes->af_size = 0;
+    if (key) {
+        pes->af[0] = 7;    /* size */
+        pes->af[1] = 0x50; /* random access + PCR */
+        ngx_rtmp_mpegts_pes_write_pcr(&pes->af[2], pcr);
+        pes->af_size = 8;
+    }
+
+    header_size = 5;
+    flags = 0x80; /* PTS */
+
+    if (dts != pts) {
+        header_size += 5;
+        flags |= 0x40; /* DTS */
+    }
+
+    pes_size = size + header_size + 3;
+    if (pes_size > 0xffff) {
+        pes_size = 0;
+    }
+
+    p = pes->pes;
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = 0x01;
+    *p++ = (u_char) sid;
+    *p++ = (u_char) (pes_size >> 8);
+    *p++ = (u_char) pes_size;
+    *p++ = 0x80; /* H222 */
+    *p++ = (u_char) flags;
+    *p++ = (u_char) header_size;
+
+    p = ngx_rtmp_mpegts_pes_write_pts(p, flags >> 6, pts);
+
+    if (dts != pts) {
+        p = ngx_rtmp_mpegts_pes_write_pts(p, 1, dts);
+    }
+
+    pes->pes_size = p - pes->pes;
+
+    /* payload could be put in first packet */
+    first = NGX_RTMP_MPEGTS_PAYLOAD_SIZE - pes->af_size - pes->pes_size;
+
+    pes->packet = 0;
+
+    if (size == 0) {
+        pes->packets = 0;
+        pes->stuff = 0;
+
+    } else if (size <= first) {
+        pes->packets = 1;
+        pes->stuff = first - size;
+
+    } else {
+        size -= first;
+        pes->packets = 1 + (size + NGX_RTMP_MPEGTS_PAYLOAD_SIZE - 1)
+                         / NGX_RTMP_MPEGTS_PAYLOAD_SIZE;
+        pes->stuff = (pes->packets - 1) * NGX_RTMP_MPEGTS_PAYLOAD_SIZE - size;
+    }
+}
+
+
+static u_char *
+ngx_rtmp_mpegts_pes_edge(ngx_rtmp_mpegts_pes_t *pes, u_char *packet,
+    ngx_buf_t *b, ngx_uint_t cc)
+{
+    u_char     *p;
+    size_t      stuff, n;
+    ngx_flag_t  first;
+
+    first = (pes->packet == 0);
+    stuff = (pes->packet == pes->packets - 1) ? pes->stuff : 0;
+
+    p = ngx_cpymem(packet, pes->ts, sizeof(pes->ts));
+    packet[3] |= (u_char) (cc & 0x0f);
+
+    if (first) {
+        packet[1] |= 0x40;
+    }
+
+    if (first && pes->af_size) {
+        packet[3] |= 0x20; /* adaptation */
+
+        p = ngx_cpymem(p, pes->af, pes->af_size);
+        packet[4] += (u_char) stuff;
+
+        ngx_memset(p, 0xff, stuff);
+        p += stuff;
+
+    } else if (stuff) {
+        packet[3] |= 0x20; /* adaptation only for stuffing */
+
+        *p++ = (u_char) (stuff - 1);
+        if (stuff >= 2) {
+            *p++ = 0;
+            ngx_memset(p, 0xff, stuff - 2);
+            p += stuff - 2;
+        }
+    }
+
+    if (first) {
+        p = ngx_cpymem(p, pes->pes, pes->pes_size);
+    }
+
+    n = packet + NGX_RTMP_MPEGTS_PACKET_SIZE - p;
+    ngx_memcpy(p, b->pos, n);
+    b->pos += n;
+
+    ++pes->packet;
+
+    return packet + NGX_RTMP_MPEGTS_PACKET_SIZE;
+}
+
+
+u_char *
+ngx_rtmp_mpegts_pes_write(ngx_rtmp_mpegts_pes_t *pes, u_char *out,
+    u_char *end, ngx_buf_t *b, ngx_uint_t *cc)
+{
+    ngx_uint_t  last;
+    u_char     *src;
+
+    last = pes->packets - 1;
+
+    while (pes->packet < pes->packets
+           && end - out >= NGX_RTMP_MPEGTS_PACKET_SIZE)
+    {
+        if (pes->packet == 0 || pes->packet == last) {
+            out = ngx_rtmp_mpegts_pes_edge(pes, out, b, ++*cc);
+            continue;
+        }
+
+        /* packets between first and last carry payload only */
+
+        src = b->pos;
+
+        while (pes->packet < last
+               && end - out >= NGX_RTMP_MPEGTS_PACKET_SIZE)
+        {
+            ++*cc;
+
+            out[0] = pes->ts[0];
+            out[1] = pes->ts[1];
+            out[2] = pes->ts[2];
+            out[3] = (u_char) (pes->ts[3] | (*cc & 0x0f));
+
+            ngx_memcpy(out + 4, src, NGX_RTMP_MPEGTS_PAYLOAD_SIZE);
+
+            src += NGX_RTMP_MPEGTS_PAYLOAD_SIZE;
+            out += NGX_RTMP_MPEGTS_PACKET_SIZE;
+            ++pes->packet;
+        }
+
+        b->pos = src;
+    }
+
+    return out;
+}
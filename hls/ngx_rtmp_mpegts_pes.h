@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_MPEGTS_PES_H_INCLUDED_
+#define _NGX_RTMP_MPEGTS_PES_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_RTMP_MPEGTS_PACKET_SIZE     188
+
+
+/*
+ * Layout of one PES in ts packets, computed before packetizing, so every
+ * packet is written from templates with payload copied once and stuffing
+ * put in place without moving payload.
+ */
+typedef struct {
+    u_char          ts[4];      /* ts header template of pid */
+    u_char          af[8];      /* adaptation of first packet, random access
+                                   and PCR for key frame */
+    size_t          af_size;
+    u_char          pes[19];    /* PES header with PTS and DTS */
+    size_t          pes_size;
+
+    ngx_uint_t      packets;    /* ts packets of PES */
+    ngx_uint_t      packet;     /* next packet to write */
+    size_t          stuff;      /* stuffing bytes in last packet */
+} ngx_rtmp_mpegts_pes_t;
+
+
+/*
+ * paras:
+ *      pes: layout to init
+ *      pid, sid: ts pid and PES stream id
+ *      key: write random access and PCR in first packet
+ *      pcr, pts, dts: timestamps in 90KHz, delay already added
+ *      size: PES payload size
+ */
+void ngx_rtmp_mpegts_pes_init(ngx_rtmp_mpegts_pes_t *pes, ngx_uint_t pid,
+    ngx_uint_t sid, ngx_flag_t key, uint64_t pcr, uint64_t pts, uint64_t dts,
+    size_t size);
+
+/*
+ * paras:
+ *      pes: layout inited by ngx_rtmp_mpegts_pes_init
+ *      out: buffer to write packets into
+ *      end: end of buffer, packets are written until buffer could not hold
+ *           one more packet or all packets of PES written
+ *      b: PES payload, b->pos moves forward after payload packed
+ *      cc: continuity counter, increased for every packet written
+ *
+ * return:
+ *      end of packets written, PES is done when pes->packet reaches
+ *      pes->packets
+ */
+u_char *ngx_rtmp_mpegts_pes_write(ngx_rtmp_mpegts_pes_t *pes, u_char *out,
+    u_char *end, ngx_buf_t *b, ngx_uint_t *cc);
+
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_HTTP_FLV_H_INCLUDED_
+#define _NGX_HTTP_FLV_H_INCLUDED_
+
+
+/* flv file header with first PreviousTagSize */
+#define NGX_FLV_HEADER_SIZE     13
+/* tag header: type, data size, timestamp, timestamp extended, stream id */
+#define NGX_FLV_TAG_SIZE        11
+/* PreviousTagSize after every tag */
+#define NGX_FLV_PTS_SIZE        4
+
+
+#endif
@@ -11,6 +11,7 @@
 #include "ngx_rtmp_cmd_module.h"
 #include "ngx_rbuf.h"
 #include "ngx_http_set_header.h"
+#include "ngx_http_flv.h"
 #include "ngx_rtmp_monitor_module.h"
 
 
@@ -30,9 +31,6 @@ static ngx_keyval_t ngx_http_flv_live_headers[] = {
     { ngx_null_string, ngx_null_string }
 };
 
-#define NGX_FLV_TAG_SIZE        11
-#define NGX_FLV_PTS_SIZE        4
-
 typedef struct {
     ngx_rtmp_session_t         *session;
 } ngx_http_flv_live_ctx_t;
@@ -185,8 +183,7 @@ ngx_http_flv_live_prepare_out_chain(ngx_rtmp_session_t *s)
                 && frame->hdr.type != NGX_RTMP_MSG_AMF3_META)
         {
             ngx_rtmp_shared_free_frame(frame);
-            ++s->out_pos;
-            s->out_pos %= s->out_queue;
+            s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
             frame = NULL;
 
             continue;
@@ -336,6 +333,7 @@ ngx_http_flv_live_write_handler(ngx_http_request_t *r)
         sent = r->connection->sent - present;
 
         ngx_rtmp_update_bandwidth(&ngx_rtmp_bw_out, sent);
+        ngx_rtmp_update_bandwidth(&ngx_rtmp_send_calls, 1);
 
         if (rc == NGX_AGAIN) {
             ngx_add_timer(wev, s->timeout);
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_rtmp_record_module.h"
+
+
+static char *ngx_http_flv_vod(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+
+static ngx_command_t  ngx_http_flv_vod_commands[] = {
+
+    { ngx_string("flv_vod"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_flv_vod,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_flv_vod_module_ctx = {
+    NULL,                               /* preconfiguration */
+    NULL,                               /* postconfiguration */
+
+    NULL,                               /* create main configuration */
+    NULL,                               /* init main configuration */
+
+    NULL,                               /* create server configuration */
+    NULL,                               /* merge server configuration */
+
+    NULL,                               /* create location configuration */
+    NULL                                /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_flv_vod_module = {
+    NGX_MODULE_V1,
+    &ngx_http_flv_vod_module_ctx,       /* module context */
+    ngx_http_flv_vod_commands,          /* module directives */
+    NGX_HTTP_MODULE,                    /* module type */
+    NULL,                               /* init master */
+    NULL,                               /* init module */
+    NULL,                               /* init process */
+    NULL,                               /* init thread */
+    NULL,                               /* exit thread */
+    NULL,                               /* exit process */
+    NULL,                               /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_buf_t *
+ngx_http_flv_vod_file_buf(ngx_http_request_t *r, ngx_open_file_info_t *of,
+        ngx_str_t *path, off_t start, off_t end)
+{
+    ngx_buf_t                          *b;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NULL;
+    }
+
+    b->file_pos = start;
+    b->file_last = end;
+    b->in_file = (end > start) ? 1 : 0;
+
+    b->file->fd = of->fd;
+    b->file->name = *path;
+    b->file->log = r->connection->log;
+    b->file->directio = of->is_directio;
+
+    return b;
+}
+
+
+/*
+ * serve record flv, ?start= is timestamp in msec of the file,
+ * body is flv header and codec headers followed by tags
+ * from first keyframe at or after start, sent by sendfile
+ */
+static ngx_int_t
+ngx_http_flv_vod_handler(ngx_http_request_t *r)
+{
+    ngx_http_core_loc_conf_t           *clcf;
+    ngx_open_file_info_t                of;
+    ngx_str_t                           path, arg;
+    ngx_buf_t                          *b;
+    ngx_chain_t                         out[2], *cl;
+    off_t                               start_time, header, start;
+    size_t                              root;
+    u_char                             *last;
+    ngx_int_t                           rc;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    start_time = 0;
+
+    if (ngx_http_arg(r, (u_char *) "start", sizeof("start") - 1, &arg)
+        == NGX_OK)
+    {
+        start_time = ngx_atoof(arg.data, arg.len);
+        if (start_time == NGX_ERROR || start_time > NGX_MAX_UINT32_VALUE) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        if (of.err == NGX_ENOENT || of.err == NGX_ENOTDIR
+            || of.err == NGX_ENAMETOOLONG)
+        {
+            return NGX_HTTP_NOT_FOUND;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                "%s \"%V\" failed", of.failed, &path);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!of.is_file) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    header = 0;
+    start = 0;
+
+    if (start_time > 0) {
+        rc = ngx_rtmp_record_index_seek(&path, r->connection->log,
+                                        (uint32_t) start_time, &header,
+                                        &start);
+
+        switch (rc) {
+        case NGX_OK:
+            if (header > start || start > of.size) {
+                ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                        "flv vod: index mismatch \"%V\"", &path);
+                header = 0;
+                start = 0;
+            }
+            break;
+
+        case NGX_DECLINED:
+            break;
+
+        case NGX_DONE:
+            return NGX_HTTP_RANGE_NOT_SATISFIABLE;
+
+        default:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    /* keyframe right after codec headers */
+    if (start <= header) {
+        header = 0;
+        start = 0;
+    }
+
+    r->root_tested = !r->error_page;
+    r->allow_ranges = (start == 0);
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = header + of.size - start;
+    r->headers_out.last_modified_time = of.mtime;
+
+    ngx_str_set(&r->headers_out.content_type, "video/x-flv");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->header_only = 1;
+        return ngx_http_send_header(r);
+    }
+
+    cl = &out[1];
+
+    if (header) {
+        b = ngx_http_flv_vod_file_buf(r, &of, &path, 0, header);
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        out[0].buf = b;
+        out[0].next = &out[1];
+        cl = &out[0];
+    }
+
+    b = ngx_http_flv_vod_file_buf(r, &of, &path, start, of.size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out[1].buf = b;
+    out[1].next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, cl);
+}
+
+
+static char *
+ngx_http_flv_vod(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t           *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_flv_vod_handler;
+
+    return NGX_CONF_OK;
+}
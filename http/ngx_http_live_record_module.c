@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_live_record.h"
+
+
+/* PAT and PMT written at the beginning of record ts file */
+#define NGX_HTTP_LIVE_RECORD_HEADER     (2 * 188)
+
+
+static char *ngx_http_live_record_seek(ngx_conf_t *cf, ngx_command_t *cmd,
+       void *conf);
+
+
+static ngx_command_t  ngx_http_live_record_commands[] = {
+
+    { ngx_string("live_record_seek"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_live_record_seek,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_live_record_module_ctx = {
+    NULL,                               /* preconfiguration */
+    NULL,                               /* postconfiguration */
+
+    NULL,                               /* create main configuration */
+    NULL,                               /* init main configuration */
+
+    NULL,                               /* create server configuration */
+    NULL,                               /* merge server configuration */
+
+    NULL,                               /* create location configuration */
+    NULL                                /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_live_record_module = {
+    NGX_MODULE_V1,
+    &ngx_http_live_record_module_ctx,   /* module context */
+    ngx_http_live_record_commands,      /* module directives */
+    NGX_HTTP_MODULE,                    /* module type */
+    NULL,                               /* init master */
+    NULL,                               /* init module */
+    NULL,                               /* init process */
+    NULL,                               /* init thread */
+    NULL,                               /* exit thread */
+    NULL,                               /* exit process */
+    NULL,                               /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_live_record_time_arg(ngx_http_request_t *r, char *name, size_t len,
+        off_t *time)
+{
+    ngx_str_t                           arg;
+
+    if (ngx_http_arg(r, (u_char *) name, len, &arg) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    *time = ngx_atoof(arg.data, arg.len);
+    if (*time == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* number of entries whose time is not greater than time */
+static ngx_uint_t
+ngx_http_live_record_bsearch(ngx_live_record_index_t *key, ngx_uint_t n,
+        uint64_t time)
+{
+    ngx_uint_t                          lo, hi, mid;
+
+    lo = 0;
+    hi = n;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (key[mid].time <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/*
+ * lookup [*start, *end) in ts by keyframe index, *start is offset of nearest
+ * keyframe before start time, *end is offset of first keyframe after end time
+ */
+static ngx_int_t
+ngx_http_live_record_lookup(ngx_http_request_t *r, ngx_str_t *name,
+        off_t start_time, off_t end_time, off_t *start, off_t *end)
+{
+    ngx_fd_t                            fd;
+    ngx_file_info_t                     fi;
+    ngx_live_record_index_t            *key;
+    ngx_uint_t                          n, i;
+    size_t                              size;
+    ngx_int_t                           rc;
+
+    fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                ngx_open_file_n " \"%V\" failed", name);
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                ngx_fd_info_n " \"%V\" failed", name);
+        goto done;
+    }
+
+    n = ngx_file_size(&fi) / sizeof(ngx_live_record_index_t);
+    if (n == 0) {
+        rc = NGX_HTTP_NOT_FOUND;
+        goto done;
+    }
+
+    size = n * sizeof(ngx_live_record_index_t);
+
+    key = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (key == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, ngx_errno,
+                "mmap(%uz) \"%V\" failed", size, name);
+        goto done;
+    }
+
+    if (start_time >= 0) {
+        i = ngx_http_live_record_bsearch(key, n, start_time);
+        *start = key[i ? i - 1 : 0].offset;
+    }
+
+    if (end_time >= 0) {
+        i = ngx_http_live_record_bsearch(key, n, end_time);
+        if (i < n) {
+            *end = key[i].offset;
+        }
+    }
+
+    if (munmap(key, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                "munmap(%uz) \"%V\" failed", size, name);
+    }
+
+    rc = NGX_OK;
+
+done:
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                ngx_close_file_n " \"%V\" failed", name);
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_live_record_seek_handler(ngx_http_request_t *r)
+{
+    ngx_http_core_loc_conf_t           *clcf;
+    ngx_open_file_info_t                of;
+    ngx_str_t                           path, keys;
+    ngx_buf_t                          *b;
+    ngx_chain_t                         out[2], *cl;
+    off_t                               start_time, end_time, start, end;
+    size_t                              root;
+    u_char                             *last;
+    ngx_int_t                           rc;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    start_time = -1;
+    end_time = -1;
+
+    if (ngx_http_live_record_time_arg(r, "start", sizeof("start") - 1,
+                                      &start_time) == NGX_ERROR
+        || ngx_http_live_record_time_arg(r, "end", sizeof("end") - 1,
+                                         &end_time) == NGX_ERROR)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    if (path.len < sizeof(".ts") - 1
+        || ngx_strncmp(last - (sizeof(".ts") - 1), ".ts", sizeof(".ts") - 1)
+           != 0)
+    {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        if (of.err == NGX_ENOENT || of.err == NGX_ENOTDIR
+            || of.err == NGX_ENAMETOOLONG)
+        {
+            return NGX_HTTP_NOT_FOUND;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                "%s \"%V\" failed", of.failed, &path);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (!of.is_file) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    start = 0;
+    end = of.size;
+
+    if (start_time >= 0 || end_time >= 0) {
+        keys.len = path.len + 1;
+        keys.data = ngx_pnalloc(r->pool, keys.len + 1);
+        if (keys.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        last = ngx_cpymem(keys.data, path.data,
+                          path.len - (sizeof("ts") - 1));
+        ngx_memcpy(last, "idx", sizeof("idx"));
+
+        rc = ngx_http_live_record_lookup(r, &keys, start_time, end_time,
+                                         &start, &end);
+        if (rc != NGX_OK) {
+            return rc;
+        }
+
+        if (end > of.size) {
+            end = of.size;
+        }
+    }
+
+    if (start >= end) {
+        return NGX_HTTP_RANGE_NOT_SATISFIABLE;
+    }
+
+    /* ts served from keyframe must start with PAT and PMT */
+    if (start <= NGX_HTTP_LIVE_RECORD_HEADER) {
+        start = 0;
+    }
+
+    r->root_tested = !r->error_page;
+    r->allow_ranges = 0;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = end - start;
+    r->headers_out.last_modified_time = of.mtime;
+
+    ngx_str_set(&r->headers_out.content_type, "video/mp2t");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+
+    if (start) {
+        r->headers_out.content_length_n += NGX_HTTP_LIVE_RECORD_HEADER;
+    }
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->header_only = 1;
+        return ngx_http_send_header(r);
+    }
+
+    cl = &out[1];
+
+    if (start) {
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->file_pos = 0;
+        b->file_last = NGX_HTTP_LIVE_RECORD_HEADER;
+        b->in_file = 1;
+
+        b->file->fd = of.fd;
+        b->file->name = path;
+        b->file->log = r->connection->log;
+        b->file->directio = of.is_directio;
+
+        out[0].buf = b;
+        out[0].next = &out[1];
+        cl = &out[0];
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->file_pos = start;
+    b->file_last = end;
+    b->in_file = 1;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    b->file->fd = of.fd;
+    b->file->name = path;
+    b->file->log = r->connection->log;
+    b->file->directio = of.is_directio;
+
+    out[1].buf = b;
+    out[1].next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, cl);
+}
+
+
+static char *
+ngx_http_live_record_seek(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t           *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_live_record_seek_handler;
+
+    return NGX_CONF_OK;
+}
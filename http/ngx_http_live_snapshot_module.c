@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_rtmp.h"
+#include "ngx_http_set_header.h"
+#include "ngx_http_flv.h"
+
+
+#define NGX_HTTP_LIVE_SNAPSHOT_FLV      0
+#define NGX_HTTP_LIVE_SNAPSHOT_ANNEXB   1
+
+/* video tag: frame type and codec, packet type, composition time */
+#define NGX_FLV_VIDEO_HEADER_SIZE       5
+
+
+static char *ngx_http_live_snapshot(ngx_conf_t *cf, ngx_command_t *cmd,
+       void *conf);
+
+
+/* video only */
+static u_char  ngx_http_live_snapshot_flv_header[] =
+    "FLV\x1\x1\0\0\0\x9\0\0\0\0";
+
+
+static ngx_command_t  ngx_http_live_snapshot_commands[] = {
+
+    { ngx_string("live_snapshot"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_live_snapshot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_live_snapshot_module_ctx = {
+    NULL,                               /* preconfiguration */
+    NULL,                               /* postconfiguration */
+
+    NULL,                               /* create main configuration */
+    NULL,                               /* init main configuration */
+
+    NULL,                               /* create server configuration */
+    NULL,                               /* merge server configuration */
+
+    NULL,                               /* create location configuration */
+    NULL                                /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_live_snapshot_module = {
+    NGX_MODULE_V1,
+    &ngx_http_live_snapshot_module_ctx, /* module context */
+    ngx_http_live_snapshot_commands,    /* module directives */
+    NGX_HTTP_MODULE,                    /* module type */
+    NULL,                               /* init master */
+    NULL,                               /* init module */
+    NULL,                               /* init process */
+    NULL,                               /* init thread */
+    NULL,                               /* exit thread */
+    NULL,                               /* exit process */
+    NULL,                               /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static size_t
+ngx_http_live_snapshot_size(ngx_rtmp_frame_t *frame)
+{
+    ngx_chain_t                        *cl;
+    size_t                              size;
+
+    size = 0;
+    for (cl = frame->chain; cl; cl = cl->next) {
+        size += cl->buf->last - cl->buf->pos;
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_live_snapshot_copy(u_char *p, ngx_rtmp_frame_t *frame)
+{
+    ngx_chain_t                        *cl;
+
+    for (cl = frame->chain; cl; cl = cl->next) {
+        p = ngx_cpymem(p, cl->buf->pos, cl->buf->last - cl->buf->pos);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_live_snapshot_flv_tag(u_char *p, ngx_rtmp_frame_t *frame)
+{
+    size_t                              size;
+
+    size = ngx_http_live_snapshot_size(frame);
+
+    /* TagType, DataSize, Timestamp and StreamID, timestamp is always 0 */
+    *p++ = NGX_RTMP_MSG_VIDEO;
+    *p++ = (u_char) (size >> 16);
+    *p++ = (u_char) (size >> 8);
+    *p++ = (u_char) size;
+    ngx_memzero(p, 7);
+    p += 7;
+
+    p = ngx_http_live_snapshot_copy(p, frame);
+
+    /* PreviousTagSize */
+    size += NGX_FLV_TAG_SIZE;
+    *p++ = (u_char) (size >> 24);
+    *p++ = (u_char) (size >> 16);
+    *p++ = (u_char) (size >> 8);
+    *p++ = (u_char) size;
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_live_snapshot_flv(ngx_http_request_t *r, ngx_rtmp_frame_t *header,
+        ngx_rtmp_frame_t *keyframe, ngx_buf_t *b)
+{
+    size_t                              size;
+
+    size = NGX_FLV_HEADER_SIZE
+         + NGX_FLV_TAG_SIZE + ngx_http_live_snapshot_size(header)
+         + NGX_FLV_PTS_SIZE
+         + NGX_FLV_TAG_SIZE + ngx_http_live_snapshot_size(keyframe)
+         + NGX_FLV_PTS_SIZE;
+
+    b->start = ngx_pnalloc(r->pool, size);
+    if (b->start == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = b->start;
+    b->end = b->start + size;
+
+    b->last = ngx_cpymem(b->pos, ngx_http_live_snapshot_flv_header,
+                         NGX_FLV_HEADER_SIZE);
+    b->last = ngx_http_live_snapshot_flv_tag(b->last, header);
+    b->last = ngx_http_live_snapshot_flv_tag(b->last, keyframe);
+
+    return NGX_OK;
+}
+
+
+/*
+ * write NAL units with nal_bytes length prefix in [p, last) as annex-b to
+ * out, return size written, only count size if out is NULL
+ */
+static ssize_t
+ngx_http_live_snapshot_nals(u_char *p, u_char *last, ngx_uint_t nal_bytes,
+        u_char *out)
+{
+    size_t                              len, size;
+    ngx_uint_t                          i;
+
+    size = 0;
+
+    while (p < last) {
+        if ((size_t) (last - p) < nal_bytes) {
+            return NGX_ERROR;
+        }
+
+        len = 0;
+        for (i = 0; i < nal_bytes; ++i) {
+            len = (len << 8) | *p++;
+        }
+
+        if ((size_t) (last - p) < len) {
+            return NGX_ERROR;
+        }
+
+        if (out) {
+            out = ngx_cpymem(out, "\0\0\0\1", 4);
+            out = ngx_cpymem(out, p, len);
+        }
+
+        p += len;
+        size += 4 + len;
+    }
+
+    return size;
+}
+
+
+/* parameter sets in AVCDecoderConfigurationRecord */
+static ssize_t
+ngx_http_live_snapshot_avc_header(u_char *p, u_char *last,
+        ngx_uint_t *nal_bytes, u_char *out)
+{
+    size_t                              len, size;
+    ngx_uint_t                          n, nnals;
+
+    /* version, profile, compatibility, level */
+    if (last - p < 5) {
+        return NGX_ERROR;
+    }
+
+    *nal_bytes = (p[4] & 0x03) + 1;
+    p += 5;
+
+    size = 0;
+
+    /* SPS, then PPS */
+    for (n = 0; n < 2; ++n) {
+        if (p == last) {
+            return NGX_ERROR;
+        }
+
+        nnals = *p++;
+        if (n == 0) {
+            nnals &= 0x1f;
+        }
+
+        for (; nnals; --nnals) {
+            if (last - p < 2) {
+                return NGX_ERROR;
+            }
+
+            len = (p[0] << 8) | p[1];
+            p += 2;
+
+            if ((size_t) (last - p) < len) {
+                return NGX_ERROR;
+            }
+
+            if (out) {
+                out = ngx_cpymem(out, "\0\0\0\1", 4);
+                out = ngx_cpymem(out, p, len);
+            }
+
+            p += len;
+            size += 4 + len;
+        }
+    }
+
+    return size;
+}
+
+
+/* parameter sets in HEVCDecoderConfigurationRecord */
+static ssize_t
+ngx_http_live_snapshot_hevc_header(u_char *p, u_char *last,
+        ngx_uint_t *nal_bytes, u_char *out)
+{
+    size_t                              len, size;
+    ngx_uint_t                          narrays, nnals;
+
+    if (last - p < 23) {
+        return NGX_ERROR;
+    }
+
+    *nal_bytes = (p[21] & 0x03) + 1;
+    narrays = p[22];
+    p += 23;
+
+    size = 0;
+
+    for (; narrays; --narrays) {
+        /* NAL unit type, number of NALs */
+        if (last - p < 3) {
+            return NGX_ERROR;
+        }
+
+        nnals = (p[1] << 8) | p[2];
+        p += 3;
+
+        for (; nnals; --nnals) {
+            if (last - p < 2) {
+                return NGX_ERROR;
+            }
+
+            len = (p[0] << 8) | p[1];
+            p += 2;
+
+            if ((size_t) (last - p) < len) {
+                return NGX_ERROR;
+            }
+
+            if (out) {
+                out = ngx_cpymem(out, "\0\0\0\1", 4);
+                out = ngx_cpymem(out, p, len);
+            }
+
+            p += len;
+            size += 4 + len;
+        }
+    }
+
+    return size;
+}
+
+
+static ngx_int_t
+ngx_http_live_snapshot_annexb(ngx_http_request_t *r, ngx_rtmp_frame_t *header,
+        ngx_rtmp_frame_t *keyframe, ngx_buf_t *b)
+{
+    u_char                             *hdr, *key, *hlast, *klast;
+    ngx_uint_t                          codec, nal_bytes;
+    ssize_t                             hsize, ksize;
+    ssize_t                           (*parse)(u_char *, u_char *,
+                                               ngx_uint_t *, u_char *);
+
+    hdr = ngx_pnalloc(r->pool, ngx_http_live_snapshot_size(header)
+                               + ngx_http_live_snapshot_size(keyframe));
+    if (hdr == NULL) {
+        return NGX_ERROR;
+    }
+
+    hlast = ngx_http_live_snapshot_copy(hdr, header);
+    key = hlast;
+    klast = ngx_http_live_snapshot_copy(key, keyframe);
+
+    if (hlast - hdr < NGX_FLV_VIDEO_HEADER_SIZE
+        || klast - key < NGX_FLV_VIDEO_HEADER_SIZE)
+    {
+        return NGX_DECLINED;
+    }
+
+    codec = hdr[0] & 0x0f;
+
+    switch (codec) {
+    case NGX_RTMP_VIDEO_H264:
+        parse = ngx_http_live_snapshot_avc_header;
+        ngx_str_set(&r->headers_out.content_type, "video/H264");
+        break;
+
+    case NGX_RTMP_VIDEO_H265:
+        parse = ngx_http_live_snapshot_hevc_header;
+        ngx_str_set(&r->headers_out.content_type, "video/H265");
+        break;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    hdr += NGX_FLV_VIDEO_HEADER_SIZE;
+    key += NGX_FLV_VIDEO_HEADER_SIZE;
+
+    hsize = parse(hdr, hlast, &nal_bytes, NULL);
+    if (hsize == NGX_ERROR) {
+        return NGX_DECLINED;
+    }
+
+    ksize = ngx_http_live_snapshot_nals(key, klast, nal_bytes, NULL);
+    if (ksize == NGX_ERROR) {
+        return NGX_DECLINED;
+    }
+
+    b->start = ngx_pnalloc(r->pool, hsize + ksize);
+    if (b->start == NULL) {
+        return NGX_ERROR;
+    }
+
+    b->pos = b->start;
+    b->last = b->start + hsize + ksize;
+    b->end = b->last;
+
+    parse(hdr, hlast, &nal_bytes, b->pos);
+    ngx_http_live_snapshot_nals(key, klast, nal_bytes, b->pos + hsize);
+
+    return NGX_OK;
+}
+
+
+/* etag keyed on publisher and keyframe timestamp */
+static ngx_int_t
+ngx_http_live_snapshot_etag(ngx_http_request_t *r, ngx_rtmp_session_t *s,
+        uint32_t timestamp)
+{
+    ngx_table_elt_t                    *etag;
+
+    etag = ngx_list_push(&r->headers_out.headers);
+    if (etag == NULL) {
+        return NGX_ERROR;
+    }
+
+    etag->value.data = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN + NGX_INT32_LEN
+                                            + 3);
+    if (etag->value.data == NULL) {
+        etag->hash = 0;
+        return NGX_ERROR;
+    }
+
+    etag->hash = 1;
+    ngx_str_set(&etag->key, "ETag");
+
+    etag->value.len = ngx_sprintf(etag->value.data, "\"%xA-%xD\"",
+                                  s->number, timestamp)
+                      - etag->value.data;
+
+    r->headers_out.etag = etag;
+
+    return NGX_OK;
+}
+
+
+/*
+ * ?srv=<serverid>&app=<app>&name=<name>[&format=flv|annexb]
+ *
+ * latest keyframe with its codec header in gop cache of stream, as flv
+ * or annex-b elementary stream, conditional get by etag
+ *
+ * stream is looked up in current worker only, with worker_processes more
+ * than 1, rtmp_auto_push must be on to have publisher in every worker,
+ * otherwise request to a worker without publisher gets 404
+ */
+static ngx_int_t
+ngx_http_live_snapshot_handler(ngx_http_request_t *r)
+{
+    ngx_core_conf_t                    *ccf;
+    ngx_live_stream_t                  *st;
+    ngx_rtmp_session_t                 *s;
+    ngx_rtmp_frame_t                   *header, *keyframe;
+    ngx_str_t                           srv, app, name, format, stream;
+    ngx_str_t                           key, value;
+    ngx_uint_t                          type;
+    uint32_t                            timestamp;
+    ngx_buf_t                          *b;
+    ngx_chain_t                         out;
+    ngx_int_t                           rc;
+    u_char                             *p;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "srv", sizeof("srv") - 1, &srv) != NGX_OK
+        || ngx_http_arg(r, (u_char *) "app", sizeof("app") - 1, &app)
+           != NGX_OK
+        || ngx_http_arg(r, (u_char *) "name", sizeof("name") - 1, &name)
+           != NGX_OK)
+    {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    type = NGX_HTTP_LIVE_SNAPSHOT_FLV;
+
+    if (ngx_http_arg(r, (u_char *) "format", sizeof("format") - 1, &format)
+        == NGX_OK)
+    {
+        if (format.len == sizeof("annexb") - 1
+            && ngx_strncmp(format.data, "annexb", format.len) == 0)
+        {
+            type = NGX_HTTP_LIVE_SNAPSHOT_ANNEXB;
+
+        } else if (format.len != sizeof("flv") - 1
+                   || ngx_strncmp(format.data, "flv", format.len) != 0)
+        {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    /* serverid/app/name */
+    stream.len = srv.len + 1 + app.len + 1 + name.len;
+    stream.data = ngx_pnalloc(r->pool, stream.len);
+    if (stream.data == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = ngx_cpymem(stream.data, srv.data, srv.len);
+    *p++ = '/';
+    p = ngx_cpymem(p, app.data, app.len);
+    *p++ = '/';
+    ngx_memcpy(p, name.data, name.len);
+
+    st = ngx_live_fetch_stream(&srv, &stream);
+    if (st == NULL || st->publish_ctx == NULL) {
+        ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_core_module);
+        if (ccf->worker_processes > 1) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                    "live snapshot, \"%V\" not published in this worker, "
+                    "rtmp_auto_push is needed with %i workers",
+                    &stream, ccf->worker_processes);
+        }
+
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    s = st->publish_ctx->session;
+
+    if (ngx_rtmp_gop_snapshot(s, &header, &keyframe, &timestamp) != NGX_OK) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (type == NGX_HTTP_LIVE_SNAPSHOT_ANNEXB) {
+        rc = ngx_http_live_snapshot_annexb(r, header, keyframe, b);
+    } else {
+        rc = ngx_http_live_snapshot_flv(r, header, keyframe, b);
+        ngx_str_set(&r->headers_out.content_type, "video/x-flv");
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                "live snapshot, unsupported video in \"%V\"", &stream);
+        return NGX_HTTP_UNSUPPORTED_MEDIA_TYPE;
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    /* must revalidate, not modified filter answers If-None-Match */
+    ngx_str_set(&key, "Cache-Control");
+    ngx_str_set(&value, "no-cache");
+    if (ngx_http_set_header_out(r, &key, &value) != NGX_OK
+        || ngx_http_live_snapshot_etag(r, s, timestamp) != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->memory = 1;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static char *
+ngx_http_live_snapshot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t           *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_live_snapshot_handler;
+
+    return NGX_CONF_OK;
+}
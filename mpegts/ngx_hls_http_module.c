@@ -14,6 +14,7 @@
 #include "ngx_http_set_header.h"
 #include "ngx_mpegts_live_module.h"
 #include "ngx_hls_live_module.h"
+#include "ngx_rtmp_ttff_module.h"
 #include "ngx_rbuf.h"
 #include "ngx_rtmp_dynamic.h"
 
@@ -1050,6 +1051,15 @@ ngx_hls_http_ts_handler(ngx_http_request_t *r, ngx_rtmp_addr_conf_t *addr_conf)
 
     ngx_rtmp_shared_acquire_frag(frag);
 
+    /* first fragment served to hls session */
+    if (s->first_video == 0) {
+        s->stage = NGX_LIVE_AV;
+        s->first_video = ngx_current_msec;
+        s->first_data = ngx_current_msec;
+
+        ngx_rtmp_ttff_first_frame(s);
+    }
+
     if (1) {
         r->write_event_handler = ngx_hls_http_write_handler;
 
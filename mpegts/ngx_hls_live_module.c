@@ -589,10 +589,12 @@ ngx_hls_live_open_fragment(ngx_rtmp_session_t *s, uint64_t ts,
     ngx_hls_live_ctx_t       *ctx;
     ngx_hls_live_frag_t     **ffrag, *frag;
     ngx_hls_live_app_conf_t  *hacf;
+    ngx_rtmp_live_app_conf_t *lacf;
     ngx_mpegts_frame_t       *frame;
     ngx_chain_t               patpmt;
 
     hacf = ngx_rtmp_get_module_app_conf(s, ngx_hls_live_module);
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
 
     ctx = ngx_rtmp_get_module_ctx(s, ngx_hls_live_module);
 
@@ -628,7 +630,9 @@ ngx_hls_live_open_fragment(ngx_rtmp_session_t *s, uint64_t ts,
     patpmt.buf->last = ngx_cpymem(patpmt.buf->pos,
         ngx_rtmp_mpegts_pat, 188);
 
-    ngx_rtmp_mpegts_gen_pmt(s->vcodec, s->acodec, s->log, patpmt.buf->last);
+    ngx_rtmp_mpegts_gen_pmt(s->vcodec, s->acodec,
+                            lacf && lacf->latency_probe, s->log,
+                            patpmt.buf->last);
     patpmt.buf->last += 188;
 
     frame = ngx_rtmp_shared_alloc_mpegts_frame(&patpmt, 1);
@@ -946,6 +950,8 @@ ngx_hls_live_update(ngx_rtmp_session_t *s, ngx_rtmp_codec_ctx_t *codec_ctx)
             boundary = frame->key &&
                 (codec_ctx->aac_header == NULL || !ctx->opened ||
                 (b && b->last > b->pos));
+        } else if (frame->type == NGX_MPEGTS_MSG_ID3) {
+            boundary = 0;
         } else {
             return NGX_ERROR;
         }
@@ -963,8 +969,7 @@ ngx_hls_live_update(ngx_rtmp_session_t *s, ngx_rtmp_codec_ctx_t *codec_ctx)
 
         ngx_rtmp_shared_free_mpegts_frame(frame);
 
-        ++s->out_pos;
-        s->out_pos %= s->out_queue;
+        s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
     }
 
     return NGX_OK;
@@ -1006,7 +1011,9 @@ ngx_hls_live_av(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
 
     if (frame->type == NGX_MPEGTS_MSG_VIDEO) {
         return next_mpegts_video(s, frame);
-    } else if (frame->type == NGX_MPEGTS_MSG_AUDIO) {
+    } else if (frame->type == NGX_MPEGTS_MSG_AUDIO
+               || frame->type == NGX_MPEGTS_MSG_ID3)
+    {
         return next_mpegts_audio(s, frame);
     }
 
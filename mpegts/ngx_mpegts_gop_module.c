@@ -185,12 +185,13 @@ static ngx_int_t
 ngx_mpegts_gop_link_frame(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
 {
     ngx_uint_t              nmsg;
+    ngx_int_t               rc;
 
     if (frame == NULL) {
         return NGX_OK;
     }
 
-    nmsg = (s->out_last - s->out_pos) % s->out_queue + 1;
+    nmsg = ngx_rtmp_out_nmsg(s) + 1;
 
     if (nmsg >= s->out_queue) {
         ngx_log_error(NGX_LOG_ERR, s->log, 0,
@@ -204,11 +205,25 @@ ngx_mpegts_gop_link_frame(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
         s->out_pos, s->out_last, frame->pts);
 #endif
 
+    rc = ngx_rtmp_alloc_out_queue(s);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
     s->mpegts_out[s->out_last] = frame;
-    s->out_last = ngx_mpegts_gop_next(s, s->out_last);
+    s->out_last = ngx_rtmp_out_next(s, s->out_last);
 
     ngx_rtmp_shared_acquire_mpegts_frame(frame);
 
+    if (s->live_stream && (frame->type == NGX_MPEGTS_MSG_AUDIO
+                           || frame->type == NGX_MPEGTS_MSG_VIDEO))
+    {
+        ngx_rtmp_histogram_add(&s->live_stream->queue_delay,
+                               ngx_current_msec - frame->time);
+    }
+
+    ngx_rtmp_coalesce_frame(s, frame->length, frame->key);
+
     return NGX_OK;
 }
 
@@ -259,11 +274,11 @@ ngx_mpegts_gop_reset_gop(ngx_rtmp_session_t *s, ngx_mpegts_gop_ctx_t *ctx,
         goto reset;
     }
 
-    if (frame->type == NGX_MPEGTS_MSG_AUDIO) {
+    if (frame->type != NGX_MPEGTS_MSG_VIDEO) {
         return;
     }
 
-    if (frame->type == NGX_MPEGTS_MSG_VIDEO && frame->pts
+    if (frame->pts
             - next_keyframe->pts < cache_time * 90)
     {
         return;
@@ -306,6 +321,9 @@ ngx_mpegts_gop_print_cache(ngx_rtmp_session_t *s, ngx_mpegts_gop_ctx_t *ctx)
         case NGX_MPEGTS_MSG_VIDEO:
             *p++ = 'V';
             break;
+        case NGX_MPEGTS_MSG_ID3:
+            *p++ = 'M';
+            break;
         default:
             *p++ = 'O';
             break;
@@ -706,7 +724,9 @@ ngx_mpegts_gop_av(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
         ngx_mpegts_gop_cache(s, frame);
 
         return next_mpegts_video(s, frame);
-    } else if (frame->type == NGX_MPEGTS_MSG_AUDIO) {
+    } else if (frame->type == NGX_MPEGTS_MSG_AUDIO
+               || frame->type == NGX_MPEGTS_MSG_ID3)
+    {
         ngx_mpegts_gop_cache(s, frame);
 
         return next_mpegts_audio(s, frame);
@@ -13,8 +13,10 @@
 #include "ngx_rbuf.h"
 #include "ngx_http_set_header.h"
 #include "ngx_rtmp_monitor_module.h"
+#include "ngx_rtmp_ttff_module.h"
 #include "ngx_mpegts_gop_module.h"
 #include "ngx_mpegts_live_module.h"
+#include "ngx_rtmp_live_module.h"
 
 
 static char *ngx_mpegts_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -91,11 +93,12 @@ ngx_module_t  ngx_mpegts_http_module = {
 static ngx_int_t
 ngx_mpegts_http_send_header(ngx_http_request_t *r)
 {
-    ngx_int_t                rc;
-    ngx_keyval_t            *h;
-    ngx_chain_t              out;
-    ngx_mpegts_http_ctx_t   *ctx;
-    ngx_rtmp_session_t      *s, *ps;
+    ngx_int_t                   rc;
+    ngx_keyval_t               *h;
+    ngx_chain_t                 out;
+    ngx_mpegts_http_ctx_t      *ctx;
+    ngx_rtmp_session_t         *s, *ps;
+    ngx_rtmp_live_app_conf_t   *lacf;
 
     if (r->header_sent) {
         return NGX_OK;
@@ -127,7 +130,11 @@ ngx_mpegts_http_send_header(ngx_http_request_t *r)
     out.buf->last = ngx_cpymem(out.buf->pos,
         ngx_rtmp_mpegts_pat, 188);
 
-    ngx_rtmp_mpegts_gen_pmt(ps->vcodec, ps->acodec, s->log, out.buf->last);
+    lacf = ngx_rtmp_get_module_app_conf(ps, ngx_rtmp_live_module);
+
+    ngx_rtmp_mpegts_gen_pmt(ps->vcodec, ps->acodec,
+                            lacf && lacf->latency_probe, s->log,
+                            out.buf->last);
     out.buf->last += 188;
 
     out.buf->flush = 1;
@@ -200,6 +207,7 @@ ngx_mpegts_http_write_handler(ngx_http_request_t *r)
         sent = r->connection->sent - present;
 
         ngx_rtmp_update_bandwidth(&ngx_rtmp_bw_out, sent);
+        ngx_rtmp_update_bandwidth(&ngx_rtmp_send_calls, 1);
 
         if (rc == NGX_AGAIN) {
             ngx_add_timer(wev, s->timeout);
@@ -397,6 +405,14 @@ ngx_mpegts_http_prepare_out_chain(ngx_rtmp_session_t *s)
         return NULL;
     }
 
+    if (s->first_video == 0 && frame->type == NGX_MPEGTS_MSG_VIDEO) {
+        s->stage = NGX_LIVE_AV;
+        s->first_video = ngx_current_msec;
+        s->first_data = s->first_data == 0? ngx_current_msec: s->first_data;
+
+        ngx_rtmp_ttff_first_frame(s);
+    }
+
     ll = &head;
 
     for (cl = frame->chain; cl; cl = cl->next) {
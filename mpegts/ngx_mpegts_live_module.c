@@ -13,6 +13,8 @@
 #include "ngx_mpegts_live_module.h"
 #include "ngx_mpegts_gop_module.h"
 #include "ngx_rtmp_codec_module.h"
+#include "hls/ngx_rtmp_mpegts.h"
+#include "hls/ngx_rtmp_mpegts_pes.h"
 
 ngx_mpegts_video_pt ngx_mpegts_video;
 ngx_mpegts_audio_pt ngx_mpegts_audio;
@@ -36,6 +38,7 @@ typedef struct ngx_mpegts_live_app_conf_s {
     ngx_msec_t              sync;
     ngx_msec_t              audio_delay;
     size_t                  out_queue;
+    ngx_flag_t              shared_mux;
     ngx_mpegts_live_ctx_t  *players;
     u_char                  packet_buffer[NGX_RTMP_MPEG_BUFSIZE];
 } ngx_mpegts_live_app_conf_t;
@@ -77,6 +80,10 @@ struct ngx_mpegts_live_ctx_s {
     ngx_uint_t                    aframe_num;
     ngx_msec_t                    aframe_base;
     ngx_buf_t                    *aframe;
+
+    /* timed ID3 latency probe */
+    ngx_uint_t                    id3_cc;
+    ngx_msec_t                    probe_time;
 };
 
 /* 700 ms PCR delay */
@@ -87,6 +94,8 @@ ngx_mpegts_live_create_app_conf(ngx_conf_t *cf);
 static char *
 ngx_mpegts_live_merge_app_conf(ngx_conf_t *cf, void *parent, void *child);
 static ngx_int_t
+ngx_mpegts_live_preconfiguration(ngx_conf_t *cf);
+static ngx_int_t
 ngx_mpegts_live_postconfiguration(ngx_conf_t *cf);
 
 static ngx_command_t ngx_mpegts_live_commands[] = {
@@ -119,12 +128,19 @@ static ngx_command_t ngx_mpegts_live_commands[] = {
       offsetof(ngx_mpegts_live_app_conf_t, out_queue),
       NULL },
 
+    { ngx_string("mpegts_shared_mux"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_mpegts_live_app_conf_t, shared_mux),
+      NULL },
+
     ngx_null_command
 };
 
 
 static ngx_rtmp_module_t ngx_mpegts_live_ctx = {
-    NULL,                                   /* preconfiguration */
+    ngx_mpegts_live_preconfiguration,       /* preconfiguration */
     ngx_mpegts_live_postconfiguration,      /* postconfiguration */
     NULL,                                   /* create main configuration */
     NULL,                                   /* init main configuration */
@@ -165,6 +181,7 @@ ngx_mpegts_live_create_app_conf(ngx_conf_t *cf)
     macf->sync = NGX_CONF_UNSET_MSEC;
     macf->audio_delay = NGX_CONF_UNSET_MSEC;
     macf->out_queue = NGX_CONF_UNSET;
+    macf->shared_mux = NGX_CONF_UNSET;
 
     return macf;
 }
@@ -181,6 +198,7 @@ ngx_mpegts_live_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->sync, prev->sync, 2);
     ngx_conf_merge_msec_value(conf->audio_delay, prev->audio_delay, 300);
     ngx_conf_merge_size_value(conf->out_queue, prev->out_queue, 4096);
+    ngx_conf_merge_value(conf->shared_mux, prev->shared_mux, 0);
     conf->pool = ngx_create_pool(4096, &cf->cycle->new_log);
     if (!conf->pool) {
         return NGX_CONF_ERROR;
@@ -189,47 +207,14 @@ ngx_mpegts_live_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
     return NGX_CONF_OK;
 }
 
-static u_char *
-ngx_mpegts_live_write_pcr(u_char *p, uint64_t pcr)
-{
-    *p++ = (u_char) (pcr >> 25);
-    *p++ = (u_char) (pcr >> 17);
-    *p++ = (u_char) (pcr >> 9);
-    *p++ = (u_char) (pcr >> 1);
-    *p++ = (u_char) (pcr << 7 | 0x7e);
-    *p++ = 0;
-
-    return p;
-}
-
-static u_char *
-ngx_mpegts_live_write_pts(u_char *p, ngx_uint_t fb, uint64_t pts)
-{
-    ngx_uint_t val;
-
-    val = fb << 4 | (((pts >> 30) & 0x07) << 1) | 1;
-    *p++ = (u_char) val;
-
-    val = (((pts >> 15) & 0x7fff) << 1) | 1;
-    *p++ = (u_char) (val >> 8);
-    *p++ = (u_char) val;
-
-    val = (((pts) & 0x7fff) << 1) | 1;
-    *p++ = (u_char) (val >> 8);
-    *p++ = (u_char) val;
-
-    return p;
-}
-
 ngx_int_t
 ngx_mpegts_live_shared_append_chain(ngx_mpegts_frame_t *f, ngx_buf_t *b,
                                     ngx_flag_t mandatory)
 {
-    ngx_uint_t   pes_size, header_size, body_size, in_size, stuff_size, flags;
-    u_char      *packet, *p, *base;
-    ngx_int_t    first;
-    ngx_chain_t *cl, **ll;
-    uint64_t     pcr;
+    ngx_rtmp_mpegts_pes_t   pes;
+    ngx_chain_t            *cl, **ll;
+    uint64_t                pcr;
+    u_char                 *last;
 
     for (ll = &f->chain; (*ll) && (*ll)->next; ll = &(*ll)->next);
     cl = *ll;
@@ -240,9 +225,17 @@ ngx_mpegts_live_shared_append_chain(ngx_mpegts_frame_t *f, ngx_buf_t *b,
         return NGX_OK;
     }
 
-    first = 1;
+    if (f->dts < NGX_RTMP_MEGPTS_DELAY) {
+        pcr = 0;
+    } else {
+        pcr = f->dts;
+    }
+
+    ngx_rtmp_mpegts_pes_init(&pes, f->pid, f->sid, f->key, pcr,
+                             f->pts + NGX_RTMP_MEGPTS_DELAY,
+                             f->dts + NGX_RTMP_MEGPTS_DELAY, b->last - b->pos);
 
-    while (b->pos < b->last) {
+    while (pes.packet < pes.packets) {
         if ((*ll) && (*ll)->buf->end - (*ll)->buf->last < 188) {
             ll = &(*ll)->next;
             cl = *ll;
@@ -254,113 +247,11 @@ ngx_mpegts_live_shared_append_chain(ngx_mpegts_frame_t *f, ngx_buf_t *b,
             cl->buf->flush = 1;
         }
 
-        packet = cl->buf->last;
-        p = packet;
-
-        f->cc++;
-
-        *p++ = 0x47;
-        *p++ = (u_char) (f->pid >> 8);
-
-        if (first) {
-            p[-1] |= 0x40;
-        }
-
-        *p++ = (u_char) f->pid;
-        *p++ = 0x10 | (f->cc & 0x0f); /* payload */
-
-        if (first) {
-
-            if (f->key) {
-                packet[3] |= 0x20; /* adaptation */
-
-                *p++ = 7;    /* size */
-                *p++ = 0x50; /* random access + PCR */
-                if (f->dts < NGX_RTMP_MEGPTS_DELAY) {
-                    pcr = 0;
-                } else {
-                    pcr = f->dts;
-                }
-                p = ngx_mpegts_live_write_pcr(p, pcr);
-            }
-
-            /* PES header */
-
-            *p++ = 0x00;
-            *p++ = 0x00;
-            *p++ = 0x01;
-            *p++ = (u_char) f->sid;
-
-            header_size = 5;
-            flags = 0x80; /* PTS */
-
-            if (f->dts != f->pts) {
-                header_size += 5;
-                flags |= 0x40; /* DTS */
-            }
-
-            pes_size = (b->last - b->pos) + header_size + 3;
-            if (pes_size > 0xffff) {
-                pes_size = 0;
-            }
-
-            *p++ = (u_char) (pes_size >> 8);
-            *p++ = (u_char) pes_size;
-            *p++ = 0x80; /* H222 */
-            *p++ = (u_char) flags;
-            *p++ = (u_char) header_size;
-
-            p = ngx_mpegts_live_write_pts(p, flags >> 6, f->pts +
-                                                         NGX_RTMP_MEGPTS_DELAY);
-
-            if (f->dts != f->pts) {
-                p = ngx_mpegts_live_write_pts(p, 1, f->dts +
-                                                    NGX_RTMP_MEGPTS_DELAY);
-            }
-
-            first = 0;
-        }
-
-        body_size = (ngx_uint_t) (packet + 188 - p);
-        in_size = (ngx_uint_t) (b->last - b->pos);
-
-        if (body_size <= in_size) {
-            ngx_memcpy(p, b->pos, body_size);
-            b->pos += body_size;
-
-        } else {
-            stuff_size = (body_size - in_size);
-
-            if (packet[3] & 0x20) {
-
-                /* has adaptation */
-
-                base = &packet[5] + packet[4];
-                p = ngx_movemem(base + stuff_size, base, p - base);
-                ngx_memset(base, 0xff, stuff_size);
-                packet[4] += (u_char) stuff_size;
-
-            } else {
+        last = ngx_rtmp_mpegts_pes_write(&pes, cl->buf->last, cl->buf->end,
+                                         b, &f->cc);
 
-                /* no adaptation */
-
-                packet[3] |= 0x20;
-                p = ngx_movemem(&packet[4] + stuff_size, &packet[4],
-                                p - &packet[4]);
-
-                packet[4] = (u_char) (stuff_size - 1);
-                if (stuff_size >= 2) {
-                    packet[5] = 0;
-                    ngx_memset(&packet[6], 0xff, stuff_size - 2);
-                }
-            }
-
-            ngx_memcpy(p, b->pos, in_size);
-            b->pos = b->last;
-        }
-
-        cl->buf->last += 188;
-        f->length += 188;
+        f->length += last - cl->buf->last;
+        cl->buf->last = last;
     }
 
     return NGX_OK;
@@ -686,6 +577,58 @@ ngx_mpegts_live_flush_audio(ngx_rtmp_session_t *s)
 }
 
 
+/*
+ * ID3 probe is passed through audio filters, it is tied to pts, so it is
+ * cached in gop as audio and players compute latency when rendering it
+ */
+static ngx_int_t
+ngx_mpegts_live_id3_probe(ngx_rtmp_session_t *s, uint32_t timestamp)
+{
+    ngx_mpegts_live_ctx_t          *ctx;
+    ngx_mpegts_frame_t             *frame;
+    ngx_int_t                       rc;
+    ngx_buf_t                       b;
+    u_char                          id3[NGX_RTMP_MPEGTS_ID3_PROBE_SIZE];
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_mpegts_live_module);
+
+    ngx_memzero(&b, sizeof(b));
+    b.start = id3;
+    b.pos = id3;
+    b.last = ngx_rtmp_mpegts_id3_probe(id3);
+    b.end = id3 + sizeof(id3);
+
+    frame = ngx_rtmp_shared_alloc_mpegts_frame(NULL, 0);
+    if (frame == NULL) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "rtmp-mpegts: id3_probe| "
+                      "memory error, alloc mpegts frame failed");
+        return NGX_ERROR;
+    }
+
+    frame->dts = (uint64_t) timestamp * 90;
+    frame->pts = frame->dts;
+    frame->cc = ctx->id3_cc;
+    frame->pid = NGX_RTMP_MPEGTS_ID3_PID;
+    frame->sid = NGX_RTMP_MPEGTS_ID3_SID;
+    frame->type = NGX_MPEGTS_MSG_ID3;
+
+    rc = ngx_mpegts_live_shared_append_chain(frame, &b, 1);
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "rtmp-mpegts: id3_probe| append failed");
+    } else {
+        ctx->id3_cc = frame->cc;
+        ngx_mpegts_live_audio_filter(s, frame);
+    }
+
+    ngx_rtmp_shared_free_mpegts_frame(frame);
+
+    return rc;
+}
+
+
 static ngx_int_t
 ngx_mpegts_live_append_hevc_vps_sps_pps(ngx_rtmp_session_t *s, ngx_buf_t *out)
 {
@@ -1620,8 +1563,10 @@ ngx_mpegts_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     ngx_rtmp_frame_t          frame;
     ngx_rtmp_codec_ctx_t     *codec_ctx;
     ngx_rtmp_core_app_conf_t *cacf;
+    ngx_rtmp_live_app_conf_t *lacf;
 
     cacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_core_module);
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
 
     codec_ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_codec_module);
 
@@ -1663,6 +1608,14 @@ ngx_mpegts_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         } else if (codec_ctx->video_codec_id == cacf->hevc_codec) {
             ngx_mpegts_live_h265_handler(s, &frame);
         }
+
+        /* same interval as onFI probe of rtmp live */
+        if (lacf && lacf->latency_probe
+            && ngx_current_msec - ctx->probe_time >= lacf->latency_probe)
+        {
+            ctx->probe_time = ngx_current_msec;
+            ngx_mpegts_live_id3_probe(s, frame.hdr.timestamp);
+        }
         break;
 
     default:
@@ -1674,6 +1627,43 @@ ngx_mpegts_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     return NGX_OK;
 }
 
+ngx_int_t
+ngx_mpegts_live_shared(ngx_rtmp_session_t *s)
+{
+    ngx_mpegts_live_app_conf_t *macf;
+    ngx_mpegts_live_ctx_t      *ctx;
+    ngx_rtmp_codec_ctx_t       *codec_ctx;
+    ngx_rtmp_core_app_conf_t   *cacf;
+
+    macf = ngx_rtmp_get_module_app_conf(s, ngx_mpegts_live_module);
+    if (macf == NULL || !macf->shared_mux) {
+        return 0;
+    }
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_mpegts_live_module);
+    codec_ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_codec_module);
+    if (ctx == NULL || codec_ctx == NULL || codec_ctx->avc_header == NULL) {
+        return 0;
+    }
+
+    cacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_core_module);
+
+    /* same as codecs muxed in ngx_mpegts_live_av */
+    if (codec_ctx->video_codec_id != NGX_RTMP_VIDEO_H264 &&
+        codec_ctx->video_codec_id != cacf->hevc_codec)
+    {
+        return 0;
+    }
+
+    if (codec_ctx->audio_codec_id != 0 &&
+        codec_ctx->audio_codec_id != NGX_RTMP_AUDIO_AAC)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
 ngx_int_t
 ngx_mpegts_live_video_filter(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
 {
@@ -1858,6 +1848,19 @@ next:
     return next_close_stream(s, v);
 }
 
+/*
+ * set tail of mpegts frame filters before any postconfiguration, so modules
+ * before mpegts live in module order could also be linked into filters
+ */
+static ngx_int_t
+ngx_mpegts_live_preconfiguration(ngx_conf_t *cf)
+{
+    ngx_mpegts_video = ngx_mpegts_live_avframe;
+    ngx_mpegts_audio = ngx_mpegts_live_avframe;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 ngx_mpegts_live_postconfiguration(ngx_conf_t *cf)
 {
@@ -1883,9 +1886,6 @@ ngx_mpegts_live_postconfiguration(ngx_conf_t *cf)
     next_close_stream = ngx_rtmp_close_stream;
     ngx_rtmp_close_stream = ngx_mpegts_live_close_stream;
 
-    ngx_mpegts_video = ngx_mpegts_live_avframe;
-    ngx_mpegts_audio = ngx_mpegts_live_avframe;
-
     return NGX_OK;
 }
 
@@ -16,9 +16,20 @@ typedef ngx_int_t (*ngx_mpegts_audio_pt)(ngx_rtmp_session_t *s,
 extern ngx_mpegts_video_pt ngx_mpegts_video;
 extern ngx_mpegts_audio_pt ngx_mpegts_audio;
 
+/*
+ * paras:
+ *      id3: declare timed ID3 stream of latency probe
+ */
 ngx_int_t
-ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec,
+ngx_rtmp_mpegts_gen_pmt(ngx_int_t vcodec, ngx_int_t acodec, ngx_flag_t id3,
     ngx_log_t *log, u_char *pmt);
+/*
+ * return 1 if frames of publisher s are muxed by mpegts live and passed
+ * through ngx_mpegts_video and ngx_mpegts_audio filters, other ts writers
+ * could consume these frames instead of muxing again
+ */
+ngx_int_t
+ngx_mpegts_live_shared(ngx_rtmp_session_t *s);
 ngx_int_t
 ngx_mpegts_live_video_filter(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame);
 ngx_int_t
@@ -9,6 +9,7 @@
 #include "ngx_rtmp_cmd_module.h"
 #include "ngx_rtmp_codec_module.h"
 #include "ngx_live_record.h"
+#include "mpegts/ngx_mpegts_live_module.h"
 
 
 ngx_live_record_start_pt            ngx_live_record_start;
@@ -22,6 +23,9 @@ static ngx_live_record_done_pt      next_record_done;
 static ngx_rtmp_publish_pt          next_publish;
 static ngx_rtmp_close_stream_pt     next_close_stream;
 
+static ngx_mpegts_video_pt          next_mpegts_video;
+static ngx_mpegts_audio_pt          next_mpegts_audio;
+
 
 static ngx_int_t ngx_live_record_postconfiguration(ngx_conf_t *cf);
 static void * ngx_live_record_create_app_conf(ngx_conf_t *cf);
@@ -231,6 +235,111 @@ ngx_live_record_write_buf(ngx_rtmp_mpegts_file_t *file, u_char *in,
 }
 
 
+static void
+ngx_live_record_open_keys(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx)
+{
+    ngx_live_record_index_t         last;
+    off_t                           size;
+
+    ctx->nkeys = 0;
+    ctx->frag = 0;
+
+    ctx->keys.log = s->log;
+    ctx->keys.fd = ngx_open_file(ctx->keys.name.data, NGX_FILE_RDWR,
+            NGX_FILE_CREATE_OR_OPEN, NGX_FILE_DEFAULT_ACCESS);
+    if (ctx->keys.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                "record: failed to open keyframe index '%V'",
+                &ctx->keys.name);
+        return;
+    }
+
+    size = lseek(ctx->keys.fd, 0, SEEK_END);
+    if (size == (off_t) -1) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                "record: %V seek failed", &ctx->keys.name);
+        goto failed;
+    }
+
+    if (size % sizeof(ngx_live_record_index_t)) { // drop partial entry
+        size -= size % sizeof(ngx_live_record_index_t);
+
+        if (ngx_truncate_file(ctx->keys.fd, size) == NGX_FILE_ERROR
+            || lseek(ctx->keys.fd, 0, SEEK_END) == (off_t) -1)
+        {
+            ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                    "record: %V truncate failed", &ctx->keys.name);
+            goto failed;
+        }
+    }
+
+    // continue fragment id of file reopened
+    if (size && ngx_read_file(&ctx->keys, (u_char *) &last, sizeof(last),
+                              size - sizeof(last)) == sizeof(last))
+    {
+        ctx->frag = last.frag + 1;
+    }
+
+    return;
+
+failed:
+    ngx_close_file(ctx->keys.fd);
+    ctx->keys.fd = -1;
+}
+
+
+static void
+ngx_live_record_write_keys(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx)
+{
+    size_t                          n;
+
+    if (ctx->nkeys == 0 || ctx->keys.fd == -1) {
+        ctx->nkeys = 0;
+        return;
+    }
+
+    n = ctx->nkeys * sizeof(ngx_live_record_index_t);
+    if (ngx_write_fd(ctx->keys.fd, ctx->key, n) != (ssize_t) n) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                "record, write %V failed", &ctx->keys.name);
+    }
+
+    ctx->nkeys = 0;
+}
+
+
+/* called before keyframe written into ts */
+static void
+ngx_live_record_add_key(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
+        ngx_msec_t curr_time)
+{
+    ngx_live_record_index_t        *key;
+    off_t                           offset;
+
+    if (ctx->keys.fd == -1) {
+        return;
+    }
+
+    // entry must not point beyond data in ts file
+    if (ctx->nkeys == NGX_LIVE_RECORD_KEYS) {
+        ngx_live_record_flush(&ctx->ts);
+        ngx_live_record_write_keys(s, ctx);
+    }
+
+    offset = ctx->ts.file_size + (ctx->ts.wbuf.last - ctx->ts.wbuf.pos);
+
+    key = &ctx->key[ctx->nkeys++];
+    key->time = ctx->wallbase + curr_time;
+    key->offset = offset;
+    key->frag = ctx->frag;
+    key->flags = NGX_LIVE_RECORD_KEY;
+
+    if (offset == ctx->startsize) {
+        key->flags |= NGX_LIVE_RECORD_FRAGMENT;
+    }
+}
+
+
 static ngx_int_t
 ngx_live_record_open_file(ngx_rtmp_session_t *s)
 {
@@ -273,6 +382,22 @@ ngx_live_record_open_file(ngx_rtmp_session_t *s)
     *p = 0;
     ctx->file.name.len = p - ctx->file.name.data;
 
+    // keyframe index name, replace .ts with .idx
+    if (ctx->keys.name.len == 0) {
+        ctx->keys.name.data = ngx_pcalloc(s->pool, len + sizeof("x"));
+        if (ctx->keys.name.data == NULL) {
+            ngx_log_error(NGX_LOG_CRIT, s->log, 0,
+                    "record: alloc for keyframe index name failed");
+            return NGX_ERROR;
+        }
+    }
+
+    p = ngx_cpymem(ctx->keys.name.data, ctx->file.name.data,
+                   ctx->file.name.len - (sizeof("ts") - 1));
+    p = ngx_cpymem(p, "idx", sizeof("idx") - 1);
+    *p = 0;
+    ctx->keys.name.len = p - ctx->keys.name.data;
+
     // create dir
     err = ngx_create_full_path(ctx->file.name.data, 0755);
     if (err) {
@@ -331,6 +456,8 @@ ngx_live_record_open_file(ngx_rtmp_session_t *s)
     ctx->startsize = ctx->ts.file_size;
     ctx->endsize = ctx->ts.file_size;
 
+    ngx_live_record_open_keys(s, ctx);
+
     return NGX_OK;
 }
 
@@ -342,6 +469,8 @@ ngx_live_record_write_index(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
     u_char                         *p, buf[1024];
 
     ngx_live_record_flush(&ctx->ts);
+    ngx_live_record_write_keys(s, ctx);
+    ++ctx->frag;
 
     ctx->endsize = ctx->ts.file_size - 1;
 
@@ -441,6 +570,11 @@ ngx_live_record_close_index(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx)
     ngx_close_file(ctx->file.fd);
     ctx->file.fd = -1;
 
+    if (ctx->keys.fd != -1) {
+        ngx_close_file(ctx->keys.fd);
+        ctx->keys.fd = -1;
+    }
+
     ngx_close_file(ctx->index.fd);
     ctx->index.fd = -1;
 }
@@ -467,10 +601,17 @@ ngx_live_record_reopen_index(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
 
         if (ctx->index.fd != -1) {
             ngx_close_file(ctx->index.fd);
+            ctx->index.fd = -1;
         }
 
         if (ctx->file.fd != -1) {
             ngx_close_file(ctx->file.fd);
+            ctx->file.fd = -1;
+        }
+
+        if (ctx->keys.fd != -1) {
+            ngx_close_file(ctx->keys.fd);
+            ctx->keys.fd = -1;
         }
 
         return;
@@ -478,6 +619,90 @@ ngx_live_record_reopen_index(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
 }
 
 
+static ngx_int_t
+ngx_live_record_init_file(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
+        uint32_t timestamp)
+{
+    ngx_live_record_app_conf_t     *lracf;
+    ngx_time_t                     *tp;
+
+    if (ctx->last_time) {
+        return NGX_OK;
+    }
+
+    lracf = ngx_rtmp_get_module_app_conf(s, ngx_live_record_module);
+
+    ctx->publish_epoch = ngx_current_msec;
+
+    tp = ngx_timeofday();
+    ctx->wallbase = (uint64_t) tp->sec * 1000 + tp->msec - ctx->publish_epoch;
+    ctx->last_time = ngx_time() - ngx_time() % (lracf->interval / 1000);
+    ctx->basetime = ctx->publish_epoch - timestamp;
+
+    ctx->begintime = ngx_current_msec;
+    ctx->starttime = ngx_current_msec;
+    ctx->endtime = ngx_current_msec;
+
+    // open new index and file
+    if (ngx_live_record_open_index(s) == NGX_ERROR) {
+        ctx->last_time = 0;
+
+        if (ctx->index.fd != -1) {
+            ngx_close_file(ctx->index.fd);
+            ctx->index.fd = -1;
+        }
+
+        if (ctx->file.fd != -1) {
+            ngx_close_file(ctx->file.fd);
+            ctx->file.fd = -1;
+        }
+
+        if (ctx->keys.fd != -1) {
+            ngx_close_file(ctx->keys.fd);
+            ctx->keys.fd = -1;
+        }
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* slice at key frame after min_fraglen, force slice after max_fraglen */
+static void
+ngx_live_record_slice(ngx_rtmp_session_t *s, ngx_live_record_ctx_t *ctx,
+        ngx_msec_t curr_time, ngx_flag_t key)
+{
+    ngx_live_record_app_conf_t     *lracf;
+    time_t                          last_time;
+
+    lracf = ngx_rtmp_get_module_app_conf(s, ngx_live_record_module);
+
+    last_time = curr_time / 1000 - (curr_time / 1000)
+                                 % (lracf->interval / 1000);
+    if (key) {
+        if (curr_time > ctx->starttime + lracf->min_fraglen) {
+            if (last_time > ctx->last_time) {
+                ngx_live_record_reopen_index(s, ctx, curr_time, last_time);
+            } else {
+                ngx_live_record_write_index(s, ctx, curr_time);
+            }
+        }
+    } else if (curr_time > ctx->starttime + lracf->max_fraglen) { // force slice
+        if (last_time > ctx->last_time) {
+            ngx_log_error(NGX_LOG_INFO, s->log, 0, "record: force slice, "
+                    "curr_time:%M, starttime:%M, max_fraglen:%M",
+                    curr_time, ctx->starttime, lracf->max_fraglen);
+
+            ngx_live_record_reopen_index(s, ctx, curr_time, last_time);
+        } else {
+            ngx_live_record_write_index(s, ctx, curr_time);
+        }
+    }
+}
+
+
 static ngx_int_t
 ngx_live_record_copy(ngx_rtmp_session_t *s, void *dst, u_char **src, size_t n,
     ngx_chain_t **in)
@@ -725,9 +950,7 @@ ngx_live_record_aac(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     u_char                         *p;
     ngx_uint_t                      objtype, srindex, chconf, size;
     static u_char                   buffer[NGX_LIVE_RECORD_BUFSIZE];
-    ngx_live_record_app_conf_t     *lracf;
     ngx_msec_t                      curr_time;
-    time_t                          last_time;
 
     ctx = ngx_rtmp_get_module_ctx(s, ngx_live_record_module);
 
@@ -748,31 +971,8 @@ ngx_live_record_aac(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         }
     }
 
-    lracf = ngx_rtmp_get_module_app_conf(s, ngx_live_record_module);
-
-    if (ctx->last_time == 0) {
-        ctx->publish_epoch = ngx_current_msec;
-        ctx->last_time = ngx_time() - ngx_time() % (lracf->interval / 1000);
-        ctx->basetime = ctx->publish_epoch - h->timestamp;
-
-        ctx->begintime = ngx_current_msec;
-        ctx->starttime = ngx_current_msec;
-        ctx->endtime = ngx_current_msec;
-
-        // open new index and file
-        if (ngx_live_record_open_index(s) == NGX_ERROR) {
-            ctx->last_time = 0;
-
-            if (ctx->index.fd != -1) {
-                ngx_close_file(ctx->index.fd);
-            }
-
-            if (ctx->file.fd != -1) {
-                ngx_close_file(ctx->file.fd);
-            }
-
-            return NGX_OK;
-        }
+    if (ngx_live_record_init_file(s, ctx, h->timestamp) != NGX_OK) {
+        return NGX_OK;
     }
 
     /*
@@ -830,16 +1030,8 @@ ngx_live_record_aac(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     // reopen index and ts file
     curr_time = ctx->basetime + h->timestamp;
-    if (codec_ctx->avc_header == NULL) { // no video
-        last_time = curr_time / 1000 - (curr_time / 1000)
-                                     % (lracf->interval / 1000);
-        if (curr_time > ctx->starttime + lracf->min_fraglen) {
-            if (last_time > ctx->last_time) {
-                ngx_live_record_reopen_index(s, ctx, curr_time, last_time);
-            } else {
-                ngx_live_record_write_index(s, ctx, curr_time);
-            }
-        }
+    if (codec_ctx->avc_header == NULL) { // no video, every frame is key
+        ngx_live_record_slice(s, ctx, curr_time, 1);
     }
 
     /* write frame */
@@ -880,9 +1072,7 @@ ngx_live_record_avc(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     ngx_uint_t                      nal_bytes;
     ngx_int_t                       aud_sent, sps_pps_sent;
     static u_char                   buffer[NGX_LIVE_RECORD_BUFSIZE];
-    ngx_live_record_app_conf_t     *lracf;
     ngx_msec_t                      curr_time;
-    time_t                          last_time;
 
     ctx = ngx_rtmp_get_module_ctx(s, ngx_live_record_module);
 
@@ -911,31 +1101,8 @@ ngx_live_record_avc(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         }
     }
 
-    lracf = ngx_rtmp_get_module_app_conf(s, ngx_live_record_module);
-
-    if (ctx->last_time == 0) {
-        ctx->publish_epoch = ngx_current_msec;
-        ctx->last_time = ngx_time() - ngx_time() % (lracf->interval / 1000);
-        ctx->basetime = ctx->publish_epoch - h->timestamp;
-
-        ctx->begintime = ngx_current_msec;
-        ctx->starttime = ngx_current_msec;
-        ctx->endtime = ngx_current_msec;
-
-        // open new index and file
-        if (ngx_live_record_open_index(s) == NGX_ERROR) {
-            ctx->last_time = 0;
-
-            if (ctx->index.fd != -1) {
-                ngx_close_file(ctx->index.fd);
-            }
-
-            if (ctx->file.fd != -1) {
-                ngx_close_file(ctx->file.fd);
-            }
-
-            return NGX_OK;
-        }
+    if (ngx_live_record_init_file(s, ctx, h->timestamp) != NGX_OK) {
+        return NGX_OK;
     }
 
     if (ngx_live_record_copy(s, NULL, &p, 1, &in) != NGX_OK) {
@@ -1061,26 +1228,10 @@ ngx_live_record_avc(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     // reopen index and ts file
     curr_time = ctx->basetime + h->timestamp;
-    last_time = curr_time / 1000 - (curr_time / 1000)
-                                 % (lracf->interval / 1000);
-    if (ftype == 1) { // key frame
-        if (curr_time > ctx->starttime + lracf->min_fraglen) {
-            if (last_time > ctx->last_time) {
-                ngx_live_record_reopen_index(s, ctx, curr_time, last_time);
-            } else {
-                ngx_live_record_write_index(s, ctx, curr_time);
-            }
-        }
-    } else if (curr_time > ctx->starttime + lracf->max_fraglen) { // force slice
-        if (last_time > ctx->last_time) {
-            ngx_log_error(NGX_LOG_INFO, s->log, 0, "record: force slice, "
-                    "curr_time:%M, starttime:%M, max_fraglen:%M",
-                    curr_time, ctx->starttime, lracf->max_fraglen);
+    ngx_live_record_slice(s, ctx, curr_time, ftype == 1);
 
-            ngx_live_record_reopen_index(s, ctx, curr_time, last_time);
-        } else {
-            ngx_live_record_write_index(s, ctx, curr_time);
-        }
+    if (ftype == 1) {
+        ngx_live_record_add_key(s, ctx, curr_time);
     }
 
     /* write frame */
@@ -1107,6 +1258,77 @@ ngx_live_record_avc(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 }
 
 
+/* only h264 is recorded, same as ngx_live_record_avc */
+static ngx_flag_t
+ngx_live_record_shared(ngx_rtmp_session_t *s, ngx_rtmp_codec_ctx_t *codec_ctx)
+{
+    return codec_ctx && codec_ctx->video_codec_id == NGX_RTMP_VIDEO_H264
+        && ngx_mpegts_live_shared(s);
+}
+
+
+static ngx_int_t
+ngx_live_record_mpegts_av(ngx_rtmp_session_t *s, ngx_mpegts_frame_t *frame)
+{
+    ngx_live_record_ctx_t          *ctx;
+    ngx_rtmp_codec_ctx_t           *codec_ctx;
+    ngx_msec_t                      curr_time;
+    uint32_t                        timestamp;
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_live_record_module);
+    if (ctx == NULL || !ctx->open) {
+        goto next;
+    }
+
+    codec_ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_codec_module);
+    if (!ngx_live_record_shared(s, codec_ctx)) {
+        goto next;
+    }
+
+    /* latency probe is useless in record, ID3 is not declared in its PMT */
+    if (frame->type == NGX_MPEGTS_MSG_ID3) {
+        goto next;
+    }
+
+    if (ctx->open == 2) { // wait for key frame
+        if (frame->type != NGX_MPEGTS_MSG_VIDEO || !frame->key) {
+            goto next;
+        }
+
+        ctx->open = 1;
+    }
+
+    timestamp = (uint32_t) (frame->dts / 90);
+
+    if (ngx_live_record_init_file(s, ctx, timestamp) != NGX_OK) {
+        goto next;
+    }
+
+    // reopen index and ts file
+    curr_time = ctx->basetime + timestamp;
+    if (frame->type == NGX_MPEGTS_MSG_VIDEO) {
+        ngx_live_record_slice(s, ctx, curr_time, frame->key);
+
+        if (frame->key) {
+            ngx_live_record_add_key(s, ctx, curr_time);
+        }
+    }
+
+    if (ngx_rtmp_mpegts_write_chain(&ctx->ts, frame->chain) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0, "record: shared frame failed");
+    }
+
+    ctx->endtime = curr_time;
+
+next:
+    if (frame->type == NGX_MPEGTS_MSG_VIDEO) {
+        return next_mpegts_video(s, frame);
+    }
+
+    return next_mpegts_audio(s, frame);
+}
+
+
 static ngx_int_t
 ngx_live_record_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         ngx_chain_t *in)
@@ -1125,6 +1347,11 @@ ngx_live_record_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     codec_ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_codec_module);
 
+    /* write ts packets muxed by mpegts live in ngx_live_record_mpegts_av */
+    if (ngx_live_record_shared(s, codec_ctx)) {
+        return NGX_OK;
+    }
+
     if (h->type == NGX_RTMP_MSG_AUDIO) {
         switch (codec_ctx->audio_codec_id) {
             case NGX_RTMP_AUDIO_AAC:
@@ -1241,6 +1468,7 @@ ngx_live_record_publish(ngx_rtmp_session_t *s, ngx_rtmp_publish_t *v)
     ctx->pubv = *v;
     ctx->index.fd = -1;
     ctx->file.fd = -1;
+    ctx->keys.fd = -1;
 
     return ngx_live_record_start(s);
 }
@@ -1303,5 +1531,11 @@ ngx_live_record_postconfiguration(ngx_conf_t *cf)
     next_close_stream = ngx_rtmp_close_stream;
     ngx_rtmp_close_stream = ngx_live_record_close_stream;
 
+    next_mpegts_video = ngx_mpegts_video;
+    ngx_mpegts_video = ngx_live_record_mpegts_av;
+
+    next_mpegts_audio = ngx_mpegts_audio;
+    ngx_mpegts_audio = ngx_live_record_mpegts_av;
+
     return NGX_OK;
 }
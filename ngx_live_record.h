@@ -13,6 +13,24 @@
 #include "hls/ngx_rtmp_mpegts.h"
 
 
+#define NGX_LIVE_RECORD_KEY         0x01
+#define NGX_LIVE_RECORD_FRAGMENT    0x02
+
+#define NGX_LIVE_RECORD_KEYS        64
+
+
+/*
+ * entry of binary keyframe index, <name>_<time>.idx beside ts file,
+ * one entry for each video keyframe in host byte order
+ */
+typedef struct {
+    uint64_t                    time;       /* wallclock in msec */
+    uint64_t                    offset;     /* offset of keyframe in ts */
+    uint32_t                    frag;       /* fragment id in index */
+    uint32_t                    flags;      /* NGX_LIVE_RECORD_KEY... */
+} ngx_live_record_index_t;
+
+
 typedef struct {
     unsigned                    open; /* 0 close, 1 open, 2 wait for key */
 
@@ -36,6 +54,13 @@ typedef struct {
 
     ngx_msec_t                  publish_epoch;
     ngx_msec_t                  basetime;
+    uint64_t                    wallbase;
+
+    /* keyframe entries are written after ts flushed */
+    ngx_file_t                  keys;
+    ngx_live_record_index_t     key[NGX_LIVE_RECORD_KEYS];
+    ngx_uint_t                  nkeys;
+    uint32_t                    frag;
 } ngx_live_record_ctx_t;
 
 
@@ -5,6 +5,8 @@
 
 #include "ngx_live_relay.h"
 #include "ngx_rtmp_cmd_module.h"
+#include "ngx_rtmp_codec_module.h"
+#include "ngx_rtmp_abr_module.h"
 #include "ngx_toolkit_misc.h"
 
 
@@ -48,6 +50,32 @@ static const char *relay_type[] = {
 };
 
 
+/* weight more than this is cut, hash cost is proportional to weight */
+#define NGX_LIVE_RELAY_MAX_WEIGHT   100
+
+
+/* state per upstream, to find out bad upstream */
+typedef struct ngx_live_relay_upstream_s  ngx_live_relay_upstream_t;
+
+struct ngx_live_relay_upstream_s {
+    ngx_live_relay_upstream_t  *next;
+    ngx_str_t                   upstream;
+    ngx_uint_t                  starts;             // race starts
+    ngx_uint_t                  wins;               // race wins
+    ngx_uint_t                  fails;
+    ngx_msec_t                  down;               // down until
+};
+
+
+typedef struct {
+    uint32_t                    score;
+    ngx_uint_t                  idx;
+} ngx_live_relay_hash_t;
+
+
+static ngx_live_relay_upstream_t       *ngx_live_relay_upstreams;
+
+
 static ngx_command_t  ngx_live_relay_commands[] = {
 
     { ngx_string("failed_reconnect"),
@@ -64,6 +92,34 @@ static ngx_command_t  ngx_live_relay_commands[] = {
       offsetof(ngx_live_relay_app_conf_t, relay_reconnect),
       NULL },
 
+    { ngx_string("relay_race"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_app_conf_t, race),
+      NULL },
+
+    { ngx_string("relay_race_delay"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_app_conf_t, race_delay),
+      NULL },
+
+    { ngx_string("relay_hash"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_app_conf_t, hash),
+      NULL },
+
+    { ngx_string("relay_down_timeout"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_app_conf_t, down_timeout),
+      NULL },
+
       ngx_null_command
 };
 
@@ -108,6 +164,10 @@ ngx_live_relay_create_app_conf(ngx_conf_t *cf)
 
     racf->failed_reconnect = NGX_CONF_UNSET_MSEC;
     racf->relay_reconnect = NGX_CONF_UNSET_MSEC;
+    racf->race = NGX_CONF_UNSET_UINT;
+    racf->race_delay = NGX_CONF_UNSET_MSEC;
+    racf->hash = NGX_CONF_UNSET;
+    racf->down_timeout = NGX_CONF_UNSET_MSEC;
 
     return racf;
 }
@@ -123,6 +183,263 @@ ngx_live_relay_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
             50);
     ngx_conf_merge_msec_value(conf->relay_reconnect, prev->relay_reconnect,
             3000);
+    ngx_conf_merge_uint_value(conf->race, prev->race, 0);
+    ngx_conf_merge_msec_value(conf->race_delay, prev->race_delay, 100);
+    ngx_conf_merge_value(conf->hash, prev->hash, 0);
+    ngx_conf_merge_msec_value(conf->down_timeout, prev->down_timeout, 30000);
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_live_relay_upstream_t *
+ngx_live_relay_get_upstream(ngx_live_relay_url_t *url)
+{
+    ngx_live_relay_upstream_t  *up;
+    ngx_str_t                  *upstream;
+
+    upstream = &url->url.host_with_port;
+
+    for (up = ngx_live_relay_upstreams; up; up = up->next) {
+        if (up->upstream.len == upstream->len
+            && ngx_memcmp(up->upstream.data, upstream->data, upstream->len)
+               == 0)
+        {
+            return up;
+        }
+    }
+
+    up = ngx_calloc(sizeof(ngx_live_relay_upstream_t) + upstream->len,
+                    ngx_cycle->log);
+    if (up == NULL) {
+        return NULL;
+    }
+
+    /* url may be in session pool, copy upstream */
+    up->upstream.data = (u_char *) (up + 1);
+    up->upstream.len = upstream->len;
+    ngx_memcpy(up->upstream.data, upstream->data, upstream->len);
+
+    up->next = ngx_live_relay_upstreams;
+    ngx_live_relay_upstreams = up;
+
+    return up;
+}
+
+
+static void
+ngx_live_relay_race_stat(ngx_live_relay_url_t *url, ngx_flag_t win)
+{
+    ngx_live_relay_upstream_t  *up;
+
+    up = ngx_live_relay_get_upstream(url);
+    if (up == NULL) {
+        return;
+    }
+
+    if (win) {
+        ++up->wins;
+    } else {
+        ++up->starts;
+    }
+}
+
+
+static ngx_flag_t
+ngx_live_relay_upstream_down(ngx_live_relay_url_t *url)
+{
+    ngx_live_relay_upstream_t  *up;
+
+    up = ngx_live_relay_get_upstream(url);
+    if (up == NULL || up->down == 0) {
+        return 0;
+    }
+
+    if ((ngx_msec_int_t) (up->down - ngx_current_msec) > 0) {
+        return 1;
+    }
+
+    up->down = 0;
+
+    return 0;
+}
+
+
+static void
+ngx_live_relay_upstream_state(ngx_rtmp_session_t *rs, ngx_flag_t ok)
+{
+    ngx_live_relay_ctx_t       *ctx;
+    ngx_live_relay_app_conf_t  *lracf;
+    ngx_live_relay_upstream_t  *up;
+
+    ctx = ngx_rtmp_get_module_ctx(rs, ngx_live_relay_module);
+    if (ctx == NULL || ctx->url == NULL) {
+        return;
+    }
+
+    up = ngx_live_relay_get_upstream(ctx->url);
+    if (up == NULL) {
+        return;
+    }
+
+    if (ok) {
+        up->down = 0;
+        return;
+    }
+
+    lracf = ngx_rtmp_get_module_app_conf(rs, ngx_live_relay_module);
+
+    ++up->fails;
+
+    if (lracf->down_timeout) {
+        up->down = ngx_current_msec + lracf->down_timeout;
+        if (up->down == 0) {
+            up->down = 1;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_WARN, rs->log, 0,
+            "relay upstream %V failed, mark down for %M",
+            &up->upstream, lracf->down_timeout);
+}
+
+
+/*
+ * upstream is not reachable: relay timeout, or connection error before
+ * upstream answered rtmp connect or http request. Errors after that, such
+ * as stream not found, are about the stream, not the upstream
+ */
+static ngx_flag_t
+ngx_live_relay_upstream_failed(ngx_rtmp_session_t *rs)
+{
+    switch (rs->finalize_reason) {
+    case NGX_LIVE_RELAY_TIMEOUT:
+        return 1;
+
+    case NGX_LIVE_INTERNAL_ERR:
+    case NGX_LIVE_NORMAL_CLOSE:
+    case NGX_LIVE_RTMP_SEND_ERR:
+    case NGX_LIVE_RTMP_SEND_TIMEOUT:
+    case NGX_LIVE_RTMP_RECV_ERR:
+    case NGX_LIVE_FLV_RECV_ERR:
+        return rs->stage < NGX_LIVE_CREATE_STREAM;
+
+    default:
+        return 0;
+    }
+}
+
+
+static uint32_t
+ngx_live_relay_hash_mix(uint32_t h)
+{
+    /* murmur3 finalizer */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+
+static int ngx_libc_cdecl
+ngx_live_relay_hash_cmp(const void *one, const void *two)
+{
+    ngx_live_relay_hash_t      *first, *second;
+
+    first = (ngx_live_relay_hash_t *) one;
+    second = (ngx_live_relay_hash_t *) two;
+
+    /* higher score first */
+    if (first->score == second->score) {
+        return first->idx < second->idx ? -1 : 1;
+    }
+
+    return first->score < second->score ? 1 : -1;
+}
+
+
+/*
+ * weighted rendezvous hash, score of url is max hash of weight copies of
+ * (stream, upstream), so url wins with probability weight / total weight,
+ * and only streams on removed url move when urls changed.
+ *
+ * return index in urls for the idx-th try, urls down are skipped
+ * if any url after them is up, *next is set to idx for next try
+ */
+static ngx_int_t
+ngx_live_relay_hash(ngx_rtmp_session_t *rs, ngx_live_relay_t *relay,
+        ngx_uint_t idx, ngx_uint_t *next)
+{
+    ngx_live_relay_url_t       *url;
+    ngx_live_relay_hash_t      *hs;
+    ngx_uint_t                  i, j, w;
+    uint32_t                    key, h;
+    u_char                     *name;
+
+    url = relay->urls.elts;
+
+    hs = ngx_palloc(rs->pool, sizeof(ngx_live_relay_hash_t)
+                              * relay->urls.nelts);
+    if (hs == NULL) {
+        return NGX_ERROR;
+    }
+
+    name = rs->live_stream->name;
+    key = ngx_murmur_hash2(name, ngx_strlen(name));
+
+    for (i = 0; i < relay->urls.nelts; ++i) {
+        h = key ^ ngx_murmur_hash2(url[i].url.host_with_port.data,
+                                   url[i].url.host_with_port.len);
+
+        w = ngx_min(ngx_max(url[i].weight, 1), NGX_LIVE_RELAY_MAX_WEIGHT);
+
+        hs[i].idx = i;
+        hs[i].score = 0;
+        for (j = 0; j < w; ++j) {
+            hs[i].score = ngx_max(hs[i].score,
+                                  ngx_live_relay_hash_mix(h + j * 0x9e3779b9));
+        }
+    }
+
+    ngx_sort(hs, relay->urls.nelts, sizeof(ngx_live_relay_hash_t),
+             ngx_live_relay_hash_cmp);
+
+    for (i = idx; i < relay->urls.nelts; ++i) {
+        if (!ngx_live_relay_upstream_down(&url[hs[i].idx])) {
+            break;
+        }
+    }
+
+    if (i == relay->urls.nelts) { // all left down, try as order
+        i = idx;
+    }
+
+    *next = i + 1;
+
+    return hs[i].idx;
+}
+
+
+/* weight=N in pull, push and static_pull, for url right before it */
+char *
+ngx_live_relay_url_weight(ngx_live_relay_t *relay, ngx_str_t *value)
+{
+    ngx_live_relay_url_t       *url;
+
+    if (relay->urls.nelts == 0) {
+        return "weight must follow url";
+    }
+
+    url = relay->urls.elts;
+    url += relay->urls.nelts - 1;
+
+    url->weight = ngx_atoi(value->data, value->len);
+    if (url->weight == (ngx_uint_t) NGX_ERROR || url->weight == 0) {
+        return "invalid weight";
+    }
 
     return NGX_CONF_OK;
 }
@@ -132,8 +449,11 @@ ngx_int_t
 ngx_live_relay_create(ngx_rtmp_session_t *rs, ngx_live_relay_t *relay)
 {
     ngx_live_relay_ctx_t       *ctx;
+    ngx_live_relay_app_conf_t  *lracf;
     ngx_live_relay_url_t       *url;
     relay_create_pt             create;
+    ngx_int_t                   n;
+    ngx_uint_t                  next;
 
     ctx = ngx_rtmp_get_module_ctx(rs, ngx_live_relay_module);
     if (ctx->idx >= relay->urls.nelts) {
@@ -141,8 +461,20 @@ ngx_live_relay_create(ngx_rtmp_session_t *rs, ngx_live_relay_t *relay)
     }
     ctx->failed_delay = 0;
 
+    lracf = ngx_rtmp_get_module_app_conf(rs, ngx_live_relay_module);
+
+    n = ctx->idx;
+    next = ctx->idx + 1;
+
+    if (lracf->hash && relay->urls.nelts > 1) {
+        n = ngx_live_relay_hash(rs, relay, ctx->idx, &next);
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     url = relay->urls.elts;
-    url += ctx->idx;
+    url += n;
 
     if (url->relay_type >= NGX_LIVE_RELAY_MAXTYPE) {
         ngx_log_error(NGX_LOG_ERR, rs->log, 0, "unsupported relay type %ui",
@@ -152,6 +484,11 @@ ngx_live_relay_create(ngx_rtmp_session_t *rs, ngx_live_relay_t *relay)
 
     create = create_relay[url->relay_type];
 
+    ctx->url = url;
+    if (ctx->race) {
+        ngx_live_relay_race_stat(url, 0);
+    }
+
     ngx_log_error(NGX_LOG_INFO, rs->log, 0,
             "create %s relay %s to %V:%d, domain='%V' app='%V' name='%V' "
             "pargs='%V' referer='%V' user_agent='%V'",
@@ -159,7 +496,7 @@ ngx_live_relay_create(ngx_rtmp_session_t *rs, ngx_live_relay_t *relay)
             &url->url.host, url->port, &relay->domain, &relay->app,
             &relay->name, &relay->pargs, &relay->referer, &relay->user_agent);
 
-    ++ctx->idx;
+    ctx->idx = next;
 
     return create(rs, relay, url);
 }
@@ -187,6 +524,13 @@ ngx_int_t
 ngx_live_relay_publish_local(ngx_rtmp_session_t *rs)
 {
     ngx_rtmp_publish_t          v;
+    ngx_live_relay_ctx_t       *ctx;
+
+    /* racing pull publish local when it wins */
+    ctx = ngx_rtmp_get_module_ctx(rs, ngx_live_relay_module);
+    if (ctx && ctx->race) {
+        return NGX_OK;
+    }
 
     ngx_memzero(&v, sizeof(ngx_rtmp_publish_t));
     v.silent = 1;
@@ -231,6 +575,8 @@ ngx_live_relay_publish(ngx_rtmp_session_t *s, ngx_rtmp_publish_t *v)
     ctx->successd = 1;
     ctx->failed_reconnect = 0;
 
+    ngx_live_relay_upstream_state(s, 1);
+
     ctx->idx = 0;
 
 next:
@@ -243,6 +589,11 @@ ngx_live_relay_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
 {
     ngx_live_relay_ctx_t       *ctx;
 
+    /* abr player is attached to a local rendition, group is not a stream */
+    if (ngx_rtmp_get_module_ctx(s, ngx_rtmp_abr_module)) {
+        goto next;
+    }
+
     if (ngx_live_pull(s) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -263,6 +614,8 @@ ngx_live_relay_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
     ctx->successd = 1;
     ctx->failed_reconnect = 0;
 
+    ngx_live_relay_upstream_state(s, 1);
+
     ctx->idx = 0;
 
 next:
@@ -281,6 +634,14 @@ ngx_live_relay_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
         goto next;
     }
 
+    // relay failed before success, caused by upstream
+    rctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+    if (rctx && !rctx->successd && !rctx->giveup
+        && ngx_live_relay_upstream_failed(s))
+    {
+        ngx_live_relay_upstream_state(s, 0);
+    }
+
     if (s->publishing) {
         /*
          * normal publisher close or relay puller close
@@ -399,9 +760,154 @@ ngx_live_relay_pull_close(ngx_rtmp_session_t *s)
 }
 
 
+static ngx_int_t
+ngx_live_relay_race_win(ngx_rtmp_session_t *s)
+{
+    ngx_live_relay_ctx_t       *ctx, *lctx;
+    ngx_rtmp_core_ctx_t        *cctx, *next;
+    ngx_rtmp_session_t         *ls;
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+    ctx->race = 0;
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0, "relay race, %V wins",
+            &ctx->url->url.host_with_port);
+
+    ngx_live_relay_race_stat(ctx->url, 1);
+
+    /*
+     * remove losers from stream before winner publish, so winner is the
+     * only publisher in stream, and losers will not trigger pull again
+     */
+    for (cctx = s->live_stream->publish_ctx; cctx; cctx = next) {
+        next = cctx->next;
+        ls = cctx->session;
+
+        lctx = ngx_rtmp_get_module_ctx(ls, ngx_live_relay_module);
+        if (ls == s || lctx == NULL || !lctx->race) {
+            continue;
+        }
+
+        lctx->giveup = 1;
+        ngx_live_delete_ctx(ls);
+
+        ls->finalize_reason = NGX_LIVE_RELAY_CLOSE;
+        ngx_rtmp_finalize_session(ls);
+    }
+
+    return ngx_live_relay_publish_local(s);
+}
+
+
+static ngx_int_t
+ngx_live_relay_race_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+        ngx_chain_t *in)
+{
+    ngx_live_relay_ctx_t       *ctx;
+    ngx_rtmp_codec_ctx_t       *codec_ctx;
+
+    if (!s->relay || !s->publishing) {
+        return NGX_OK;
+    }
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+    if (ctx == NULL || !ctx->race) {
+        return NGX_OK;
+    }
+
+    if (h->type == NGX_RTMP_MSG_VIDEO) {
+        if (ngx_rtmp_get_video_frame_type(in) != NGX_RTMP_VIDEO_KEY_FRAME
+            || ngx_rtmp_is_codec_header(in))
+        {
+            return NGX_OK;
+        }
+
+    } else {
+        /* audio only stream, wins on audio after metadata */
+        codec_ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_codec_module);
+        if (codec_ctx == NULL || codec_ctx->meta == NULL
+            || codec_ctx->video_codec_id || ngx_rtmp_is_codec_header(in))
+        {
+            return NGX_OK;
+        }
+    }
+
+    return ngx_live_relay_race_win(s);
+}
+
+
+ngx_chain_t *
+ngx_live_relay_state(ngx_http_request_t *r)
+{
+    ngx_live_relay_upstream_t  *up;
+    ngx_chain_t                *cl;
+    ngx_buf_t                  *b;
+    size_t                      len;
+    ngx_msec_int_t              down;
+
+    len = sizeof("##########live relay state##########\n") - 1;
+    for (up = ngx_live_relay_upstreams; up; up = up->next) {
+        len += sizeof("ngx_live_relay upstream  race_starts:  race_wins:  "
+                      "fails:  down: \n") - 1
+             + up->upstream.len + 4 * NGX_OFF_T_LEN;
+    }
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+    cl->next = NULL;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NULL;
+    }
+    cl->buf = b;
+
+    b->last = ngx_snprintf(b->last, len,
+            "##########live relay state##########\n");
+
+    for (up = ngx_live_relay_upstreams; up; up = up->next) {
+        down = up->down ? (ngx_msec_int_t) (up->down - ngx_current_msec) : 0;
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "ngx_live_relay upstream %V race_starts: %ui race_wins: %ui "
+                "fails: %ui down: %ui\n",
+                &up->upstream, up->starts, up->wins, up->fails,
+                (ngx_uint_t) ngx_max(down, 0));
+    }
+
+    return cl;
+}
+
+
 static ngx_int_t
 ngx_live_relay_postconfiguration(ngx_conf_t *cf)
 {
+    ngx_rtmp_core_main_conf_t  *cmcf;
+    ngx_rtmp_handler_pt        *h;
+    ngx_array_t                *evhs;
+    ngx_uint_t                  n;
+
+    cmcf = ngx_rtmp_conf_get_module_main_conf(cf, ngx_rtmp_core_module);
+
+    /*
+     * race winner must publish before live module handle the keyframe,
+     * so put race handler in front of audio and video handlers
+     */
+    for (n = NGX_RTMP_MSG_AUDIO; n <= NGX_RTMP_MSG_VIDEO; ++n) {
+        evhs = &cmcf->events[n];
+
+        h = ngx_array_push(evhs);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h = evhs->elts;
+        ngx_memmove(h + 1, h, (evhs->nelts - 1) * sizeof(ngx_rtmp_handler_pt));
+        *h = ngx_live_relay_race_av;
+    }
+
     next_publish = ngx_rtmp_publish;
     ngx_rtmp_publish = ngx_live_relay_publish;
 
@@ -16,6 +16,14 @@
 #define NGX_LIVE_RELAY_MAXTYPE      2
 
 
+typedef struct {
+    ngx_request_url_t           url;
+    in_port_t                   port;
+    ngx_uint_t                  relay_type;
+    ngx_uint_t                  weight;             // for relay_hash
+} ngx_live_relay_url_t;
+
+
 typedef struct {
     // reconnect
     ngx_event_t                 reconnect;
@@ -34,6 +42,11 @@ typedef struct {
     ngx_msec_t                  failed_reconnect;   // reconnect timeout
     ngx_flag_t                  failed_delay;
     ngx_flag_t                  giveup;             // no need to reconnect
+    /*
+     * pull racing with other candidates, publish local only when
+     * first keyframe received, other candidates will be closed
+     */
+    ngx_flag_t                  race;
 
     // base para
     ngx_str_t                   domain;
@@ -51,23 +64,22 @@ typedef struct {
 
     void                       *tag;
     ngx_uint_t                  idx;
+    ngx_live_relay_url_t       *url;                // url connecting
 } ngx_live_relay_ctx_t;
 
 
-typedef struct {
-    ngx_request_url_t           url;
-    in_port_t                   port;
-    ngx_uint_t                  relay_type;
-} ngx_live_relay_url_t;
-
-
 typedef struct {
     ngx_msec_t                  failed_reconnect;
     ngx_msec_t                  relay_reconnect;
+    ngx_uint_t                  race;               // candidates in race
+    ngx_msec_t                  race_delay;         // start delay between
+    ngx_flag_t                  hash;               // hash stream to url
+    ngx_msec_t                  down_timeout;       // url down after failed
 } ngx_live_relay_app_conf_t;
 
 
 extern ngx_module_t  ngx_live_relay_module;
+extern ngx_module_t  ngx_live_relay_inner_module;
 
 
 ngx_int_t ngx_live_relay_create_httpflv(ngx_rtmp_session_t *rs,
@@ -79,6 +91,8 @@ ngx_int_t ngx_live_relay_create_rtmp(ngx_rtmp_session_t *rs,
 ngx_int_t ngx_live_relay_create(ngx_rtmp_session_t *rs,
         ngx_live_relay_t *relay);
 
+char *ngx_live_relay_url_weight(ngx_live_relay_t *relay, ngx_str_t *value);
+
 ngx_int_t ngx_live_relay_play_local(ngx_rtmp_session_t *rs);
 
 ngx_int_t ngx_live_relay_publish_local(ngx_rtmp_session_t *rs);
@@ -27,6 +27,140 @@ static ngx_http_status_code_t ngx_http_relay_status_code[] = {
 };
 
 
+/* FLV file header and previous tag size + tag header */
+#define NGX_LIVE_RELAY_FLV_HEADER_SIZE      9
+#define NGX_LIVE_RELAY_FLV_TAG_HEADER_SIZE  15
+
+
+enum {
+    flv_header_F = 0,
+    flv_header_FL,
+    flv_header_FLV,
+    flv_header_Version,
+    flv_header_Flags,
+    flv_header_DataOffset0,
+    flv_header_DataOffset1,
+    flv_header_DataOffset2,
+    flv_header_DataOffset3,
+    flv_tagsize0,
+    flv_tagsize1,
+    flv_tagsize2,
+    flv_tagsize3,
+    flv_tagtype,
+    flv_datasize0,
+    flv_datasize1,
+    flv_datasize2,
+    flv_timestamp0,
+    flv_timestamp1,
+    flv_timestamp2,
+    flv_timestamp_extended,
+    flv_streamid0,
+    flv_streamid1,
+    flv_streamid2,
+    flv_data
+};
+
+
+#define ngx_live_relay_flv_r24(p)                                           \
+    ((uint32_t) (p)[0] << 16 | (uint32_t) (p)[1] << 8 | (uint32_t) (p)[2])
+
+#define ngx_live_relay_flv_r32(p)                                           \
+    ((uint32_t) (p)[0] << 24 | ngx_live_relay_flv_r24((p) + 1))
+
+
+/*
+ * fast path for header and tag which is complete in b, header is parsed
+ * with fixed-width loads, payload is referenced in ref without copy
+ *
+ * return:
+ *      NGX_DONE: a whole tag parsed, payload in ref
+ *      NGX_DECLINED: parse remaining bytes with state machine
+ *      NGX_ERROR: invalid flv
+ */
+static ngx_int_t
+ngx_live_relay_httpflv_parse_fast(ngx_rtmp_session_t *s, ngx_buf_t *b,
+        ngx_chain_t *ref)
+{
+    u_char                     *p;
+    ngx_rtmp_stream_t          *st;
+    ngx_rtmp_header_t          *h;
+    uint32_t                    tagsize;
+
+    p = b->pos;
+
+    if (s->flv_state == flv_header_F) {
+        if (b->last - p < NGX_LIVE_RELAY_FLV_HEADER_SIZE) {
+            return NGX_DECLINED;
+        }
+
+        if (p[0] != 'F' || p[1] != 'L' || p[2] != 'V' || p[3] != 1) {
+            return NGX_ERROR;
+        }
+
+        s->flv_version = p[3];
+        s->flv_flags = p[4];
+        s->flv_data_offset = ngx_live_relay_flv_r32(p + 5);
+
+        p += NGX_LIVE_RELAY_FLV_HEADER_SIZE;
+        b->pos = p;
+        s->flv_state = flv_tagsize0;
+    }
+
+    if (s->flv_state != flv_tagsize0
+        || b->last - p < NGX_LIVE_RELAY_FLV_TAG_HEADER_SIZE)
+    {
+        return NGX_DECLINED;
+    }
+
+    st = &s->in_streams[0];
+    h = &st->hdr;
+
+    tagsize = ngx_live_relay_flv_r32(p);
+
+    if (h->mlen == 0 && s->flv_first_pts == 0) {
+        s->flv_first_pts = 1;
+        if (tagsize != 0) {
+            return NGX_ERROR;
+        }
+    } else {
+        if (h->mlen + 11 != tagsize) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (p[4] != NGX_RTMP_MSG_AMF_META && p[4] != NGX_RTMP_MSG_AUDIO
+            && p[4] != NGX_RTMP_MSG_VIDEO)
+    {
+        return NGX_ERROR;
+    }
+
+    s->flv_tagsize = tagsize;
+    h->type = p[4];
+    h->mlen = ngx_live_relay_flv_r24(p + 5);
+    h->timestamp = ngx_live_relay_flv_r24(p + 8) | (uint32_t) p[11] << 24;
+    h->msid = ngx_live_relay_flv_r24(p + 12);
+    st->len = h->mlen;
+
+    p += NGX_LIVE_RELAY_FLV_TAG_HEADER_SIZE;
+    b->pos = p;
+    s->flv_state = flv_data;
+
+    /* payload across buffers, copy it in state machine */
+    if (st->in || (size_t) (b->last - p) < h->mlen) {
+        return NGX_DECLINED;
+    }
+
+    ref->buf->pos = p;
+    ref->buf->last = p + h->mlen;
+    ref->next = NULL;
+
+    b->pos = p + h->mlen;
+    st->len = 0;
+    s->flv_state = flv_tagsize0;
+
+    return NGX_DONE;
+}
+
 static ngx_int_t
 ngx_live_relay_httpflv_parse(ngx_rtmp_session_t *s, ngx_buf_t *b)
 {
@@ -37,33 +171,7 @@ ngx_live_relay_httpflv_parse(ngx_rtmp_session_t *s, ngx_buf_t *b)
     size_t                      len;
     ngx_rtmp_core_srv_conf_t   *cscf;
     ngx_int_t                   rc = NGX_AGAIN;
-    enum {
-        flv_header_F = 0,
-        flv_header_FL,
-        flv_header_FLV,
-        flv_header_Version,
-        flv_header_Flags,
-        flv_header_DataOffset0,
-        flv_header_DataOffset1,
-        flv_header_DataOffset2,
-        flv_header_DataOffset3,
-        flv_tagsize0,
-        flv_tagsize1,
-        flv_tagsize2,
-        flv_tagsize3,
-        flv_tagtype,
-        flv_datasize0,
-        flv_datasize1,
-        flv_datasize2,
-        flv_timestamp0,
-        flv_timestamp1,
-        flv_timestamp2,
-        flv_timestamp_extended,
-        flv_streamid0,
-        flv_streamid1,
-        flv_streamid2,
-        flv_data
-    } state;
+    ngx_uint_t                  state;
 
     state = s->flv_state;
     cscf = ngx_rtmp_get_module_srv_conf(s, ngx_rtmp_core_module);
@@ -359,9 +467,15 @@ ngx_live_relay_httpflv_recv_body(void *request, ngx_http_request_t *hcr)
     ngx_chain_t                *cl, *l, *in;
     ngx_rtmp_header_t          *h;
     ngx_rtmp_stream_t          *st = NULL;
+    ngx_chain_t                 ref;
+    ngx_buf_t                   refbuf;
 
     s = request;
 
+    ngx_memzero(&refbuf, sizeof(ngx_buf_t));
+    refbuf.memory = 1;
+    ref.buf = &refbuf;
+
     n = ngx_http_client_read_body(hcr, &cl);
 
     if (n == 0 || n == NGX_ERROR) {
@@ -383,7 +497,10 @@ ngx_live_relay_httpflv_recv_body(void *request, ngx_http_request_t *hcr)
             return;
         }
 
-        n = ngx_live_relay_httpflv_parse(s, l->buf);
+        n = ngx_live_relay_httpflv_parse_fast(s, l->buf, &ref);
+        if (n == NGX_DECLINED) {
+            n = ngx_live_relay_httpflv_parse(s, l->buf);
+        }
 
         if (n == NGX_ERROR) {
             ngx_log_error(NGX_LOG_ERR, s->log, 0,
@@ -398,9 +515,23 @@ ngx_live_relay_httpflv_recv_body(void *request, ngx_http_request_t *hcr)
             continue;
         }
 
-        /* NGX_OK */
         st = &s->in_streams[0];
         h = &st->hdr;
+
+        /*
+         * NGX_DONE, payload referenced in received buffer,
+         * handlers copy frame into shared buffers before return
+         */
+        if (n == NGX_DONE) {
+            if (ngx_rtmp_receive_message(s, h, &ref) != NGX_OK) {
+                ngx_rtmp_finalize_session(s);
+                return;
+            }
+
+            continue;
+        }
+
+        /* NGX_OK */
         in = st->in;
 
         if (ngx_rtmp_receive_message(s, h, in) != NGX_OK) {
@@ -17,9 +17,93 @@ static char *ngx_live_relay_rtmp_merge_app_conf(ngx_conf_t *cf, void *parent,
 
 typedef struct {
     ngx_msec_t                  buflen;
+    ngx_flag_t                  mux;
+    ngx_uint_t                  mux_streams;
+    ngx_uint_t                  pool_min;
+    ngx_uint_t                  pool_max;
+    ngx_msec_t                  pool_idle_timeout;
 } ngx_live_relay_rtmp_app_conf_t;
 
 
+/*
+ * multiplexed relay pull, streams to the same upstream server, domain and app
+ * share one rtmp connection, every stream get its own message stream id
+ * by createStream. The session owns the connection is called carrier.
+ */
+typedef struct ngx_live_relay_rtmp_mux_s  ngx_live_relay_rtmp_mux_t;
+
+typedef struct {
+    ngx_rtmp_session_t         *session;
+    ngx_live_relay_rtmp_mux_t  *mux;
+    uint32_t                    msid;
+    ngx_uint_t                  slot;
+    ngx_uint_t                  trans;      /* of createStream sent */
+
+    uint64_t                    in_bytes;
+    ngx_uint_t                  in_msgs;
+
+    unsigned                    warm:1;     /* upstream connected already */
+    unsigned                    ttff:1;     /* first frame recorded */
+} ngx_live_relay_rtmp_stream_t;
+
+struct ngx_live_relay_rtmp_mux_s {
+    ngx_str_t                   key;
+    ngx_rtmp_session_t         *session;
+
+    ngx_live_relay_rtmp_stream_t  **streams;
+    ngx_uint_t                  max_streams;
+    ngx_uint_t                  nstreams;
+
+    /* trans of next createStream, never reused in carrier */
+    ngx_uint_t                  trans;
+
+    ngx_live_relay_rtmp_mux_t  *next;
+
+    /* idle timer of pooled carrier */
+    ngx_event_t                 idle_evt;
+
+    unsigned                    connected:1;
+    unsigned                    pool:1;     /* created by connection pool */
+    unsigned                    idle:1;     /* in pool, not claimed */
+};
+
+/* upstream which could not multiplex streams, use dedicated connection */
+typedef struct ngx_live_relay_rtmp_refused_s  ngx_live_relay_rtmp_refused_t;
+
+struct ngx_live_relay_rtmp_refused_s {
+    ngx_live_relay_rtmp_refused_t  *next;
+    ngx_msec_t                  expire;
+    ngx_str_t                   key;
+};
+
+
+/*
+ * time to first frame of relay pull, from relay session created to
+ * first audio or video received
+ *      warm: upstream connection is ready when pull created
+ *      cold: pull need to wait for handshake and connect
+ */
+#define NGX_RTMP_RELAY_TTFF_BUCKETS             8
+
+static ngx_msec_t ngx_live_relay_rtmp_ttff_bound[] = {
+    100, 200, 500, 1000, 2000, 5000, 10000
+};
+
+typedef struct {
+    ngx_uint_t                  pool_create;
+    ngx_uint_t                  pool_claim;
+    ngx_uint_t                  pool_miss;
+    ngx_uint_t                  pool_idle_close;
+
+    ngx_uint_t                  ttff[2][NGX_RTMP_RELAY_TTFF_BUCKETS];
+} ngx_live_relay_rtmp_stat_t;
+
+
+static ngx_live_relay_rtmp_mux_t       *ngx_live_relay_rtmp_muxes;
+static ngx_live_relay_rtmp_refused_t   *ngx_live_relay_rtmp_refused;
+static ngx_live_relay_rtmp_stat_t       ngx_live_relay_rtmp_stat;
+
+
 typedef struct {
     char                       *code;
     ngx_uint_t                  status;
@@ -38,6 +122,13 @@ static ngx_rtmp_status_code_t ngx_rtmp_relay_status_error_code[] = {
 
 #define NGX_RTMP_RELAY_CONNECT_TRANS            1
 #define NGX_RTMP_RELAY_CREATE_STREAM_TRANS      2
+/*
+ * createStream of multiplexed stream, trans starts from base and increases
+ * in carrier, result of a stream detached or created already is stale
+ */
+#define NGX_RTMP_RELAY_MUX_TRANS                16
+
+#define NGX_RTMP_RELAY_MUX_REFUSE_TIME          60000
 
 
 #define NGX_RTMP_RELAY_CSID_AMF_INI             3
@@ -54,6 +145,41 @@ static ngx_command_t  ngx_live_relay_rtmp_commands[] = {
       offsetof(ngx_live_relay_rtmp_app_conf_t, buflen),
       NULL },
 
+    { ngx_string("relay_mux"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_rtmp_app_conf_t, mux),
+      NULL },
+
+    { ngx_string("relay_mux_streams"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_rtmp_app_conf_t, mux_streams),
+      NULL },
+
+    { ngx_string("relay_pool_min"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_rtmp_app_conf_t, pool_min),
+      NULL },
+
+    { ngx_string("relay_pool_max"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_rtmp_app_conf_t, pool_max),
+      NULL },
+
+    { ngx_string("relay_pool_idle_timeout"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_live_relay_rtmp_app_conf_t, pool_idle_timeout),
+      NULL },
+
       ngx_null_command
 };
 
@@ -97,6 +223,11 @@ ngx_live_relay_rtmp_create_app_conf(ngx_conf_t *cf)
     }
 
     racf->buflen = NGX_CONF_UNSET_MSEC;
+    racf->mux = NGX_CONF_UNSET;
+    racf->mux_streams = NGX_CONF_UNSET_UINT;
+    racf->pool_min = NGX_CONF_UNSET_UINT;
+    racf->pool_max = NGX_CONF_UNSET_UINT;
+    racf->pool_idle_timeout = NGX_CONF_UNSET_MSEC;
 
     return racf;
 }
@@ -109,6 +240,25 @@ ngx_live_relay_rtmp_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_live_relay_rtmp_app_conf_t *conf = child;
 
     ngx_conf_merge_msec_value(conf->buflen, prev->buflen, 5000);
+    ngx_conf_merge_value(conf->mux, prev->mux, 0);
+    ngx_conf_merge_uint_value(conf->mux_streams, prev->mux_streams, 64);
+
+    ngx_conf_merge_uint_value(conf->pool_min, prev->pool_min, 0);
+    ngx_conf_merge_uint_value(conf->pool_max, prev->pool_max, 8);
+    ngx_conf_merge_msec_value(conf->pool_idle_timeout,
+                              prev->pool_idle_timeout, 60000);
+
+    if (conf->mux_streams == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "relay_mux_streams must be greater than 0");
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->pool_min > conf->pool_max) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                "relay_pool_min must not be greater than relay_pool_max");
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
@@ -247,9 +397,9 @@ ngx_live_relay_rtmp_send_connect(ngx_rtmp_session_t *s)
 
 
 static ngx_int_t
-ngx_live_relay_rtmp_send_create_stream(ngx_rtmp_session_t *s)
+ngx_live_relay_rtmp_send_create_stream(ngx_rtmp_session_t *s, ngx_uint_t tr)
 {
-    static double                   trans = NGX_RTMP_RELAY_CREATE_STREAM_TRANS;
+    static double                   trans;
 
     static ngx_rtmp_amf_elt_t       out_elts[] = {
 
@@ -269,6 +419,8 @@ ngx_live_relay_rtmp_send_create_stream(ngx_rtmp_session_t *s)
     ngx_rtmp_header_t               h;
 
 
+    trans = tr;
+
     ngx_memzero(&h, sizeof(h));
     h.csid = NGX_RTMP_RELAY_CSID_AMF_INI;
     h.type = NGX_RTMP_MSG_AMF_CMD;
@@ -281,6 +433,45 @@ ngx_live_relay_rtmp_send_create_stream(ngx_rtmp_session_t *s)
 }
 
 
+static ngx_int_t
+ngx_live_relay_rtmp_send_delete_stream(ngx_rtmp_session_t *s, uint32_t msid)
+{
+    static double                   trans;
+    static double                   stream;
+
+    static ngx_rtmp_amf_elt_t       out_elts[] = {
+
+        { NGX_RTMP_AMF_STRING,
+          ngx_null_string,
+          "deleteStream", 0 },
+
+        { NGX_RTMP_AMF_NUMBER,
+          ngx_null_string,
+          &trans, 0 },
+
+        { NGX_RTMP_AMF_NULL,
+          ngx_null_string,
+          NULL, 0 },
+
+        { NGX_RTMP_AMF_NUMBER,
+          ngx_null_string,
+          &stream, 0 }
+    };
+
+    ngx_rtmp_header_t               h;
+
+
+    stream = msid;
+
+    ngx_memzero(&h, sizeof(h));
+    h.csid = NGX_RTMP_RELAY_CSID_AMF_INI;
+    h.type = NGX_RTMP_MSG_AMF_CMD;
+
+    return ngx_rtmp_send_amf(s, &h, out_elts,
+            sizeof(out_elts) / sizeof(out_elts[0]));
+}
+
+
 static ngx_int_t
 ngx_live_relay_rtmp_send_publish(ngx_rtmp_session_t *s)
 {
@@ -384,6 +575,9 @@ ngx_live_relay_rtmp_send_play(ngx_rtmp_session_t *s)
     ngx_rtmp_header_t               h;
     ngx_live_relay_ctx_t           *ctx;
     ngx_live_relay_rtmp_app_conf_t *racf;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_rtmp_session_t             *ss;
+    uint32_t                        msid;
 
 
     racf = ngx_rtmp_get_module_app_conf(s, ngx_live_relay_rtmp_module);
@@ -392,6 +586,15 @@ ngx_live_relay_rtmp_send_play(ngx_rtmp_session_t *s)
         return NGX_ERROR;
     }
 
+    /* multiplexed stream send play in carrier with its own msid */
+    ss = s;
+    msid = NGX_RTMP_RELAY_MSID;
+    if (s->mux) {
+        st = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+        ss = s->mux;
+        msid = st->msid;
+    }
+
     if (ctx->pargs.len) {
         name.len = ctx->name.len + 1 + ctx->pargs.len;
         name.data = ngx_pcalloc(s->pool, name.len);
@@ -412,16 +615,15 @@ ngx_live_relay_rtmp_send_play(ngx_rtmp_session_t *s)
 
     ngx_memzero(&h, sizeof(h));
     h.csid = NGX_RTMP_RELAY_CSID_AMF;
-    h.msid = NGX_RTMP_RELAY_MSID;
+    h.msid = msid;
     h.type = NGX_RTMP_MSG_AMF_CMD;
 
     s->stage = NGX_LIVE_PLAY;
     s->ptime = ngx_current_msec;
 
-    return ngx_rtmp_send_amf(s, &h, out_elts,
+    return ngx_rtmp_send_amf(ss, &h, out_elts,
             sizeof(out_elts) / sizeof(out_elts[0])) != NGX_OK
-           || ngx_rtmp_send_set_buflen(s, NGX_RTMP_RELAY_MSID,
-                   racf->buflen) != NGX_OK
+           || ngx_rtmp_send_set_buflen(ss, msid, racf->buflen) != NGX_OK
            ? NGX_ERROR
            : NGX_OK;
 }
@@ -435,6 +637,11 @@ ngx_live_relay_rtmp_status_error(ngx_rtmp_session_t *s, char *type, char *code,
     size_t                          i;
     ngx_flag_t                      status = 0;
 
+    /* carrier of multiplexed streams has no live stream */
+    if (s->live_stream == NULL) {
+        return NGX_OK;
+    }
+
     if (ngx_strcmp(type, "onStatus") == 0) {
         status = 1;
     }
@@ -475,6 +682,261 @@ ngx_live_relay_rtmp_status_error(ngx_rtmp_session_t *s, char *type, char *code,
 }
 
 
+static ngx_int_t
+ngx_live_relay_rtmp_mux_refuse(ngx_live_relay_rtmp_mux_t *mux)
+{
+    ngx_live_relay_rtmp_refused_t  *rf;
+
+    for (rf = ngx_live_relay_rtmp_refused; rf; rf = rf->next) {
+        if (rf->key.len == mux->key.len
+            && ngx_memcmp(rf->key.data, mux->key.data, rf->key.len) == 0)
+        {
+            rf->expire = ngx_current_msec + NGX_RTMP_RELAY_MUX_REFUSE_TIME;
+            return NGX_OK;
+        }
+    }
+
+    rf = ngx_alloc(sizeof(ngx_live_relay_rtmp_refused_t) + mux->key.len,
+                   ngx_cycle->log);
+    if (rf == NULL) {
+        return NGX_ERROR;
+    }
+
+    rf->expire = ngx_current_msec + NGX_RTMP_RELAY_MUX_REFUSE_TIME;
+    rf->key.len = mux->key.len;
+    rf->key.data = (u_char *) rf + sizeof(ngx_live_relay_rtmp_refused_t);
+    ngx_memcpy(rf->key.data, mux->key.data, mux->key.len);
+
+    rf->next = ngx_live_relay_rtmp_refused;
+    ngx_live_relay_rtmp_refused = rf;
+
+    ngx_log_error(NGX_LOG_WARN, mux->session->log, 0,
+            "relay mux, upstream %V refused multiplexing, "
+            "use dedicated connection", &mux->key);
+
+    return NGX_OK;
+}
+
+
+static ngx_flag_t
+ngx_live_relay_rtmp_mux_refused(ngx_str_t *key)
+{
+    ngx_live_relay_rtmp_refused_t **rfp, *rf;
+
+    rfp = &ngx_live_relay_rtmp_refused;
+    while (*rfp) {
+        rf = *rfp;
+
+        if ((ngx_msec_int_t) (ngx_current_msec - rf->expire) >= 0) {
+            *rfp = rf->next;
+            ngx_free(rf);
+            continue;
+        }
+
+        if (rf->key.len == key->len
+            && ngx_memcmp(rf->key.data, key->data, key->len) == 0)
+        {
+            return 1;
+        }
+
+        rfp = &rf->next;
+    }
+
+    return 0;
+}
+
+
+static ngx_rtmp_session_t *
+ngx_live_relay_rtmp_mux_stream_session(ngx_rtmp_session_t *s,
+        ngx_rtmp_header_t *h)
+{
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_uint_t                      i;
+
+    mux = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+    if (mux == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < mux->max_streams; ++i) {
+        st = mux->streams[i];
+        if (st == NULL || st->msid != h->msid) {
+            continue;
+        }
+
+        st->in_bytes += h->mlen;
+        ++st->in_msgs;
+
+        return st->session->destroyed ? NULL : st->session;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_live_relay_rtmp_mux_create_stream(ngx_live_relay_rtmp_mux_t *mux,
+        ngx_live_relay_rtmp_stream_t *st)
+{
+    st->session->stage = NGX_LIVE_CREATE_STREAM;
+    st->session->create_stream_time = ngx_current_msec;
+
+    st->trans = mux->trans++;
+
+    return ngx_live_relay_rtmp_send_create_stream(mux->session, st->trans);
+}
+
+
+static ngx_live_relay_rtmp_stream_t *
+ngx_live_relay_rtmp_mux_find_trans(ngx_live_relay_rtmp_mux_t *mux,
+        ngx_uint_t trans)
+{
+    ngx_uint_t                      i;
+
+    for (i = 0; i < mux->max_streams; ++i) {
+        if (mux->streams[i] && mux->streams[i]->trans == trans) {
+            return mux->streams[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_live_relay_rtmp_mux_connected(ngx_rtmp_session_t *s)
+{
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_uint_t                      i;
+
+    mux = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+    if (mux == NULL) {
+        return NGX_ERROR;
+    }
+
+    mux->connected = 1;
+
+    for (i = 0; i < mux->max_streams; ++i) {
+        st = mux->streams[i];
+        if (st == NULL) {
+            continue;
+        }
+
+        if (ngx_live_relay_rtmp_mux_create_stream(mux, st) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_live_relay_rtmp_mux_stream_created(ngx_rtmp_session_t *s,
+        ngx_uint_t tr, ngx_chain_t *in)
+{
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_rtmp_session_t             *rs;
+    ngx_uint_t                      i;
+    static double                   trans, stream;
+
+    static ngx_rtmp_amf_elt_t       in_elts[] = {
+
+        { NGX_RTMP_AMF_NUMBER,
+          ngx_null_string,
+          &trans, 0 },
+
+        { NGX_RTMP_AMF_NULL,
+          ngx_null_string,
+          NULL, 0 },
+
+        { NGX_RTMP_AMF_NUMBER,
+          ngx_null_string,
+          &stream, 0 },
+    };
+
+    mux = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+    if (mux == NULL) {
+        return NGX_OK;
+    }
+
+    stream = 0;
+    if (ngx_rtmp_receive_amf(s, in, in_elts,
+                sizeof(in_elts) / sizeof(in_elts[0])))
+    {
+        return NGX_ERROR;
+    }
+
+    st = ngx_live_relay_rtmp_mux_find_trans(mux, tr);
+
+    /*
+     * stream detached before result, or result repeated, delete the stream
+     * upstream created for nobody unless it is used by another stream
+     */
+    if (st == NULL || st->msid) {
+        if ((uint32_t) stream == 0) {
+            return NGX_OK;
+        }
+
+        for (i = 0; i < mux->max_streams; ++i) {
+            if (mux->streams[i]
+                && mux->streams[i]->msid == (uint32_t) stream)
+            {
+                return NGX_OK;
+            }
+        }
+
+        ngx_log_error(NGX_LOG_INFO, s->log, 0,
+                "relay mux, stale createStream result trans=%ui, "
+                "delete msid=%uD", tr, (uint32_t) stream);
+
+        return ngx_live_relay_rtmp_send_delete_stream(s, (uint32_t) stream);
+    }
+
+    rs = st->session;
+    st->msid = (uint32_t) stream;
+
+    /*
+     * upstream do not support several streams in one connection,
+     * it may return the same stream id for every createStream
+     */
+    for (i = 0; i < mux->max_streams; ++i) {
+        if (i != st->slot && mux->streams[i]
+            && mux->streams[i]->msid == st->msid)
+        {
+            st->msid = 0;
+            break;
+        }
+    }
+
+    if (st->msid == 0) {
+        if (ngx_live_relay_rtmp_mux_refuse(mux) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        rs->finalize_reason = NGX_LIVE_RELAY_TRANSIT;
+        ngx_rtmp_finalize_session(rs);
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, rs->log, 0,
+            "relay mux, stream created in carrier %p, msid=%uD",
+            s, st->msid);
+
+    if (ngx_live_relay_rtmp_send_play(rs) != NGX_OK
+        || ngx_live_relay_publish_local(rs) != NGX_OK)
+    {
+        ngx_rtmp_finalize_session(rs);
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_live_relay_rtmp_on_result(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         ngx_chain_t *in)
@@ -536,7 +998,12 @@ ngx_live_relay_rtmp_on_result(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     switch ((ngx_int_t)v.trans) {
         case NGX_RTMP_RELAY_CONNECT_TRANS:
-            return ngx_live_relay_rtmp_send_create_stream(s);
+            if (s->stream_session) {
+                return ngx_live_relay_rtmp_mux_connected(s);
+            }
+
+            return ngx_live_relay_rtmp_send_create_stream(s,
+                    NGX_RTMP_RELAY_CREATE_STREAM_TRANS);
 
         case NGX_RTMP_RELAY_CREATE_STREAM_TRANS:
             if (s->publishing == 0) {
@@ -553,6 +1020,11 @@ ngx_live_relay_rtmp_on_result(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
             }
 
         default:
+            if (s->stream_session && v.trans >= NGX_RTMP_RELAY_MUX_TRANS) {
+                return ngx_live_relay_rtmp_mux_stream_created(s,
+                        (ngx_uint_t) v.trans, in);
+            }
+
             return NGX_OK;
     }
 }
@@ -563,6 +1035,8 @@ ngx_live_relay_rtmp_on_error(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         ngx_chain_t *in)
 {
     ngx_live_relay_ctx_t           *ctx;
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_rtmp_stream_t   *st;
     static struct {
         double                      trans;
         u_char                      level[32];
@@ -617,6 +1091,28 @@ ngx_live_relay_rtmp_on_error(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
             "relay: _error: level='%s' code='%s' description='%s'",
             v.level, v.code, v.desc);
 
+    /* createStream of multiplexed stream failed, upstream refused */
+    if (s->stream_session) {
+        mux = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+
+        if (v.trans < NGX_RTMP_RELAY_MUX_TRANS) {
+            return NGX_ERROR;
+        }
+
+        st = ngx_live_relay_rtmp_mux_find_trans(mux, (ngx_uint_t) v.trans);
+
+        if (st && st->msid == 0) {
+            if (ngx_live_relay_rtmp_mux_refuse(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            st->session->finalize_reason = NGX_LIVE_RELAY_TRANSIT;
+            ngx_rtmp_finalize_session(st->session);
+        }
+
+        return NGX_OK;
+    }
+
     ngx_live_relay_rtmp_status_error(s, "_error", (char *) v.code,
             (char *) v.level, (char *) v.desc);
 
@@ -728,11 +1224,9 @@ ngx_live_relay_rtmp_free_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
-ngx_int_t
-ngx_live_relay_create_rtmp(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
-        ngx_live_relay_url_t *url)
+static ngx_int_t
+ngx_live_relay_rtmp_connect(ngx_rtmp_session_t *s, ngx_live_relay_url_t *url)
 {
-    ngx_live_relay_ctx_t           *rctx;
     ngx_pool_t                     *pool;
     ngx_peer_connection_t          *pc;
     ngx_connection_t               *c;
@@ -745,31 +1239,11 @@ ngx_live_relay_create_rtmp(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
     struct sockaddr                *sa;
     socklen_t                       len;
 
-    rctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
-    if (rctx == NULL) {
-        return NGX_ERROR;
-    }
-
     pool = ngx_create_pool(4096, ngx_cycle->log);
     if (pool == NULL) {
-        goto destroy;
-    }
-
-#define NGX_LIVE_RELAY_CTX(para)                                        \
-    if (ngx_copy_str(s->pool, &rctx->para, &relay->para) != NGX_OK) {   \
-        goto destroy;                                                   \
+        return NGX_ERROR;
     }
 
-    NGX_LIVE_RELAY_CTX(domain);
-    NGX_LIVE_RELAY_CTX(app);
-    NGX_LIVE_RELAY_CTX(name);
-    NGX_LIVE_RELAY_CTX(pargs);
-    NGX_LIVE_RELAY_CTX(referer);
-    NGX_LIVE_RELAY_CTX(user_agent);
-#undef NGX_LIVE_RELAY_CTX
-
-    rctx->tag = relay->tag;
-
     // connect server
     pc = ngx_pcalloc(s->pool, sizeof(ngx_peer_connection_t));
     if (pc == NULL) {
@@ -822,10 +1296,477 @@ ngx_live_relay_create_rtmp(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
     return NGX_OK;
 
 destroy:
-    if (pool) {
-        ngx_destroy_pool(pool);
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_live_relay_rtmp_mux_t *
+ngx_live_relay_rtmp_mux_create(ngx_rtmp_session_t *s,
+        ngx_live_relay_url_t *url, ngx_str_t *key)
+{
+    ngx_live_relay_rtmp_app_conf_t *racf;
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_ctx_t           *rctx, *crctx;
+    ngx_rtmp_session_t             *cs;
+
+    racf = ngx_rtmp_get_module_app_conf(s, ngx_live_relay_rtmp_module);
+    rctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+
+    cs = ngx_rtmp_create_relay_session(s, &ngx_live_relay_rtmp_module);
+    if (cs == NULL) {
+        return NULL;
+    }
+
+    crctx = ngx_rtmp_get_module_ctx(cs, ngx_live_relay_module);
+
+#define NGX_LIVE_RELAY_CTX(para)                                        \
+    if (ngx_copy_str(cs->pool, &crctx->para, &rctx->para) != NGX_OK) {  \
+        goto destroy;                                                   \
+    }
+
+    NGX_LIVE_RELAY_CTX(domain);
+    NGX_LIVE_RELAY_CTX(app);
+    NGX_LIVE_RELAY_CTX(args);
+    NGX_LIVE_RELAY_CTX(referer);
+    NGX_LIVE_RELAY_CTX(user_agent);
+    NGX_LIVE_RELAY_CTX(swf_url);
+#undef NGX_LIVE_RELAY_CTX
+
+    mux = ngx_pcalloc(cs->pool, sizeof(ngx_live_relay_rtmp_mux_t));
+    if (mux == NULL) {
+        goto destroy;
+    }
+
+    mux->streams = ngx_pcalloc(cs->pool,
+            sizeof(ngx_live_relay_rtmp_stream_t *) * racf->mux_streams);
+    if (mux->streams == NULL) {
+        goto destroy;
+    }
+
+    if (ngx_copy_str(cs->pool, &mux->key, key) != NGX_OK) {
+        goto destroy;
+    }
+
+    mux->session = cs;
+    mux->max_streams = racf->mux_streams;
+    mux->trans = NGX_RTMP_RELAY_MUX_TRANS;
+
+    ngx_rtmp_set_ctx(cs, mux, ngx_live_relay_rtmp_module);
+    cs->stream_session = ngx_live_relay_rtmp_mux_stream_session;
+
+    if (ngx_live_relay_rtmp_connect(cs, url) != NGX_OK) {
+        goto destroy;
+    }
+
+    mux->next = ngx_live_relay_rtmp_muxes;
+    ngx_live_relay_rtmp_muxes = mux;
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+            "relay mux, create carrier %p for %V", cs, key);
+
+    return mux;
+
+destroy:
+    /* carrier not in list, no stream attached */
+    ngx_rtmp_finalize_session(cs);
+
+    return NULL;
+}
+
+
+static void
+ngx_live_relay_rtmp_pool_idle(ngx_event_t *ev)
+{
+    ngx_live_relay_rtmp_mux_t      *mux;
+
+    mux = ev->data;
+
+    ngx_log_error(NGX_LOG_INFO, mux->session->log, 0,
+            "relay pool, close idle connection to %V", &mux->key);
+
+    ++ngx_live_relay_rtmp_stat.pool_idle_close;
+
+    ngx_rtmp_finalize_session(mux->session);
+}
+
+
+/*
+ * keep pool_min idle connections to upstream, but no more than pool_max
+ * connections created by pool, claimed ones included
+ */
+static void
+ngx_live_relay_rtmp_pool_fill(ngx_rtmp_session_t *s,
+        ngx_live_relay_url_t *url, ngx_str_t *key)
+{
+    ngx_live_relay_rtmp_app_conf_t *racf;
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_uint_t                      nidle, ntotal;
+
+    racf = ngx_rtmp_get_module_app_conf(s, ngx_live_relay_rtmp_module);
+
+    nidle = 0;
+    ntotal = 0;
+    for (mux = ngx_live_relay_rtmp_muxes; mux; mux = mux->next) {
+        if (!mux->pool || mux->session->destroyed
+            || mux->key.len != key->len
+            || ngx_memcmp(mux->key.data, key->data, key->len) != 0)
+        {
+            continue;
+        }
+
+        ++ntotal;
+        if (mux->idle) {
+            ++nidle;
+        }
+    }
+
+    while (nidle < racf->pool_min && ntotal < racf->pool_max) {
+        mux = ngx_live_relay_rtmp_mux_create(s, url, key);
+        if (mux == NULL) {
+            return;
+        }
+
+        mux->pool = 1;
+        mux->idle = 1;
+
+        mux->idle_evt.data = mux;
+        mux->idle_evt.log = mux->session->log;
+        mux->idle_evt.handler = ngx_live_relay_rtmp_pool_idle;
+        ngx_rtmp_wheel_add_timer(&mux->idle_evt, racf->pool_idle_timeout);
+
+        ++ngx_live_relay_rtmp_stat.pool_create;
+
+        ++nidle;
+        ++ntotal;
+    }
+}
+
+
+/*
+ * find carrier for stream, carrier which could share with other streams
+ * first, then idle carrier in pool, prefer connected one
+ */
+static ngx_live_relay_rtmp_mux_t *
+ngx_live_relay_rtmp_mux_find(ngx_str_t *key, ngx_flag_t share)
+{
+    ngx_live_relay_rtmp_mux_t      *mux, *idle;
+
+    idle = NULL;
+    for (mux = ngx_live_relay_rtmp_muxes; mux; mux = mux->next) {
+        if (mux->session->destroyed || mux->key.len != key->len
+            || ngx_memcmp(mux->key.data, key->data, key->len) != 0)
+        {
+            continue;
+        }
+
+        if (mux->idle) {
+            if (idle == NULL || (mux->connected && !idle->connected)) {
+                idle = mux;
+            }
+
+            continue;
+        }
+
+        if (share && mux->nstreams < mux->max_streams) {
+            return mux;
+        }
+    }
+
+    return idle;
+}
+
+
+/*
+ * return:
+ *      NGX_OK: s is attached to a carrier
+ *      NGX_DECLINED: s should use dedicated connection
+ *      NGX_ERROR: error
+ */
+static ngx_int_t
+ngx_live_relay_rtmp_mux_attach(ngx_rtmp_session_t *s,
+        ngx_live_relay_url_t *url)
+{
+    ngx_live_relay_rtmp_app_conf_t *racf;
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_live_relay_ctx_t           *rctx;
+    ngx_str_t                       key;
+    ngx_flag_t                      share;
+    ngx_uint_t                      i;
+
+    racf = ngx_rtmp_get_module_app_conf(s, ngx_live_relay_rtmp_module);
+    rctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+
+    key.len = url->url.host_with_port.len + 1 + rctx->domain.len + 1
+            + rctx->app.len + 1 + rctx->args.len;
+    key.data = ngx_pnalloc(s->pool, key.len);
+    if (key.data == NULL) {
+        return NGX_ERROR;
+    }
+    ngx_snprintf(key.data, key.len, "%V/%V/%V?%V", &url->url.host_with_port,
+            &rctx->domain, &rctx->app, &rctx->args);
+
+    share = racf->mux && !ngx_live_relay_rtmp_mux_refused(&key);
+
+    mux = ngx_live_relay_rtmp_mux_find(&key, share);
+
+    /* claim idle connection in pool */
+    if (mux && mux->idle) {
+        mux->idle = 0;
+        mux->max_streams = share ? racf->mux_streams : 1;
+
+        if (mux->idle_evt.timer_set) {
+            ngx_rtmp_wheel_del_timer(&mux->idle_evt);
+        }
+
+        ++ngx_live_relay_rtmp_stat.pool_claim;
+
+        ngx_log_error(NGX_LOG_INFO, s->log, 0,
+                "relay pool, claim %s connection %p to %V",
+                mux->connected ? "connected" : "connecting", mux->session,
+                &key);
+
+    } else if (racf->pool_min) {
+        ++ngx_live_relay_rtmp_stat.pool_miss;
+    }
+
+    if (racf->pool_min) {
+        ngx_live_relay_rtmp_pool_fill(s, url, &key);
     }
 
+    if (mux == NULL) {
+        if (!share) {
+            return NGX_DECLINED;
+        }
+
+        mux = ngx_live_relay_rtmp_mux_create(s, url, &key);
+        if (mux == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    for (i = 0; i < mux->max_streams; ++i) {
+        if (mux->streams[i] == NULL) {
+            break;
+        }
+    }
+
+    st = ngx_pcalloc(s->pool, sizeof(ngx_live_relay_rtmp_stream_t));
+    if (st == NULL) {
+        return NGX_ERROR;
+    }
+
+    st->session = s;
+    st->mux = mux;
+    st->slot = i;
+    st->warm = mux->connected;
+
+    mux->streams[i] = st;
+    ++mux->nstreams;
+
+    ngx_rtmp_set_ctx(s, st, ngx_live_relay_rtmp_module);
+    s->mux = mux->session;
+    s->connection = mux->session->connection;
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+            "relay mux, attach to carrier %p slot %ui, %ui streams",
+            mux->session, i, mux->nstreams);
+
+    s->status = NGX_LIVE_CONNECT;
+    s->connect_time = ngx_current_msec;
+
+    if (!mux->connected) {
+        return NGX_OK;
+    }
+
+    return ngx_live_relay_rtmp_mux_create_stream(mux, st);
+}
+
+
+static ngx_int_t
+ngx_live_relay_rtmp_ttff(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+        ngx_chain_t *in)
+{
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_msec_t                      ttff;
+    ngx_uint_t                      i;
+
+    /* ctx of carrier is not stream */
+    if (!s->relay || !s->publishing || s->stream_session) {
+        return NGX_OK;
+    }
+
+    st = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+    if (st == NULL || st->ttff) {
+        return NGX_OK;
+    }
+
+    st->ttff = 1;
+
+    ttff = ngx_current_msec - s->init_time;
+    for (i = 0; i < NGX_RTMP_RELAY_TTFF_BUCKETS - 1; ++i) {
+        if (ttff < ngx_live_relay_rtmp_ttff_bound[i]) {
+            break;
+        }
+    }
+
+    ++ngx_live_relay_rtmp_stat.ttff[st->warm][i];
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+            "relay rtmp, %s pull first frame in %Mms",
+            st->warm ? "warm" : "cold", ttff);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_live_relay_rtmp_mux_disconnect(ngx_rtmp_session_t *s,
+        ngx_rtmp_header_t *h, ngx_chain_t *in)
+{
+    ngx_live_relay_rtmp_mux_t      *mux, **muxp;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_rtmp_session_t             *ss;
+    ngx_uint_t                      i;
+
+    /* stream in carrier */
+    if (s->mux) {
+        st = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+        mux = st->mux;
+
+        ngx_log_error(NGX_LOG_INFO, s->log, 0,
+                "relay mux, detach from carrier %p slot %ui, msid=%uD "
+                "in_bytes=%uL in_msgs=%ui",
+                s->mux, st->slot, st->msid, st->in_bytes, st->in_msgs);
+
+        mux->streams[st->slot] = NULL;
+        --mux->nstreams;
+
+        s->mux = NULL;
+        s->connection = NULL;
+
+        if (mux->session->destroyed) {
+            return NGX_OK;
+        }
+
+        if (st->msid) {
+            ngx_live_relay_rtmp_send_delete_stream(mux->session, st->msid);
+        }
+
+        if (mux->nstreams == 0) {
+            ngx_rtmp_finalize_session(mux->session);
+        }
+
+        return NGX_OK;
+    }
+
+    if (s->stream_session == NULL) {
+        return NGX_OK;
+    }
+
+    /* carrier, close all streams in it */
+    mux = ngx_rtmp_get_module_ctx(s, ngx_live_relay_rtmp_module);
+
+    if (mux->idle_evt.timer_set) {
+        ngx_rtmp_wheel_del_timer(&mux->idle_evt);
+    }
+
+    for (muxp = &ngx_live_relay_rtmp_muxes; *muxp; muxp = &(*muxp)->next) {
+        if (*muxp == mux) {
+            *muxp = mux->next;
+            break;
+        }
+    }
+
+    for (i = 0; i < mux->max_streams; ++i) {
+        st = mux->streams[i];
+        if (st == NULL) {
+            continue;
+        }
+
+        ss = st->session;
+        ngx_log_error(NGX_LOG_INFO, ss->log, 0,
+                "relay mux, carrier %p closed, msid=%uD "
+                "in_bytes=%uL in_msgs=%ui",
+                s, st->msid, st->in_bytes, st->in_msgs);
+
+        /*
+         * carrier connection is closed before stream's close handlers
+         * run, ngx_rtmp_send_message refuses session without connection
+         */
+        mux->streams[i] = NULL;
+        st->mux = NULL;
+        ss->mux = NULL;
+        ss->connection = NULL;
+
+        ngx_rtmp_finalize_session(ss);
+    }
+
+    mux->nstreams = 0;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_live_relay_create_rtmp(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
+        ngx_live_relay_url_t *url)
+{
+    ngx_live_relay_rtmp_app_conf_t *racf;
+    ngx_live_relay_rtmp_stream_t   *st;
+    ngx_live_relay_ctx_t           *rctx;
+    ngx_int_t                       rc;
+
+    racf = ngx_rtmp_get_module_app_conf(s, ngx_live_relay_rtmp_module);
+    rctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
+    if (rctx == NULL) {
+        return NGX_ERROR;
+    }
+
+#define NGX_LIVE_RELAY_CTX(para)                                        \
+    if (ngx_copy_str(s->pool, &rctx->para, &relay->para) != NGX_OK) {   \
+        goto destroy;                                                   \
+    }
+
+    NGX_LIVE_RELAY_CTX(domain);
+    NGX_LIVE_RELAY_CTX(app);
+    NGX_LIVE_RELAY_CTX(name);
+    NGX_LIVE_RELAY_CTX(pargs);
+    NGX_LIVE_RELAY_CTX(referer);
+    NGX_LIVE_RELAY_CTX(user_agent);
+#undef NGX_LIVE_RELAY_CTX
+
+    rctx->tag = relay->tag;
+
+    /* only pull could be multiplexed or pooled, out queue is per session */
+    if ((racf->mux || racf->pool_min) && s->publishing) {
+        rc = ngx_live_relay_rtmp_mux_attach(s, url);
+        if (rc == NGX_OK) {
+            return NGX_OK;
+        }
+
+        if (rc == NGX_ERROR) {
+            goto destroy;
+        }
+
+        /* cold pull, for time to first frame statistics */
+        st = ngx_pcalloc(s->pool, sizeof(ngx_live_relay_rtmp_stream_t));
+        if (st == NULL) {
+            goto destroy;
+        }
+        st->session = s;
+        ngx_rtmp_set_ctx(s, st, ngx_live_relay_rtmp_module);
+    }
+
+    if (ngx_live_relay_rtmp_connect(s, url) != NGX_OK) {
+        goto destroy;
+    }
+
+    return NGX_OK;
+
+destroy:
     ngx_rtmp_finalize_session(s);
 
     return NGX_ERROR;
@@ -844,6 +1785,15 @@ ngx_live_relay_rtmp_postconfiguration(ngx_conf_t *cf)
     h = ngx_array_push(&cmcf->events[NGX_RTMP_HANDSHAKE_DONE]);
     *h = ngx_live_relay_rtmp_handshake_done;
 
+    h = ngx_array_push(&cmcf->events[NGX_RTMP_DISCONNECT]);
+    *h = ngx_live_relay_rtmp_mux_disconnect;
+
+    h = ngx_array_push(&cmcf->events[NGX_RTMP_MSG_AUDIO]);
+    *h = ngx_live_relay_rtmp_ttff;
+
+    h = ngx_array_push(&cmcf->events[NGX_RTMP_MSG_VIDEO]);
+    *h = ngx_live_relay_rtmp_ttff;
+
     ch = ngx_array_push(&cmcf->amf);
     ngx_str_set(&ch->name, "_result");
     ch->handler = ngx_live_relay_rtmp_on_result;
@@ -858,3 +1808,74 @@ ngx_live_relay_rtmp_postconfiguration(ngx_conf_t *cf)
 
     return NGX_OK;
 }
+
+
+ngx_chain_t *
+ngx_live_relay_rtmp_state(ngx_http_request_t *r)
+{
+    ngx_live_relay_rtmp_stat_t     *st;
+    ngx_live_relay_rtmp_mux_t      *mux;
+    ngx_chain_t                    *cl;
+    ngx_buf_t                      *b;
+    size_t                          len;
+    ngx_uint_t                      ncarrier, nidle, nstreams, i, n;
+    static char                    *type[] = { "cold", "warm" };
+
+    st = &ngx_live_relay_rtmp_stat;
+
+    ncarrier = 0;
+    nidle = 0;
+    nstreams = 0;
+    for (mux = ngx_live_relay_rtmp_muxes; mux; mux = mux->next) {
+        ++ncarrier;
+        nidle += mux->idle;
+        nstreams += mux->nstreams;
+    }
+
+    len = sizeof("##########relay rtmp state##########\n") - 1
+        + sizeof("ngx_live_relay_rtmp carriers:  idle:  streams: \n") - 1
+        + 3 * NGX_OFF_T_LEN
+        + sizeof("ngx_live_relay_rtmp pool create:  claim:  miss:  "
+                 "idle close: \n") - 1 + 4 * NGX_OFF_T_LEN
+        + 2 * NGX_RTMP_RELAY_TTFF_BUCKETS
+        * (sizeof("ngx_live_relay_rtmp warm ttff < ms: \n") - 1
+           + 2 * NGX_OFF_T_LEN);
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+    cl->next = NULL;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NULL;
+    }
+    cl->buf = b;
+
+    b->last = ngx_snprintf(b->last, len,
+            "##########relay rtmp state##########\n"
+            "ngx_live_relay_rtmp carriers: %ui idle: %ui streams: %ui\n"
+            "ngx_live_relay_rtmp pool create: %ui claim: %ui miss: %ui "
+            "idle close: %ui\n",
+            ncarrier, nidle, nstreams, st->pool_create, st->pool_claim,
+            st->pool_miss, st->pool_idle_close);
+
+    for (n = 0; n < 2; ++n) {
+        for (i = 0; i < NGX_RTMP_RELAY_TTFF_BUCKETS; ++i) {
+            if (i == NGX_RTMP_RELAY_TTFF_BUCKETS - 1) {
+                b->last = ngx_snprintf(b->last, b->end - b->last,
+                        "ngx_live_relay_rtmp %s ttff >= %Mms: %ui\n",
+                        type[n], ngx_live_relay_rtmp_ttff_bound[i - 1],
+                        st->ttff[n][i]);
+            } else {
+                b->last = ngx_snprintf(b->last, b->end - b->last,
+                        "ngx_live_relay_rtmp %s ttff < %Mms: %ui\n",
+                        type[n], ngx_live_relay_rtmp_ttff_bound[i],
+                        st->ttff[n][i]);
+            }
+        }
+    }
+
+    return cl;
+}
@@ -151,20 +151,19 @@ ngx_live_relay_simple_handler(ngx_event_t *ev)
 }
 
 
-static ngx_int_t
-ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
+static ngx_rtmp_session_t *
+ngx_live_relay_simple_create(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
         unsigned publishing)
 {
     ngx_rtmp_session_t                 *rs;
-    ngx_live_relay_ctx_t               *ctx, *pctx;
-    ngx_live_relay_app_conf_t          *lracf;
+    ngx_live_relay_ctx_t               *ctx;
     ngx_live_relay_simple_ctx_t        *sctx;
 
     rs = ngx_rtmp_create_relay_session(s, &ngx_live_relay_simple_module);
     if (rs == NULL) {
         ngx_log_error(NGX_LOG_ERR, s->log, 0,
                 "relay simple, create relay session failed");
-        return NGX_DECLINED;
+        return NULL;
     }
     rs->publishing = publishing;
     rs->live_stream = s->live_stream;
@@ -176,7 +175,7 @@ ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
                 "relay simple, create simple relay ctx failed");
         ngx_rtmp_finalize_session(rs);
 
-        return NGX_OK;
+        return NULL;
     }
     ngx_rtmp_set_ctx(rs, sctx, ngx_live_relay_simple_module);
     sctx->relay = relay;
@@ -186,30 +185,93 @@ ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
     ctx->reconnect.data = rs;
     ctx->reconnect.handler = ngx_live_relay_simple_handler;
 
+    return rs;
+}
+
+
+/*
+ * start other candidates with other urls for pull, staggered by race_delay
+ * after the first one, the first one delivers keyframe wins
+ */
+static void
+ngx_live_relay_simple_race(ngx_rtmp_session_t *s, ngx_rtmp_session_t *rs,
+        ngx_live_relay_t *relay, ngx_msec_t delay)
+{
+    ngx_rtmp_session_t                 *cs;
+    ngx_live_relay_ctx_t               *ctx, *cctx;
+    ngx_live_relay_app_conf_t          *lracf;
+    ngx_uint_t                          i, n;
+    ngx_msec_t                          t;
+
+    lracf = ngx_rtmp_get_module_app_conf(rs, ngx_live_relay_module);
+
+    n = ngx_min(lracf->race, relay->urls.nelts);
+    if (n < 2) {
+        return;
+    }
+
+    ctx = ngx_rtmp_get_module_ctx(rs, ngx_live_relay_module);
+    ctx->race = 1;
+
+    for (i = 1; i < n; ++i) {
+        cs = ngx_live_relay_simple_create(s, relay, 1);
+        if (cs == NULL) {
+            return;
+        }
+
+        cctx = ngx_rtmp_get_module_ctx(cs, ngx_live_relay_module);
+        cctx->race = 1;
+        cctx->idx = (ctx->idx + i) % relay->urls.nelts;
+        cctx->failed_reconnect = ctx->failed_reconnect;
+
+        t = delay + i * lracf->race_delay;
+        if (t) {
+            cctx->failed_delay = 1;
+            ngx_add_timer(&cctx->reconnect, t);
+        } else {
+            ngx_post_event(&cctx->reconnect, &ngx_posted_events);
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
+        unsigned publishing)
+{
+    ngx_rtmp_session_t                 *rs;
+    ngx_live_relay_ctx_t               *ctx, *pctx;
+    ngx_live_relay_app_conf_t          *lracf;
+    ngx_msec_t                          delay;
+
+    rs = ngx_live_relay_simple_create(s, relay, publishing);
+    if (rs == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_rtmp_get_module_ctx(rs, ngx_live_relay_module);
+    delay = 0;
+
     if (s->publishing != rs->publishing) {
-        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
-        return NGX_OK;
+        goto start;
     }
 
     // normal publisher close, need to trigger pull
     if (s->publishing && !s->relay) {
-        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
-        return NGX_OK;
+        goto start;
     }
 
     // reconnect
     pctx = ngx_rtmp_get_module_ctx(s, ngx_live_relay_module);
     if (pctx->successd) { // prev relay successd
-        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
-        return NGX_OK;
+        goto start;
     }
 
     ctx->idx = pctx->idx;
     ctx->failed_reconnect = pctx->failed_reconnect;
 
     if (ctx->idx < relay->urls.nelts) { // retry backup url immediately
-        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
-        return NGX_OK;
+        goto start;
     }
 
     lracf = ngx_rtmp_get_module_app_conf(rs, ngx_live_relay_module);
@@ -217,8 +279,7 @@ ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
     if (!pctx->reconnect.timer_set) { // prev relay timeout
         ctx->failed_reconnect = ngx_min(pctx->failed_reconnect * 2,
                 lracf->relay_reconnect);
-        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
-        return NGX_OK;
+        goto start;
     }
 
     if (pctx->failed_reconnect) {
@@ -229,7 +290,18 @@ ngx_live_relay_simple_relay(ngx_rtmp_session_t *s, ngx_live_relay_t *relay,
     }
 
     ctx->failed_delay = 1;
-    ngx_add_timer(&ctx->reconnect, ctx->failed_reconnect);
+    delay = ctx->failed_reconnect;
+
+start:
+    if (delay) {
+        ngx_add_timer(&ctx->reconnect, delay);
+    } else {
+        ngx_post_event(&ctx->reconnect, &ngx_posted_events);
+    }
+
+    if (publishing) {
+        ngx_live_relay_simple_race(s, rs, relay, delay);
+    }
 
     return NGX_OK;
 }
@@ -325,6 +397,7 @@ ngx_live_relay_push_pull(ngx_conf_t *cf, ngx_live_relay_t *relay)
     ngx_str_t                          *value, n, v;
     ngx_uint_t                          i;
     u_char                             *p;
+    char                               *rv;
 
     relay->tag = &ngx_live_relay_simple_module;
 
@@ -346,6 +419,7 @@ ngx_live_relay_push_pull(ngx_conf_t *cf, ngx_live_relay_t *relay)
                 return NGX_CONF_ERROR;
             }
             ngx_memzero(url, sizeof(ngx_live_relay_url_t));
+            url->weight = 1;
 
             if (value->data[0] == 'h') {
                 url->relay_type = NGX_LIVE_RELAY_HTTPFLV;
@@ -379,6 +453,18 @@ ngx_live_relay_push_pull(ngx_conf_t *cf, ngx_live_relay_t *relay)
             v.len = value->data + value->len - v.data;
         }
 
+        // weight of url before
+        if (n.len == sizeof("weight") - 1
+            && ngx_strncasecmp(n.data, (u_char *) "weight", n.len) == 0)
+        {
+            rv = ngx_live_relay_url_weight(relay, &v);
+            if (rv != NGX_CONF_OK) {
+                return rv;
+            }
+
+            continue;
+        }
+
 #define NGX_LIVE_RELAY_STR_PAR(name, var)                               \
         if (n.len == sizeof(name) - 1                                   \
             && ngx_strncasecmp(n.data, (u_char *) name, n.len) == 0)    \
@@ -501,6 +501,7 @@ ngx_live_relay_pull(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                          *value, n, v;
     ngx_uint_t                          i;
     u_char                             *p;
+    char                               *rv;
 
     rsmdcf = conf;
 
@@ -530,6 +531,7 @@ ngx_live_relay_pull(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
             ngx_memzero(url, sizeof(ngx_live_relay_url_t));
+            url->weight = 1;
 
             if (value->data[0] == 'h') {
                 url->relay_type = NGX_LIVE_RELAY_HTTPFLV;
@@ -563,6 +565,18 @@ ngx_live_relay_pull(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             v.len = value->data + value->len - v.data;
         }
 
+        // weight of url before
+        if (n.len == sizeof("weight") - 1
+            && ngx_strncasecmp(n.data, (u_char *) "weight", n.len) == 0)
+        {
+            rv = ngx_live_relay_url_weight(relay, &v);
+            if (rv != NGX_CONF_OK) {
+                return rv;
+            }
+
+            continue;
+        }
+
 #define NGX_LIVE_RELAY_STR_PAR(name, var)                               \
         if (n.len == sizeof(name) - 1                                   \
             && ngx_strncasecmp(n.data, (u_char *) name, n.len) == 0)    \
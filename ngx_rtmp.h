@@ -17,6 +17,8 @@
 
 #include "ngx_rtmp_amf.h"
 #include "ngx_rtmp_bandwidth.h"
+#include "ngx_rtmp_histogram.h"
+#include "ngx_rtmp_wheel.h"
 #include "ngx_http_client.h"
 #include "ngx_netcall.h"
 #include "ngx_map.h"
@@ -105,7 +107,8 @@ typedef struct {
 #define NGX_MPEGTS_MSG_PATPMT           NGX_RTMP_MSG_MAX + 6
 #define NGX_MPEGTS_MSG_M3U8             NGX_RTMP_MSG_MAX + 7
 #define NGX_MPEGTS_MSG_CLOSE            NGX_RTMP_MSG_MAX + 8
-#define NGX_RTMP_MAX_EVENT              NGX_RTMP_MSG_MAX + 9
+#define NGX_MPEGTS_MSG_ID3              NGX_RTMP_MSG_MAX + 9
+#define NGX_RTMP_MAX_EVENT              NGX_RTMP_MSG_MAX + 10
 
 
 /* RMTP control message types */
@@ -188,6 +191,16 @@ struct ngx_rtmp_frame_s {
     ngx_flag_t              keyframe;
     ngx_flag_t              mandatory;
     ngx_uint_t              ref;
+    ngx_msec_t              time;       /* msec when frame received */
+
+    /* run of consecutive frames of publisher which may be packed into
+     * aggregate message, 0 for not packable, agg_seq is index in run */
+    ngx_uint_t              agg_id;
+    ngx_uint_t              agg_seq;
+    /* aggregate message of naggregate frames from this one,
+     * shared by players whose queue hold the same frames */
+    ngx_rtmp_frame_t       *aggregate;
+    ngx_uint_t              naggregate;
 
     ngx_rtmp_frame_t       *next;
     ngx_chain_t            *chain;
@@ -203,6 +216,7 @@ struct ngx_mpegts_frame_s {
     ngx_uint_t                  cc;
     unsigned                    key:1;
     ngx_uint_t                  ref;
+    ngx_msec_t                  time;   /* msec when frame muxed */
 
     ngx_uint_t                  type;
     ngx_uint_t                  length;
@@ -227,8 +241,11 @@ struct ngx_mpegts_frame_s {
 typedef struct ngx_rtmp_session_s  ngx_rtmp_session_t;
 
 #define NGX_RTMP_MAX_MERGE_FRAME    64
+#define NGX_RTMP_MAX_AGGREGATE      64
 
 typedef ngx_chain_t * (* ngx_rtmp_prepared_pt)(ngx_rtmp_session_t *s);
+typedef ngx_rtmp_session_t * (* ngx_rtmp_stream_session_pt)(
+        ngx_rtmp_session_t *s, ngx_rtmp_header_t *h);
 
 typedef struct ngx_live_stream_s    ngx_live_stream_t;
 typedef struct ngx_live_server_s    ngx_live_server_t;
@@ -260,6 +277,34 @@ typedef struct ngx_rtmp_addr_conf_s ngx_rtmp_addr_conf_t;
 #define NGX_LIVE_OCLP_PARA_ERR      14
 #define NGX_LIVE_RELAY_CLOSE        15
 
+/* TCP_INFO sample of session's socket, rtt in usec, rate in bytes/s */
+typedef struct {
+    ngx_msec_t              time;           /* last sample, 0 for never */
+    uint32_t                rtt;
+    uint32_t                rttvar;
+    uint32_t                retrans;
+    uint32_t                cwnd;
+    uint32_t                unacked;
+    uint32_t                delivery_rate;
+
+    ngx_msec_t              rate_time;
+    off_t                   rate_sent;
+} ngx_rtmp_tcpinfo_t;
+
+/*
+ * session is one struct for all roles, not split into core and per role
+ * extensions, memory depends on role only through:
+ *      out or mpegts_out: allocated when first frame linked, so only
+ *          players pay for ring of their own type
+ *      merge, prepare_frame, prepare_mpegts_frame: allocated on first
+ *          send, sized by merge_frame
+ *      ctx[]: state of publisher, player, relay and fake session modules,
+ *          allocated by each module for the roles it serves
+ * handshake, flv parse, coalesce and trace fields stay here for every
+ * role, they are used in hot paths of handler and parsers by field name.
+ * ngx_rtmp_session_size counts session, ctx[] pointers, in_streams, rings
+ * and merge arrays but not module ctx, sys_stat reports it per role.
+ */
 struct ngx_rtmp_session_s {
     ngx_atomic_uint_t       number;
     struct sockaddr        *sockaddr;
@@ -351,6 +396,15 @@ struct ngx_rtmp_session_s {
     unsigned                ping_active:1;
     unsigned                ping_reset:1;
 
+    /*
+     * multiplexed relay, several streams share one connection
+     *      mux: session owns the connection, set in stream session
+     *      stream_session: find stream session for message with msid,
+     *          set in session owns the connection
+     */
+    ngx_rtmp_session_t     *mux;
+    ngx_rtmp_stream_session_pt  stream_session;
+
     /* auto-pushed? */
     unsigned                interprocess:1;
     unsigned                static_pull:1;
@@ -388,10 +442,11 @@ struct ngx_rtmp_session_s {
 
     ngx_connection_t       *connection;
 
-    /* merge frame and send */
-    ngx_mpegts_frame_t     *prepare_mpegts_frame[NGX_RTMP_MAX_MERGE_FRAME];
-    ngx_rtmp_frame_t       *prepare_frame[NGX_RTMP_MAX_MERGE_FRAME];
-    ngx_chain_t            *merge[NGX_RTMP_MAX_MERGE_FRAME];
+    /* merge frame and send, allocated on first send, sized by merge_frame */
+    ngx_mpegts_frame_t    **prepare_mpegts_frame;
+    ngx_rtmp_frame_t      **prepare_frame;
+    ngx_chain_t           **merge;
+    ngx_uint_t              merge_size;
     ngx_uint_t              nframe;
     ngx_rtmp_prepared_pt    prepare_handler;
 
@@ -409,17 +464,31 @@ struct ngx_rtmp_session_s {
     ngx_msec_t              first_audio;
     ngx_msec_t              first_video;
     ngx_msec_t              close_stream_time;
+    ngx_rtmp_tcpinfo_t      tcpinfo;
 
-    /* circular buffer of RTMP message pointers */
+    /* circular buffer of RTMP message pointers,
+     * out for RTMP and HTTP-FLV, mpegts_out for MPEG-TS,
+     * allocated when first frame linked, out_size is power of 2,
+     * grow when full and shrink when idle, out_queue is the cap */
     ngx_msec_t              timeout;
     uint32_t                out_bytes;
     size_t                  out_pos, out_last;
+    size_t                  out_size;
+    size_t                  out_peak;
+    ngx_msec_t              out_resize_time;
     ngx_chain_t            *out_chain;
     unsigned                out_buffer:1;
     size_t                  out_queue;
     size_t                  out_cork;
+
+    /* send coalescing, write event is delayed until coalesce_time passed
+     * or coalesce_size bytes queued, keyframe and header send immediately */
+    ngx_event_t             coalesce_evt;
+    size_t                  coalesce_bytes;
+    unsigned                coalesce_flush:1;
+
     ngx_mpegts_frame_t    **mpegts_out;
-    ngx_rtmp_frame_t       *out[0];
+    ngx_rtmp_frame_t      **out;
 };
 
 /* live stream manage */
@@ -465,6 +534,9 @@ struct ngx_live_stream_s {
     ngx_rtmp_bandwidth_t        bw_in_audio;
     ngx_rtmp_bandwidth_t        bw_in_video;
     ngx_rtmp_bandwidth_t        bw_out;
+    /* msec from frame received to queued for and sent to subscribers */
+    ngx_rtmp_histogram_t        queue_delay;
+    ngx_rtmp_histogram_t        send_delay;
     ngx_msec_t                  epoch;
     unsigned                    active:1;
     unsigned                    publishing:1;
@@ -552,6 +624,8 @@ typedef struct {
     ngx_array_t             applications; /* ngx_rtmp_core_app_conf_t */
     ngx_str_t               name;
     ngx_uint_t              merge_frame;
+    ngx_msec_t              coalesce_time;
+    size_t                  coalesce_size;
     ngx_flag_t              tcp_nodelay;
     void                  **app_conf;
     ngx_uint_t              hevc_codec;
@@ -849,12 +923,27 @@ ngx_int_t ngx_rtmp_amf_shared_object_handler(ngx_rtmp_session_t *s,
 
 ngx_int_t ngx_rtmp_prepare_merge_frame(ngx_rtmp_session_t *s);
 void ngx_rtmp_free_merge_frame(ngx_rtmp_session_t *s);
+ngx_int_t ngx_rtmp_alloc_out_queue(ngx_rtmp_session_t *s);
+void ngx_rtmp_free_out_queue(ngx_rtmp_session_t *s);
+void ngx_rtmp_coalesce_frame(ngx_rtmp_session_t *s, size_t size,
+        ngx_flag_t flush);
+ngx_flag_t ngx_rtmp_coalesce_delay(ngx_rtmp_session_t *s);
+size_t ngx_rtmp_out_queue_max(ngx_rtmp_session_t *s);
+
+#define ngx_rtmp_out_next(s, pos)   (((pos) + 1) & ((s)->out_size - 1))
+#define ngx_rtmp_out_nmsg(s)                                                \
+    ((s)->out_size ? ((s)->out_last - (s)->out_pos) & ((s)->out_size - 1) : 0)
+
+size_t ngx_rtmp_session_size(ngx_rtmp_session_t *s);
 
 void ngx_rtmp_shared_append_chain(ngx_rtmp_frame_t *frame, size_t size,
         ngx_chain_t *cl, ngx_flag_t mandatory);
 ngx_rtmp_frame_t *ngx_rtmp_shared_alloc_frame(size_t size, ngx_chain_t *cl,
         ngx_flag_t mandatory);
 void ngx_rtmp_shared_free_frame(ngx_rtmp_frame_t *frame);
+/* pack n frames as flv tags into aggregate message of chunk size bufs */
+ngx_rtmp_frame_t *ngx_rtmp_shared_alloc_aggregate(size_t size,
+        ngx_rtmp_frame_t **frames, ngx_uint_t n);
 
 #define ngx_rtmp_shared_acquire_frame(frame) ++frame->ref;
 
@@ -875,6 +964,19 @@ ngx_int_t ngx_rtmp_send_message(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *out,
 /* GOP */
 ngx_int_t ngx_rtmp_gop_cache(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame);
 ngx_int_t ngx_rtmp_gop_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss);
+/*
+ * player s is moved to another publisher, gop send restarts from publisher's
+ * keyframe not earlier than timestamp, NGX_DECLINED for time-shifted player
+ */
+ngx_int_t ngx_rtmp_gop_switch(ngx_rtmp_session_t *s, uint32_t timestamp);
+/*
+ * latest video keyframe cached for publisher s and codec header before it,
+ * timestamp is keyframe timestamp when cached, frames are valid until
+ * return to event loop, NGX_DECLINED for no keyframe
+ */
+ngx_int_t ngx_rtmp_gop_snapshot(ngx_rtmp_session_t *s,
+        ngx_rtmp_frame_t **header, ngx_rtmp_frame_t **keyframe,
+        uint32_t *timestamp);
 
 /* RTMP Relation server */
 ngx_rtmp_addr_conf_t *ngx_rtmp_find_related_addr_conf(ngx_cycle_t *cycle,
@@ -998,8 +1100,23 @@ ngx_rtmp_is_codec_header(ngx_chain_t *in)
 }
 
 
+/*
+ * codec headers are resent long after received, not for latency,
+ * aggregate message never packs codec headers
+ */
+static ngx_inline ngx_int_t
+ngx_rtmp_is_latency_frame(ngx_rtmp_frame_t *frame)
+{
+    return ((frame->hdr.type == NGX_RTMP_MSG_AUDIO
+             || frame->hdr.type == NGX_RTMP_MSG_VIDEO)
+            && frame->chain && !ngx_rtmp_is_codec_header(frame->chain))
+        || frame->hdr.type == NGX_RTMP_MSG_AGGREGATE;
+}
+
+
 extern ngx_rtmp_bandwidth_t                 ngx_rtmp_bw_out;
 extern ngx_rtmp_bandwidth_t                 ngx_rtmp_bw_in;
+extern ngx_rtmp_bandwidth_t                 ngx_rtmp_send_calls;
 
 
 extern ngx_uint_t                           ngx_rtmp_naccepted;
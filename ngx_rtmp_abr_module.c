@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp_abr_module.h"
+#include "ngx_rtmp_live_module.h"
+#include "ngx_live.h"
+
+
+static ngx_rtmp_play_pt                 next_play;
+static ngx_rtmp_close_stream_pt         next_close_stream;
+
+
+static ngx_int_t ngx_rtmp_abr_postconfiguration(ngx_conf_t *cf);
+static void *ngx_rtmp_abr_create_app_conf(ngx_conf_t *cf);
+static char *ngx_rtmp_abr_merge_app_conf(ngx_conf_t *cf, void *parent,
+       void *child);
+static char *ngx_rtmp_abr_renditions(ngx_conf_t *cf, ngx_command_t *cmd,
+       void *conf);
+
+
+/* out queue depth at keyframe for congestion and for switching up */
+#define NGX_RTMP_ABR_QUEUE_HIGH(s)      ((s)->out_queue / 4)
+#define NGX_RTMP_ABR_QUEUE_LOW(s)       ((s)->out_queue / 16)
+
+/* max backoff of interval after failed switching up */
+#define NGX_RTMP_ABR_BACKOFF            8
+
+
+static ngx_command_t  ngx_rtmp_abr_commands[] = {
+
+    { ngx_string("abr_renditions"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_2MORE,
+      ngx_rtmp_abr_renditions,
+      NGX_RTMP_APP_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("abr_interval"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_abr_app_conf_t, interval),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_rtmp_module_t  ngx_rtmp_abr_module_ctx = {
+    NULL,                                   /* preconfiguration */
+    ngx_rtmp_abr_postconfiguration,         /* postconfiguration */
+    NULL,                                   /* create main configuration */
+    NULL,                                   /* init main configuration */
+    NULL,                                   /* create server configuration */
+    NULL,                                   /* merge server configuration */
+    ngx_rtmp_abr_create_app_conf,           /* create app configuration */
+    ngx_rtmp_abr_merge_app_conf             /* merge app configuration */
+};
+
+
+ngx_module_t  ngx_rtmp_abr_module = {
+    NGX_MODULE_V1,
+    &ngx_rtmp_abr_module_ctx,               /* module context */
+    ngx_rtmp_abr_commands,                  /* module directives */
+    NGX_RTMP_MODULE,                        /* module type */
+    NULL,                                   /* init master */
+    NULL,                                   /* init module */
+    NULL,                                   /* init process */
+    NULL,                                   /* init thread */
+    NULL,                                   /* exit thread */
+    NULL,                                   /* exit process */
+    NULL,                                   /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void *
+ngx_rtmp_abr_create_app_conf(ngx_conf_t *cf)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+
+    aacf = ngx_pcalloc(cf->pool, sizeof(ngx_rtmp_abr_app_conf_t));
+    if (aacf == NULL) {
+        return NULL;
+    }
+
+    aacf->renditions = NGX_CONF_UNSET_PTR;
+    aacf->interval = NGX_CONF_UNSET_MSEC;
+
+    return aacf;
+}
+
+static char *
+ngx_rtmp_abr_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_rtmp_abr_app_conf_t        *prev = parent;
+    ngx_rtmp_abr_app_conf_t        *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->renditions, prev->renditions, NULL);
+    ngx_conf_merge_msec_value(conf->interval, prev->interval, 10000);
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_rtmp_abr_renditions(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf = conf;
+    ngx_str_t                      *value, *r;
+    ngx_uint_t                      i;
+
+    if (aacf->renditions != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    aacf->renditions = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                        sizeof(ngx_str_t));
+    if (aacf->renditions == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; ++i) {
+        r = ngx_array_push(aacf->renditions);
+        if (r == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *r = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+/* live stream of rendition n in group, NULL if not publishing */
+static ngx_live_stream_t *
+ngx_rtmp_abr_rendition(ngx_rtmp_session_t *s, ngx_str_t *group, ngx_uint_t n)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_live_stream_t              *st;
+    ngx_str_t                      *r, stream;
+    u_char                          name[NGX_LIVE_STREAM_LEN];
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+
+    r = aacf->renditions->elts;
+
+    if (group->len + r[n].len > NGX_LIVE_STREAM_LEN) {
+        return NULL;
+    }
+
+    stream.data = name;
+    stream.len = ngx_cpymem(ngx_cpymem(name, group->data, group->len),
+                            r[n].data, r[n].len) - name;
+
+    st = ngx_live_fetch_stream(&s->serverid, &stream);
+    if (st == NULL || ngx_map_rbegin(&st->pubctx) == NULL) {
+        return NULL;
+    }
+
+    return st;
+}
+
+static ngx_int_t
+ngx_rtmp_abr_switch(ngx_rtmp_session_t *s, ngx_rtmp_abr_ctx_t *ctx,
+        ngx_uint_t n, uint32_t timestamp)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_live_stream_t              *st;
+    ngx_str_t                      *r;
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+
+    st = ngx_rtmp_abr_rendition(s, &ctx->group, n);
+    if (st == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_rtmp_gop_switch(s, timestamp) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_rtmp_live_switch(s, st) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r = aacf->renditions->elts;
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+            "abr: switch from '%V' to '%V', rate %uL nmsg %ui",
+            &ctx->rendition, &r[n], ctx->rate, ctx->nmsg);
+
+    if (n < ctx->current) {
+        ++ctx->nup;
+    } else {
+        ++ctx->ndown;
+    }
+
+    ctx->up = n < ctx->current;
+    ctx->current = n;
+    ctx->rendition = r[n];
+    ctx->switch_time = ngx_current_msec;
+    ctx->stable = ngx_current_msec;
+
+    return NGX_OK;
+}
+
+/*
+ * sample send rate and out queue of player at keyframe, switch down to
+ * rendition fit in send rate when queue grows or frames dropped, switch up
+ * one rendition when queue keeps drained for interval
+ */
+static ngx_uint_t
+ngx_rtmp_abr_select(ngx_rtmp_session_t *s, ngx_rtmp_abr_ctx_t *ctx,
+        ngx_rtmp_live_ctx_t *lctx)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_live_stream_t              *st;
+    ngx_msec_t                      now, elapsed;
+    ngx_uint_t                      nmsg, n, target;
+    unsigned                        congested;
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+
+    now = ngx_current_msec;
+    elapsed = now - ctx->time;
+    if (elapsed == 0) {
+        return ctx->current;
+    }
+
+    nmsg = ngx_rtmp_out_nmsg(s);
+
+    ctx->rate = (s->connection->sent - ctx->sent) * 1000 / elapsed;
+
+    congested = lctx->ndropped != ctx->ndropped
+                || (nmsg > NGX_RTMP_ABR_QUEUE_HIGH(s) && nmsg > ctx->nmsg);
+
+    ctx->time = now;
+    ctx->sent = s->connection->sent;
+    ctx->nmsg = nmsg;
+    ctx->ndropped = lctx->ndropped;
+
+    target = ctx->current;
+
+    if (congested) {
+        ++ctx->nstall;
+        ctx->stable = now;
+
+        /*
+         * congested soon after switching up, it failed, probe later,
+         * switching down does not back off
+         */
+        if (ctx->up) {
+            if (now - ctx->switch_time >= ctx->interval) {
+                ctx->interval = aacf->interval;
+
+            } else if (ctx->interval < aacf->interval * NGX_RTMP_ABR_BACKOFF) {
+                ctx->interval *= 2;
+            }
+
+            ctx->up = 0;
+        }
+
+        /* highest lower rendition under 80% of send rate, or the lowest */
+        for (n = ctx->current + 1; n < aacf->renditions->nelts; ++n) {
+            st = ngx_rtmp_abr_rendition(s, &ctx->group, n);
+            if (st == NULL) {
+                continue;
+            }
+
+            target = n;
+
+            if (st->bw_in.bandwidth * 5 / 4 <= ctx->rate) {
+                break;
+            }
+        }
+
+        return target;
+    }
+
+    /* switching up held for interval, probe at base interval again */
+    if (ctx->up && now - ctx->stable >= ctx->interval) {
+        ctx->up = 0;
+        ctx->interval = aacf->interval;
+    }
+
+    if (ctx->current == 0 || nmsg > NGX_RTMP_ABR_QUEUE_LOW(s)
+        || now - ctx->stable < ctx->interval)
+    {
+        return target;
+    }
+
+    for (n = ctx->current; n > 0; --n) {
+        if (ngx_rtmp_abr_rendition(s, &ctx->group, n - 1)) {
+            return n - 1;
+        }
+    }
+
+    return target;
+}
+
+void
+ngx_rtmp_abr_keyframe(ngx_rtmp_session_t *s, uint32_t timestamp)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_rtmp_abr_ctx_t             *ctx;
+    ngx_rtmp_live_ctx_t            *lctx, *pctx, *next;
+    ngx_rtmp_session_t             *ss;
+    ngx_uint_t                      n;
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+    if (aacf == NULL || aacf->renditions == NULL) {
+        return;
+    }
+
+    lctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_live_module);
+    if (lctx == NULL || lctx->stream == NULL
+        || ngx_map_rbegin(&lctx->stream->pubctx) != &lctx->node)
+    {
+        return;
+    }
+
+    /* player switched is moved out of list */
+    for (pctx = lctx->stream->ctx; pctx; pctx = next) {
+        next = pctx->next;
+
+        if (pctx->publishing || pctx->paused) {
+            continue;
+        }
+
+        ss = pctx->session;
+
+        ctx = ngx_rtmp_get_module_ctx(ss, ngx_rtmp_abr_module);
+        if (ctx == NULL) {
+            continue;
+        }
+
+        n = ngx_rtmp_abr_select(ss, ctx, pctx);
+        if (n == ctx->current) {
+            continue;
+        }
+
+        if (ngx_rtmp_abr_switch(ss, ctx, n, timestamp) == NGX_ERROR) {
+            ngx_rtmp_finalize_session(ss);
+        }
+    }
+}
+
+static ngx_int_t
+ngx_rtmp_abr_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_rtmp_abr_ctx_t             *ctx;
+    ngx_live_stream_t              *st;
+    ngx_str_t                      *r;
+    ngx_uint_t                      n;
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+    if (aacf == NULL || aacf->renditions == NULL || s->relay
+        || s->live_type == NGX_HLS_LIVE || s->live_type == NGX_MPEGTS_LIVE)
+    {
+        goto next;
+    }
+
+    /* stream played is published, not a group */
+    if (s->live_stream == NULL || s->live_stream->publish_ctx) {
+        goto next;
+    }
+
+    /* start from the lowest rendition, switch up when player keeps up */
+    st = NULL;
+    for (n = aacf->renditions->nelts; n > 0; --n) {
+        st = ngx_rtmp_abr_rendition(s, &s->stream, n - 1);
+        if (st) {
+            break;
+        }
+    }
+
+    if (st == NULL) {
+        goto next;
+    }
+
+    --n;
+
+    ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_abr_ctx_t));
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_rtmp_live_switch(s, st) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r = aacf->renditions->elts;
+
+    ctx->session = s;
+    ctx->group = s->stream;
+    ctx->current = n;
+    ctx->rendition = r[n];
+    ctx->interval = aacf->interval;
+    ctx->stable = ngx_current_msec;
+    ctx->time = ngx_current_msec;
+    ctx->sent = s->connection->sent;
+
+    ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_abr_module);
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+            "abr: play group '%V' from '%V'", &s->name, &r[n]);
+
+next:
+    return next_play(s, v);
+}
+
+/*
+ * move players of rendition to nearest rendition publishing, lower first,
+ * players are closed if no rendition left
+ */
+static ngx_int_t
+ngx_rtmp_abr_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
+{
+    ngx_rtmp_abr_app_conf_t        *aacf;
+    ngx_rtmp_abr_ctx_t             *ctx;
+    ngx_rtmp_live_ctx_t            *lctx, *pctx, *next;
+    ngx_rtmp_session_t             *ss;
+    ngx_uint_t                      n, nrenditions;
+    ngx_int_t                       rc;
+
+    aacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_abr_module);
+    if (aacf == NULL || aacf->renditions == NULL || !s->publishing) {
+        goto next;
+    }
+
+    lctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_live_module);
+    if (lctx == NULL || lctx->stream == NULL || !lctx->publishing) {
+        goto next;
+    }
+
+    /* other publisher of rendition left */
+    for (pctx = lctx->stream->ctx; pctx; pctx = pctx->next) {
+        if (pctx->publishing && pctx != lctx) {
+            goto next;
+        }
+    }
+
+    nrenditions = aacf->renditions->nelts;
+
+    for (pctx = lctx->stream->ctx; pctx; pctx = next) {
+        next = pctx->next;
+
+        if (pctx->publishing) {
+            continue;
+        }
+
+        ss = pctx->session;
+
+        ctx = ngx_rtmp_get_module_ctx(ss, ngx_rtmp_abr_module);
+        if (ctx == NULL) {
+            continue;
+        }
+
+        rc = NGX_DECLINED;
+
+        for (n = ctx->current + 1; n < nrenditions && rc == NGX_DECLINED; ++n)
+        {
+            rc = ngx_rtmp_abr_switch(ss, ctx, n, s->current_time);
+        }
+
+        for (n = ctx->current; n > 0 && rc == NGX_DECLINED; --n) {
+            rc = ngx_rtmp_abr_switch(ss, ctx, n - 1, s->current_time);
+        }
+
+        if (rc == NGX_OK) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, ss->log, 0,
+                "abr: no rendition left in group '%V'", &ss->name);
+
+        ngx_rtmp_live_switch(ss, NULL);
+        ngx_rtmp_finalize_session(ss);
+    }
+
+next:
+    return next_close_stream(s, v);
+}
+
+static ngx_int_t
+ngx_rtmp_abr_postconfiguration(ngx_conf_t *cf)
+{
+    next_play = ngx_rtmp_play;
+    ngx_rtmp_play = ngx_rtmp_abr_play;
+
+    next_close_stream = ngx_rtmp_close_stream;
+    ngx_rtmp_close_stream = ngx_rtmp_abr_close_stream;
+
+    return NGX_OK;
+}
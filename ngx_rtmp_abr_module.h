@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_ABR_MODULE_H_INCLUDED_
+#define _NGX_RTMP_ABR_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp.h"
+
+
+typedef struct {
+    ngx_array_t                *renditions;     /* ngx_str_t, highest first */
+    ngx_msec_t                  interval;
+} ngx_rtmp_abr_app_conf_t;
+
+
+/* player of rendition group, renditions are group name with suffix */
+typedef struct {
+    ngx_rtmp_session_t         *session;
+    ngx_str_t                   group;
+
+    /* index and suffix of rendition playing */
+    ngx_uint_t                  current;
+    ngx_str_t                   rendition;
+
+    /* switch up after no congestion for interval since stable */
+    ngx_msec_t                  interval;
+    ngx_msec_t                  stable;
+    ngx_msec_t                  switch_time;
+    unsigned                    up:1;       /* last switch is up */
+
+    /* sampled at last keyframe of rendition */
+    ngx_msec_t                  time;
+    off_t                       sent;
+    ngx_uint_t                  nmsg;
+    ngx_uint_t                  ndropped;
+
+    /* bytes/s sent to player between last two keyframes */
+    uint64_t                    rate;
+
+    ngx_uint_t                  nstall;
+    ngx_uint_t                  nup;
+    ngx_uint_t                  ndown;
+} ngx_rtmp_abr_ctx_t;
+
+
+extern ngx_module_t  ngx_rtmp_abr_module;
+
+
+/*
+ * paras:
+ *      s: publisher session receiving video keyframe
+ *      timestamp: timestamp of keyframe
+ */
+void ngx_rtmp_abr_keyframe(ngx_rtmp_session_t *s, uint32_t timestamp);
+
+
+#endif
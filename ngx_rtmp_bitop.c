@@ -61,3 +61,55 @@ ngx_rtmp_bit_read_golomb(ngx_rtmp_bit_reader_t *br)
 
     return ((uint64_t) 1 << n) + ngx_rtmp_bit_read(br, n) - 1;
 }
+
+
+/*
+ * Remove emulation_prevention_three_byte, ITU-T H.264 7.4.1, H.265 7.4.2.
+ * Zero bytes are located with memchr which is vectorized in libc, bytes
+ * between 0x000003 sequences are copied in bulk.
+ */
+ngx_int_t
+ngx_rtmp_bit_nal_to_rbsp(u_char *dst, u_char *src, size_t len)
+{
+    u_char     *p, *z, *run, *last, *d;
+
+    d = dst;
+    p = src;
+    run = src;
+    last = src + len;
+
+    while (last - p >= 3) {
+        z = (u_char *) memchr(p, 0x00, last - p - 2);
+        if (z == NULL) {
+            break;
+        }
+
+        if (z[1] != 0x00) {
+            p = z + 2;
+            continue;
+        }
+
+        /* 0x000000, 0x000001 and 0x000002 shall not occur */
+        if (z[2] < 0x03) {
+            return NGX_ERROR;
+        }
+
+        if (z[2] > 0x03) {
+            p = z + 3;
+            continue;
+        }
+
+        /* only 0x00000300 - 0x00000303 could start with 0x000003 */
+        if (z + 3 < last && z[3] > 0x03) {
+            return NGX_ERROR;
+        }
+
+        d = ngx_cpymem(d, run, z + 2 - run);
+        run = z + 3;
+        p = run;
+    }
+
+    d = ngx_cpymem(d, run, last - run);
+
+    return d - dst;
+}
@@ -25,6 +25,17 @@ void ngx_rtmp_bit_init_reader(ngx_rtmp_bit_reader_t *br, u_char *pos,
 uint64_t ngx_rtmp_bit_read(ngx_rtmp_bit_reader_t *br, ngx_uint_t n);
 uint64_t ngx_rtmp_bit_read_golomb(ngx_rtmp_bit_reader_t *br);
 
+/*
+ * paras:
+ *      dst: buffer for rbsp, at least len bytes
+ *      src: NAL unit payload
+ *      len: bytes of src
+ *
+ * return:
+ *      bytes of rbsp, NGX_ERROR for forbidden three or four bytes sequence
+ */
+ngx_int_t ngx_rtmp_bit_nal_to_rbsp(u_char *dst, u_char *src, size_t len);
+
 
 #define ngx_rtmp_bit_read_err(br) ((br)->err)
 
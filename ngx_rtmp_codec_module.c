@@ -379,7 +379,7 @@ ngx_rtmp_codec_parse_hevc_nal_to_rbsp(ngx_rtmp_session_t *s, u_char *p,
         ngx_rtmp_bit_reader_t *br, ngx_uint_t nal_unit_type,
         ngx_uint_t nal_unit_len)
 {
-    ngx_uint_t                  i, count, rbsp_bytes;
+    ngx_int_t                   rbsp_bytes;
 
     /*
      * nal_unit
@@ -427,35 +427,12 @@ ngx_rtmp_codec_parse_hevc_nal_to_rbsp(ngx_rtmp_session_t *s, u_char *p,
     ngx_rtmp_bit_read(br, 6);
     ngx_rtmp_bit_read(br, 3);
 
-    count = 0;
-    rbsp_bytes = 0;
-    for (i = 0; i < nal_unit_len; ++i) {
-        if (count == 2) { /* already 0x0000 */
-            if (br->pos[i] < 0x03) {
-                ngx_log_error(NGX_LOG_ERR, s->log, 0,
-                        "three bytes sequence error");
-                return NGX_ERROR;
-            }
-
-            if (br->pos[i] == 0x03 && br->pos[i + 1] > 0x03) {
-                ngx_log_error(NGX_LOG_ERR, s->log, 0,
-                        "four bytes sequence error");
-                return NGX_ERROR;
-            }
-
-            if (br->pos[i] == 0x03) {
-                count = 0;
-                continue;
-            }
-        }
-
-        *p++ = br->pos[i];
-        ++rbsp_bytes;
-        if (br->pos[i] == 0x00) {
-            ++count;
-        } else {
-            count = 0;
-        }
+    /* nal_unit_header has been read */
+    rbsp_bytes = ngx_rtmp_bit_nal_to_rbsp(p, br->pos, nal_unit_len - 2);
+    if (rbsp_bytes == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                "emulation prevention sequence error");
+        return NGX_ERROR;
     }
 
     return rbsp_bytes;
@@ -567,6 +544,14 @@ ngx_rtmp_codec_parse_hevc_sps(ngx_rtmp_session_t *s, ngx_rtmp_codec_ctx_t *ctx,
     u_char                  buf[4096];
     ngx_int_t               rbsp_bytes;
 
+    if (nal_unit_len < 2 || nal_unit_len > sizeof(buf)
+        || (ngx_uint_t) (pbr->last - pbr->pos) < nal_unit_len)
+    {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                "codec: hevc sps length %ui invalid", nal_unit_len);
+        return;
+    }
+
     ngx_rtmp_bit_init_reader(&br, pbr->pos, pbr->pos + nal_unit_len);
     rbsp_bytes = ngx_rtmp_codec_parse_hevc_nal_to_rbsp(s, buf, &br, NAL_SPS,
                                                        nal_unit_len);
@@ -784,6 +769,9 @@ ngx_rtmp_codec_parse_avc_header(ngx_rtmp_session_t *s, ngx_chain_t *in)
                             num_ref_frames;
     ngx_rtmp_codec_ctx_t   *ctx;
     ngx_rtmp_bit_reader_t   br;
+    u_char                  buf[4096];
+    ngx_int_t               rbsp_bytes;
+    size_t                  len;
 
 #if (NGX_DEBUG)
     ngx_rtmp_codec_dump_header(s, "avc", in);
@@ -808,7 +796,7 @@ ngx_rtmp_codec_parse_avc_header(ngx_rtmp_session_t *s, ngx_chain_t *in)
     }
 
     /* nal size */
-    ngx_rtmp_bit_read(&br, 16);
+    len = (size_t) ngx_rtmp_bit_read_16(&br);
 
     /* nal type */
     if (ngx_rtmp_bit_read_8(&br) != 0x67) {
@@ -817,6 +805,22 @@ ngx_rtmp_codec_parse_avc_header(ngx_rtmp_session_t *s, ngx_chain_t *in)
 
     /* SPS */
 
+    if (len < 1 || len > sizeof(buf) || (size_t) (br.last - br.pos) < len - 1)
+    {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                "codec: avc sps length %uz invalid", len);
+        return;
+    }
+
+    rbsp_bytes = ngx_rtmp_bit_nal_to_rbsp(buf, br.pos, len - 1);
+    if (rbsp_bytes == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                "codec: avc sps emulation prevention sequence error");
+        return;
+    }
+
+    ngx_rtmp_bit_init_reader(&br, buf, buf + rbsp_bytes);
+
     /* profile idc */
     profile_idc = (ngx_uint_t) ngx_rtmp_bit_read(&br, 8);
 
@@ -164,6 +164,20 @@ static ngx_command_t  ngx_rtmp_core_commands[] = {
       offsetof(ngx_rtmp_core_app_conf_t, merge_frame),
       &ngx_rtmp_merge_frame_p },
 
+    { ngx_string("coalesce_time"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_core_app_conf_t, coalesce_time),
+      NULL },
+
+    { ngx_string("coalesce_size"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_core_app_conf_t, coalesce_size),
+      NULL },
+
     { ngx_string("tcp_nodelay"),
       NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -454,6 +468,8 @@ ngx_rtmp_core_create_app_conf(ngx_conf_t *cf)
 
     conf->hevc_codec = NGX_CONF_UNSET_UINT;
     conf->merge_frame = NGX_CONF_UNSET_UINT;
+    conf->coalesce_time = NGX_CONF_UNSET_MSEC;
+    conf->coalesce_size = NGX_CONF_UNSET_SIZE;
     conf->tcp_nodelay = NGX_CONF_UNSET;
 
     return conf;
@@ -468,6 +484,10 @@ ngx_rtmp_core_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_uint_value(conf->hevc_codec, prev->hevc_codec, 12);
     ngx_conf_merge_uint_value(conf->merge_frame, prev->merge_frame, 32);
+    /* 0 for disable send coalescing */
+    ngx_conf_merge_msec_value(conf->coalesce_time, prev->coalesce_time, 0);
+    ngx_conf_merge_size_value(conf->coalesce_size, prev->coalesce_size,
+            65536);
     ngx_conf_merge_value(conf->tcp_nodelay, prev->tcp_nodelay, 1);
 
     NGX_RTMP_HEVC_CODEC_ID = conf->hevc_codec;
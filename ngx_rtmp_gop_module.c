@@ -22,6 +22,51 @@ static ngx_int_t ngx_rtmp_gop_postconfiguration(ngx_conf_t *cf);
 #define ngx_rtmp_gop_next(s, pos) ((pos + 1) % s->out_queue)
 #define ngx_rtmp_gop_prev(s, pos) (pos == 0 ? s->out_queue - 1 : pos - 1)
 
+#define NGX_RTMP_GOP_SHIFT_FRAMES   1024
+#define NGX_RTMP_GOP_SHIFT_KEYS     64
+
+/* max msec waiting for keyframe of new publisher after switch point */
+#define NGX_RTMP_GOP_SWITCH_WAIT    10000
+
+typedef struct {
+    ngx_rtmp_frame_t           *frame;
+    /* frame timestamp may be rewritten by fix_timestamp when linked */
+    uint32_t                    timestamp;
+} ngx_rtmp_gop_shift_frame_t;
+
+typedef struct {
+    ngx_uint_t                  seq;
+    /* wallclock in msec when keyframe received */
+    uint64_t                    time;
+    uint32_t                    timestamp;
+    ngx_rtmp_frame_t           *aac_header;
+    ngx_rtmp_frame_t           *avc_header;
+} ngx_rtmp_gop_shift_key_t;
+
+/*
+ * time-shift ring of publisher, frames and keyframes are indexed by
+ * sequence number, [first, last) are in ring, slot of seq is
+ * seq & (n - 1), keyframes are ordered by time for binary search
+ */
+typedef struct {
+    ngx_uint_t                  id;
+
+    ngx_rtmp_gop_shift_frame_t *frames;
+    ngx_uint_t                  nframes;
+    ngx_uint_t                  first;
+    ngx_uint_t                  last;
+
+    ngx_rtmp_gop_shift_key_t   *keys;
+    ngx_uint_t                  nkeys;
+    ngx_uint_t                  key_first;
+    ngx_uint_t                  key_last;
+
+    size_t                      size;
+
+    ngx_rtmp_frame_t           *aac_header;
+    ngx_rtmp_frame_t           *avc_header;
+} ngx_rtmp_gop_shift_t;
+
 typedef struct {
     /* publisher: head of cache
      * player: cache send position of publisher's out
@@ -44,6 +89,28 @@ typedef struct {
 
     uint32_t                    first_timestamp;
 
+    /* publisher: latest video keyframe and its header for snapshot */
+    ngx_rtmp_frame_t           *video_header;
+    ngx_rtmp_frame_t           *snapshot;
+    ngx_rtmp_frame_t           *snapshot_header;
+    uint32_t                    snapshot_timestamp;
+
+    /* publisher: time-shift ring */
+    ngx_rtmp_gop_shift_t        shift;
+
+    /* player: time-shift ring id and position, 0 for live */
+    ngx_uint_t                  shift_id;
+    ngx_uint_t                  shift_seq;
+    ngx_uint_t                  shift_key;
+    uint32_t                    shift_delay;
+    unsigned                    shift_header:1;
+
+    /* player: switched to another publisher, wait for keyframe not
+     * earlier than switch_timestamp
+     */
+    uint32_t                    switch_timestamp;
+    unsigned                    switching:1;
+
     /* only for publisher, must at last of ngx_rtmp_gop_ctx_t */
     ngx_rtmp_frame_t           *cache[];
 } ngx_rtmp_gop_ctx_t;
@@ -54,9 +121,14 @@ typedef struct {
     ngx_flag_t                  send_all;
     ngx_msec_t                  fix_timestamp;
     ngx_flag_t                  zero_start;
+    ngx_msec_t                  timeshift;
+    size_t                      timeshift_size;
 } ngx_rtmp_gop_app_conf_t;
 
 
+static ngx_uint_t               ngx_rtmp_gop_shift_id;
+
+
 static ngx_command_t  ngx_rtmp_gop_commands[] = {
 
     { ngx_string("cache_time"),
@@ -93,6 +165,21 @@ static ngx_command_t  ngx_rtmp_gop_commands[] = {
       NGX_RTMP_APP_CONF_OFFSET,
       offsetof(ngx_rtmp_gop_app_conf_t, zero_start),
       NULL },
+
+    { ngx_string("timeshift"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_gop_app_conf_t, timeshift),
+      NULL },
+
+    { ngx_string("timeshift_size"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_gop_app_conf_t, timeshift_size),
+      NULL },
+
       ngx_null_command
 };
 
@@ -140,6 +227,8 @@ ngx_rtmp_gop_create_app_conf(ngx_conf_t *cf)
     gacf->send_all = NGX_CONF_UNSET;
     gacf->fix_timestamp = NGX_CONF_UNSET_MSEC;
     gacf->zero_start = NGX_CONF_UNSET;
+    gacf->timeshift = NGX_CONF_UNSET_MSEC;
+    gacf->timeshift_size = NGX_CONF_UNSET_SIZE;
 
     return gacf;
 }
@@ -155,6 +244,9 @@ ngx_rtmp_gop_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->send_all, prev->send_all, 0);
     ngx_conf_merge_msec_value(conf->fix_timestamp, prev->fix_timestamp, 10000);
     ngx_conf_merge_value(conf->zero_start, prev->zero_start, 0);
+    ngx_conf_merge_msec_value(conf->timeshift, prev->timeshift, 0);
+    ngx_conf_merge_size_value(conf->timeshift_size, prev->timeshift_size,
+                              64 * 1024 * 1024);
 
     return NGX_CONF_OK;
 }
@@ -163,6 +255,7 @@ static ngx_int_t
 ngx_rtmp_gop_link_frame(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
 {
     ngx_uint_t                      nmsg;
+    ngx_int_t                       rc;
     ngx_rtmp_live_chunk_stream_t   *cs;
     ngx_uint_t                      csidx;
     ngx_rtmp_live_ctx_t            *lctx;
@@ -174,9 +267,17 @@ ngx_rtmp_gop_link_frame(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
         return NGX_OK;
     }
 
+    lctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_live_module);
+
+    /* not subscribed, skip as sent */
+    if (lctx && !ngx_rtmp_live_track(lctx, frame->hdr.type,
+                                     frame->keyframe || frame->av_header))
+    {
+        return NGX_OK;
+    }
+
     gacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_gop_module);
     if (gacf->fix_timestamp) {
-        lctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_live_module);
         csidx = !(frame->hdr.type == NGX_RTMP_MSG_VIDEO);
 
         cs  = &lctx->cs[csidx];
@@ -210,7 +311,7 @@ ngx_rtmp_gop_link_frame(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
         }
     }
 
-    nmsg = (s->out_last - s->out_pos) % s->out_queue + 1;
+    nmsg = ngx_rtmp_out_nmsg(s) + 1;
 
     if (nmsg >= s->out_queue) {
         ngx_log_error(NGX_LOG_ERR, s->log, 0,
@@ -228,11 +329,26 @@ ngx_rtmp_gop_link_frame(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
         ctx->latest_avc_header = frame;
     }
 
+    rc = ngx_rtmp_alloc_out_queue(s);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
     s->out[s->out_last] = frame;
-    s->out_last = ngx_rtmp_gop_next(s, s->out_last);
+    s->out_last = ngx_rtmp_out_next(s, s->out_last);
 
     ngx_rtmp_shared_acquire_frame(frame);
 
+    if (s->live_stream && ngx_rtmp_is_latency_frame(frame)) {
+        ngx_rtmp_histogram_add(&s->live_stream->queue_delay,
+                               ngx_current_msec - frame->time);
+    }
+
+    ngx_rtmp_coalesce_frame(s, frame->hdr.mlen,
+            frame->keyframe || frame->av_header
+            || (frame->hdr.type != NGX_RTMP_MSG_AUDIO
+                && frame->hdr.type != NGX_RTMP_MSG_VIDEO));
+
     return NGX_OK;
 }
 
@@ -404,6 +520,197 @@ ngx_rtmp_gop_print_cache(ngx_rtmp_session_t *s, ngx_rtmp_gop_ctx_t *ctx)
 #endif
 }
 
+static uint64_t
+ngx_rtmp_gop_shift_now(void)
+{
+    ngx_time_t                 *tp;
+
+    tp = ngx_timeofday();
+
+    return (uint64_t) tp->sec * 1000 + tp->msec;
+}
+
+/* double ring of n elts with [first, last) in use, slots remapped by seq */
+static void *
+ngx_rtmp_gop_shift_grow(void *elts, size_t size, ngx_uint_t *n,
+        ngx_uint_t first, ngx_uint_t last, ngx_uint_t init, ngx_log_t *log)
+{
+    u_char                     *p;
+    ngx_uint_t                  seq, nelts;
+
+    nelts = *n ? *n * 2 : init;
+
+    p = ngx_alloc(nelts * size, log);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    for (seq = first; seq != last; ++seq) {
+        ngx_memcpy(p + (seq & (nelts - 1)) * size,
+                   (u_char *) elts + (seq & (*n - 1)) * size, size);
+    }
+
+    if (elts) {
+        ngx_free(elts);
+    }
+
+    *n = nelts;
+
+    return p;
+}
+
+/* hold frame in *ref, release the one held before */
+static void
+ngx_rtmp_gop_set_frame(ngx_rtmp_frame_t **ref, ngx_rtmp_frame_t *frame)
+{
+    if (*ref) {
+        ngx_rtmp_shared_free_frame(*ref);
+    }
+
+    *ref = frame;
+
+    if (frame) {
+        ngx_rtmp_shared_acquire_frame(frame);
+    }
+}
+
+static void
+ngx_rtmp_gop_shift_evict(ngx_rtmp_gop_shift_t *shift)
+{
+    ngx_rtmp_gop_shift_frame_t *f;
+    ngx_rtmp_gop_shift_key_t   *key;
+
+    f = &shift->frames[shift->first & (shift->nframes - 1)];
+
+    shift->size -= f->frame->hdr.mlen;
+    ngx_rtmp_shared_free_frame(f->frame);
+    f->frame = NULL;
+
+    ++shift->first;
+
+    while (shift->key_first != shift->key_last) {
+        key = &shift->keys[shift->key_first & (shift->nkeys - 1)];
+        if (key->seq >= shift->first) {
+            break;
+        }
+
+        ngx_rtmp_gop_set_frame(&key->aac_header, NULL);
+        ngx_rtmp_gop_set_frame(&key->avc_header, NULL);
+
+        ++shift->key_first;
+    }
+}
+
+static void
+ngx_rtmp_gop_shift_free(ngx_rtmp_gop_shift_t *shift)
+{
+    while (shift->first != shift->last) {
+        ngx_rtmp_gop_shift_evict(shift);
+    }
+
+    ngx_rtmp_gop_set_frame(&shift->aac_header, NULL);
+    ngx_rtmp_gop_set_frame(&shift->avc_header, NULL);
+
+    if (shift->frames) {
+        ngx_free(shift->frames);
+        shift->frames = NULL;
+    }
+
+    if (shift->keys) {
+        ngx_free(shift->keys);
+        shift->keys = NULL;
+    }
+
+    shift->nframes = 0;
+    shift->nkeys = 0;
+}
+
+static ngx_int_t
+ngx_rtmp_gop_shift_cache(ngx_rtmp_session_t *s, ngx_rtmp_gop_ctx_t *ctx,
+        ngx_rtmp_frame_t *frame)
+{
+    ngx_rtmp_gop_app_conf_t    *gacf;
+    ngx_rtmp_gop_shift_t       *shift;
+    ngx_rtmp_gop_shift_frame_t *f;
+    ngx_rtmp_gop_shift_key_t   *key;
+    void                       *elts;
+
+    gacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_gop_module);
+    shift = &ctx->shift;
+
+    if (shift->id == 0) {
+        shift->id = ++ngx_rtmp_gop_shift_id;
+    }
+
+    if (frame->av_header) {
+        ngx_rtmp_gop_set_frame(frame->hdr.type == NGX_RTMP_MSG_AUDIO ?
+                               &shift->aac_header : &shift->avc_header, frame);
+    }
+
+    if (shift->last - shift->first == shift->nframes) {
+        elts = ngx_rtmp_gop_shift_grow(shift->frames,
+                                       sizeof(ngx_rtmp_gop_shift_frame_t),
+                                       &shift->nframes, shift->first,
+                                       shift->last, NGX_RTMP_GOP_SHIFT_FRAMES,
+                                       s->log);
+        if (elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        shift->frames = elts;
+    }
+
+    if (frame->keyframe && !frame->av_header) {
+        if (shift->key_last - shift->key_first == shift->nkeys) {
+            elts = ngx_rtmp_gop_shift_grow(shift->keys,
+                                           sizeof(ngx_rtmp_gop_shift_key_t),
+                                           &shift->nkeys, shift->key_first,
+                                           shift->key_last,
+                                           NGX_RTMP_GOP_SHIFT_KEYS, s->log);
+            if (elts == NULL) {
+                return NGX_ERROR;
+            }
+
+            shift->keys = elts;
+        }
+
+        key = &shift->keys[shift->key_last & (shift->nkeys - 1)];
+        key->seq = shift->last;
+        key->time = ngx_rtmp_gop_shift_now();
+        key->timestamp = frame->hdr.timestamp;
+        key->aac_header = NULL;
+        key->avc_header = NULL;
+        ngx_rtmp_gop_set_frame(&key->aac_header, shift->aac_header);
+        ngx_rtmp_gop_set_frame(&key->avc_header, shift->avc_header);
+
+        ++shift->key_last;
+    }
+
+    f = &shift->frames[shift->last & (shift->nframes - 1)];
+    f->frame = frame;
+    f->timestamp = frame->hdr.timestamp;
+
+    ngx_rtmp_shared_acquire_frame(frame);
+
+    shift->size += frame->hdr.mlen;
+    ++shift->last;
+
+    /* bounded by both time and bytes */
+    while (shift->last - shift->first > 1) {
+        f = &shift->frames[shift->first & (shift->nframes - 1)];
+
+        if (shift->size <= gacf->timeshift_size
+            && frame->hdr.timestamp - f->timestamp <= gacf->timeshift)
+        {
+            break;
+        }
+
+        ngx_rtmp_gop_shift_evict(shift);
+    }
+
+    return NGX_OK;
+}
+
 ngx_int_t
 ngx_rtmp_gop_cache(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
 {
@@ -413,7 +720,7 @@ ngx_rtmp_gop_cache(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
     ngx_uint_t                  nmsg;
 
     gacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_gop_module);
-    if (gacf->cache_time == 0) {
+    if (gacf->cache_time == 0 && gacf->timeshift == 0) {
         return NGX_OK;
     }
 
@@ -427,6 +734,29 @@ ngx_rtmp_gop_cache(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
         ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_gop_module);
     }
 
+    ngx_rtmp_gop_set_avframe_tag(frame);
+
+    if (frame->hdr.type == NGX_RTMP_MSG_VIDEO) {
+        if (frame->av_header) {
+            ngx_rtmp_gop_set_frame(&ctx->video_header, frame);
+
+        } else if (frame->keyframe) {
+            ngx_rtmp_gop_set_frame(&ctx->snapshot, frame);
+            ngx_rtmp_gop_set_frame(&ctx->snapshot_header, ctx->video_header);
+            ctx->snapshot_timestamp = frame->hdr.timestamp;
+        }
+    }
+
+    if (gacf->timeshift
+        && ngx_rtmp_gop_shift_cache(s, ctx, frame) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (gacf->cache_time == 0) {
+        return NGX_OK;
+    }
+
     nmsg = (ctx->gop_last - ctx->gop_pos) % s->out_queue + 1;
     if (nmsg >= s->out_queue) {
         ngx_log_error(NGX_LOG_ERR, s->log, 0,
@@ -434,8 +764,6 @@ ngx_rtmp_gop_cache(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *frame)
         return NGX_AGAIN;
     }
 
-    ngx_rtmp_gop_set_avframe_tag(frame);
-
     ngx_log_debug5(NGX_LOG_DEBUG_RTMP, s->log, 0,
             "cache frame: %ud[%d %d], %ud, %ud",
             frame->hdr.type, frame->keyframe, frame->av_header,
@@ -580,6 +908,261 @@ ngx_rtmp_gop_send_gop(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
     return NGX_AGAIN;
 }
 
+/* last keyframe received not later than time, or the oldest one */
+static ngx_int_t
+ngx_rtmp_gop_shift_lookup(ngx_rtmp_gop_shift_t *shift, uint64_t time,
+        ngx_uint_t *k)
+{
+    ngx_uint_t                  lo, hi, mid;
+
+    if (shift->key_first == shift->key_last) {
+        return NGX_DECLINED;
+    }
+
+    lo = shift->key_first;
+    hi = shift->key_last;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (shift->keys[mid & (shift->nkeys - 1)].time <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *k = lo == shift->key_first ? lo : lo - 1;
+
+    return NGX_OK;
+}
+
+static void
+ngx_rtmp_gop_shift_seek(ngx_rtmp_gop_shift_t *shift, ngx_rtmp_gop_ctx_t *ssctx,
+        ngx_uint_t k)
+{
+    ngx_rtmp_gop_shift_key_t   *key;
+    uint32_t                    latest;
+
+    key = &shift->keys[k & (shift->nkeys - 1)];
+    latest = shift->frames[(shift->last - 1) & (shift->nframes - 1)].timestamp;
+
+    ssctx->shift_id = shift->id;
+    ssctx->shift_seq = key->seq;
+    ssctx->shift_key = k;
+    ssctx->shift_delay = latest - key->timestamp;
+    ssctx->shift_header = 1;
+}
+
+/*
+ * play args start=-<time> for time before now, such as start=-30s,
+ * or start=<msec> for absolute unix time in msec
+ */
+static void
+ngx_rtmp_gop_shift_start(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
+{
+    ngx_rtmp_gop_ctx_t         *sctx, *ssctx;
+    ngx_str_t                   arg;
+    ngx_int_t                   delta;
+    off_t                       start;
+    uint64_t                    now, time;
+    ngx_uint_t                  k;
+
+    if (ngx_rtmp_arg(ss, (u_char *) "start", 5, &arg) != NGX_OK
+        || arg.len == 0)
+    {
+        return;
+    }
+
+    sctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_gop_module);
+    ssctx = ngx_rtmp_get_module_ctx(ss, ngx_rtmp_gop_module);
+
+    now = ngx_rtmp_gop_shift_now();
+
+    if (arg.data[0] == '-') {
+        ++arg.data;
+        --arg.len;
+
+        delta = ngx_parse_time(&arg, 0);
+        if (delta == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, ss->log, 0,
+                    "gop, timeshift, invalid start \"-%V\"", &arg);
+            return;
+        }
+
+        time = (uint64_t) delta < now ? now - delta : 0;
+    } else {
+        start = ngx_atoof(arg.data, arg.len);
+        if (start == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ERR, ss->log, 0,
+                    "gop, timeshift, invalid start \"%V\"", &arg);
+            return;
+        }
+
+        time = start;
+    }
+
+    if (time >= now) {
+        return;
+    }
+
+    if (ngx_rtmp_gop_shift_lookup(&sctx->shift, time, &k) != NGX_OK) {
+        return;
+    }
+
+    ngx_rtmp_gop_shift_seek(&sctx->shift, ssctx, k);
+
+    ngx_log_error(NGX_LOG_INFO, ss->log, 0,
+            "gop, timeshift, start %uL msec ago, delay %uD",
+            now - sctx->shift.keys[k & (sctx->shift.nkeys - 1)].time,
+            ssctx->shift_delay);
+}
+
+/* frames are sent shift_delay behind the latest frame of publisher */
+static ngx_int_t
+ngx_rtmp_gop_shift_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
+{
+    ngx_rtmp_gop_ctx_t         *sctx, *ssctx;
+    ngx_rtmp_gop_shift_t       *shift;
+    ngx_rtmp_gop_shift_frame_t *f;
+    ngx_rtmp_gop_shift_key_t   *key;
+    ngx_uint_t                  seq;
+    uint32_t                    latest;
+
+    sctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_gop_module);
+    ssctx = ngx_rtmp_get_module_ctx(ss, ngx_rtmp_gop_module);
+    shift = &sctx->shift;
+
+    if (shift->first == shift->last) {
+        return NGX_OK;
+    }
+
+    /* frames evicted before sent or publisher republished */
+    if (ssctx->shift_id != shift->id || ssctx->shift_seq < shift->first
+        || ssctx->shift_seq > shift->last)
+    {
+        if (shift->key_first == shift->key_last) {
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, ss->log, 0,
+                "gop, timeshift, position out of ring, "
+                "skip to oldest keyframe [%ui %ui] %ui",
+                shift->first, shift->last, ssctx->shift_seq);
+
+        ngx_rtmp_gop_shift_seek(shift, ssctx, shift->key_first);
+    }
+
+    if (ngx_rtmp_gop_send_meta(s, ss) == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
+    if (ssctx->shift_header) {
+        key = &shift->keys[ssctx->shift_key & (shift->nkeys - 1)];
+
+        if (key->aac_header && key->aac_header != ssctx->latest_aac_header
+            && ngx_rtmp_gop_link_frame(ss, key->aac_header) == NGX_AGAIN)
+        {
+            return NGX_AGAIN;
+        }
+
+        if (key->avc_header && key->avc_header != ssctx->latest_avc_header
+            && ngx_rtmp_gop_link_frame(ss, key->avc_header) == NGX_AGAIN)
+        {
+            return NGX_AGAIN;
+        }
+
+        ssctx->shift_header = 0;
+    }
+
+    latest = shift->frames[(shift->last - 1) & (shift->nframes - 1)].timestamp;
+
+    for (seq = ssctx->shift_seq; seq != shift->last; ++seq) {
+        f = &shift->frames[seq & (shift->nframes - 1)];
+
+        if ((int32_t) (f->timestamp + ssctx->shift_delay - latest) > 0) {
+            break;
+        }
+
+        if (ngx_rtmp_gop_link_frame(ss, f->frame) == NGX_AGAIN) {
+            break;
+        }
+    }
+
+    ssctx->shift_seq = seq;
+    ngx_rtmp_send_message(ss, NULL, 0);
+
+    return NGX_OK;
+}
+
+/*
+ * ss switched from another publisher, start from latest keyframe of s not
+ * earlier than switch point with codec headers before it, frames before
+ * the keyframe are skipped and nothing is sent until such keyframe cached
+ */
+static ngx_int_t
+ngx_rtmp_gop_send_switch(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
+{
+    ngx_rtmp_gop_ctx_t         *sctx, *ssctx;
+    size_t                      pos;
+    uint32_t                    delta;
+
+    sctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_gop_module);
+    ssctx = ngx_rtmp_get_module_ctx(ss, ngx_rtmp_gop_module);
+
+    if (sctx->snapshot == NULL) {
+        return NGX_OK;
+    }
+
+    /* timestamps too far from switch point are not aligned, no wait */
+    delta = ssctx->switch_timestamp - sctx->snapshot_timestamp;
+    if (delta && delta < NGX_RTMP_GOP_SWITCH_WAIT) {
+        return NGX_OK;
+    }
+
+    for (pos = sctx->gop_pos; pos != sctx->gop_last;
+            pos = ngx_rtmp_gop_next(s, pos))
+    {
+        if (sctx->cache[pos] == sctx->snapshot) {
+            break;
+        }
+    }
+
+    /* keyframe not cached */
+    if (pos == sctx->gop_last) {
+        return NGX_OK;
+    }
+
+    if (ngx_rtmp_gop_send_meta(s, ss) == NGX_AGAIN) {
+        return NGX_AGAIN;
+    }
+
+    if (ngx_rtmp_gop_link_frame(ss, sctx->latest_aac_header) == NGX_AGAIN
+        || ngx_rtmp_gop_link_frame(ss, sctx->snapshot_header) == NGX_AGAIN)
+    {
+        return NGX_AGAIN;
+    }
+
+    ngx_log_error(NGX_LOG_INFO, ss->log, 0,
+            "gop, switch to keyframe %uD", sctx->snapshot_timestamp);
+
+    ssctx->switching = 0;
+    ssctx->send_gop = 3;
+
+    while (pos != sctx->gop_last) {
+        if (ngx_rtmp_gop_link_frame(ss, sctx->cache[pos]) == NGX_AGAIN) {
+            break;
+        }
+
+        pos = ngx_rtmp_gop_next(s, pos);
+    }
+
+    ssctx->gop_pos = pos;
+    ngx_rtmp_send_message(ss, NULL, 0);
+
+    return NGX_OK;
+}
+
 ngx_int_t
 ngx_rtmp_gop_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
 {
@@ -589,7 +1172,7 @@ ngx_rtmp_gop_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
     size_t                      pos;
 
     gacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_gop_module);
-    if (gacf->cache_time == 0) {
+    if (gacf->cache_time == 0 && gacf->timeshift == 0) {
         return NGX_DECLINED;
     }
 
@@ -605,6 +1188,22 @@ ngx_rtmp_gop_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
             return NGX_ERROR;
         }
         ngx_rtmp_set_ctx(ss, ssctx, ngx_rtmp_gop_module);
+
+        if (gacf->timeshift) {
+            ngx_rtmp_gop_shift_start(s, ss);
+        }
+    }
+
+    if (ssctx->shift_id) {
+        return ngx_rtmp_gop_shift_send(s, ss);
+    }
+
+    if (gacf->cache_time == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (ssctx->switching) {
+        return ngx_rtmp_gop_send_switch(s, ss);
     }
 
     if (ngx_rtmp_gop_send_gop(s, ss) == NGX_AGAIN) {
@@ -689,6 +1288,51 @@ ngx_rtmp_gop_send(ngx_rtmp_session_t *s, ngx_rtmp_session_t *ss)
     return NGX_OK;
 }
 
+ngx_int_t
+ngx_rtmp_gop_switch(ngx_rtmp_session_t *s, uint32_t timestamp)
+{
+    ngx_rtmp_gop_app_conf_t    *gacf;
+    ngx_rtmp_gop_ctx_t         *ctx;
+
+    gacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_gop_module);
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_gop_module);
+    if (gacf->cache_time == 0 || ctx == NULL) {
+        return NGX_OK;
+    }
+
+    /* time-shift ring belongs to publisher */
+    if (ctx->shift_id) {
+        return NGX_DECLINED;
+    }
+
+    ctx->switch_timestamp = timestamp;
+    ctx->switching = 1;
+    ctx->meta_version = 0;
+
+    return NGX_OK;
+}
+
+ngx_int_t
+ngx_rtmp_gop_snapshot(ngx_rtmp_session_t *s, ngx_rtmp_frame_t **header,
+        ngx_rtmp_frame_t **keyframe, uint32_t *timestamp)
+{
+    ngx_rtmp_gop_ctx_t         *ctx;
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_gop_module);
+    if (ctx == NULL || ctx->snapshot == NULL
+        || ctx->snapshot_header == NULL)
+    {
+        return NGX_DECLINED;
+    }
+
+    *header = ctx->snapshot_header;
+    *keyframe = ctx->snapshot;
+    *timestamp = ctx->snapshot_timestamp;
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 ngx_rtmp_gop_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
 {
@@ -720,6 +1364,12 @@ ngx_rtmp_gop_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
         ctx->gop_pos = ngx_rtmp_gop_next(s, ctx->gop_pos);
     }
 
+    ngx_rtmp_gop_set_frame(&ctx->video_header, NULL);
+    ngx_rtmp_gop_set_frame(&ctx->snapshot, NULL);
+    ngx_rtmp_gop_set_frame(&ctx->snapshot_header, NULL);
+
+    ngx_rtmp_gop_shift_free(&ctx->shift);
+
 next:
     return next_close_stream(s, v);
 }
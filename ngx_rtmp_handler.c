@@ -24,6 +24,8 @@ ngx_uint_t                  ngx_rtmp_naccepted;
 
 ngx_rtmp_bandwidth_t        ngx_rtmp_bw_out;
 ngx_rtmp_bandwidth_t        ngx_rtmp_bw_in;
+/* send syscalls to players, bandwidth field is calls per second */
+ngx_rtmp_bandwidth_t        ngx_rtmp_send_calls;
 
 
 #ifdef NGX_DEBUG
@@ -140,7 +142,7 @@ ngx_rtmp_reset_ping(ngx_rtmp_session_t *s)
 
     s->ping_active = 0;
     s->ping_reset = 0;
-    ngx_add_timer(&s->ping_evt, cscf->ping);
+    ngx_rtmp_wheel_add_timer(&s->ping_evt, cscf->ping);
 
     ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
             "ping: wait %Mms", cscf->ping);
@@ -186,7 +188,7 @@ ngx_rtmp_ping(ngx_event_t *pev)
     }
 
     s->ping_active = 1;
-    ngx_add_timer(pev, cscf->ping_timeout);
+    ngx_rtmp_wheel_add_timer(pev, cscf->ping_timeout);
 }
 
 
@@ -494,6 +496,85 @@ ngx_rtmp_relative_timestamp(ngx_rtmp_session_t *s, ngx_rtmp_header_t *lh)
     return 0;
 }
 
+/*
+ * pack frames of the same run at head of out queue into aggregate message,
+ * replace them in queue with it, aggregate is cached in first frame for
+ * other players with the same frames queued
+ */
+static ngx_rtmp_frame_t *
+ngx_rtmp_prepare_aggregate(ngx_rtmp_session_t *s)
+{
+    ngx_rtmp_core_srv_conf_t   *cscf;
+    ngx_rtmp_frame_t           *frame, *f, *agg;
+    ngx_rtmp_frame_t           *frames[NGX_RTMP_MAX_AGGREGATE];
+    size_t                      pos;
+    ngx_uint_t                  n, i;
+
+    frame = s->out[s->out_pos];
+    if (frame->agg_id == 0) {
+        return frame;
+    }
+
+    frames[0] = frame;
+    n = 1;
+
+    for (pos = ngx_rtmp_out_next(s, s->out_pos);
+         pos != s->out_last && n < NGX_RTMP_MAX_AGGREGATE;
+         pos = ngx_rtmp_out_next(s, pos))
+    {
+        f = s->out[pos];
+        if (f->agg_id != frame->agg_id || f->agg_seq != frame->agg_seq + n) {
+            break;
+        }
+
+        frames[n++] = f;
+    }
+
+    if (n == 1) {
+        return frame;
+    }
+
+    agg = frame->aggregate;
+    if (agg == NULL || frame->naggregate != n) {
+        cscf = ngx_rtmp_get_module_srv_conf(s, ngx_rtmp_core_module);
+
+        agg = ngx_rtmp_shared_alloc_aggregate(cscf->chunk_size, frames, n);
+        if (agg == NULL) {
+            return frame;
+        }
+
+        if (frame->aggregate) {
+            ngx_rtmp_shared_free_frame(frame->aggregate);
+        }
+
+        frame->aggregate = agg;
+        frame->naggregate = n;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_RTMP, s->log, 0,
+            "RTMP aggregate %ui frames timestamp=%uD mlen=%uD",
+            n, agg->hdr.timestamp, agg->hdr.mlen);
+
+    /* hold aggregate before frames caching it are released */
+    ngx_rtmp_shared_acquire_frame(agg);
+
+    /* frames are replaced by aggregate in slot of the last one */
+    for (i = 0; i < n; ++i) {
+        f = frames[i];
+
+        ngx_rtmp_monitor_frame(s, &f->hdr, NULL, f->av_header, 0);
+        ngx_rtmp_shared_free_frame(f);
+
+        if (i + 1 < n) {
+            s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
+        }
+    }
+
+    s->out[s->out_pos] = agg;
+
+    return agg;
+}
+
 static ngx_chain_t *
 ngx_rtmp_prepare_out_chain(ngx_rtmp_session_t *s)
 {
@@ -509,7 +590,7 @@ ngx_rtmp_prepare_out_chain(ngx_rtmp_session_t *s)
 
     cscf = ngx_rtmp_get_module_srv_conf(s, ngx_rtmp_core_module);
 
-    frame = s->out[s->out_pos];
+    frame = ngx_rtmp_prepare_aggregate(s);
     head = NULL;
 
     if (frame->hdr.csid >= (uint32_t)cscf->max_streams) {
@@ -706,6 +787,7 @@ ngx_rtmp_send(ngx_event_t *wev)
         sent = c->sent;
 
         chain = c->send_chain(c, s->out_chain, 0);
+        ngx_rtmp_update_bandwidth(&ngx_rtmp_send_calls, 1);
 
         n = c->sent - sent;
 
@@ -753,12 +835,23 @@ ngx_rtmp_send_message(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *out,
         ngx_uint_t priority)
 {
     ngx_uint_t                      nmsg;
+    ngx_int_t                       rc;
+
+    /*
+     * stream of multiplexed relay never sends by itself, it has no
+     * connection after detached from carrier
+     */
+    if (s->mux || s->connection == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                "RTMP drop message, session has no connection of its own");
+        return NGX_AGAIN;
+    }
 
     if (out == NULL) {
         goto send;
     }
 
-    nmsg = (s->out_last - s->out_pos) % s->out_queue + 1;
+    nmsg = ngx_rtmp_out_nmsg(s) + 1;
 
     if (priority > 3) {
         priority = 3;
@@ -773,11 +866,25 @@ ngx_rtmp_send_message(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *out,
         return NGX_AGAIN;
     }
 
-    s->out[s->out_last++] = out;
-    s->out_last %= s->out_queue;
+    rc = ngx_rtmp_alloc_out_queue(s);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    s->out[s->out_last] = out;
+    s->out_last = ngx_rtmp_out_next(s, s->out_last);
 
     ngx_rtmp_shared_acquire_frame(out);
 
+    if (s->live_stream && ngx_rtmp_is_latency_frame(out)) {
+        ngx_rtmp_histogram_add(&s->live_stream->queue_delay,
+                               ngx_current_msec - out->time);
+    }
+
+    ngx_rtmp_coalesce_frame(s, out->hdr.mlen, out->keyframe || out->av_header
+            || (out->hdr.type != NGX_RTMP_MSG_AUDIO
+                && out->hdr.type != NGX_RTMP_MSG_VIDEO));
+
     ngx_log_debug3(NGX_LOG_DEBUG_RTMP, s->log, 0,
             "RTMP send nmsg=%ui, priority=%ui #%ui",
             nmsg, priority, s->out_last);
@@ -787,6 +894,10 @@ ngx_rtmp_send_message(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *out,
     }
 
 send:
+    if (ngx_rtmp_coalesce_delay(s)) {
+        return NGX_OK;
+    }
+
     if (!s->connection->write->active) {
         ngx_post_event(s->connection->write, &ngx_posted_events);
     }
@@ -803,6 +914,23 @@ ngx_rtmp_receive_message(ngx_rtmp_session_t *s,
     ngx_array_t                *evhs;
     size_t                      n;
     ngx_rtmp_handler_pt        *evh;
+    ngx_rtmp_session_t         *ss;
+
+    /* message of multiplexed stream, error only close the stream */
+    if (s->stream_session && h->msid) {
+        ss = s->stream_session(s, h);
+        if (ss == NULL) {
+            ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                    "drop message of unknown stream msid=%D", h->msid);
+            return NGX_OK;
+        }
+
+        if (ngx_rtmp_receive_message(ss, h, in) != NGX_OK) {
+            ngx_rtmp_finalize_session(ss);
+        }
+
+        return NGX_OK;
+    }
 
     cmcf = ngx_rtmp_get_module_main_conf(s, ngx_rtmp_core_module);
 
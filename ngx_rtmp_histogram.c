@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp_histogram.h"
+
+
+static ngx_uint_t
+ngx_rtmp_histogram_index(ngx_msec_t v)
+{
+    ngx_uint_t                  shift, idx;
+
+    if (v < NGX_RTMP_HISTOGRAM_SUB) {
+        return v;
+    }
+
+    /* v >> shift in [SUB, 2 * SUB) */
+    shift = 0;
+    while ((v >> shift) >= 2 * NGX_RTMP_HISTOGRAM_SUB) {
+        ++shift;
+    }
+
+    idx = (shift + 1) * NGX_RTMP_HISTOGRAM_SUB
+        + (v >> shift) - NGX_RTMP_HISTOGRAM_SUB;
+
+    if (idx >= NGX_RTMP_HISTOGRAM_BUCKETS) {
+        idx = NGX_RTMP_HISTOGRAM_BUCKETS - 1;
+    }
+
+    return idx;
+}
+
+
+static ngx_msec_t
+ngx_rtmp_histogram_upper(ngx_uint_t idx)
+{
+    ngx_uint_t                  shift, m;
+
+    if (idx < NGX_RTMP_HISTOGRAM_SUB) {
+        return idx;
+    }
+
+    shift = idx / NGX_RTMP_HISTOGRAM_SUB - 1;
+    m = idx % NGX_RTMP_HISTOGRAM_SUB + NGX_RTMP_HISTOGRAM_SUB;
+
+    return ((m + 1) << shift) - 1;
+}
+
+
+void
+ngx_rtmp_histogram_add(ngx_rtmp_histogram_t *h, ngx_msec_t v)
+{
+    ++h->buckets[ngx_rtmp_histogram_index(v)];
+    ++h->count;
+    h->sum += v;
+
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+
+ngx_msec_t
+ngx_rtmp_histogram_percentile(ngx_rtmp_histogram_t *h, ngx_uint_t percent)
+{
+    uint64_t                    rank, n;
+    ngx_uint_t                  i;
+    ngx_msec_t                  v;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    /* rank of value at percent, 1 based */
+    rank = (h->count * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    n = 0;
+    for (i = 0; i < NGX_RTMP_HISTOGRAM_BUCKETS; ++i) {
+        n += h->buckets[i];
+        if (n >= rank) {
+            break;
+        }
+    }
+
+    v = ngx_rtmp_histogram_upper(i);
+
+    return ngx_min(v, h->max);
+}
+
+
+void
+ngx_rtmp_histogram_merge(ngx_rtmp_histogram_t *dst, ngx_rtmp_histogram_t *src)
+{
+    ngx_uint_t                  i;
+
+    for (i = 0; i < NGX_RTMP_HISTOGRAM_BUCKETS; ++i) {
+        dst->buckets[i] += src->buckets[i];
+    }
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_HISTOGRAM_H_INCLUDED_
+#define _NGX_RTMP_HISTOGRAM_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+/*
+ * log-linear histogram of msec values, each power of two is split into
+ * NGX_RTMP_HISTOGRAM_SUB buckets, so relative error is less than 1/SUB,
+ * values not less than 2^(NGX_RTMP_HISTOGRAM_EXP + 2) msec fall into the
+ * last bucket
+ */
+#define NGX_RTMP_HISTOGRAM_SUB          8
+#define NGX_RTMP_HISTOGRAM_EXP          18
+#define NGX_RTMP_HISTOGRAM_BUCKETS                                          \
+    (NGX_RTMP_HISTOGRAM_SUB * NGX_RTMP_HISTOGRAM_EXP)
+
+
+typedef struct {
+    uint64_t            count;
+    uint64_t            sum;
+    ngx_msec_t          max;
+    uint32_t            buckets[NGX_RTMP_HISTOGRAM_BUCKETS];
+} ngx_rtmp_histogram_t;
+
+
+void ngx_rtmp_histogram_add(ngx_rtmp_histogram_t *h, ngx_msec_t v);
+
+/*
+ * paras:
+ *      h: histogram
+ *      percent: 0 - 100
+ * return:
+ *      upper bound of bucket which value at percent in, 0 if h is empty
+ */
+ngx_msec_t ngx_rtmp_histogram_percentile(ngx_rtmp_histogram_t *h,
+        ngx_uint_t percent);
+
+void ngx_rtmp_histogram_merge(ngx_rtmp_histogram_t *dst,
+        ngx_rtmp_histogram_t *src);
+
+
+#endif /* _NGX_RTMP_HISTOGRAM_H_INCLUDED_ */
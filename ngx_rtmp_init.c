@@ -282,7 +282,11 @@ static void
 ngx_rtmp_close_session(ngx_rtmp_session_t *s)
 {
     if (s->ping_evt.timer_set) {
-        ngx_del_timer(&s->ping_evt);
+        ngx_rtmp_wheel_del_timer(&s->ping_evt);
+    }
+
+    if (s->coalesce_evt.timer_set) {
+        ngx_del_timer(&s->coalesce_evt);
     }
 
     if (s->in_old_pool) {
@@ -301,17 +305,7 @@ ngx_rtmp_close_session(ngx_rtmp_session_t *s)
 
     ngx_rtmp_free_merge_frame(s);
 
-    if (s->live_type == NGX_MPEGTS_LIVE) {
-        while (s->out_pos != s->out_last) {
-            ngx_rtmp_shared_free_mpegts_frame(s->mpegts_out[s->out_pos++]);
-            s->out_pos %= s->out_queue;
-        }
-    } else {
-        while (s->out_pos != s->out_last) {
-            ngx_rtmp_shared_free_frame(s->out[s->out_pos++]);
-            s->out_pos %= s->out_queue;
-        }
-    }
+    ngx_rtmp_free_out_queue(s);
 
     NGX_DESTROY_POOL(s->pool);
 }
@@ -324,7 +318,8 @@ ngx_rtmp_close_session_handler(ngx_event_t *e)
     ngx_connection_t                   *c;
 
     s = e->data;
-    c = s->connection;
+    /* connection of multiplexed stream is closed by session owns it */
+    c = s->mux ? NULL : s->connection;
     if (c) {
         c->destroyed = 1;
     }
@@ -686,10 +681,7 @@ ngx_rtmp_create_session(ngx_rtmp_addr_conf_t *addr_conf)
         return NULL;
     }
 
-    s = ngx_pcalloc(pool, sizeof(ngx_rtmp_session_t) +
-            sizeof(ngx_rtmp_frame_t *) * ((ngx_rtmp_core_srv_conf_t *)
-                addr_conf->default_server->ctx-> srv_conf[ngx_rtmp_core_module
-                    .ctx_index])->out_queue);
+    s = ngx_pcalloc(pool, sizeof(ngx_rtmp_session_t));
     if (s == NULL) {
         goto destroy;
     }
@@ -749,10 +741,6 @@ ngx_rtmp_create_session(ngx_rtmp_addr_conf_t *addr_conf)
     s->stage = NGX_LIVE_INIT;
     s->init_time = ngx_current_msec;
 
-    s->mpegts_out = ngx_pcalloc(s->pool, sizeof(ngx_mpegts_frame_t *) *
-                ((ngx_rtmp_core_srv_conf_t *) addr_conf->default_server->ctx->
-                srv_conf[ngx_rtmp_core_module.ctx_index])->out_queue);
-
     return s;
 
 destroy:
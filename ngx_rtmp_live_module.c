@@ -7,6 +7,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include "ngx_rtmp_live_module.h"
+#include "ngx_rtmp_abr_module.h"
 #include "ngx_rtmp_cmd_module.h"
 #include "ngx_rtmp_codec_module.h"
 
@@ -29,6 +30,10 @@ static void ngx_rtmp_live_start(ngx_rtmp_session_t *s);
 static void ngx_rtmp_live_stop(ngx_rtmp_session_t *s);
 
 
+/* run id of frames packable into aggregate message, unique in worker */
+static ngx_uint_t                       ngx_rtmp_live_agg_id;
+
+
 static ngx_command_t  ngx_rtmp_live_commands[] = {
 
     { ngx_string("live"),
@@ -101,6 +106,27 @@ static ngx_command_t  ngx_rtmp_live_commands[] = {
       offsetof(ngx_rtmp_live_app_conf_t, idle_timeout),
       NULL },
 
+    { ngx_string("latency_probe"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_rtmp_live_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_live_app_conf_t, latency_probe),
+      NULL },
+
+    { ngx_string("aggregate_size"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_live_app_conf_t, aggregate_size),
+      NULL },
+
+    { ngx_string("aggregate_time"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_live_app_conf_t, aggregate_time),
+      NULL },
+
       ngx_null_command
 };
 
@@ -147,6 +173,9 @@ ngx_rtmp_live_create_app_conf(ngx_conf_t *cf)
     lacf->buflen = NGX_CONF_UNSET_MSEC;
     lacf->sync = NGX_CONF_UNSET_MSEC;
     lacf->idle_timeout = NGX_CONF_UNSET_MSEC;
+    lacf->latency_probe = NGX_CONF_UNSET_MSEC;
+    lacf->aggregate_size = NGX_CONF_UNSET_SIZE;
+    lacf->aggregate_time = NGX_CONF_UNSET_MSEC;
     lacf->interleave = NGX_CONF_UNSET;
     lacf->wait_key = NGX_CONF_UNSET;
     lacf->wait_video = NGX_CONF_UNSET;
@@ -168,6 +197,11 @@ ngx_rtmp_live_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_msec_value(conf->buflen, prev->buflen, 0);
     ngx_conf_merge_msec_value(conf->sync, prev->sync, 300);
     ngx_conf_merge_msec_value(conf->idle_timeout, prev->idle_timeout, 0);
+    ngx_conf_merge_msec_value(conf->latency_probe, prev->latency_probe, 0);
+    /* 0 for disable aggregate message */
+    ngx_conf_merge_size_value(conf->aggregate_size, prev->aggregate_size, 0);
+    ngx_conf_merge_msec_value(conf->aggregate_time, prev->aggregate_time,
+                              100);
     ngx_conf_merge_value(conf->interleave, prev->interleave, 0);
     ngx_conf_merge_value(conf->wait_key, prev->wait_key, 1);
     ngx_conf_merge_value(conf->wait_video, prev->wait_video, 0);
@@ -204,11 +238,9 @@ ngx_rtmp_live_set_msec_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 static void
 ngx_rtmp_live_idle(ngx_event_t *pev)
 {
-    ngx_connection_t           *c;
     ngx_rtmp_session_t         *s;
 
-    c = pev->data;
-    s = c->data;
+    s = pev->data;
 
     ngx_log_error(NGX_LOG_ERR, s->log, 0,
                   "live: drop idle publisher");
@@ -252,14 +284,14 @@ ngx_rtmp_live_set_status(ngx_rtmp_session_t *s, ngx_rtmp_frame_t *control,
             e = &ctx->idle_evt;
 
             if (active && !ctx->idle_evt.timer_set) {
-                e->data = s->connection;
+                e->data = s;
                 e->log = s->log;
                 e->handler = ngx_rtmp_live_idle;
 
-                ngx_add_timer(e, lacf->idle_timeout);
+                ngx_rtmp_wheel_add_timer(e, lacf->idle_timeout);
 
             } else if (!active && ctx->idle_evt.timer_set) {
-                ngx_del_timer(e);
+                ngx_rtmp_wheel_del_timer(e);
             }
         }
 
@@ -450,6 +482,7 @@ ngx_rtmp_live_join(ngx_rtmp_session_t *s, u_char *name, unsigned publisher)
     ngx_memzero(ctx, sizeof(*ctx));
 
     ctx->session = s;
+    ctx->tracks = NGX_RTMP_LIVE_TRACK_ALL;
 
     ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
                    "live: join '%s'", name);
@@ -598,6 +631,81 @@ next:
 }
 
 
+ngx_int_t
+ngx_rtmp_live_switch(ngx_rtmp_session_t *s, ngx_live_stream_t *st)
+{
+    ngx_rtmp_live_ctx_t            *ctx, **cctx;
+    ngx_rtmp_live_app_conf_t       *lacf;
+
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_live_module);
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_live_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_live_module);
+
+        ctx->session = s;
+        ctx->tracks = NGX_RTMP_LIVE_TRACK_ALL;
+
+        ctx->cs[0].csid = NGX_RTMP_CSID_VIDEO;
+        ctx->cs[1].csid = NGX_RTMP_CSID_AUDIO;
+
+        if (lacf->buflen) {
+            s->out_buffer = 1;
+        }
+    }
+
+    if (ctx->publishing) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->stream) {
+        ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                       "live: switch from '%s'", ctx->stream->name);
+
+        for (cctx = &ctx->stream->ctx; *cctx; cctx = &(*cctx)->next) {
+            if (*cctx == ctx) {
+                *cctx = ctx->next;
+                break;
+            }
+        }
+
+        ctx->stream = NULL;
+    }
+
+    if (st == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                   "live: switch to '%s'", st->name);
+
+    ctx->stream = st;
+    ctx->next = st->ctx;
+
+    st->ctx = ctx;
+
+    /* send metadata and absolute codec headers of new stream */
+    ctx->meta_version = 0;
+    ctx->wait_key = 1;
+
+    ctx->cs[0].active = 0;
+    ctx->cs[0].dropped = 0;
+
+    ctx->cs[1].active = 0;
+    ctx->cs[1].dropped = 0;
+
+    if (st->active) {
+        ngx_rtmp_live_start(s);
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_rtmp_live_pause(ngx_rtmp_session_t *s, ngx_rtmp_pause_t *v)
 {
@@ -642,6 +750,111 @@ next:
     return next_pause(s, v);
 }
 
+/*
+ * onFI data message carrying wallclock of ingest, players compare it with
+ * their own wallclock when rendering frame at same timestamp
+ */
+static ngx_rtmp_frame_t *
+ngx_rtmp_live_create_probe(ngx_rtmp_session_t *s, uint32_t timestamp)
+{
+    ngx_rtmp_header_t               h;
+    ngx_time_t                     *tp;
+    ngx_tm_t                        tm;
+
+    static double                   epoch;
+    static u_char                   sd[sizeof("dd-mm-yy")];
+    static u_char                   st[sizeof("hh:mm:ss.mmm")];
+
+    static ngx_rtmp_amf_elt_t       out_inf[] = {
+
+        { NGX_RTMP_AMF_STRING,
+          ngx_string("sd"),
+          sd, 0 },
+
+        { NGX_RTMP_AMF_STRING,
+          ngx_string("st"),
+          st, 0 },
+
+        { NGX_RTMP_AMF_NUMBER,
+          ngx_string("epoch"),
+          &epoch, 0 },
+    };
+
+    static ngx_rtmp_amf_elt_t       out_elts[] = {
+
+        { NGX_RTMP_AMF_STRING,
+          ngx_null_string,
+          "onFI", 0 },
+
+        { NGX_RTMP_AMF_OBJECT,
+          ngx_null_string,
+          out_inf, sizeof(out_inf) },
+    };
+
+    tp = ngx_timeofday();
+    ngx_gmtime(tp->sec, &tm);
+
+    ngx_sprintf(sd, "%02d-%02d-%02d%Z",
+                tm.ngx_tm_mday, tm.ngx_tm_mon, tm.ngx_tm_year % 100);
+    ngx_sprintf(st, "%02d:%02d:%02d.%03M%Z",
+                tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec, tp->msec);
+    epoch = (double) tp->sec * 1000 + tp->msec;
+
+    ngx_memzero(&h, sizeof(h));
+
+    h.type = NGX_RTMP_MSG_AMF_META;
+    h.csid = NGX_RTMP_CSID_AMF;
+    h.msid = NGX_RTMP_MSID;
+    h.timestamp = timestamp;
+
+    return ngx_rtmp_create_amf(s, &h, out_elts,
+                               sizeof(out_elts) / sizeof(out_elts[0]));
+}
+
+
+/*
+ * consecutive frames of publisher in aggregate_size bytes and aggregate_time
+ * msec are tagged as a run, players pack frames of a run queued together
+ * into one aggregate message, codec headers are never packed and keyframe
+ * starts a new run as players join from it
+ */
+static void
+ngx_rtmp_live_aggregate(ngx_rtmp_session_t *s, ngx_rtmp_live_ctx_t *ctx,
+        ngx_rtmp_frame_t *frame, ngx_flag_t header, ngx_flag_t key)
+{
+    ngx_rtmp_live_app_conf_t       *lacf;
+    size_t                          size;
+
+    lacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_live_module);
+
+    /* flv tag header and previous tag size */
+    size = frame->hdr.mlen + 15;
+
+    if (lacf->aggregate_size == 0 || header || size > lacf->aggregate_size) {
+        ctx->agg_id = 0;
+        return;
+    }
+
+    if (ctx->agg_id == 0 || key || ctx->agg_seq + 1 >= NGX_RTMP_MAX_AGGREGATE
+        || ctx->agg_size + size > lacf->aggregate_size
+        || frame->hdr.timestamp - ctx->agg_timestamp >= lacf->aggregate_time)
+    {
+        ctx->agg_id = ++ngx_rtmp_live_agg_id;
+        ctx->agg_seq = 0;
+        ctx->agg_size = 0;
+        ctx->agg_timestamp = frame->hdr.timestamp;
+
+    } else {
+        ++ctx->agg_seq;
+    }
+
+    ctx->agg_size += size;
+
+    frame->agg_id = ctx->agg_id;
+    frame->agg_seq = ctx->agg_seq;
+}
+
+
 static ngx_int_t
 ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
                  ngx_chain_t *in)
@@ -649,6 +862,7 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     ngx_rtmp_live_ctx_t            *ctx, *pctx;
     ngx_rtmp_codec_ctx_t           *codec_ctx;
     ngx_rtmp_frame_t               *header, *coheader, *meta, *avframe, *dummy;
+    ngx_rtmp_frame_t               *probe;
     ngx_rtmp_core_srv_conf_t       *cscf;
     ngx_rtmp_live_app_conf_t       *lacf;
     ngx_rtmp_session_t             *ss;
@@ -711,7 +925,7 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     }
 
     if (ctx->idle_evt.timer_set) {
-        ngx_add_timer(&ctx->idle_evt, lacf->idle_timeout);
+        ngx_rtmp_wheel_add_timer(&ctx->idle_evt, lacf->idle_timeout);
     }
 
     ngx_log_debug2(NGX_LOG_DEBUG_RTMP, s->log, 0,
@@ -725,6 +939,7 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     coheader = NULL;
     meta = NULL;
     dummy = NULL;
+    probe = NULL;
     meta_version = 0;
     mandatory = 0;
 
@@ -773,6 +988,9 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     avframe = ngx_rtmp_shared_alloc_frame(cscf->chunk_size, in, 0);
     avframe->hdr = ch;
 
+    ngx_rtmp_live_aggregate(s, ctx, avframe, ngx_rtmp_is_codec_header(in),
+                            prio == NGX_RTMP_VIDEO_KEY_FRAME);
+
     if (codec_ctx) {
 
         if (h->type == NGX_RTMP_MSG_AUDIO) {
@@ -814,6 +1032,20 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         return NGX_ERROR;
     }
 
+    if (lacf->latency_probe
+        && ngx_current_msec - ctx->probe_time >= lacf->latency_probe)
+    {
+        ctx->probe_time = ngx_current_msec;
+        probe = ngx_rtmp_live_create_probe(s, ch.timestamp);
+    }
+
+    /* adaptive players may switch rendition before keyframe broadcast */
+    if (h->type == NGX_RTMP_MSG_VIDEO && prio == NGX_RTMP_VIDEO_KEY_FRAME
+        && !ngx_rtmp_is_codec_header(in))
+    {
+        ngx_rtmp_abr_keyframe(s, h->timestamp);
+    }
+
     /* broadcast to all subscribers */
 
     for (pctx = ctx->stream->ctx; pctx; pctx = pctx->next) {
@@ -841,6 +1073,9 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         case NGX_ERROR:
             ngx_rtmp_finalize_session(ss);
             continue;
+        case NGX_AGAIN:
+            ++pctx->ndropped;
+            continue;
         default:
             peers++;
             continue;
@@ -857,6 +1092,19 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
             }
         }
 
+        /* tracks not subscribed, codec headers go with keyframes */
+
+        if (!ngx_rtmp_live_track(pctx, h->type,
+                                 prio == NGX_RTMP_VIDEO_KEY_FRAME
+                                 || ngx_rtmp_is_codec_header(in)))
+        {
+            if (cs->active) {
+                cs->timestamp += delta;
+            }
+
+            continue;
+        }
+
         /* sync stream */
 
         if (cs->active && (lacf->sync && cs->dropped > lacf->sync)) {
@@ -878,21 +1126,27 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
             }
 
             if (lacf->wait_video && h->type == NGX_RTMP_MSG_AUDIO &&
-                !pctx->cs[0].active)
+                !pctx->cs[0].active &&
+                pctx->tracks != NGX_RTMP_LIVE_TRACK_AUDIO)
             {
                 ngx_log_debug0(NGX_LOG_DEBUG_RTMP, ss->log, 0,
                                "live: waiting for video");
                 continue;
             }
 
-            if (lacf->wait_key && prio != NGX_RTMP_VIDEO_KEY_FRAME &&
-               (lacf->interleave || h->type == NGX_RTMP_MSG_VIDEO))
+            if ((lacf->wait_key || pctx->wait_key)
+                && prio != NGX_RTMP_VIDEO_KEY_FRAME
+                && (lacf->interleave || h->type == NGX_RTMP_MSG_VIDEO))
             {
                 ngx_log_debug0(NGX_LOG_DEBUG_RTMP, ss->log, 0,
                                "live: skip non-key");
                 continue;
             }
 
+            if (h->type == NGX_RTMP_MSG_VIDEO) {
+                pctx->wait_key = 0;
+            }
+
             dummy_audio = 0;
             if (lacf->wait_video && h->type == NGX_RTMP_MSG_VIDEO &&
                 !pctx->cs[1].active)
@@ -962,12 +1216,21 @@ ngx_rtmp_live_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         cs->timestamp += delta;
         ++peers;
         ss->current_time = cs->timestamp;
+
+        /* not gop cached, stale probe is useless for latency */
+        if (probe) {
+            ngx_rtmp_send_message(ss, probe, 0);
+        }
     }
 
     if (avframe) {
         ngx_rtmp_shared_free_frame(avframe);
     }
 
+    if (probe) {
+        ngx_rtmp_shared_free_frame(probe);
+    }
+
     if (dummy) {
         ngx_rtmp_shared_free_frame(dummy);
     }
@@ -1021,6 +1284,37 @@ next:
 }
 
 
+static void
+ngx_rtmp_live_parse_track(ngx_rtmp_session_t *s, ngx_rtmp_live_ctx_t *ctx)
+{
+    ngx_str_t                       track;
+
+    if (ngx_rtmp_arg(s, (u_char *) "track", 5, &track) != NGX_OK) {
+        return;
+    }
+
+    if (track.len == sizeof("audio") - 1
+        && ngx_strncmp(track.data, "audio", track.len) == 0)
+    {
+        ctx->tracks = NGX_RTMP_LIVE_TRACK_AUDIO;
+
+    } else if (track.len == sizeof("video") - 1
+               && ngx_strncmp(track.data, "video", track.len) == 0)
+    {
+        ctx->tracks = NGX_RTMP_LIVE_TRACK_VIDEO;
+
+    } else if (track.len == sizeof("keyframe") - 1
+               && ngx_strncmp(track.data, "keyframe", track.len) == 0)
+    {
+        ctx->tracks = NGX_RTMP_LIVE_TRACK_KEYFRAME;
+
+    } else {
+        ngx_log_error(NGX_LOG_WARN, s->log, 0,
+                "live: unknown track \"%V\", play all tracks", &track);
+    }
+}
+
+
 static ngx_int_t
 ngx_rtmp_live_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
 {
@@ -1052,14 +1346,19 @@ ngx_rtmp_live_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
 
     ctx->silent = v->silent;
 
+    ngx_rtmp_live_parse_track(s, ctx);
+
     if (!ctx->silent && !lacf->play_restart) {
         ngx_rtmp_send_status(s, "NetStream.Play.Start",
                              "status", "Start live");
         ngx_rtmp_send_sample_access(s);
     }
 
-    if (s->live_stream->publish_ctx && s->live_stream->publish_ctx->session) {
-        ps = s->live_stream->publish_ctx->session;
+    /* live stream may be a rendition other than played one */
+    if (ctx->stream && ctx->stream->publish_ctx
+        && ctx->stream->publish_ctx->session)
+    {
+        ps = ctx->stream->publish_ctx->session;
         ngx_rtmp_gop_send(ps, s);
     }
 
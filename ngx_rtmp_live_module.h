@@ -17,6 +17,22 @@
 #include "ngx_map.h"
 
 
+/* tracks subscribed by player, play arg track=audio|video|keyframe */
+#define NGX_RTMP_LIVE_TRACK_AUDIO           0x01
+#define NGX_RTMP_LIVE_TRACK_VIDEO           0x02
+/* video keyframes and codec headers only */
+#define NGX_RTMP_LIVE_TRACK_KEYFRAME        0x04
+#define NGX_RTMP_LIVE_TRACK_ALL                                               \
+    (NGX_RTMP_LIVE_TRACK_AUDIO|NGX_RTMP_LIVE_TRACK_VIDEO)
+
+#define ngx_rtmp_live_track(ctx, type, key)                                   \
+    ((type) == NGX_RTMP_MSG_AUDIO ? (ctx)->tracks & NGX_RTMP_LIVE_TRACK_AUDIO \
+     : (type) == NGX_RTMP_MSG_VIDEO ?                                         \
+        ((ctx)->tracks & NGX_RTMP_LIVE_TRACK_VIDEO                            \
+         || ((key) && (ctx)->tracks & NGX_RTMP_LIVE_TRACK_KEYFRAME))          \
+     : 1)
+
+
 typedef struct {
     unsigned                            active:1;
     uint32_t                            timestamp;
@@ -35,11 +51,21 @@ struct ngx_rtmp_live_ctx_s {
     ngx_uint_t                          ndropped;
     ngx_rtmp_live_chunk_stream_t        cs[2];
     ngx_uint_t                          meta_version;
+    ngx_uint_t                          tracks;
     ngx_event_t                         idle_evt;
+    /* msec when last latency probe injected by publisher */
+    ngx_msec_t                          probe_time;
+    /* publisher: run of frames packable into one aggregate message */
+    ngx_uint_t                          agg_id;
+    ngx_uint_t                          agg_seq;
+    size_t                              agg_size;
+    uint32_t                            agg_timestamp;
     unsigned                            active:1;
     unsigned                            publishing:1;
     unsigned                            silent:1;
     unsigned                            paused:1;
+    /* skip non-key video until keyframe after switching stream */
+    unsigned                            wait_key:1;
 };
 
 
@@ -57,10 +83,21 @@ typedef struct {
     ngx_flag_t                          idle_streams;
     ngx_flag_t                          fix_timestamp;
     ngx_msec_t                          buflen;
+    ngx_msec_t                          latency_probe;
+    size_t                              aggregate_size;
+    ngx_msec_t                          aggregate_time;
 } ngx_rtmp_live_app_conf_t;
 
 
 extern ngx_module_t  ngx_rtmp_live_module;
 
 
+/*
+ * paras:
+ *      s: subscriber to leave its live stream without close
+ *      st: live stream to join, NULL for leave only
+ */
+ngx_int_t ngx_rtmp_live_switch(ngx_rtmp_session_t *s, ngx_live_stream_t *st);
+
+
 #endif /* _NGX_RTMP_LIVE_H_INCLUDED_ */
@@ -8,6 +8,7 @@
 #include <ngx_core.h>
 #include "ngx_rtmp_cmd_module.h"
 #include "ngx_rtmp_codec_module.h"
+#include "ngx_rtmp_tcpinfo_module.h"
 
 
 static ngx_rtmp_publish_pt  next_publish;
@@ -626,6 +627,36 @@ static ngx_rtmp_log_var_t ngx_rtmp_log_vars[] = {
       ngx_rtmp_log_var_session_audio_flag,
       0 },
 
+    { ngx_string("tcpinfo_rtt"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.rtt) },
+
+    { ngx_string("tcpinfo_rttvar"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.rttvar) },
+
+    { ngx_string("tcpinfo_retrans"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.retrans) },
+
+    { ngx_string("tcpinfo_cwnd"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.cwnd) },
+
+    { ngx_string("tcpinfo_unacked"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.unacked) },
+
+    { ngx_string("tcpinfo_delivery_rate"),
+      ngx_rtmp_log_var_session_uint32_getlen,
+      ngx_rtmp_log_var_session_uint32_getdata,
+      offsetof(ngx_rtmp_session_t, tcpinfo.delivery_rate) },
+
     { ngx_null_string, NULL, NULL, 0 }
 };
 
@@ -1115,6 +1146,9 @@ ngx_rtmp_log_pre_write(ngx_rtmp_session_t *s, ngx_rtmp_log_t *log)
         return;
     }
 
+    /* refresh tcpinfo variables */
+    ngx_rtmp_tcpinfo_sample(s);
+
     len = 0;
     op = log->format->ops->elts;
     for (n = 0; n < log->format->ops->nelts; ++n, ++op) {
@@ -1158,7 +1192,7 @@ ngx_rtmp_log_trunc_timer(ngx_event_t *ev)
     ngx_rtmp_log_pre_write(s, log);
 
     t = log->trunc_timer - ngx_current_msec % log->trunc_timer;
-    ngx_add_timer(ev, t);
+    ngx_rtmp_wheel_add_timer(ev, t);
 }
 
 static void
@@ -1180,7 +1214,7 @@ ngx_rtmp_log_add_trunc_timer(ngx_rtmp_session_t *s, ngx_rtmp_log_ctx_t *ctx,
     e->handler = ngx_rtmp_log_trunc_timer;
 
     t = log->trunc_timer - ngx_current_msec % log->trunc_timer;
-    ngx_add_timer(e, t);
+    ngx_rtmp_wheel_add_timer(e, t);
 }
 
 static ngx_int_t
@@ -1297,7 +1331,7 @@ ngx_rtmp_log_disconnect(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
 
     ltctx = ctx->timers.elts;
     for (i = 0; i < ctx->timers.nelts; ++i, ++ltctx) {
-        ngx_del_timer(&ltctx->event);
+        ngx_rtmp_wheel_del_timer(&ltctx->event);
     }
 
     return NGX_OK;
@@ -6,6 +6,7 @@
 #include "ngx_rtmp_monitor_module.h"
 #include "ngx_rtmp_cmd_module.h"
 #include "ngx_rtmp_codec_module.h"
+#include "ngx_rtmp_ttff_module.h"
 
 
 static ngx_rtmp_close_stream_pt         next_close_stream;
@@ -24,6 +25,10 @@ static char *ngx_rtmp_monitor_buffered_log(ngx_conf_t *cf, ngx_command_t *cmd,
 
 #define NGX_RTMP_MONITOR_BUFFER_SIZE    61
 
+/* dump records are written when buffer full or every second */
+#define NGX_RTMP_MONITOR_DUMP_BUFSIZE   65536
+#define NGX_RTMP_MONITOR_DUMP_FLUSH     1000
+
 
 typedef struct {
     ngx_str_t                   dump_path;
@@ -45,6 +50,10 @@ typedef struct {
     ngx_uint_t                  curr;
 
     ngx_flag_t                  dump;
+    ngx_file_t                  dump_file;
+    ngx_msec_t                  dump_epoch;
+    ngx_buf_t                  *dump_buf;
+    ngx_msec_t                  dump_flush;
 
     unsigned                    publishing:1;
 } ngx_rtmp_monitor_ctx_t;
@@ -98,12 +107,6 @@ ngx_module_t  ngx_rtmp_monitor_module = {
 };
 
 
-static void
-ngx_rtmp_monitor_dump_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
-        ngx_chain_t *in)
-{
-}
-
 static void
 ngx_rtmp_monitor_consume(ngx_event_t *ev)
 {
@@ -194,7 +197,242 @@ next:
 
     ctx->fps[ctx->curr] = 0;
 
-    ngx_add_timer(&ctx->consume, 1000);
+    ngx_rtmp_wheel_add_timer(&ctx->consume, 1000);
+}
+
+static ngx_rtmp_monitor_ctx_t *
+ngx_rtmp_monitor_get_ctx(ngx_rtmp_session_t *s, ngx_flag_t publishing)
+{
+    ngx_rtmp_monitor_app_conf_t    *macf;
+    ngx_rtmp_monitor_ctx_t         *ctx;
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_monitor_module);
+    if (ctx) {
+        return ctx;
+    }
+
+    macf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_monitor_module);
+
+    ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_monitor_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_monitor_module);
+
+    ctx->dump = macf->dump_path.len > 0;
+    ctx->dump_file.fd = NGX_INVALID_FILE;
+    ctx->publishing = publishing;
+
+    if (macf->monitor) {
+        ctx->consume.data = s;
+        ctx->consume.log = s->log;
+        ctx->consume.handler = ngx_rtmp_monitor_consume;
+        ngx_rtmp_wheel_add_timer(&ctx->consume, 1000);
+    }
+
+    return ctx;
+}
+
+static ngx_int_t
+ngx_rtmp_monitor_dump_flush(ngx_rtmp_monitor_ctx_t *ctx)
+{
+    ngx_buf_t                      *b;
+    ssize_t                         n;
+
+    b = ctx->dump_buf;
+    ctx->dump_flush = ngx_current_msec;
+
+    if (b == NULL || b->pos == b->last) {
+        return NGX_OK;
+    }
+
+    n = ngx_write_file(&ctx->dump_file, b->pos, b->last - b->pos,
+                       ctx->dump_file.offset);
+
+    b->pos = b->start;
+    b->last = b->start;
+
+    return n == NGX_ERROR ? NGX_ERROR : NGX_OK;
+}
+
+static ngx_int_t
+ngx_rtmp_monitor_dump_write(ngx_rtmp_monitor_ctx_t *ctx, u_char *p,
+        size_t len)
+{
+    ngx_buf_t                      *b;
+    size_t                          n;
+
+    b = ctx->dump_buf;
+
+    while (len) {
+        if (b->last == b->end
+            && ngx_rtmp_monitor_dump_flush(ctx) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        n = ngx_min(len, (size_t) (b->end - b->last));
+        b->last = ngx_cpymem(b->last, p, n);
+        p += n;
+        len -= n;
+    }
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_rtmp_monitor_dump_open(ngx_rtmp_session_t *s, ngx_rtmp_monitor_ctx_t *ctx)
+{
+    ngx_rtmp_monitor_app_conf_t    *macf;
+    u_char                         *path, *p, *last;
+    u_char                          header[NGX_RTMP_MONITOR_DUMP_HEADER];
+    size_t                          len;
+
+    macf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_monitor_module);
+
+    len = macf->dump_path.len + 1 + s->app.len + 1 + s->name.len + 1
+        + NGX_TIME_T_LEN + 1 + NGX_INT64_LEN + sizeof(".dump");
+
+    path = ngx_pnalloc(s->pool, len);
+    if (path == NULL) {
+        return NGX_ERROR;
+    }
+
+    last = ngx_snprintf(path, len, "%V/%V-%V-%T-%P.dump%Z", &macf->dump_path,
+                        &s->app, &s->name, ngx_time(), ngx_pid);
+
+    /* app and name may have '/' */
+    for (p = path + macf->dump_path.len + 1; p < last; ++p) {
+        if (*p == '/') {
+            *p = '_';
+        }
+    }
+
+    ctx->dump_file.fd = ngx_open_file(path, NGX_FILE_WRONLY,
+                                      NGX_FILE_TRUNCATE,
+                                      NGX_FILE_DEFAULT_ACCESS);
+    if (ctx->dump_file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                "monitor, dump open '%s' failed", path);
+        return NGX_ERROR;
+    }
+
+    ctx->dump_file.name.data = path;
+    ctx->dump_file.name.len = last - path - 1;
+    ctx->dump_file.log = s->log;
+    ctx->dump_file.offset = 0;
+    ctx->dump_epoch = ngx_current_msec;
+    ctx->dump_flush = ngx_current_msec;
+
+    ctx->dump_buf = ngx_create_temp_buf(s->pool,
+                                        NGX_RTMP_MONITOR_DUMP_BUFSIZE);
+    if (ctx->dump_buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(header, sizeof(header));
+    ngx_memcpy(header, NGX_RTMP_MONITOR_DUMP_MAGIC, 4);
+    header[4] = NGX_RTMP_MONITOR_DUMP_VERSION;
+
+    ngx_rtmp_monitor_dump_write(ctx, header, sizeof(header));
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0, "monitor, dump to '%V'",
+            &ctx->dump_file.name);
+
+    return NGX_OK;
+}
+
+static void
+ngx_rtmp_monitor_dump_close(ngx_rtmp_monitor_ctx_t *ctx)
+{
+    if (ctx->dump_file.fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    /* records buffered are dropped if dump already failed */
+    if (ctx->dump && ngx_rtmp_monitor_dump_flush(ctx) != NGX_OK) {
+        ngx_log_error(NGX_LOG_ERR, ctx->dump_file.log, 0,
+                "monitor, dump write '%V' failed", &ctx->dump_file.name);
+    }
+
+    if (ngx_close_file(ctx->dump_file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, ctx->dump_file.log, ngx_errno,
+                "monitor, dump close '%V' failed", &ctx->dump_file.name);
+    }
+
+    ctx->dump_file.fd = NGX_INVALID_FILE;
+}
+
+/* record message with arrival time, see ngx_rtmp_monitor_module.h */
+static void
+ngx_rtmp_monitor_dump_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+        ngx_chain_t *in)
+{
+    ngx_rtmp_monitor_app_conf_t    *macf;
+    ngx_rtmp_monitor_ctx_t         *ctx;
+    u_char                          hdr[NGX_RTMP_MONITOR_DUMP_RECORD], *p;
+    ngx_msec_t                      arrival;
+
+    macf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_monitor_module);
+    if (macf == NULL || macf->dump_path.len == 0) {
+        return;
+    }
+
+    ctx = ngx_rtmp_monitor_get_ctx(s, 1);
+    if (ctx == NULL || !ctx->dump) {
+        return;
+    }
+
+    if (ctx->dump_file.fd == NGX_INVALID_FILE
+        && ngx_rtmp_monitor_dump_open(s, ctx) != NGX_OK)
+    {
+        ctx->dump = 0;
+        ngx_rtmp_monitor_dump_close(ctx);
+        return;
+    }
+
+    arrival = ngx_current_msec - ctx->dump_epoch;
+
+    p = hdr;
+    *p++ = (u_char) (arrival >> 24);
+    *p++ = (u_char) (arrival >> 16);
+    *p++ = (u_char) (arrival >> 8);
+    *p++ = (u_char) arrival;
+    *p++ = h->type;
+    *p++ = (u_char) (h->timestamp >> 24);
+    *p++ = (u_char) (h->timestamp >> 16);
+    *p++ = (u_char) (h->timestamp >> 8);
+    *p++ = (u_char) h->timestamp;
+    *p++ = (u_char) (h->mlen >> 16);
+    *p++ = (u_char) (h->mlen >> 8);
+    *p++ = (u_char) h->mlen;
+
+    if (ngx_rtmp_monitor_dump_write(ctx, hdr, sizeof(hdr)) != NGX_OK) {
+        goto failed;
+    }
+
+    for (; in; in = in->next) {
+        if (ngx_rtmp_monitor_dump_write(ctx, in->buf->pos,
+                                        in->buf->last - in->buf->pos)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    if (ngx_current_msec - ctx->dump_flush >= NGX_RTMP_MONITOR_DUMP_FLUSH
+        && ngx_rtmp_monitor_dump_flush(ctx) != NGX_OK)
+    {
+        goto failed;
+    }
+
+    return;
+
+failed:
+    ngx_log_error(NGX_LOG_ERR, s->log, 0, "monitor, dump write '%V' failed",
+            &ctx->dump_file.name);
+    ctx->dump = 0;
+    ngx_rtmp_monitor_dump_close(ctx);
 }
 
 static ngx_int_t
@@ -220,6 +458,17 @@ ngx_rtmp_monitor_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
     return NGX_OK;
 }
 
+static ngx_int_t
+ngx_rtmp_monitor_dump_meta(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+        ngx_chain_t *in)
+{
+    if (s->publishing) {
+        ngx_rtmp_monitor_dump_frame(s, h, in);
+    }
+
+    return NGX_OK;
+}
+
 static ngx_int_t
 ngx_rtmp_monitor_meta_data(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         ngx_chain_t *in)
@@ -247,13 +496,15 @@ ngx_rtmp_monitor_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
     }
 
     if (ctx->consume.timer_set) {
-        ngx_del_timer(&ctx->consume);
+        ngx_rtmp_wheel_del_timer(&ctx->consume);
     }
 
     if (ctx->consume.posted) {
         ngx_delete_posted_event(&ctx->consume);
     }
 
+    ngx_rtmp_monitor_dump_close(ctx);
+
 next:
     return next_close_stream(s, v);
 }
@@ -283,6 +534,10 @@ ngx_rtmp_monitor_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         s->stage = NGX_LIVE_AV;
         s->first_video = ngx_current_msec;
         s->first_data = s->first_data == 0? ngx_current_msec: s->first_data;
+
+        if (!publishing) {
+            ngx_rtmp_ttff_first_frame(s);
+        }
     }
 
     if (h->type == NGX_RTMP_MSG_AUDIO && is_header) {
@@ -301,6 +556,10 @@ ngx_rtmp_monitor_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         }
     }
 
+    if (publishing) {
+        ngx_rtmp_monitor_dump_frame(s, h, in);
+    }
+
     if (h->type != NGX_RTMP_MSG_VIDEO) {
         return;
     }
@@ -311,26 +570,9 @@ ngx_rtmp_monitor_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         return;
     }
 
-    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_monitor_module);
-
+    ctx = ngx_rtmp_monitor_get_ctx(s, publishing);
     if (ctx == NULL) {
-        ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_monitor_ctx_t));
-        if (ctx == NULL) {
-            return;
-        }
-        ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_monitor_module);
-
-        ctx->dump = macf->dump_path.len > 0;
-        ctx->publishing = publishing;
-
-        ctx->consume.data = s;
-        ctx->consume.log = s->log;
-        ctx->consume.handler = ngx_rtmp_monitor_consume;
-        ngx_add_timer(&ctx->consume, 1000);
-    }
-
-    if (publishing && ctx->dump) {
-        ngx_rtmp_monitor_dump_frame(s, h, in);
+        return;
     }
 
     if (is_header) {
@@ -436,6 +678,9 @@ ngx_rtmp_monitor_postconfiguration(ngx_conf_t *cf)
     h = ngx_array_push(&cmcf->events[NGX_RTMP_MSG_VIDEO]);
     *h = ngx_rtmp_monitor_av;
 
+    h = ngx_array_push(&cmcf->events[NGX_RTMP_MSG_AMF_META]);
+    *h = ngx_rtmp_monitor_dump_meta;
+
     /* register metadata handler */
     ch = ngx_array_push(&cmcf->amf);
     if (ch == NULL) {
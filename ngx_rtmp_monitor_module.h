@@ -13,6 +13,20 @@
 #include "ngx_rtmp.h"
 
 
+/*
+ * dump file of publisher ingest, one per publish session, written into dump
+ * path as app-name-time-pid.dump, replayed by test/load/ngx_rtmp_load
+ *      header: "NRTD" version(1) reserved(3)
+ *      record: arrival(4) type(1) timestamp(4) size(3) data(size)
+ * integers are big endian, arrival is msec since first record, audio, video
+ * and amf0 data messages are recorded as received
+ */
+#define NGX_RTMP_MONITOR_DUMP_MAGIC     "NRTD"
+#define NGX_RTMP_MONITOR_DUMP_VERSION   1
+#define NGX_RTMP_MONITOR_DUMP_HEADER    8
+#define NGX_RTMP_MONITOR_DUMP_RECORD    12
+
+
 void ngx_rtmp_monitor_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
         ngx_chain_t *in, ngx_flag_t is_header, ngx_flag_t publishing);
 
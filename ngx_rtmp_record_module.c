@@ -363,6 +363,102 @@ ngx_rtmp_record_find(ngx_rtmp_record_app_conf_t *racf, ngx_str_t *id)
 }
 
 
+ngx_int_t
+ngx_rtmp_record_index_seek(ngx_str_t *path, ngx_log_t *log, uint32_t time,
+                           off_t *header, off_t *offset)
+{
+    ngx_rtmp_record_index_t    *index;
+    ngx_file_info_t             fi;
+    ngx_fd_t                    fd;
+    ngx_uint_t                  n, first, lo, hi, mid;
+    size_t                      size;
+    ngx_int_t                   rc;
+    u_char                     *p;
+    u_char                      name[NGX_MAX_PATH + sizeof(".idx")];
+
+    if (path->len >= NGX_MAX_PATH) {
+        return NGX_DECLINED;
+    }
+
+    p = ngx_cpymem(name, path->data, path->len);
+    ngx_memcpy(p, ".idx", sizeof(".idx"));
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_debug1(NGX_LOG_DEBUG_RTMP, log, ngx_errno,
+                       "record: no index '%s'", name);
+        return NGX_DECLINED;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      ngx_fd_info_n " '%s' failed", name);
+        goto done;
+    }
+
+    n = ngx_file_size(&fi) / sizeof(ngx_rtmp_record_index_t);
+    if (n == 0) {
+        rc = NGX_DECLINED;
+        goto done;
+    }
+
+    size = n * sizeof(ngx_rtmp_record_index_t);
+
+    index = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (index == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ERR, log, ngx_errno,
+                      "mmap(%uz) '%s' failed", size, name);
+        goto done;
+    }
+
+    lo = 0;
+    *header = NGX_RTMP_RECORD_HEADER_SIZE;
+
+    if (index[0].flags & NGX_RTMP_RECORD_INDEX_HEADER) {
+        *header = index[0].offset;
+        lo = 1;
+    }
+
+    /* first keyframe whose time is not less than time */
+    first = lo;
+    hi = n;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (index[mid].time < time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < n) {
+        *offset = index[lo].offset;
+        rc = NGX_OK;
+
+    } else {
+        /* audio only record has no keyframe */
+        rc = (first == n) ? NGX_DECLINED : NGX_DONE;
+    }
+
+    if (munmap(index, size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(%uz) '%s' failed", size, name);
+    }
+
+done:
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " '%s' failed", name);
+    }
+
+    return rc;
+}
+
+
 /* This funcion returns pointer to a static buffer */
 static void
 ngx_rtmp_record_make_path(ngx_rtmp_session_t *s,
@@ -441,6 +537,7 @@ ngx_rtmp_record_node_open(ngx_rtmp_session_t *s,
     u_char                      buf[8], *p;
     off_t                       file_size;
     uint32_t                    tag_size, mlen, timestamp;
+    ngx_array_t                *index;
 
     rracf = rctx->conf;
     tag_size = 0;
@@ -452,9 +549,17 @@ ngx_rtmp_record_node_open(ngx_rtmp_session_t *s,
     ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
                    "record: %V opening", &rracf->id);
 
+    /* keep index array allocated for previous file */
+    index = rctx->index;
+
     ngx_memzero(rctx, sizeof(*rctx));
     rctx->conf = rracf;
+    rctx->index = index;
     rctx->last = *ngx_cached_time;
+
+    if (index) {
+        index->nelts = 0;
+    }
     rctx->timestamp = ngx_cached_time->sec;
 
     ngx_rtmp_record_make_path(s, rctx, &path);
@@ -605,7 +710,7 @@ ngx_rtmp_record_init(ngx_rtmp_session_t *s)
         return NGX_OK;
     }
 
-    ctx = ngx_pcalloc(s->connection->pool, sizeof(ngx_rtmp_record_ctx_t));
+    ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_record_ctx_t));
 
     if (ctx == NULL) {
         return NGX_ERROR;
@@ -613,7 +718,7 @@ ngx_rtmp_record_init(ngx_rtmp_session_t *s)
 
     ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_record_module);
 
-    if (ngx_array_init(&ctx->rec, s->connection->pool, racf->rec.nelts,
+    if (ngx_array_init(&ctx->rec, s->pool, racf->rec.nelts,
                        sizeof(ngx_rtmp_record_rec_ctx_t))
         != NGX_OK)
     {
@@ -780,6 +885,59 @@ next:
 }
 
 
+static void
+ngx_rtmp_record_write_index(ngx_rtmp_session_t *s,
+                            ngx_rtmp_record_rec_ctx_t *rctx)
+{
+    ngx_rtmp_record_app_conf_t *rracf;
+    ngx_str_t                   path;
+    ngx_fd_t                    fd;
+    ngx_int_t                   mode, create_mode;
+    size_t                      size;
+    u_char                     *p;
+    u_char                      name[NGX_MAX_PATH + sizeof(".idx")];
+
+    rracf = rctx->conf;
+
+    if (rctx->index == NULL || !rctx->initialized) {
+        return;
+    }
+
+    ngx_rtmp_record_make_path(s, rctx, &path);
+
+    p = ngx_cpymem(name, path.data, path.len);
+    ngx_memcpy(p, ".idx", sizeof(".idx"));
+
+    /* index of appended record continues the old one */
+    mode = rracf->append ? NGX_FILE_APPEND : NGX_FILE_WRONLY;
+    create_mode = rracf->append ? NGX_FILE_CREATE_OR_OPEN : NGX_FILE_TRUNCATE;
+
+    fd = ngx_open_file(name, mode, create_mode, NGX_FILE_DEFAULT_ACCESS);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, s->log, ngx_errno,
+                      "record: %V failed to open index '%s'",
+                      &rracf->id, name);
+        return;
+    }
+
+    size = rctx->index->nelts * sizeof(ngx_rtmp_record_index_t);
+
+    if (size && ngx_write_fd(fd, rctx->index->elts, size) != (ssize_t) size) {
+        ngx_log_error(NGX_LOG_CRIT, s->log, ngx_errno,
+                      "record: %V error writing index '%s'",
+                      &rracf->id, name);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, s->log, ngx_errno,
+                      "record: %V error closing index '%s'",
+                      &rracf->id, name);
+    }
+
+    rctx->index->nelts = 0;
+}
+
+
 static ngx_int_t
 ngx_rtmp_record_node_close(ngx_rtmp_session_t *s,
                            ngx_rtmp_record_rec_ctx_t *rctx)
@@ -814,6 +972,8 @@ ngx_rtmp_record_node_close(ngx_rtmp_session_t *s,
         }
     }
 
+    ngx_rtmp_record_write_index(s, rctx);
+
     if (ngx_close_file(rctx->file.fd) == NGX_FILE_ERROR) {
         err = ngx_errno;
         ngx_log_error(NGX_LOG_CRIT, s->log, err,
@@ -867,6 +1027,61 @@ next:
 }
 
 
+static void
+ngx_rtmp_record_index_frame(ngx_rtmp_session_t *s,
+                            ngx_rtmp_record_rec_ctx_t *rctx,
+                            ngx_rtmp_header_t *h, ngx_chain_t *in,
+                            uint32_t timestamp, off_t offset)
+{
+    ngx_rtmp_record_index_t    *e;
+    ngx_int_t                   keyframe;
+
+    if (ngx_rtmp_is_codec_header(in)) {
+        return;
+    }
+
+    keyframe = (h->type == NGX_RTMP_MSG_VIDEO &&
+                ngx_rtmp_get_video_frame_type(in) == NGX_RTMP_VIDEO_KEY_FRAME);
+
+    if (!keyframe && !rctx->index_header) {
+        return;
+    }
+
+    if (rctx->index == NULL) {
+        rctx->index = ngx_array_create(s->pool, 64,
+                                       sizeof(ngx_rtmp_record_index_t));
+        if (rctx->index == NULL) {
+            return;
+        }
+    }
+
+    /* codec headers are all before first media frame */
+    if (rctx->index_header) {
+        e = ngx_array_push(rctx->index);
+        if (e == NULL) {
+            return;
+        }
+
+        e->time = timestamp;
+        e->flags = NGX_RTMP_RECORD_INDEX_HEADER;
+        e->offset = offset;
+
+        rctx->index_header = 0;
+    }
+
+    if (keyframe) {
+        e = ngx_array_push(rctx->index);
+        if (e == NULL) {
+            return;
+        }
+
+        e->time = timestamp;
+        e->flags = NGX_RTMP_RECORD_INDEX_KEY;
+        e->offset = offset;
+    }
+}
+
+
 static ngx_int_t
 ngx_rtmp_record_write_frame(ngx_rtmp_session_t *s,
                             ngx_rtmp_record_rec_ctx_t *rctx,
@@ -875,6 +1090,7 @@ ngx_rtmp_record_write_frame(ngx_rtmp_session_t *s,
 {
     u_char                      hdr[11], *p, *ph;
     uint32_t                    timestamp, tag_size;
+    off_t                       offset;
     ngx_rtmp_record_app_conf_t *rracf;
 
     rracf = rctx->conf;
@@ -919,6 +1135,7 @@ ngx_rtmp_record_write_frame(ngx_rtmp_session_t *s,
     *ph++ = 0;
 
     tag_size = (ph - hdr) + h->mlen;
+    offset = rctx->file.offset;
 
     if (ngx_write_file(&rctx->file, hdr, ph - hdr, rctx->file.offset)
         == NGX_ERROR)
@@ -967,6 +1184,10 @@ ngx_rtmp_record_write_frame(ngx_rtmp_session_t *s,
 
     rctx->nframes += inc_nframes;
 
+    if (inc_nframes) {
+        ngx_rtmp_record_index_frame(s, rctx, h, in, timestamp, offset);
+    }
+
     /* watch max size */
     if ((rracf->max_size && rctx->file.offset >= (ngx_int_t) rracf->max_size) ||
         (rracf->max_frames && rctx->nframes >= rracf->max_frames))
@@ -1089,6 +1310,7 @@ ngx_rtmp_record_node_av(ngx_rtmp_session_t *s, ngx_rtmp_record_rec_ctx_t *rctx,
 
         rctx->initialized = 1;
         rctx->epoch = h->timestamp - rctx->time_shift;
+        rctx->index_header = (rctx->file.offset == 0);
 
         if (rctx->file.offset == 0 &&
             ngx_rtmp_record_write_header(&rctx->file) != NGX_OK)
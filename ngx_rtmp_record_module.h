@@ -20,6 +20,25 @@
 #define NGX_RTMP_RECORD_MANUAL          0x10
 
 
+/* FLV header and PreviousTagSize0 */
+#define NGX_RTMP_RECORD_HEADER_SIZE     13
+
+
+/* flags of keyframe index entry */
+#define NGX_RTMP_RECORD_INDEX_HEADER    0x01
+#define NGX_RTMP_RECORD_INDEX_KEY       0x02
+
+
+/* entry of <record>.idx written beside record file when it is closed,
+ * first entry with NGX_RTMP_RECORD_INDEX_HEADER is the end of codec headers,
+ * others are video keyframes in timestamp order */
+typedef struct {
+    uint32_t                            time;
+    uint32_t                            flags;
+    uint64_t                            offset;
+} ngx_rtmp_record_index_t;
+
+
 typedef struct {
     ngx_str_t                           id;
     ngx_uint_t                          flags;
@@ -46,6 +65,7 @@ typedef struct {
     uint32_t                            epoch, time_shift;
     ngx_time_t                          last;
     time_t                              timestamp;
+    ngx_array_t                        *index; /* ngx_rtmp_record_index_t */
     unsigned                            failed:1;
     unsigned                            initialized:1;
     unsigned                            aac_header_sent:1;
@@ -53,6 +73,7 @@ typedef struct {
     unsigned                            video_key_sent:1;
     unsigned                            audio:1;
     unsigned                            video:1;
+    unsigned                            index_header:1;
 } ngx_rtmp_record_rec_ctx_t;
 
 
@@ -77,6 +98,14 @@ ngx_int_t ngx_rtmp_record_close(ngx_rtmp_session_t *s, ngx_uint_t n,
           ngx_str_t *path);
 
 
+/* Find first keyframe at or after time in record file by its index,
+ * header is end of codec headers, offset is the keyframe tag,
+ * return NGX_DECLINED if no index, NGX_DONE if time after last keyframe */
+
+ngx_int_t ngx_rtmp_record_index_seek(ngx_str_t *path, ngx_log_t *log,
+          uint32_t time, off_t *header, off_t *offset);
+
+
 typedef struct {
     ngx_str_t                           recorder;
     ngx_str_t                           path;
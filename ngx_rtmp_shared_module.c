@@ -7,15 +7,44 @@
 #include <ngx_core.h>
 #include "ngx_rtmp.h"
 #include "ngx_rbuf.h"
+#include "ngx_live.h"
 
 
 static void *ngx_rtmp_shared_create_conf(ngx_cycle_t *cycle);
 static char *ngx_rtmp_shared_init_conf(ngx_cycle_t *cycle, void *conf);
+static void ngx_rtmp_shrink_out_queue(ngx_rtmp_session_t *s);
+static void ngx_rtmp_sent_merge_frame(ngx_rtmp_session_t *s);
 
 
 /* 1316 == 188 * 7 RTP pack 7 MPEG-TS packets as a RTP package */
 #define NGX_MPEGTS_BUF_SIZE   1316
 
+/* initial out queue size, must be power of 2 */
+#define NGX_RTMP_OUT_QUEUE_MIN      16
+/* period of checking out queue occupancy for shrinking */
+#define NGX_RTMP_OUT_QUEUE_IDLE     10000
+/* buckets of out queue size distribution: none, 16, 32, ..., >= 256K */
+#define NGX_RTMP_OUT_QUEUE_BUCKETS  16
+
+/* session role for memory statistics */
+enum {
+    NGX_RTMP_SHARED_PUBLISHER,
+    NGX_RTMP_SHARED_RTMP_PLAYER,
+    NGX_RTMP_SHARED_FLV_PLAYER,
+    NGX_RTMP_SHARED_TS_PLAYER,
+    NGX_RTMP_SHARED_RELAY,
+    NGX_RTMP_SHARED_MAX_ROLE
+};
+
+static char *ngx_rtmp_shared_role[] = {
+    "publisher",
+    "rtmp player",
+    "flv player",
+    "hls/ts player",
+    "relay",
+};
+
+
 typedef struct {
     ngx_rtmp_frame_t           *free_frame;
     ngx_mpegts_frame_t         *free_mpegts_frame;
@@ -97,8 +126,41 @@ ngx_rtmp_prepare_merge_frame(ngx_rtmp_session_t *s)
 
     cacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_core_module);
 
+    ngx_rtmp_sent_merge_frame(s);
     ngx_rtmp_free_merge_frame(s);
 
+    // all frames queued will be sent, start a new coalescing window
+    s->coalesce_bytes = 0;
+    s->coalesce_flush = 0;
+    if (s->coalesce_evt.timer_set) {
+        ngx_del_timer(&s->coalesce_evt);
+    }
+
+    // merge arrays is empty now, realloc if merge_frame larger in new app
+    if (s->merge_size < cacf->merge_frame) {
+        s->merge = ngx_pcalloc(s->pool,
+                               sizeof(ngx_chain_t *) * cacf->merge_frame);
+        if (s->merge == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (s->live_type == NGX_MPEGTS_LIVE) {
+            s->prepare_mpegts_frame = ngx_pcalloc(s->pool,
+                    sizeof(ngx_mpegts_frame_t *) * cacf->merge_frame);
+            if (s->prepare_mpegts_frame == NULL) {
+                return NGX_ERROR;
+            }
+        } else {
+            s->prepare_frame = ngx_pcalloc(s->pool,
+                    sizeof(ngx_rtmp_frame_t *) * cacf->merge_frame);
+            if (s->prepare_frame == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        s->merge_size = cacf->merge_frame;
+    }
+
     ln = &s->out_chain;
 
     for (n = 0; n < cacf->merge_frame && s->out_pos != s->out_last; ++n) {
@@ -128,15 +190,50 @@ ngx_rtmp_prepare_merge_frame(ngx_rtmp_session_t *s)
             s->prepare_frame[n] = s->out[s->out_pos];
         }
 
-        ++s->out_pos;
-        s->out_pos %= s->out_queue;
+        s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
     }
 
     s->nframe = n;
 
+    ngx_rtmp_shrink_out_queue(s);
+
     return NGX_OK;
 }
 
+/* frames prepared last time have been sent completely */
+static void
+ngx_rtmp_sent_merge_frame(ngx_rtmp_session_t *s)
+{
+    ngx_rtmp_histogram_t       *h;
+    ngx_rtmp_frame_t           *frame;
+    ngx_mpegts_frame_t         *mframe;
+    ngx_uint_t                  n;
+
+    if (s->live_stream == NULL) {
+        return;
+    }
+
+    h = &s->live_stream->send_delay;
+
+    if (s->live_type == NGX_MPEGTS_LIVE) {
+        for (n = 0; n < s->nframe; ++n) {
+            mframe = s->prepare_mpegts_frame[n];
+            if (mframe->type == NGX_MPEGTS_MSG_AUDIO
+                || mframe->type == NGX_MPEGTS_MSG_VIDEO)
+            {
+                ngx_rtmp_histogram_add(h, ngx_current_msec - mframe->time);
+            }
+        }
+    } else {
+        for (n = 0; n < s->nframe; ++n) {
+            frame = s->prepare_frame[n];
+            if (ngx_rtmp_is_latency_frame(frame)) {
+                ngx_rtmp_histogram_add(h, ngx_current_msec - frame->time);
+            }
+        }
+    }
+}
+
 void
 ngx_rtmp_free_merge_frame(ngx_rtmp_session_t *s)
 {
@@ -161,6 +258,225 @@ ngx_rtmp_free_merge_frame(ngx_rtmp_session_t *s)
     }
 }
 
+size_t
+ngx_rtmp_out_queue_max(ngx_rtmp_session_t *s)
+{
+    size_t                      size;
+
+    size = NGX_RTMP_OUT_QUEUE_MIN;
+    while (size < s->out_queue) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+static ngx_int_t
+ngx_rtmp_resize_out_queue(ngx_rtmp_session_t *s, size_t size)
+{
+    void                      **out, **old;
+    size_t                      pos, n;
+
+    if (s->live_type == NGX_MPEGTS_LIVE || s->live_type == NGX_HLS_LIVE) {
+        old = (void **) s->mpegts_out;
+    } else {
+        old = (void **) s->out;
+    }
+
+    out = ngx_alloc(sizeof(void *) * size, s->log);
+    if (out == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* move frames in queue to the head of new queue */
+    n = 0;
+    if (old) {
+        for (pos = s->out_pos; pos != s->out_last;
+             pos = ngx_rtmp_out_next(s, pos))
+        {
+            out[n++] = old[pos];
+        }
+
+        ngx_free(old);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_RTMP, s->log, 0,
+            "resize out queue %uz -> %uz, nmsg=%uz", s->out_size, size, n);
+
+    if (s->live_type == NGX_MPEGTS_LIVE || s->live_type == NGX_HLS_LIVE) {
+        s->mpegts_out = (ngx_mpegts_frame_t **) out;
+    } else {
+        s->out = (ngx_rtmp_frame_t **) out;
+    }
+
+    s->out_pos = 0;
+    s->out_last = n;
+    s->out_size = size;
+    s->out_peak = n;
+    s->out_resize_time = ngx_current_msec;
+
+    return NGX_OK;
+}
+
+static void
+ngx_rtmp_shrink_out_queue(ngx_rtmp_session_t *s)
+{
+    if (s->out_size <= NGX_RTMP_OUT_QUEUE_MIN || s->out_pos != s->out_last
+        || ngx_current_msec - s->out_resize_time < NGX_RTMP_OUT_QUEUE_IDLE)
+    {
+        return;
+    }
+
+    /* peak occupancy in last period less than a quarter, halve the queue */
+    if (s->out_peak < s->out_size / 4) {
+        if (ngx_rtmp_resize_out_queue(s, s->out_size / 2) == NGX_OK) {
+            return;
+        }
+    }
+
+    s->out_peak = 0;
+    s->out_resize_time = ngx_current_msec;
+}
+
+ngx_int_t
+ngx_rtmp_alloc_out_queue(ngx_rtmp_session_t *s)
+{
+    size_t                      nmsg;
+
+    if (s->out_size == 0) {
+        return ngx_rtmp_resize_out_queue(s, NGX_RTMP_OUT_QUEUE_MIN);
+    }
+
+    /* msgs in queue after new frame linked */
+    nmsg = ngx_rtmp_out_nmsg(s) + 1;
+    if (nmsg > s->out_peak) {
+        s->out_peak = nmsg;
+    }
+
+    /* always leave 1 slot free */
+    if (nmsg < s->out_size) {
+        return NGX_OK;
+    }
+
+    if (s->out_size >= ngx_rtmp_out_queue_max(s)) {
+        return NGX_AGAIN;
+    }
+
+    return ngx_rtmp_resize_out_queue(s, s->out_size * 2);
+}
+
+void
+ngx_rtmp_free_out_queue(ngx_rtmp_session_t *s)
+{
+    if (s->mpegts_out) {
+        while (s->out_pos != s->out_last) {
+            ngx_rtmp_shared_free_mpegts_frame(s->mpegts_out[s->out_pos]);
+            s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
+        }
+
+        ngx_free(s->mpegts_out);
+        s->mpegts_out = NULL;
+
+    } else if (s->out) {
+        while (s->out_pos != s->out_last) {
+            ngx_rtmp_shared_free_frame(s->out[s->out_pos]);
+            s->out_pos = ngx_rtmp_out_next(s, s->out_pos);
+        }
+
+        ngx_free(s->out);
+        s->out = NULL;
+    }
+
+    s->out_pos = 0;
+    s->out_last = 0;
+    s->out_size = 0;
+}
+
+static void
+ngx_rtmp_coalesce_handler(ngx_event_t *ev)
+{
+    ngx_rtmp_session_t         *s;
+    ngx_connection_t           *c;
+
+    s = ev->data;
+    c = s->connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_RTMP, s->log, 0,
+            "coalesce timeout, send %uz bytes", s->coalesce_bytes);
+
+    if (c && !c->write->active) {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+}
+
+void
+ngx_rtmp_coalesce_frame(ngx_rtmp_session_t *s, size_t size, ngx_flag_t flush)
+{
+    s->coalesce_bytes += size;
+
+    if (flush) {
+        s->coalesce_flush = 1;
+    }
+}
+
+ngx_flag_t
+ngx_rtmp_coalesce_delay(ngx_rtmp_session_t *s)
+{
+    ngx_rtmp_core_app_conf_t   *cacf;
+
+    cacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_core_module);
+
+    if (cacf->coalesce_time == 0 || s->coalesce_flush
+        || s->coalesce_bytes >= cacf->coalesce_size)
+    {
+        if (s->coalesce_evt.timer_set) {
+            ngx_del_timer(&s->coalesce_evt);
+        }
+
+        return 0;
+    }
+
+    /* first frame in window, wait for more frames */
+    if (!s->coalesce_evt.timer_set) {
+        s->coalesce_evt.data = s;
+        s->coalesce_evt.log = s->log;
+        s->coalesce_evt.handler = ngx_rtmp_coalesce_handler;
+
+        ngx_add_timer(&s->coalesce_evt, cacf->coalesce_time);
+    }
+
+    return 1;
+}
+
+size_t
+ngx_rtmp_session_size(ngx_rtmp_session_t *s)
+{
+    ngx_rtmp_core_srv_conf_t   *cscf;
+    size_t                      size;
+
+    size = sizeof(ngx_rtmp_session_t) + sizeof(void *) * ngx_rtmp_max_module;
+
+    cscf = ngx_rtmp_get_module_srv_conf(s, ngx_rtmp_core_module);
+    if (s->in_streams) {
+        size += sizeof(ngx_rtmp_stream_t) * cscf->max_streams;
+    }
+
+    if (s->out) {
+        size += sizeof(ngx_rtmp_frame_t *) * s->out_size;
+    }
+
+    if (s->mpegts_out) {
+        size += sizeof(ngx_mpegts_frame_t *) * s->out_size;
+    }
+
+    if (s->merge) {
+        size += sizeof(ngx_chain_t *) * s->merge_size;
+        size += sizeof(void *) * s->merge_size;  /* prepare frame */
+    }
+
+    return size;
+}
+
 void
 ngx_rtmp_shared_append_chain(ngx_rtmp_frame_t *frame, size_t size,
         ngx_chain_t *cl, ngx_flag_t mandatory)
@@ -228,6 +544,11 @@ ngx_rtmp_shared_alloc_frame(size_t size, ngx_chain_t *cl, ngx_flag_t mandatory)
     }
 
     frame->ref = 1;
+    frame->time = ngx_current_msec;
+    frame->agg_id = 0;
+    frame->agg_seq = 0;
+    frame->aggregate = NULL;
+    frame->naggregate = 0;
     frame->next = NULL;
 
     ngx_rtmp_shared_append_chain(frame, size, cl, mandatory);
@@ -235,6 +556,80 @@ ngx_rtmp_shared_alloc_frame(size_t size, ngx_chain_t *cl, ngx_flag_t mandatory)
     return frame;
 }
 
+ngx_rtmp_frame_t *
+ngx_rtmp_shared_alloc_aggregate(size_t size, ngx_rtmp_frame_t **frames,
+        ngx_uint_t n)
+{
+    ngx_rtmp_frame_t           *frame, *f;
+    ngx_chain_t                 tcl, *cl;
+    ngx_buf_t                   tb;
+    u_char                      th[11], *p;
+    uint32_t                    mlen, timestamp;
+    ngx_uint_t                  i;
+
+    frame = ngx_rtmp_shared_alloc_frame(size, NULL, 0);
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    frame->hdr = frames[0]->hdr;
+    frame->hdr.type = NGX_RTMP_MSG_AGGREGATE;
+    frame->hdr.mlen = 0;
+    frame->av_header = 0;
+    frame->keyframe = frames[0]->keyframe;
+    frame->mandatory = 0;
+    frame->time = frames[0]->time;
+
+    ngx_memzero(&tb, sizeof(tb));
+    tb.pos = th;
+    tcl.buf = &tb;
+    tcl.next = NULL;
+
+    for (i = 0; i < n; ++i) {
+        f = frames[i];
+
+        mlen = 0;
+        for (cl = f->chain; cl; cl = cl->next) {
+            mlen += cl->buf->last - cl->buf->pos;
+        }
+
+        /* flv tag header, stream id is always 0 */
+        timestamp = f->hdr.timestamp;
+
+        p = th;
+        *p++ = f->hdr.type;
+        *p++ = (u_char) (mlen >> 16);
+        *p++ = (u_char) (mlen >> 8);
+        *p++ = (u_char) mlen;
+        *p++ = (u_char) (timestamp >> 16);
+        *p++ = (u_char) (timestamp >> 8);
+        *p++ = (u_char) timestamp;
+        *p++ = (u_char) (timestamp >> 24);
+        *p++ = 0;
+        *p++ = 0;
+        *p++ = 0;
+
+        tb.last = p;
+        ngx_rtmp_shared_append_chain(frame, size, &tcl, 0);
+
+        ngx_rtmp_shared_append_chain(frame, size, f->chain, 0);
+
+        /* previous tag size */
+        p = th;
+        *p++ = (u_char) ((mlen + 11) >> 24);
+        *p++ = (u_char) ((mlen + 11) >> 16);
+        *p++ = (u_char) ((mlen + 11) >> 8);
+        *p++ = (u_char) (mlen + 11);
+
+        tb.last = p;
+        ngx_rtmp_shared_append_chain(frame, size, &tcl, 0);
+
+        frame->hdr.mlen += 11 + mlen + 4;
+    }
+
+    return frame;
+}
+
 void
 ngx_rtmp_shared_free_frame(ngx_rtmp_frame_t *frame)
 {
@@ -248,6 +643,11 @@ ngx_rtmp_shared_free_frame(ngx_rtmp_frame_t *frame)
         return;
     }
 
+    if (frame->aggregate) {
+        ngx_rtmp_shared_free_frame(frame->aggregate);
+        frame->aggregate = NULL;
+    }
+
     /* recycle chainbuf */
     cl = frame->chain;
     while (cl) {
@@ -329,6 +729,7 @@ ngx_rtmp_shared_alloc_mpegts_frame(ngx_chain_t *cl, ngx_flag_t mandatory)
 
     ngx_memset(frame, 0, sizeof(ngx_mpegts_frame_t));
     frame->ref = 1;
+    frame->time = ngx_current_msec;
     frame->next = NULL;
 
     ngx_mpegts_shared_append_chain(frame, cl, mandatory);
@@ -363,6 +764,83 @@ ngx_rtmp_shared_free_mpegts_frame(ngx_mpegts_frame_t *frame)
     ++rscf->nfree_frame;
 }
 
+static ngx_uint_t
+ngx_rtmp_shared_session_role(ngx_rtmp_session_t *s)
+{
+    if (s->relay) {
+        return NGX_RTMP_SHARED_RELAY;
+    }
+
+    if (s->publishing) {
+        return NGX_RTMP_SHARED_PUBLISHER;
+    }
+
+    switch (s->live_type) {
+    case NGX_RTMP_LIVE:
+        return NGX_RTMP_SHARED_RTMP_PLAYER;
+    case NGX_HTTP_FLV_LIVE:
+        return NGX_RTMP_SHARED_FLV_PLAYER;
+    default:
+        return NGX_RTMP_SHARED_TS_PLAYER;
+    }
+}
+
+static void
+ngx_rtmp_shared_session_account(ngx_rtmp_session_t *s, ngx_uint_t *nsession,
+        size_t *size, ngx_uint_t *nqueue)
+{
+    ngx_uint_t                  role, i;
+    size_t                      n;
+
+    role = ngx_rtmp_shared_session_role(s);
+    ++nsession[role];
+    size[role] += ngx_rtmp_session_size(s);
+
+    /* bucket 0 for out queue not allocated */
+    i = 0;
+    if (s->out_size) {
+        for (i = 1, n = NGX_RTMP_OUT_QUEUE_MIN;
+             n < s->out_size && i < NGX_RTMP_OUT_QUEUE_BUCKETS - 1;
+             ++i, n <<= 1)
+        { /* void */ }
+    }
+
+    ++nqueue[i];
+}
+
+static void
+ngx_rtmp_shared_session_stat(ngx_uint_t *nsession, size_t *size,
+        ngx_uint_t *nqueue)
+{
+    ngx_live_conf_t            *lcf;
+    ngx_live_server_t          *srv;
+    ngx_live_stream_t          *st;
+    ngx_rtmp_core_ctx_t        *cctx;
+    size_t                      n, m;
+
+    lcf = (ngx_live_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_live_module);
+
+    for (n = 0; n < lcf->server_buckets; ++n) {
+        for (srv = lcf->servers[n]; srv; srv = srv->next) {
+            for (m = 0; m < lcf->stream_buckets; ++m) {
+                for (st = srv->streams[m]; st; st = st->next) {
+
+                    for (cctx = st->publish_ctx; cctx; cctx = cctx->next) {
+                        ngx_rtmp_shared_session_account(cctx->session,
+                                nsession, size, nqueue);
+                    }
+
+                    for (cctx = st->play_ctx; cctx; cctx = cctx->next) {
+                        ngx_rtmp_shared_session_account(cctx->session,
+                                nsession, size, nqueue);
+                    }
+                }
+            }
+        }
+    }
+}
+
 ngx_chain_t *
 ngx_rtmp_shared_state(ngx_http_request_t *r)
 {
@@ -370,13 +848,28 @@ ngx_rtmp_shared_state(ngx_http_request_t *r)
     ngx_chain_t                *cl;
     ngx_buf_t                  *b;
     size_t                      len;
+    ngx_uint_t                  nsession[NGX_RTMP_SHARED_MAX_ROLE];
+    size_t                      size[NGX_RTMP_SHARED_MAX_ROLE];
+    ngx_uint_t                  nqueue[NGX_RTMP_OUT_QUEUE_BUCKETS];
+    ngx_uint_t                  i;
 
     rscf = (ngx_rtmp_shared_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
                                                    ngx_rtmp_shared_module);
 
+    ngx_memzero(nsession, sizeof(nsession));
+    ngx_memzero(size, sizeof(size));
+    ngx_memzero(nqueue, sizeof(nqueue));
+    ngx_rtmp_shared_session_stat(nsession, size, nqueue);
+
     len = sizeof("##########rtmp shared state##########\n") - 1
         + sizeof("ngx_rtmp_shared alloc frame: \n") - 1 + NGX_OFF_T_LEN
-        + sizeof("ngx_rtmp_shared free frame: \n") - 1 + NGX_OFF_T_LEN;
+        + sizeof("ngx_rtmp_shared free frame: \n") - 1 + NGX_OFF_T_LEN
+        + NGX_RTMP_SHARED_MAX_ROLE
+        * (sizeof("ngx_rtmp_shared hls/ts player: sessions  bytes  "
+                  "bytes per session\n") - 1 + 3 * NGX_OFF_T_LEN)
+        + NGX_RTMP_OUT_QUEUE_BUCKETS
+        * (sizeof("ngx_rtmp_shared out queue >= : \n") - 1
+           + 2 * NGX_OFF_T_LEN);
 
     cl = ngx_alloc_chain_link(r->pool);
     if (cl == NULL) {
@@ -396,5 +889,27 @@ ngx_rtmp_shared_state(ngx_http_request_t *r)
             "ngx_rtmp_shared free frame: %ui\n",
             rscf->nalloc_frame, rscf->nfree_frame);
 
+    for (i = 0; i < NGX_RTMP_SHARED_MAX_ROLE; ++i) {
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "ngx_rtmp_shared %s: sessions %ui bytes %uz "
+                "bytes per session %uz\n",
+                ngx_rtmp_shared_role[i], nsession[i], size[i],
+                nsession[i] ? size[i] / nsession[i] : 0);
+    }
+
+    b->last = ngx_snprintf(b->last, b->end - b->last,
+            "ngx_rtmp_shared out queue none: %ui\n", nqueue[0]);
+
+    for (i = 1; i < NGX_RTMP_OUT_QUEUE_BUCKETS; ++i) {
+        if (nqueue[i] == 0) {
+            continue;
+        }
+
+        b->last = ngx_snprintf(b->last, b->end - b->last,
+                "ngx_rtmp_shared out queue %s%uz: %ui\n",
+                i == NGX_RTMP_OUT_QUEUE_BUCKETS - 1 ? ">= " : "",
+                (size_t) NGX_RTMP_OUT_QUEUE_MIN << (i - 1), nqueue[i]);
+    }
+
     return cl;
 }
@@ -13,6 +13,8 @@
 #include "ngx_rtmp_version.h"
 #include "ngx_rtmp_live_module.h"
 #include "ngx_rtmp_codec_module.h"
+#include "ngx_rtmp_abr_module.h"
+#include "ngx_rtmp_ttff_module.h"
 
 
 static ngx_int_t ngx_rtmp_stat_init_process(ngx_cycle_t *cycle);
@@ -31,6 +33,7 @@ static time_t                       start_time;
 #define NGX_RTMP_STAT_LIVE          0x02
 #define NGX_RTMP_STAT_CLIENTS       0x04
 #define NGX_RTMP_STAT_PLAY          0x08
+#define NGX_RTMP_STAT_TTFF          0x10
 
 /*
  * global: stat-{bufs-{total,free,used}, total bytes in/out, bw in/out} - cscf
@@ -48,6 +51,7 @@ static ngx_conf_bitmask_t           ngx_rtmp_stat_masks[] = {
     { ngx_string("global"),         NGX_RTMP_STAT_GLOBAL        },
     { ngx_string("live"),           NGX_RTMP_STAT_LIVE          },
     { ngx_string("clients"),        NGX_RTMP_STAT_CLIENTS       },
+    { ngx_string("ttff"),           NGX_RTMP_STAT_TTFF          },
     { ngx_null_string,              0 }
 };
 
@@ -351,6 +355,11 @@ ngx_rtmp_stat_client(ngx_http_request_t *r, ngx_chain_t ***lll,
                   (ngx_int_t) (ngx_current_msec - s->epoch)) - buf);
     NGX_RTMP_STAT_L("</time>");
 
+    NGX_RTMP_STAT_L("<memory>");
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uz",
+                  ngx_rtmp_session_size(s)) - buf);
+    NGX_RTMP_STAT_L("</memory>");
+
     if (s->flashver.len) {
         NGX_RTMP_STAT_L("<flashver>");
         NGX_RTMP_STAT_ES(&s->flashver);
@@ -368,6 +377,130 @@ ngx_rtmp_stat_client(ngx_http_request_t *r, ngx_chain_t ***lll,
         NGX_RTMP_STAT_ES(&s->swf_url);
         NGX_RTMP_STAT_L("</swfurl>");
     }
+
+    if (s->tcpinfo.time) {
+        NGX_RTMP_STAT_L("<tcpinfo><rtt>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.rtt) - buf);
+        NGX_RTMP_STAT_L("</rtt><rttvar>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.rttvar) - buf);
+        NGX_RTMP_STAT_L("</rttvar><retrans>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.retrans) - buf);
+        NGX_RTMP_STAT_L("</retrans><cwnd>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.cwnd) - buf);
+        NGX_RTMP_STAT_L("</cwnd><unacked>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.unacked) - buf);
+        NGX_RTMP_STAT_L("</unacked><delivery_rate>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uD",
+                      s->tcpinfo.delivery_rate) - buf);
+        NGX_RTMP_STAT_L("</delivery_rate><age>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%M",
+                      ngx_current_msec - s->tcpinfo.time) - buf);
+        NGX_RTMP_STAT_L("</age></tcpinfo>");
+    }
+}
+
+
+static void
+ngx_rtmp_stat_abr(ngx_http_request_t *r, ngx_chain_t ***lll,
+        ngx_rtmp_abr_ctx_t *ctx)
+{
+    u_char  buf[NGX_INT64_LEN];
+
+    NGX_RTMP_STAT_L("<abr><group>");
+    NGX_RTMP_STAT_ES(&ctx->session->name);
+    NGX_RTMP_STAT_L("</group><rendition>");
+    NGX_RTMP_STAT_ES(&ctx->rendition);
+    NGX_RTMP_STAT_L("</rendition><rate>");
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%uL",
+                  ctx->rate) - buf);
+    NGX_RTMP_STAT_L("</rate><stall>");
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%ui",
+                  ctx->nstall) - buf);
+    NGX_RTMP_STAT_L("</stall><switch_up>");
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%ui",
+                  ctx->nup) - buf);
+    NGX_RTMP_STAT_L("</switch_up><switch_down>");
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "%ui",
+                  ctx->ndown) - buf);
+    NGX_RTMP_STAT_L("</switch_down></abr>");
+}
+
+
+static int ngx_libc_cdecl
+ngx_rtmp_stat_cmp_uint32(const void *one, const void *two)
+{
+    uint32_t    a, b;
+
+    a = *(uint32_t *) one;
+    b = *(uint32_t *) two;
+
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+
+static void
+ngx_rtmp_stat_percentiles(ngx_http_request_t *r, ngx_chain_t ***lll,
+        char *name, ngx_array_t *a)
+{
+    static ngx_uint_t   pcts[] = { 50, 90, 99 };
+
+    uint32_t           *v;
+    ngx_uint_t          n;
+    u_char              buf[NGX_RTMP_STAT_BUFSIZE];
+
+    v = a->elts;
+
+    ngx_qsort(v, a->nelts, sizeof(uint32_t), ngx_rtmp_stat_cmp_uint32);
+
+    NGX_RTMP_STAT_L("<");
+    NGX_RTMP_STAT_CS(name);
+    NGX_RTMP_STAT_L(">");
+
+    for (n = 0; n < sizeof(pcts) / sizeof(pcts[0]); ++n) {
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "<p%ui>%uD</p%ui>",
+                      pcts[n], v[(a->nelts - 1) * pcts[n] / 100], pcts[n])
+                      - buf);
+    }
+
+    NGX_RTMP_STAT_L("</");
+    NGX_RTMP_STAT_CS(name);
+    NGX_RTMP_STAT_L(">");
+}
+
+
+static void
+ngx_rtmp_stat_histogram(ngx_http_request_t *r, ngx_chain_t ***lll,
+        char *name, ngx_rtmp_histogram_t *h)
+{
+    static ngx_uint_t   pcts[] = { 50, 90, 99 };
+
+    ngx_uint_t          n;
+    u_char              buf[NGX_RTMP_STAT_BUFSIZE];
+
+    NGX_RTMP_STAT_L("<");
+    NGX_RTMP_STAT_CS(name);
+    NGX_RTMP_STAT_L(">");
+
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "<count>%uL</count>",
+                  h->count) - buf);
+
+    for (n = 0; n < sizeof(pcts) / sizeof(pcts[0]); ++n) {
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "<p%ui>%M</p%ui>",
+                      pcts[n], ngx_rtmp_histogram_percentile(h, pcts[n]),
+                      pcts[n]) - buf);
+    }
+
+    NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf), "<max>%M</max>",
+                  h->max) - buf);
+
+    NGX_RTMP_STAT_L("</");
+    NGX_RTMP_STAT_CS(name);
+    NGX_RTMP_STAT_L(">\r\n");
 }
 
 
@@ -418,6 +551,7 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
     ngx_live_stream_t              *stream;
     ngx_rtmp_codec_ctx_t           *codec;
     ngx_rtmp_live_ctx_t            *ctx;
+    ngx_rtmp_abr_ctx_t             *abr;
     ngx_rtmp_session_t             *s;
     size_t                          n;
     ngx_uint_t                      nclients, total_nclients;
@@ -427,11 +561,19 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
     ngx_live_conf_t                *lcf;
     u_char                         *cname;
     u_char                         *p;
+    ngx_array_t                    *rtts, *rates;
+    uint32_t                       *v;
 
     slcf = ngx_http_get_module_loc_conf(r, ngx_rtmp_stat_module);
     lcf = (ngx_live_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
                                            ngx_live_module);
 
+    rtts = ngx_array_create(r->pool, 16, sizeof(uint32_t));
+    rates = ngx_array_create(r->pool, 16, sizeof(uint32_t));
+    if (rtts == NULL || rates == NULL) {
+        return;
+    }
+
     NGX_RTMP_STAT_L("<live>\r\n");
 
     total_nclients = 0;
@@ -467,10 +609,34 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
             ngx_rtmp_stat_bw(r, lll, &stream->bw_in_video, "video",
                              NGX_RTMP_STAT_BW);
 
+            if (stream->queue_delay.count) {
+                ngx_rtmp_stat_histogram(r, lll, "queue_delay",
+                                        &stream->queue_delay);
+            }
+
+            if (stream->send_delay.count) {
+                ngx_rtmp_stat_histogram(r, lll, "send_delay",
+                                        &stream->send_delay);
+            }
+
             nclients = 0;
             codec = NULL;
+            rtts->nelts = 0;
+            rates->nelts = 0;
             for (ctx = stream->ctx; ctx; ctx = ctx->next, ++nclients) {
                 s = ctx->session;
+                if (s->tcpinfo.time && !ctx->publishing) {
+                    v = ngx_array_push(rtts);
+                    if (v) {
+                        *v = s->tcpinfo.rtt;
+                    }
+
+                    v = ngx_array_push(rates);
+                    if (v) {
+                        *v = s->tcpinfo.delivery_rate;
+                    }
+                }
+
                 if (slcf->stat & NGX_RTMP_STAT_CLIENTS) {
                     NGX_RTMP_STAT_L("<client>");
 
@@ -492,6 +658,11 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
                                   "%D", s->current_time) - bbuf);
                     NGX_RTMP_STAT_L("</timestamp>");
 
+                    abr = ngx_rtmp_get_module_ctx(s, ngx_rtmp_abr_module);
+                    if (abr) {
+                        ngx_rtmp_stat_abr(r, lll, abr);
+                    }
+
                     if (ctx->publishing) {
                         NGX_RTMP_STAT_L("<publishing/>");
                     }
@@ -586,6 +757,13 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
                 NGX_RTMP_STAT_L("</meta>\r\n");
             }
 
+            if (rtts->nelts && rates->nelts) {
+                NGX_RTMP_STAT_L("<tcpinfo>");
+                ngx_rtmp_stat_percentiles(r, lll, "rtt", rtts);
+                ngx_rtmp_stat_percentiles(r, lll, "delivery_rate", rates);
+                NGX_RTMP_STAT_L("</tcpinfo>\r\n");
+            }
+
             NGX_RTMP_STAT_L("<nclients>");
             NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf),
                           "%ui", nclients) - buf);
@@ -612,6 +790,105 @@ ngx_rtmp_stat_live(ngx_http_request_t *r, ngx_chain_t ***lll,
 }
 
 
+static void
+ngx_rtmp_stat_ttff_app(ngx_http_request_t *r, ngx_chain_t ***lll,
+        ngx_rtmp_core_srv_conf_t *cscf, ngx_rtmp_core_app_conf_t *cacf)
+{
+    ngx_rtmp_ttff_app_conf_t       *tacf;
+    ngx_rtmp_ttff_stat_t           *stat;
+    ngx_uint_t                      type, origin, stage;
+    u_char                          buf[NGX_INT_T_LEN];
+
+    tacf = cacf->app_conf[ngx_rtmp_ttff_module.ctx_index];
+    if (!tacf->ttff) {
+        return;
+    }
+
+    NGX_RTMP_STAT_L("<application>\r\n");
+
+    NGX_RTMP_STAT_L("<server>");
+    NGX_RTMP_STAT_ES(cscf->serverid.len ? &cscf->serverid
+                                        : &cscf->server_name);
+    NGX_RTMP_STAT_L("</server>\r\n");
+
+    NGX_RTMP_STAT_L("<name>");
+    NGX_RTMP_STAT_ES(&cacf->name);
+    NGX_RTMP_STAT_L("</name>\r\n");
+
+    for (type = 0; type < NGX_RTMP_TTFF_LIVE_TYPES; ++type) {
+        NGX_RTMP_STAT_L("<");
+        NGX_RTMP_STAT_CS(ngx_rtmp_ttff_live_type[type]);
+        NGX_RTMP_STAT_L(">");
+
+        NGX_RTMP_STAT_L("<abort>");
+        NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf),
+                      "%ui", tacf->nabort[type]) - buf);
+        NGX_RTMP_STAT_L("</abort>\r\n");
+
+        for (origin = 0; origin < NGX_RTMP_TTFF_ORIGINS; ++origin) {
+            stat = tacf->stat[type][origin];
+            if (stat == NULL) {
+                continue;
+            }
+
+            NGX_RTMP_STAT_L("<");
+            NGX_RTMP_STAT_CS(ngx_rtmp_ttff_origin[origin]);
+            NGX_RTMP_STAT_L(">");
+
+            NGX_RTMP_STAT_L("<play>");
+            NGX_RTMP_STAT(buf, ngx_snprintf(buf, sizeof(buf),
+                          "%ui", stat->nplay) - buf);
+            NGX_RTMP_STAT_L("</play>\r\n");
+
+            for (stage = 0; stage < NGX_RTMP_TTFF_STAGES; ++stage) {
+                if (stat->stage[stage].count) {
+                    ngx_rtmp_stat_histogram(r, lll,
+                            ngx_rtmp_ttff_stage[stage], &stat->stage[stage]);
+                }
+            }
+
+            NGX_RTMP_STAT_L("</");
+            NGX_RTMP_STAT_CS(ngx_rtmp_ttff_origin[origin]);
+            NGX_RTMP_STAT_L(">\r\n");
+        }
+
+        NGX_RTMP_STAT_L("</");
+        NGX_RTMP_STAT_CS(ngx_rtmp_ttff_live_type[type]);
+        NGX_RTMP_STAT_L(">\r\n");
+    }
+
+    NGX_RTMP_STAT_L("</application>\r\n");
+}
+
+
+/* time to first frame of players per application in this worker */
+static void
+ngx_rtmp_stat_ttff(ngx_http_request_t *r, ngx_chain_t ***lll)
+{
+    ngx_rtmp_core_main_conf_t      *cmcf;
+    ngx_rtmp_core_srv_conf_t      **cscfp;
+    ngx_rtmp_core_app_conf_t      **cacfp;
+    ngx_uint_t                      n, m;
+
+    cmcf = ngx_rtmp_core_main_conf;
+    if (cmcf == NULL) {
+        return;
+    }
+
+    NGX_RTMP_STAT_L("<ttff>\r\n");
+
+    cscfp = cmcf->servers.elts;
+    for (n = 0; n < cmcf->servers.nelts; ++n) {
+        cacfp = cscfp[n]->applications.elts;
+        for (m = 0; m < cscfp[n]->applications.nelts; ++m) {
+            ngx_rtmp_stat_ttff_app(r, lll, cscfp[n], cacfp[m]);
+        }
+    }
+
+    NGX_RTMP_STAT_L("</ttff>\r\n");
+}
+
+
 static ngx_int_t
 ngx_rtmp_stat_handler(ngx_http_request_t *r)
 {
@@ -673,6 +950,17 @@ ngx_rtmp_stat_handler(ngx_http_request_t *r)
     ngx_rtmp_stat_bw(r, lll, &ngx_rtmp_bw_in, "in", NGX_RTMP_STAT_BW_BYTES);
     ngx_rtmp_stat_bw(r, lll, &ngx_rtmp_bw_out, "out", NGX_RTMP_STAT_BW_BYTES);
 
+    ngx_rtmp_update_bandwidth(&ngx_rtmp_send_calls, 0);
+    NGX_RTMP_STAT_L("<send_calls>");
+    NGX_RTMP_STAT(nbuf, ngx_snprintf(nbuf, sizeof(nbuf),
+                  "%uL", ngx_rtmp_send_calls.bytes) - nbuf);
+    NGX_RTMP_STAT_L("</send_calls>\r\n");
+
+    NGX_RTMP_STAT_L("<send_calls_rate>");
+    NGX_RTMP_STAT(nbuf, ngx_snprintf(nbuf, sizeof(nbuf),
+                  "%uL", ngx_rtmp_send_calls.bandwidth) - nbuf);
+    NGX_RTMP_STAT_L("</send_calls_rate>\r\n");
+
     lcf = (ngx_live_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
                                            ngx_live_module);
 
@@ -689,6 +977,10 @@ ngx_rtmp_stat_handler(ngx_http_request_t *r)
         }
     }
 
+    if (slcf->stat & NGX_RTMP_STAT_TTFF) {
+        ngx_rtmp_stat_ttff(r, lll);
+    }
+
     NGX_RTMP_STAT_L("</rtmp>\r\n");
 
     len = 0;
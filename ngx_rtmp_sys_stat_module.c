@@ -21,6 +21,8 @@ static char *ngx_rtmp_sys_stat(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
 extern ngx_chain_t *ngx_live_relay_static_state(ngx_http_request_t *r);
+extern ngx_chain_t *ngx_live_relay_rtmp_state(ngx_http_request_t *r);
+extern ngx_chain_t *ngx_live_relay_state(ngx_http_request_t *r);
 
 
 static ngx_command_t  ngx_rtmp_sys_stat_commands[] = {
@@ -118,6 +120,16 @@ ngx_rtmp_sys_stat_handler(ngx_http_request_t *r)
     }
     *ll = ngx_live_relay_static_state(r);
 
+    if (*ll) {
+        ll = &(*ll)->next;
+    }
+    *ll = ngx_live_relay_rtmp_state(r);
+
+    if (*ll) {
+        ll = &(*ll)->next;
+    }
+    *ll = ngx_live_relay_state(r);
+
     if (*ll) {
         ll = &(*ll)->next;
     }
@@ -138,6 +150,11 @@ ngx_rtmp_sys_stat_handler(ngx_http_request_t *r)
     }
     *ll = ngx_event_timer_state(r);
 
+    if (*ll) {
+        ll = &(*ll)->next;
+    }
+    *ll = ngx_rtmp_wheel_state(r);
+
     if (*ll) {
         ll = &(*ll)->next;
     }
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp_tcpinfo_module.h"
+#include "ngx_live.h"
+
+
+static void *ngx_rtmp_tcpinfo_create_main_conf(ngx_conf_t *cf);
+static char *ngx_rtmp_tcpinfo_init_main_conf(ngx_conf_t *cf, void *conf);
+static ngx_int_t ngx_rtmp_tcpinfo_init_process(ngx_cycle_t *cycle);
+
+
+/* delivery rate is calculated over at least this period */
+#define NGX_RTMP_TCPINFO_RATE_PERIOD    1000
+
+
+typedef struct {
+    ngx_msec_t                  interval;
+} ngx_rtmp_tcpinfo_main_conf_t;
+
+
+#if (NGX_HAVE_TCP_INFO)
+static ngx_event_t              ngx_rtmp_tcpinfo_evt;
+#endif
+
+
+static ngx_command_t  ngx_rtmp_tcpinfo_commands[] = {
+
+    { ngx_string("tcpinfo_interval"),
+      NGX_RTMP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_MAIN_CONF_OFFSET,
+      offsetof(ngx_rtmp_tcpinfo_main_conf_t, interval),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_rtmp_module_t  ngx_rtmp_tcpinfo_module_ctx = {
+    NULL,                                   /* preconfiguration */
+    NULL,                                   /* postconfiguration */
+    ngx_rtmp_tcpinfo_create_main_conf,      /* create main configuration */
+    ngx_rtmp_tcpinfo_init_main_conf,        /* init main configuration */
+    NULL,                                   /* create server configuration */
+    NULL,                                   /* merge server configuration */
+    NULL,                                   /* create app configuration */
+    NULL                                    /* merge app configuration */
+};
+
+
+ngx_module_t  ngx_rtmp_tcpinfo_module = {
+    NGX_MODULE_V1,
+    &ngx_rtmp_tcpinfo_module_ctx,           /* module context */
+    ngx_rtmp_tcpinfo_commands,              /* module directives */
+    NGX_RTMP_MODULE,                        /* module type */
+    NULL,                                   /* init master */
+    NULL,                                   /* init module */
+    ngx_rtmp_tcpinfo_init_process,          /* init process */
+    NULL,                                   /* init thread */
+    NULL,                                   /* exit thread */
+    NULL,                                   /* exit process */
+    NULL,                                   /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void *
+ngx_rtmp_tcpinfo_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_rtmp_tcpinfo_main_conf_t   *tmcf;
+
+    tmcf = ngx_pcalloc(cf->pool, sizeof(ngx_rtmp_tcpinfo_main_conf_t));
+    if (tmcf == NULL) {
+        return NULL;
+    }
+
+    tmcf->interval = NGX_CONF_UNSET_MSEC;
+
+    return tmcf;
+}
+
+static char *
+ngx_rtmp_tcpinfo_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_rtmp_tcpinfo_main_conf_t   *tmcf = conf;
+
+    /* 0 for disable periodic sampling */
+    ngx_conf_init_msec_value(tmcf->interval, 0);
+
+    return NGX_CONF_OK;
+}
+
+
+void
+ngx_rtmp_tcpinfo_sample(ngx_rtmp_session_t *s)
+{
+#if (NGX_HAVE_TCP_INFO)
+    ngx_connection_t           *c;
+    struct tcp_info             ti;
+    socklen_t                   len;
+    ngx_msec_t                  elapsed;
+
+    c = s->connection;
+    if (s->closed || c == NULL || c->destroyed
+        || c->fd == (ngx_socket_t) -1)
+    {
+        return;
+    }
+
+    len = sizeof(struct tcp_info);
+    if (getsockopt(c->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_RTMP, s->log, ngx_socket_errno,
+                "tcpinfo, getsockopt(TCP_INFO) failed");
+        return;
+    }
+
+    s->tcpinfo.rtt = ti.tcpi_rtt;
+    s->tcpinfo.rttvar = ti.tcpi_rttvar;
+    s->tcpinfo.cwnd = ti.tcpi_snd_cwnd;
+
+#if (NGX_LINUX)
+    s->tcpinfo.retrans = ti.tcpi_total_retrans;
+    s->tcpinfo.unacked = ti.tcpi_unacked;
+#elif (NGX_FREEBSD)
+    s->tcpinfo.retrans = ti.tcpi_snd_rexmitpack;
+#endif
+
+    /*
+     * glibc struct tcp_info has no tcpi_delivery_rate, use bytes
+     * written to socket in last period instead
+     */
+    if (s->tcpinfo.rate_time == 0) {
+        s->tcpinfo.rate_time = ngx_current_msec;
+        s->tcpinfo.rate_sent = c->sent;
+    }
+
+    elapsed = ngx_current_msec - s->tcpinfo.rate_time;
+    if (elapsed >= NGX_RTMP_TCPINFO_RATE_PERIOD) {
+        s->tcpinfo.delivery_rate = (uint32_t)
+                ((c->sent - s->tcpinfo.rate_sent) * 1000 / elapsed);
+        s->tcpinfo.rate_time = ngx_current_msec;
+        s->tcpinfo.rate_sent = c->sent;
+    }
+
+    s->tcpinfo.time = ngx_current_msec;
+#endif
+}
+
+#if (NGX_HAVE_TCP_INFO)
+
+static void
+ngx_rtmp_tcpinfo_sample_stream(ngx_live_stream_t *st)
+{
+    ngx_rtmp_core_ctx_t        *cctx;
+
+    for (cctx = st->publish_ctx; cctx; cctx = cctx->next) {
+        ngx_rtmp_tcpinfo_sample(cctx->session);
+    }
+
+    for (cctx = st->play_ctx; cctx; cctx = cctx->next) {
+        ngx_rtmp_tcpinfo_sample(cctx->session);
+    }
+}
+
+static void
+ngx_rtmp_tcpinfo_timer(ngx_event_t *ev)
+{
+    ngx_rtmp_tcpinfo_main_conf_t   *tmcf;
+    ngx_live_conf_t                *lcf;
+    ngx_live_server_t              *srv;
+    ngx_live_stream_t              *st;
+    size_t                          n, m;
+
+    tmcf = ev->data;
+
+    lcf = (ngx_live_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_live_module);
+
+    for (n = 0; n < lcf->server_buckets; ++n) {
+        for (srv = lcf->servers[n]; srv; srv = srv->next) {
+            for (m = 0; m < lcf->stream_buckets; ++m) {
+                for (st = srv->streams[m]; st; st = st->next) {
+                    ngx_rtmp_tcpinfo_sample_stream(st);
+                }
+            }
+        }
+    }
+
+    ngx_add_timer(ev, tmcf->interval);
+}
+
+static void
+ngx_rtmp_tcpinfo_start(ngx_event_t *ev)
+{
+    ngx_rtmp_tcpinfo_main_conf_t   *tmcf;
+
+    tmcf = ev->data;
+
+    ev->handler = ngx_rtmp_tcpinfo_timer;
+    ngx_add_timer(ev, tmcf->interval);
+}
+
+#endif
+
+static ngx_int_t
+ngx_rtmp_tcpinfo_init_process(ngx_cycle_t *cycle)
+{
+#if (NGX_HAVE_TCP_INFO)
+    ngx_rtmp_tcpinfo_main_conf_t   *tmcf;
+    ngx_rtmp_conf_ctx_t            *ctx;
+    ngx_event_t                    *ev;
+
+    if (ngx_process != NGX_PROCESS_WORKER &&
+        ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_rtmp_core_main_conf == NULL) {
+        return NGX_OK;
+    }
+
+    ctx = (ngx_rtmp_conf_ctx_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_rtmp_module);
+    tmcf = (ngx_rtmp_tcpinfo_main_conf_t *)
+            ctx->main_conf[ngx_rtmp_tcpinfo_module.ctx_index];
+
+    if (tmcf->interval == 0) {
+        return NGX_OK;
+    }
+
+    ev = &ngx_rtmp_tcpinfo_evt;
+    ev->data = tmcf;
+    ev->log = cycle->log;
+    ev->handler = ngx_rtmp_tcpinfo_start;
+#if (nginx_version >= 1011011)
+    ev->cancelable = 1;
+#endif
+
+    /* event timers are not ready yet, start timer in init queue */
+    ngx_post_event(ev, &ngx_rtmp_init_queue);
+#endif
+
+    return NGX_OK;
+}
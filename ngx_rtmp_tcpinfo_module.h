@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_TCPINFO_MODULE_H_INCLUDED_
+#define _NGX_RTMP_TCPINFO_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_rtmp.h"
+
+
+extern ngx_module_t     ngx_rtmp_tcpinfo_module;
+
+
+/*
+ * paras:
+ *      s: session whose socket TCP_INFO will be sampled into s->tcpinfo
+ */
+void ngx_rtmp_tcpinfo_sample(ngx_rtmp_session_t *s);
+
+
+#endif
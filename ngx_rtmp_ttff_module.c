@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp_ttff_module.h"
+#include "ngx_rtmp_cmd_module.h"
+#include "ngx_live_relay.h"
+
+
+static ngx_rtmp_close_stream_pt         next_close_stream;
+
+
+static ngx_int_t ngx_rtmp_ttff_postconfiguration(ngx_conf_t *cf);
+static void *ngx_rtmp_ttff_create_app_conf(ngx_conf_t *cf);
+static char *ngx_rtmp_ttff_merge_app_conf(ngx_conf_t *cf,
+       void *parent, void *child);
+
+
+char *ngx_rtmp_ttff_live_type[] = {
+    "rtmp",
+    "flv",
+    "hls",
+    "ts",
+};
+
+char *ngx_rtmp_ttff_origin[] = {
+    "local",
+    "inner",
+    "remote",
+};
+
+char *ngx_rtmp_ttff_stage[] = {
+    "handshake",
+    "connect",
+    "create_stream",
+    "play",
+    "wait",
+    "ttff",
+};
+
+
+static ngx_command_t  ngx_rtmp_ttff_commands[] = {
+
+    { ngx_string("ttff_stat"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_ttff_app_conf_t, ttff),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_rtmp_module_t  ngx_rtmp_ttff_module_ctx = {
+    NULL,                                   /* preconfiguration */
+    ngx_rtmp_ttff_postconfiguration,        /* postconfiguration */
+    NULL,                                   /* create main configuration */
+    NULL,                                   /* init main configuration */
+    NULL,                                   /* create server configuration */
+    NULL,                                   /* merge server configuration */
+    ngx_rtmp_ttff_create_app_conf,          /* create app configuration */
+    ngx_rtmp_ttff_merge_app_conf            /* merge app configuration */
+};
+
+
+ngx_module_t  ngx_rtmp_ttff_module = {
+    NGX_MODULE_V1,
+    &ngx_rtmp_ttff_module_ctx,              /* module context */
+    ngx_rtmp_ttff_commands,                 /* module directives */
+    NGX_RTMP_MODULE,                        /* module type */
+    NULL,                                   /* init master */
+    NULL,                                   /* init module */
+    NULL,                                   /* init process */
+    NULL,                                   /* init thread */
+    NULL,                                   /* exit thread */
+    NULL,                                   /* exit process */
+    NULL,                                   /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void *
+ngx_rtmp_ttff_create_app_conf(ngx_conf_t *cf)
+{
+    ngx_rtmp_ttff_app_conf_t       *tacf;
+
+    tacf = ngx_pcalloc(cf->pool, sizeof(ngx_rtmp_ttff_app_conf_t));
+    if (tacf == NULL) {
+        return NULL;
+    }
+
+    tacf->ttff = NGX_CONF_UNSET;
+
+    return tacf;
+}
+
+static char *
+ngx_rtmp_ttff_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_rtmp_ttff_app_conf_t       *prev = parent;
+    ngx_rtmp_ttff_app_conf_t       *conf = child;
+
+    ngx_conf_merge_value(conf->ttff, prev->ttff, 1);
+
+    return NGX_CONF_OK;
+}
+
+
+/* players counted, relay and inner relay sessions are not */
+static ngx_flag_t
+ngx_rtmp_ttff_player(ngx_rtmp_session_t *s)
+{
+    return !s->publishing && !s->relay && !s->interprocess
+        && s->live_type < NGX_RTMP_TTFF_LIVE_TYPES;
+}
+
+static ngx_uint_t
+ngx_rtmp_ttff_stream_origin(ngx_live_stream_t *st)
+{
+    ngx_rtmp_session_t             *ps;
+    ngx_live_relay_ctx_t           *rctx;
+
+    if (st == NULL || st->publish_ctx == NULL) {
+        return NGX_RTMP_TTFF_LOCAL;
+    }
+
+    ps = st->publish_ctx->session;
+
+    /* inner relay pushed from other worker through unix socket */
+    if (ps->interprocess) {
+        return NGX_RTMP_TTFF_INNER;
+    }
+
+    if (!ps->relay) {
+        return NGX_RTMP_TTFF_LOCAL;
+    }
+
+    rctx = ngx_rtmp_get_module_ctx(ps, ngx_live_relay_module);
+    if (rctx && rctx->tag == &ngx_live_relay_inner_module) {
+        return NGX_RTMP_TTFF_INNER;
+    }
+
+    return NGX_RTMP_TTFF_REMOTE;
+}
+
+static void
+ngx_rtmp_ttff_stage_add(ngx_rtmp_ttff_stat_t *stat, ngx_uint_t stage,
+        ngx_msec_t from, ngx_msec_t to)
+{
+    if (from == 0 || to == 0 || (ngx_msec_int_t) (to - from) < 0) {
+        return;
+    }
+
+    ngx_rtmp_histogram_add(&stat->stage[stage], to - from);
+}
+
+void
+ngx_rtmp_ttff_first_frame(ngx_rtmp_session_t *s)
+{
+    ngx_rtmp_ttff_app_conf_t       *tacf;
+    ngx_rtmp_ttff_stat_t          **pstat, *stat;
+    ngx_uint_t                      origin;
+
+    if (!ngx_rtmp_ttff_player(s)) {
+        return;
+    }
+
+    tacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_ttff_module);
+    if (tacf == NULL || !tacf->ttff) {
+        return;
+    }
+
+    origin = ngx_rtmp_ttff_stream_origin(s->live_stream);
+
+    pstat = &tacf->stat[s->live_type][origin];
+    if (*pstat == NULL) {
+        *pstat = ngx_pcalloc(ngx_cycle->pool, sizeof(ngx_rtmp_ttff_stat_t));
+        if (*pstat == NULL) {
+            return;
+        }
+    }
+
+    stat = *pstat;
+
+    ++stat->nplay;
+
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_HANDSHAKE,
+                            s->init_time, s->handshake_done_time);
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_CONNECT,
+                            s->handshake_done_time, s->connect_time);
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_CREATE_STREAM,
+                            s->connect_time, s->create_stream_time);
+    /* http players have no rtmp command stages */
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_PLAY,
+                            s->create_stream_time ? s->create_stream_time
+                                                  : s->init_time,
+                            s->ptime);
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_WAIT,
+                            s->ptime, s->first_video);
+    ngx_rtmp_ttff_stage_add(stat, NGX_RTMP_TTFF_TOTAL,
+                            s->init_time, s->first_video);
+}
+
+static ngx_int_t
+ngx_rtmp_ttff_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
+{
+    ngx_rtmp_ttff_app_conf_t       *tacf;
+
+    if (!ngx_rtmp_ttff_player(s) || s->ptime == 0 || s->first_video) {
+        goto next;
+    }
+
+    tacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_ttff_module);
+    if (tacf == NULL || !tacf->ttff) {
+        goto next;
+    }
+
+    ++tacf->nabort[s->live_type];
+
+next:
+    return next_close_stream(s, v);
+}
+
+
+static ngx_int_t
+ngx_rtmp_ttff_postconfiguration(ngx_conf_t *cf)
+{
+    next_close_stream = ngx_rtmp_close_stream;
+    ngx_rtmp_close_stream = ngx_rtmp_ttff_close_stream;
+
+    return NGX_OK;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_TTFF_MODULE_H_INCLUDED_
+#define _NGX_RTMP_TTFF_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp.h"
+
+
+/* live types, same as s->live_type */
+#define NGX_RTMP_TTFF_LIVE_TYPES        4
+
+/* where stream played comes from */
+#define NGX_RTMP_TTFF_LOCAL             0   /* published to this worker */
+#define NGX_RTMP_TTFF_INNER             1   /* relayed from other worker */
+#define NGX_RTMP_TTFF_REMOTE            2   /* pulled from other server */
+#define NGX_RTMP_TTFF_ORIGINS           3
+
+/* stage deltas of player, see ngx_rtmp_ttff_stage */
+#define NGX_RTMP_TTFF_HANDSHAKE         0   /* init -> handshake done */
+#define NGX_RTMP_TTFF_CONNECT           1   /* handshake done -> connect */
+#define NGX_RTMP_TTFF_CREATE_STREAM     2   /* connect -> createStream */
+#define NGX_RTMP_TTFF_PLAY              3   /* createStream or init -> play */
+#define NGX_RTMP_TTFF_WAIT              4   /* play -> first video sent */
+#define NGX_RTMP_TTFF_TOTAL             5   /* init -> first video sent */
+#define NGX_RTMP_TTFF_STAGES            6
+
+
+typedef struct {
+    ngx_uint_t                  nplay;
+    ngx_rtmp_histogram_t        stage[NGX_RTMP_TTFF_STAGES];
+} ngx_rtmp_ttff_stat_t;
+
+
+typedef struct {
+    ngx_flag_t                  ttff;
+    /*
+     * players closed before first video sent, stream may be gone when
+     * player closed, so not broken down by origin
+     */
+    ngx_uint_t                  nabort[NGX_RTMP_TTFF_LIVE_TYPES];
+    /* per worker, allocated when first player of type and origin counted */
+    ngx_rtmp_ttff_stat_t       *stat[NGX_RTMP_TTFF_LIVE_TYPES]
+                                    [NGX_RTMP_TTFF_ORIGINS];
+} ngx_rtmp_ttff_app_conf_t;
+
+
+extern ngx_module_t  ngx_rtmp_ttff_module;
+
+extern char *ngx_rtmp_ttff_live_type[];
+extern char *ngx_rtmp_ttff_origin[];
+extern char *ngx_rtmp_ttff_stage[];
+
+
+/*
+ * paras:
+ *      s: player session just sent its first video frame,
+ *          s->first_video must be set
+ */
+void ngx_rtmp_ttff_first_frame(ngx_rtmp_session_t *s);
+
+
+#endif
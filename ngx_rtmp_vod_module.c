@@ -0,0 +1,879 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp.h"
+#include "ngx_rtmp_cmd_module.h"
+#include "ngx_rtmp_record_module.h"
+#include "ngx_rtmp_streams.h"
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
+
+#define NGX_RTMP_VOD_TAG_HEADER         11
+#define NGX_RTMP_VOD_TAG_SIZE           4
+
+/* min interval of sending, also for retry when out queue is full */
+#define NGX_RTMP_VOD_DELAY              100
+
+
+static ngx_rtmp_play_pt                 next_play;
+static ngx_rtmp_close_stream_pt         next_close_stream;
+
+
+static ngx_int_t ngx_rtmp_vod_postconfiguration(ngx_conf_t *cf);
+static void *ngx_rtmp_vod_create_app_conf(ngx_conf_t *cf);
+static char *ngx_rtmp_vod_merge_app_conf(ngx_conf_t *cf,
+       void *parent, void *child);
+#if (NGX_THREADS)
+static char *ngx_rtmp_vod_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+       void *conf);
+#endif
+
+
+typedef struct {
+    ngx_str_t                           path;
+    ngx_msec_t                          buffer;
+    size_t                              read_ahead;
+#if (NGX_THREADS)
+    ngx_thread_pool_t                  *thread_pool;
+#endif
+} ngx_rtmp_vod_app_conf_t;
+
+
+/* mapped record file, allocated from heap for read ahead task
+ * may still use it after session closed */
+typedef struct {
+    u_char                             *start;
+    u_char                             *end;
+    u_char                             *read_ahead; /* prefetched up to */
+#if (NGX_THREADS)
+    ngx_thread_task_t                  *task;
+    unsigned                            busy:1;
+    unsigned                            closed:1;
+#endif
+} ngx_rtmp_vod_file_t;
+
+
+typedef struct {
+    ngx_rtmp_vod_file_t                *file;
+    u_char                             *pos;
+    u_char                             *header;     /* end of codec headers */
+    u_char                             *seek;       /* keyframe to play */
+    uint32_t                            base;       /* timestamp of start */
+    uint32_t                            timestamp;
+    ngx_msec_t                          epoch;
+    size_t                              nbytes;
+    ngx_event_t                         send_evt;
+} ngx_rtmp_vod_ctx_t;
+
+
+#if (NGX_THREADS)
+typedef struct {
+    u_char                             *pos;
+    u_char                             *last;
+} ngx_rtmp_vod_read_ahead_ctx_t;
+#endif
+
+
+static ngx_command_t  ngx_rtmp_vod_commands[] = {
+
+    { ngx_string("vod_path"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_vod_app_conf_t, path),
+      NULL },
+
+    { ngx_string("vod_buffer"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_vod_app_conf_t, buffer),
+      NULL },
+
+    { ngx_string("vod_read_ahead"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_RTMP_APP_CONF_OFFSET,
+      offsetof(ngx_rtmp_vod_app_conf_t, read_ahead),
+      NULL },
+
+#if (NGX_THREADS)
+    { ngx_string("vod_thread_pool"),
+      NGX_RTMP_MAIN_CONF|NGX_RTMP_SRV_CONF|NGX_RTMP_APP_CONF|NGX_CONF_TAKE1,
+      ngx_rtmp_vod_thread_pool,
+      NGX_RTMP_APP_CONF_OFFSET,
+      0,
+      NULL },
+#endif
+
+      ngx_null_command
+};
+
+
+static ngx_rtmp_module_t  ngx_rtmp_vod_module_ctx = {
+    NULL,                                   /* preconfiguration */
+    ngx_rtmp_vod_postconfiguration,         /* postconfiguration */
+    NULL,                                   /* create main configuration */
+    NULL,                                   /* init main configuration */
+    NULL,                                   /* create server configuration */
+    NULL,                                   /* merge server configuration */
+    ngx_rtmp_vod_create_app_conf,           /* create app configuration */
+    ngx_rtmp_vod_merge_app_conf             /* merge app configuration */
+};
+
+
+ngx_module_t  ngx_rtmp_vod_module = {
+    NGX_MODULE_V1,
+    &ngx_rtmp_vod_module_ctx,               /* module context */
+    ngx_rtmp_vod_commands,                  /* module directives */
+    NGX_RTMP_MODULE,                        /* module type */
+    NULL,                                   /* init master */
+    NULL,                                   /* init module */
+    NULL,                                   /* init process */
+    NULL,                                   /* init thread */
+    NULL,                                   /* exit thread */
+    NULL,                                   /* exit process */
+    NULL,                                   /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void *
+ngx_rtmp_vod_create_app_conf(ngx_conf_t *cf)
+{
+    ngx_rtmp_vod_app_conf_t        *vacf;
+
+    vacf = ngx_pcalloc(cf->pool, sizeof(ngx_rtmp_vod_app_conf_t));
+    if (vacf == NULL) {
+        return NULL;
+    }
+
+    vacf->buffer = NGX_CONF_UNSET_MSEC;
+    vacf->read_ahead = NGX_CONF_UNSET_SIZE;
+#if (NGX_THREADS)
+    vacf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif
+
+    return vacf;
+}
+
+
+static char *
+ngx_rtmp_vod_merge_app_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_rtmp_vod_app_conf_t        *prev = parent;
+    ngx_rtmp_vod_app_conf_t        *conf = child;
+
+    ngx_conf_merge_str_value(conf->path, prev->path, "");
+    ngx_conf_merge_msec_value(conf->buffer, prev->buffer, 1000);
+    ngx_conf_merge_size_value(conf->read_ahead, prev->read_ahead,
+                              1024 * 1024);
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static char *
+ngx_rtmp_vod_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_rtmp_vod_app_conf_t        *vacf = conf;
+    ngx_str_t                      *value;
+
+    if (vacf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    vacf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (vacf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
+static void
+ngx_rtmp_vod_free(ngx_rtmp_vod_file_t *f)
+{
+    if (munmap(f->start, f->end - f->start) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "vod: munmap(%uz) failed", (size_t) (f->end - f->start));
+    }
+
+#if (NGX_THREADS)
+    ngx_free(f->task);
+#endif
+    ngx_free(f);
+}
+
+
+/* called when session pool destroyed, all frames refer to file are freed */
+static void
+ngx_rtmp_vod_cleanup(void *data)
+{
+    ngx_rtmp_vod_file_t            *f = data;
+
+#if (NGX_THREADS)
+    if (f->busy) {
+        f->closed = 1;
+        return;
+    }
+#endif
+
+    ngx_rtmp_vod_free(f);
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_rtmp_vod_read_ahead_thread(void *data, ngx_log_t *log)
+{
+    ngx_rtmp_vod_read_ahead_ctx_t  *ctx = data;
+    u_char                         *p;
+
+    (void) madvise(ctx->pos, ctx->last - ctx->pos, MADV_WILLNEED);
+
+    /* page in here, so event loop won't block on page fault */
+    for (p = ctx->pos; p < ctx->last; p += ngx_pagesize) {
+        (void) *(volatile u_char *) p;
+    }
+}
+
+
+static void
+ngx_rtmp_vod_read_ahead_done(ngx_event_t *ev)
+{
+    ngx_rtmp_vod_file_t            *f;
+
+    f = ev->data;
+    f->busy = 0;
+
+    if (f->closed) {
+        ngx_rtmp_vod_free(f);
+    }
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_read_ahead_post(ngx_rtmp_session_t *s, ngx_rtmp_vod_file_t *f,
+        ngx_thread_pool_t *tp, u_char *pos, u_char *last)
+{
+    ngx_rtmp_vod_read_ahead_ctx_t  *ctx;
+
+    if (f->task == NULL) {
+        f->task = ngx_calloc(sizeof(ngx_thread_task_t)
+                             + sizeof(ngx_rtmp_vod_read_ahead_ctx_t), s->log);
+        if (f->task == NULL) {
+            return NGX_ERROR;
+        }
+
+        f->task->ctx = f->task + 1;
+        f->task->handler = ngx_rtmp_vod_read_ahead_thread;
+        f->task->event.handler = ngx_rtmp_vod_read_ahead_done;
+        f->task->event.data = f;
+    }
+
+    ctx = f->task->ctx;
+    ctx->pos = pos;
+    ctx->last = last;
+
+    if (ngx_thread_task_post(tp, f->task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    f->busy = 1;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static void
+ngx_rtmp_vod_read_ahead(ngx_rtmp_session_t *s, ngx_rtmp_vod_ctx_t *ctx)
+{
+    ngx_rtmp_vod_app_conf_t        *vacf;
+    ngx_rtmp_vod_file_t            *f;
+    u_char                         *pos, *last;
+
+    vacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_vod_module);
+    f = ctx->file;
+
+    if (vacf->read_ahead == 0) {
+        return;
+    }
+
+    /* refill when less than half of read ahead left */
+    pos = ngx_max(f->read_ahead, ctx->pos);
+    if (pos >= f->end || (size_t) (pos - ctx->pos) >= vacf->read_ahead / 2) {
+        return;
+    }
+
+    last = ngx_min(ctx->pos + vacf->read_ahead, f->end);
+    pos = (u_char *) ((uintptr_t) pos & ~((uintptr_t) ngx_pagesize - 1));
+
+#if (NGX_THREADS)
+    if (vacf->thread_pool) {
+        if (f->busy) {
+            return;
+        }
+
+        if (ngx_rtmp_vod_read_ahead_post(s, f, vacf->thread_pool, pos, last)
+            == NGX_OK)
+        {
+            f->read_ahead = last;
+            return;
+        }
+    }
+#endif
+
+    (void) madvise(pos, last - pos, MADV_WILLNEED);
+
+    f->read_ahead = last;
+}
+
+
+static uint32_t
+ngx_rtmp_vod_tag_time(u_char *p)
+{
+    return (uint32_t) p[7] << 24 | (uint32_t) p[4] << 16
+         | (uint32_t) p[5] << 8 | p[6];
+}
+
+
+static size_t
+ngx_rtmp_vod_tag_size(u_char *p)
+{
+    return (size_t) p[1] << 16 | (size_t) p[2] << 8 | p[3];
+}
+
+
+/* payload refers to mapped file directly, one buf for each chunk */
+static ngx_rtmp_frame_t *
+ngx_rtmp_vod_frame(ngx_rtmp_session_t *s, ngx_uint_t type, uint32_t timestamp,
+        u_char *data, size_t size)
+{
+    ngx_rtmp_core_srv_conf_t       *cscf;
+    ngx_rtmp_frame_t               *frame;
+    ngx_chain_t                   **ll;
+    u_char                         *p, *last;
+    size_t                          n;
+
+    cscf = ngx_rtmp_get_module_srv_conf(s, ngx_rtmp_core_module);
+
+    frame = ngx_rtmp_shared_alloc_frame(cscf->chunk_size, NULL, 0);
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&frame->hdr, sizeof(frame->hdr));
+
+    switch (type) {
+    case NGX_RTMP_MSG_AUDIO:
+        frame->hdr.csid = NGX_RTMP_CSID_AUDIO;
+        break;
+    case NGX_RTMP_MSG_VIDEO:
+        frame->hdr.csid = NGX_RTMP_CSID_VIDEO;
+        break;
+    default:
+        frame->hdr.csid = NGX_RTMP_CSID_AMF;
+    }
+
+    frame->hdr.msid = NGX_RTMP_MSID;
+    frame->hdr.type = (uint8_t) type;
+    frame->hdr.timestamp = timestamp;
+    frame->hdr.mlen = size;
+
+    frame->av_header = 0;
+    frame->keyframe = 0;
+    frame->mandatory = 0;
+
+    ll = &frame->chain;
+    last = data + size;
+
+    for (p = data; p < last; p += n) {
+        n = ngx_min((size_t) cscf->chunk_size, (size_t) (last - p));
+
+        *ll = ngx_get_chainbuf(0, 0);
+        if (*ll == NULL) {
+            ngx_rtmp_shared_free_frame(frame);
+            return NULL;
+        }
+
+        (*ll)->buf->pos = p;
+        (*ll)->buf->last = p + n;
+        ll = &(*ll)->next;
+    }
+
+    if (type == NGX_RTMP_MSG_VIDEO) {
+        frame->keyframe = (ngx_rtmp_get_video_frame_type(frame->chain)
+                           == NGX_RTMP_VIDEO_KEY_FRAME);
+        frame->av_header = ngx_rtmp_is_codec_header(frame->chain);
+
+    } else if (type == NGX_RTMP_MSG_AUDIO) {
+        frame->av_header = ((data[0] >> 4) == NGX_RTMP_AUDIO_AAC
+                            && ngx_rtmp_is_codec_header(frame->chain));
+    }
+
+    return frame;
+}
+
+
+static void
+ngx_rtmp_vod_complete(ngx_rtmp_session_t *s, ngx_rtmp_vod_ctx_t *ctx)
+{
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+                  "vod: play complete, bytes=%uz", ctx->nbytes);
+
+    ngx_rtmp_send_stream_eof(s, NGX_RTMP_MSID);
+
+    ngx_rtmp_send_play_status(s, "NetStream.Play.Complete", "status",
+                              (ctx->timestamp - ctx->base) / 1000,
+                              ctx->nbytes);
+
+    ngx_rtmp_send_status(s, "NetStream.Play.Stop", "status",
+                         "Stop video on demand");
+}
+
+
+/* send tags up to vod_buffer and client buffer ahead of play time */
+static void
+ngx_rtmp_vod_send(ngx_event_t *ev)
+{
+    ngx_rtmp_session_t             *s;
+    ngx_rtmp_vod_app_conf_t        *vacf;
+    ngx_rtmp_vod_ctx_t             *ctx;
+    ngx_rtmp_frame_t               *frame;
+    ngx_msec_t                      ahead, elapsed, delay;
+    ngx_uint_t                      type;
+    uint32_t                        timestamp;
+    size_t                          size;
+    u_char                         *p, *last;
+    ngx_int_t                       rc;
+
+    s = ev->data;
+
+    vacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_vod_module);
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_vod_module);
+
+    ahead = s->buflen + vacf->buffer;
+
+    while (ctx->pos + NGX_RTMP_VOD_TAG_HEADER <= ctx->file->end) {
+
+        /* codec headers sent, skip to keyframe */
+        if (ctx->seek && ctx->pos >= ctx->header) {
+            ctx->pos = ctx->seek;
+            ctx->seek = NULL;
+            continue;
+        }
+
+        p = ctx->pos;
+        type = p[0] & 0x1f;
+        size = ngx_rtmp_vod_tag_size(p);
+        timestamp = ngx_rtmp_vod_tag_time(p);
+
+        last = p + NGX_RTMP_VOD_TAG_HEADER + size;
+        if (last > ctx->file->end) {
+            ngx_log_error(NGX_LOG_WARN, s->log, 0,
+                          "vod: truncated tag, size=%uz", size);
+            break;
+        }
+
+        /* codec headers before keyframe seeked to */
+        if ((int32_t) (timestamp - ctx->base) < 0) {
+            timestamp = ctx->base;
+        }
+
+        elapsed = ngx_current_msec - ctx->epoch;
+
+        if (timestamp - ctx->base > elapsed + ahead) {
+            delay = timestamp - ctx->base - elapsed - ahead;
+            ngx_add_timer(ev, ngx_max(delay, NGX_RTMP_VOD_DELAY));
+            return;
+        }
+
+        if (size && (type == NGX_RTMP_MSG_AUDIO || type == NGX_RTMP_MSG_VIDEO
+                     || type == NGX_RTMP_MSG_AMF_META))
+        {
+            frame = ngx_rtmp_vod_frame(s, type, timestamp,
+                                       p + NGX_RTMP_VOD_TAG_HEADER, size);
+            if (frame == NULL) {
+                ngx_rtmp_finalize_session(s);
+                return;
+            }
+
+            rc = ngx_rtmp_send_message(s, frame, 0);
+            ngx_rtmp_shared_free_frame(frame);
+
+            if (rc == NGX_AGAIN) {
+                ngx_add_timer(ev, NGX_RTMP_VOD_DELAY);
+                return;
+            }
+
+            if (rc != NGX_OK) {
+                ngx_rtmp_finalize_session(s);
+                return;
+            }
+
+            ctx->nbytes += size;
+            ctx->timestamp = timestamp;
+        }
+
+        ctx->pos = ngx_min(last + NGX_RTMP_VOD_TAG_SIZE, ctx->file->end);
+
+        ngx_rtmp_vod_read_ahead(s, ctx);
+    }
+
+    ctx->pos = ctx->file->end;
+
+    ngx_rtmp_vod_complete(s, ctx);
+}
+
+
+static ngx_rtmp_vod_file_t *
+ngx_rtmp_vod_open(ngx_rtmp_session_t *s, ngx_str_t *path)
+{
+    ngx_rtmp_vod_file_t            *f;
+    ngx_pool_cleanup_t             *cln;
+    ngx_file_info_t                 fi;
+    ngx_fd_t                        fd;
+    size_t                          size;
+    u_char                         *p;
+
+    fd = ngx_open_file(path->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                          "vod: failed to open '%V'", path);
+        }
+
+        return NULL;
+    }
+
+    f = NULL;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                      "vod: " ngx_fd_info_n " '%V' failed", path);
+        goto done;
+    }
+
+    size = ngx_file_size(&fi);
+    if (size < NGX_RTMP_RECORD_HEADER_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "vod: '%V' too small, size=%uz", path, size);
+        goto done;
+    }
+
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ERR, s->log, ngx_errno,
+                      "vod: mmap(%uz) '%V' failed", size, path);
+        goto done;
+    }
+
+    if (ngx_strncmp(p, "FLV", 3) != 0) {
+        ngx_log_error(NGX_LOG_ERR, s->log, 0,
+                      "vod: '%V' is not an flv file", path);
+        goto failed;
+    }
+
+    cln = ngx_pool_cleanup_add(s->pool, 0);
+    if (cln == NULL) {
+        goto failed;
+    }
+
+    f = ngx_calloc(sizeof(ngx_rtmp_vod_file_t), s->log);
+    if (f == NULL) {
+        goto failed;
+    }
+
+    f->start = p;
+    f->end = p + size;
+    f->read_ahead = p;
+
+    cln->handler = ngx_rtmp_vod_cleanup;
+    cln->data = f;
+
+    goto done;
+
+failed:
+    munmap(p, size);
+
+done:
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, s->log, ngx_errno,
+                      "vod: " ngx_close_file_n " '%V' failed", path);
+    }
+
+    return f;
+}
+
+
+/* record file without index, find keyframe by walking through tags */
+static void
+ngx_rtmp_vod_scan(ngx_rtmp_vod_ctx_t *ctx, uint32_t start)
+{
+    u_char                         *p, *end;
+    ngx_uint_t                      type;
+
+    end = ctx->file->end;
+
+    for (p = ctx->pos; p + NGX_RTMP_VOD_TAG_HEADER + 1 < end;
+         p += NGX_RTMP_VOD_TAG_HEADER + ngx_rtmp_vod_tag_size(p)
+              + NGX_RTMP_VOD_TAG_SIZE)
+    {
+        type = p[0] & 0x1f;
+
+        if (type != NGX_RTMP_MSG_AUDIO && type != NGX_RTMP_MSG_VIDEO) {
+            continue;
+        }
+
+        /* first media frame */
+        if (ctx->header == NULL && p[NGX_RTMP_VOD_TAG_HEADER + 1] != 0) {
+            ctx->header = p;
+        }
+
+        if (ctx->header && type == NGX_RTMP_MSG_VIDEO
+            && (p[NGX_RTMP_VOD_TAG_HEADER] >> 4) == NGX_RTMP_VIDEO_KEY_FRAME
+            && p[NGX_RTMP_VOD_TAG_HEADER + 1] != 0
+            && ngx_rtmp_vod_tag_time(p) >= start)
+        {
+            ctx->seek = p;
+            return;
+        }
+    }
+
+    ctx->header = NULL;
+    ctx->pos = end;
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_seek(ngx_rtmp_session_t *s, ngx_rtmp_vod_ctx_t *ctx,
+        ngx_str_t *path, uint32_t start)
+{
+    ngx_rtmp_vod_file_t            *f;
+    off_t                           header, offset;
+
+    f = ctx->file;
+
+    switch (ngx_rtmp_record_index_seek(path, s->log, start, &header,
+                                       &offset))
+    {
+    case NGX_OK:
+        if (f->start + header < ctx->pos || header > offset
+            || offset + NGX_RTMP_VOD_TAG_HEADER > f->end - f->start)
+        {
+            ngx_log_error(NGX_LOG_WARN, s->log, 0,
+                          "vod: index mismatch '%V', header=%O, offset=%O",
+                          path, header, offset);
+            ngx_rtmp_vod_scan(ctx, start);
+            break;
+        }
+
+        ctx->header = f->start + header;
+        ctx->seek = f->start + offset;
+        break;
+
+    case NGX_DECLINED:
+        ngx_rtmp_vod_scan(ctx, start);
+        break;
+
+    case NGX_DONE:
+        ctx->pos = f->end;
+        break;
+
+    default:
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_RTMP, s->log, 0,
+                   "vod: seek start=%uD, header=%p, keyframe=%p",
+                   start, ctx->header, ctx->seek);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_make_path(ngx_rtmp_session_t *s, u_char *name, ngx_str_t *path)
+{
+    ngx_rtmp_vod_app_conf_t        *vacf;
+    size_t                          len, escape;
+    ngx_flag_t                      suffix;
+    u_char                         *p;
+
+    vacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_vod_module);
+
+    len = ngx_strlen(name);
+    if (len == 0 || ngx_strstr(name, "..")) {
+        return NGX_DECLINED;
+    }
+
+    suffix = (len < sizeof(".flv") - 1
+              || ngx_strncmp(name + len - (sizeof(".flv") - 1), ".flv",
+                             sizeof(".flv") - 1) != 0);
+
+    /* name is escaped as record module does when it makes file path */
+    escape = 2 * ngx_escape_uri(NULL, name, len, NGX_ESCAPE_URI_COMPONENT);
+
+    path->len = vacf->path.len + 1 + len + escape
+              + (suffix ? sizeof(".flv") - 1 : 0);
+    path->data = ngx_pnalloc(s->pool, path->len + 1);
+    if (path->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(path->data, vacf->path.data, vacf->path.len);
+    *p++ = '/';
+    p = (u_char *) ngx_escape_uri(p, name, len, NGX_ESCAPE_URI_COMPONENT);
+
+    if (suffix) {
+        p = ngx_cpymem(p, ".flv", sizeof(".flv") - 1);
+    }
+
+    *p = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_play(ngx_rtmp_session_t *s, ngx_rtmp_play_t *v)
+{
+    ngx_rtmp_vod_app_conf_t        *vacf;
+    ngx_rtmp_vod_ctx_t             *ctx;
+    ngx_rtmp_vod_file_t            *f;
+    ngx_str_t                       path;
+    ngx_int_t                       rc;
+    uint32_t                        offset;
+
+    /*
+     * oclp and access accept play before, relay and live after. Play of
+     * a recorded file is served here only, it neither joins live stream
+     * nor triggers relay pull. Names not recorded are played as live.
+     */
+    vacf = ngx_rtmp_get_module_app_conf(s, ngx_rtmp_vod_module);
+
+    if (vacf == NULL || vacf->path.len == 0
+        || s->live_type != NGX_RTMP_LIVE || s->relay)
+    {
+        return next_play(s, v);
+    }
+
+    rc = ngx_rtmp_vod_make_path(s, v->name, &path);
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    f = (rc == NGX_OK) ? ngx_rtmp_vod_open(s, &path) : NULL;
+    if (f == NULL) {
+        return next_play(s, v);
+    }
+
+    ngx_log_error(NGX_LOG_INFO, s->log, 0,
+                  "vod: play '%V', start=%i", &path, (ngx_int_t) v->start);
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_vod_module);
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(s->pool, sizeof(ngx_rtmp_vod_ctx_t));
+        if (ctx == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rtmp_set_ctx(s, ctx, ngx_rtmp_vod_module);
+    }
+
+    /* previous file is unmapped with session pool, frames may refer to it */
+    if (ctx->send_evt.timer_set) {
+        ngx_del_timer(&ctx->send_evt);
+    }
+
+    ngx_memzero(ctx, sizeof(ngx_rtmp_vod_ctx_t));
+
+    ctx->file = f;
+
+    /* skip DataOffset bytes header and PreviousTagSize0 */
+    offset = (uint32_t) f->start[5] << 24 | (uint32_t) f->start[6] << 16
+           | (uint32_t) f->start[7] << 8 | f->start[8];
+    ctx->pos = ngx_min(f->start + offset + NGX_RTMP_VOD_TAG_SIZE, f->end);
+
+    if (v->start > 0
+        && ngx_rtmp_vod_seek(s, ctx, &path, (uint32_t) v->start) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ctx->seek) {
+        ctx->base = ngx_rtmp_vod_tag_time(ctx->seek);
+
+    } else if (ctx->pos + NGX_RTMP_VOD_TAG_HEADER <= f->end) {
+        ctx->base = ngx_rtmp_vod_tag_time(ctx->pos);
+    }
+
+    ctx->timestamp = ctx->base;
+    ctx->epoch = ngx_current_msec;
+
+    ctx->send_evt.data = s;
+    ctx->send_evt.log = s->log;
+    ctx->send_evt.handler = ngx_rtmp_vod_send;
+
+    ngx_rtmp_send_stream_begin(s, NGX_RTMP_MSID);
+
+    if (!v->silent) {
+        ngx_rtmp_send_status(s, "NetStream.Play.Start", "status",
+                             "Start video on demand");
+        ngx_rtmp_send_sample_access(s);
+    }
+
+    ngx_rtmp_vod_read_ahead(s, ctx);
+
+    ngx_rtmp_vod_send(&ctx->send_evt);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_close_stream(ngx_rtmp_session_t *s, ngx_rtmp_close_stream_t *v)
+{
+    ngx_rtmp_vod_ctx_t             *ctx;
+
+    ctx = ngx_rtmp_get_module_ctx(s, ngx_rtmp_vod_module);
+
+    if (ctx && ctx->send_evt.timer_set) {
+        ngx_del_timer(&ctx->send_evt);
+    }
+
+    return next_close_stream(s, v);
+}
+
+
+static ngx_int_t
+ngx_rtmp_vod_postconfiguration(ngx_conf_t *cf)
+{
+    next_play = ngx_rtmp_play;
+    ngx_rtmp_play = ngx_rtmp_vod_play;
+
+    next_close_stream = ngx_rtmp_close_stream;
+    ngx_rtmp_close_stream = ngx_rtmp_vod_close_stream;
+
+    return NGX_OK;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#include <nginx.h>
+#include "ngx_rtmp_wheel.h"
+
+
+/*
+ * two level wheel:
+ *      level 0: 256 slots, one tick per slot, about 25.6s
+ *      level 1: 64 slots, 256 ticks per slot, about 27min
+ * timer longer than level 1 is put in the last slot of level 1 and
+ * re-cascade when the slot expired
+ */
+#define NGX_RTMP_WHEEL_BITS0    8
+#define NGX_RTMP_WHEEL_BITS1    6
+#define NGX_RTMP_WHEEL_SIZE0    (1 << NGX_RTMP_WHEEL_BITS0)
+#define NGX_RTMP_WHEEL_SIZE1    (1 << NGX_RTMP_WHEEL_BITS1)
+#define NGX_RTMP_WHEEL_MASK0    (NGX_RTMP_WHEEL_SIZE0 - 1)
+#define NGX_RTMP_WHEEL_MASK1    (NGX_RTMP_WHEEL_SIZE1 - 1)
+
+
+/*
+ * timer node of event in wheel reuse ev->timer:
+ *      key: expire time in msec
+ *      left: prev node in slot
+ *      right: next node in slot
+ */
+#define ngx_rtmp_wheel_empty(h)     ((h)->right == (h))
+
+#define ngx_rtmp_wheel_init_slot(h)                                         \
+    (h)->left = h;                                                          \
+    (h)->right = h
+
+#define ngx_rtmp_wheel_link(h, n)                                           \
+    (n)->left = (h)->left;                                                  \
+    (n)->right = h;                                                         \
+    (h)->left->right = n;                                                   \
+    (h)->left = n
+
+#define ngx_rtmp_wheel_unlink(n)                                            \
+    (n)->left->right = (n)->right;                                          \
+    (n)->right->left = (n)->left
+
+
+typedef struct {
+    ngx_rbtree_node_t           slot0[NGX_RTMP_WHEEL_SIZE0];
+    ngx_rbtree_node_t           slot1[NGX_RTMP_WHEEL_SIZE1];
+
+    ngx_msec_t                  base;       /* time of tick 0 */
+    ngx_msec_t                  current;    /* time of last expired tick */
+    ngx_uint_t                  jiffies;    /* last expired tick */
+
+    ngx_event_t                 ev;
+
+    ngx_uint_t                  ntimers;
+    ngx_uint_t                  nexpired;
+    ngx_uint_t                  ncascade;
+
+    unsigned                    inited:1;
+} ngx_rtmp_wheel_t;
+
+
+static ngx_rtmp_wheel_t         ngx_rtmp_wheel;
+
+
+static void
+ngx_rtmp_wheel_insert(ngx_rtmp_wheel_t *w, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t          *h;
+    ngx_uint_t                  expires, idx;
+
+    expires = (node->key - w->base + NGX_RTMP_WHEEL_TICK - 1)
+            / NGX_RTMP_WHEEL_TICK;
+
+    /* expire at next tick at least */
+    if ((ngx_int_t) (expires - w->jiffies) <= 0) {
+        expires = w->jiffies + 1;
+    }
+
+    idx = expires - w->jiffies;
+
+    if (idx < NGX_RTMP_WHEEL_SIZE0) {
+        h = &w->slot0[expires & NGX_RTMP_WHEEL_MASK0];
+
+    } else {
+        if (idx >= NGX_RTMP_WHEEL_SIZE0 * NGX_RTMP_WHEEL_SIZE1) {
+            expires = w->jiffies + NGX_RTMP_WHEEL_SIZE0 * NGX_RTMP_WHEEL_SIZE1
+                    - 1;
+        }
+
+        h = &w->slot1[(expires >> NGX_RTMP_WHEEL_BITS0) & NGX_RTMP_WHEEL_MASK1];
+    }
+
+    ngx_rtmp_wheel_link(h, node);
+}
+
+static void
+ngx_rtmp_wheel_cascade(ngx_rtmp_wheel_t *w)
+{
+    ngx_rbtree_node_t          *h, *node, list;
+
+    h = &w->slot1[(w->jiffies >> NGX_RTMP_WHEEL_BITS0) & NGX_RTMP_WHEEL_MASK1];
+    if (ngx_rtmp_wheel_empty(h)) {
+        return;
+    }
+
+    /* move out first, node may be put back into the same slot */
+    list.left = h->left;
+    list.right = h->right;
+    list.left->right = &list;
+    list.right->left = &list;
+    ngx_rtmp_wheel_init_slot(h);
+
+    while (!ngx_rtmp_wheel_empty(&list)) {
+        node = list.right;
+        ngx_rtmp_wheel_unlink(node);
+        ngx_rtmp_wheel_insert(w, node);
+        ++w->ncascade;
+    }
+}
+
+static void
+ngx_rtmp_wheel_arm(ngx_rtmp_wheel_t *w)
+{
+    ngx_msec_int_t              timer;
+
+    timer = (ngx_msec_int_t) (w->current + NGX_RTMP_WHEEL_TICK
+                              - ngx_current_msec);
+    if (timer <= 0) {
+        timer = 1;
+    }
+
+    ngx_add_timer(&w->ev, (ngx_msec_t) timer);
+}
+
+static void
+ngx_rtmp_wheel_expire(ngx_event_t *ev)
+{
+    ngx_rtmp_wheel_t           *w;
+    ngx_rbtree_node_t          *h, *node;
+    ngx_event_t                *e;
+
+    w = ev->data;
+
+    while (w->ntimers && (ngx_msec_int_t) (ngx_current_msec - w->current)
+                         >= NGX_RTMP_WHEEL_TICK)
+    {
+        ++w->jiffies;
+        w->current += NGX_RTMP_WHEEL_TICK;
+
+        if ((w->jiffies & NGX_RTMP_WHEEL_MASK0) == 0) {
+            ngx_rtmp_wheel_cascade(w);
+        }
+
+        h = &w->slot0[w->jiffies & NGX_RTMP_WHEEL_MASK0];
+
+        while (!ngx_rtmp_wheel_empty(h)) {
+            node = h->right;
+            ngx_rtmp_wheel_unlink(node);
+            --w->ntimers;
+            ++w->nexpired;
+
+            e = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            e->timer_set = 0;
+            e->timedout = 1;
+
+            e->handler(e);
+        }
+    }
+
+    if (w->ntimers && !w->ev.timer_set) {
+        ngx_rtmp_wheel_arm(w);
+    }
+}
+
+static void
+ngx_rtmp_wheel_init(ngx_rtmp_wheel_t *w)
+{
+    ngx_uint_t                  i;
+
+    for (i = 0; i < NGX_RTMP_WHEEL_SIZE0; ++i) {
+        ngx_rtmp_wheel_init_slot(&w->slot0[i]);
+    }
+
+    for (i = 0; i < NGX_RTMP_WHEEL_SIZE1; ++i) {
+        ngx_rtmp_wheel_init_slot(&w->slot1[i]);
+    }
+
+    w->base = ngx_current_msec;
+    w->current = w->base;
+    w->jiffies = 0;
+
+    w->ev.data = w;
+    w->ev.log = ngx_cycle->log;
+    w->ev.handler = ngx_rtmp_wheel_expire;
+#if (nginx_version >= 1011011)
+    w->ev.cancelable = 1;
+#endif
+
+    w->inited = 1;
+}
+
+void
+ngx_rtmp_wheel_add_timer(ngx_event_t *ev, ngx_msec_t timer)
+{
+    ngx_rtmp_wheel_t           *w;
+    ngx_msec_t                  key;
+    ngx_msec_int_t              diff;
+
+    w = &ngx_rtmp_wheel;
+
+    if (!w->inited) {
+        ngx_rtmp_wheel_init(w);
+    }
+
+    key = ngx_current_msec + timer;
+
+    if (ev->timer_set) {
+        /* same as nginx timer, do not readd timer in the same tick */
+        diff = (ngx_msec_int_t) (key - ev->timer.key);
+        if (ngx_abs(diff) < NGX_RTMP_WHEEL_TICK) {
+            return;
+        }
+
+        ngx_rtmp_wheel_del_timer(ev);
+    }
+
+    if (w->ntimers == 0) {
+        /* wheel is empty, move wheel to current time */
+        w->jiffies = (ngx_current_msec - w->base) / NGX_RTMP_WHEEL_TICK;
+        w->current = w->base + w->jiffies * NGX_RTMP_WHEEL_TICK;
+    }
+
+    ev->timer.key = key;
+    ngx_rtmp_wheel_insert(w, &ev->timer);
+
+    ev->timer_set = 1;
+    ++w->ntimers;
+
+    if (!w->ev.timer_set) {
+        ngx_rtmp_wheel_arm(w);
+    }
+}
+
+void
+ngx_rtmp_wheel_del_timer(ngx_event_t *ev)
+{
+    ngx_rtmp_wheel_t           *w;
+
+    w = &ngx_rtmp_wheel;
+
+    if (!ev->timer_set) {
+        return;
+    }
+
+    ngx_rtmp_wheel_unlink(&ev->timer);
+    ev->timer.left = NULL;
+    ev->timer.right = NULL;
+
+    ev->timer_set = 0;
+    --w->ntimers;
+
+    if (w->ntimers == 0 && w->ev.timer_set) {
+        ngx_del_timer(&w->ev);
+    }
+}
+
+ngx_chain_t *
+ngx_rtmp_wheel_state(ngx_http_request_t *r)
+{
+    ngx_rtmp_wheel_t           *w;
+    ngx_chain_t                *cl;
+    ngx_buf_t                  *b;
+    size_t                      len;
+
+    w = &ngx_rtmp_wheel;
+
+    len = sizeof("##########rtmp timer wheel state##########\n") - 1
+        + sizeof("ngx_rtmp_wheel timers: \n") - 1 + NGX_OFF_T_LEN
+        + sizeof("ngx_rtmp_wheel expired: \n") - 1 + NGX_OFF_T_LEN
+        + sizeof("ngx_rtmp_wheel cascade: \n") - 1 + NGX_OFF_T_LEN;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
+    }
+    cl->next = NULL;
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        return NULL;
+    }
+    cl->buf = b;
+
+    b->last = ngx_snprintf(b->last, len,
+            "##########rtmp timer wheel state##########\n"
+            "ngx_rtmp_wheel timers: %ui\n"
+            "ngx_rtmp_wheel expired: %ui\n"
+            "ngx_rtmp_wheel cascade: %ui\n",
+            w->ntimers, w->nexpired, w->ncascade);
+
+    return cl;
+}
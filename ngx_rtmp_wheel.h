@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_WHEEL_H_INCLUDED_
+#define _NGX_RTMP_WHEEL_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_http.h>
+
+
+/*
+ * Coarse timer wheel for periodic session timers which could tolerate
+ * NGX_RTMP_WHEEL_TICK delay, such as ping, idle and log trunc timers.
+ * All timers in wheel share one timer in nginx event timer rbtree.
+ *
+ * ev->timer_set is valid for timer in wheel, but timer in wheel must not
+ * be deleted by ngx_del_timer or readded by ngx_add_timer.
+ */
+
+#define NGX_RTMP_WHEEL_TICK     100
+
+
+/*
+ * paras:
+ *      ev: event to add into wheel, readd if ev already in wheel
+ *      timer: timeout in msec
+ */
+void ngx_rtmp_wheel_add_timer(ngx_event_t *ev, ngx_msec_t timer);
+
+/*
+ * paras:
+ *      ev: event to delete from wheel
+ */
+void ngx_rtmp_wheel_del_timer(ngx_event_t *ev);
+
+/*
+ * paras:
+ *      r: http request to query status of timer wheel
+ */
+ngx_chain_t *ngx_rtmp_wheel_state(ngx_http_request_t *r);
+
+
+#endif
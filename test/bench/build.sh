@@ -0,0 +1,62 @@
+#!/bin/sh
+
+# build microbenchmarks with nginx source configured with this module
+#   NGX_SRC=/path/to/nginx ./build.sh
+
+if [ -z "$NGX_SRC" ] || [ ! -d "$NGX_SRC/objs" ]; then
+    echo "NGX_SRC must point to a configured nginx source directory"
+    exit 1
+fi
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$DIR/../..
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -g}
+
+INCS="-I$NGX_SRC/src/core -I$NGX_SRC/src/event -I$NGX_SRC/src/os/unix \
+      -I$NGX_SRC/objs -I$ROOT -I$ROOT/hls"
+
+$CC $CFLAGS $INCS -o "$DIR/ngx_rtmp_mpegts_bench" \
+    "$DIR/ngx_rtmp_mpegts_bench.c" "$ROOT/hls/ngx_rtmp_mpegts_pes.c" || exit 1
+
+$CC $CFLAGS $INCS -o "$DIR/ngx_rtmp_nal_bench" \
+    "$DIR/ngx_rtmp_nal_bench.c" "$ROOT/ngx_rtmp_bitop.c" || exit 1
+
+# kernels include ngx_rtmp.h which needs all include paths of nginx build
+ALL_INCS=$(sed -n '/^ALL_INCS = /,/[^\\]$/p' "$NGX_SRC/objs/Makefile" \
+           | sed -e 's/^ALL_INCS = //' -e 's/\\$//')
+
+# rtmp kernels run ngx_rtmp_handler.c on nginx core and toolkit objects, only
+# members needed are linked from archive, stub defines the rest
+if [ ! -f "$NGX_SRC/objs/src/core/ngx_palloc.o" ]; then
+    echo "nginx in NGX_SRC must be built with make"
+    exit 1
+fi
+
+NGX_OBJS=$(ls "$NGX_SRC"/objs/src/core/*.o "$NGX_SRC"/objs/src/event/*.o \
+              "$NGX_SRC"/objs/src/os/unix/*.o | grep -v '/nginx\.o$')
+TOOLKIT_OBJS=$(find "$NGX_SRC/objs/addon" -name ngx_rbuf.o -o \
+                    -name ngx_poold.o -o -name ngx_map.o)
+NGX_LIBS=$(grep -o -- ' -l[a-z0-9_]*' "$NGX_SRC/objs/Makefile" | sort -u)
+
+rm -f "$DIR/libngx_bench.a"
+ar rcs "$DIR/libngx_bench.a" $NGX_OBJS $TOOLKIT_OBJS || exit 1
+
+# sources of rtmp session on fake connection in ngx_rtmp_bench_stub.c
+STUB_SRCS="$DIR/ngx_rtmp_bench_stub.c $ROOT/ngx_rtmp_handler.c \
+           $ROOT/ngx_rtmp_shared_module.c $ROOT/ngx_rtmp_bandwidth.c \
+           $ROOT/ngx_rtmp_histogram.c"
+
+(cd "$NGX_SRC" && $CC $CFLAGS $ALL_INCS -I$ROOT -I$ROOT/hls -I$ROOT/dash \
+    -DNGX_RTMP_BENCH_CFLAGS="\"$CFLAGS\"" -o "$DIR/ngx_rtmp_kernel_bench" \
+    "$DIR/ngx_rtmp_kernel_bench.c" $STUB_SRCS \
+    "$ROOT/ngx_rtmp_amf.c" "$ROOT/hls/ngx_rtmp_mpegts.c" \
+    "$ROOT/hls/ngx_rtmp_mpegts_pes.c" "$ROOT/dash/ngx_rtmp_mp4.c" \
+    "$DIR/libngx_bench.a" $NGX_LIBS -lcrypto -lpthread) || exit 1
+
+# http client code of ngx_live_relay_httpflv.c is never called, drop it
+(cd "$NGX_SRC" && $CC $CFLAGS $ALL_INCS -I$ROOT \
+    -ffunction-sections -fdata-sections -Wl,--gc-sections \
+    -o "$DIR/ngx_live_relay_httpflv_bench" \
+    "$DIR/ngx_live_relay_httpflv_bench.c" $STUB_SRCS \
+    "$DIR/libngx_bench.a" $NGX_LIBS -lcrypto -lpthread) || exit 1
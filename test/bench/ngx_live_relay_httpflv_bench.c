@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Microbenchmark of flv tag parsing in HTTP-FLV relay pull, compare the
+ * state machine ngx_live_relay_httpflv_parse with parsing whole tags in
+ * place by ngx_live_relay_httpflv_parse_fast as body is received, fed with
+ * body buffers of 4k, 16k and 64k.
+ *
+ * Input is a flv file, 16MB of synthetic 25fps video and aac tags if no
+ * file given. Tags parsed by both are checked to be same before benchmark.
+ *
+ * Static parsers are reached by including ngx_live_relay_httpflv.c, http
+ * client code it refers to is dropped by linker with --gc-sections.
+ *
+ * build with configured and built nginx source:
+ *      NGX_SRC=/path/to/nginx ./build.sh
+ * run:
+ *      ./ngx_live_relay_httpflv_bench [rounds] [file]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ngx_live_relay_httpflv.c"
+#include "ngx_rtmp_bench_stub.h"
+
+
+#define NGX_LIVE_RELAY_HTTPFLV_BENCH_SIZE   (16 * 1024 * 1024)
+
+
+typedef struct {
+    ngx_uint_t                      tags;
+    uint64_t                        bytes;
+    uint64_t                        sum;    /* of tag headers in order */
+} ngx_live_relay_httpflv_bench_result_t;
+
+
+static ngx_log_t                    ngx_live_relay_httpflv_bench_log;
+static ngx_rtmp_session_t          *ngx_live_relay_httpflv_bench_session;
+static u_char                      *ngx_live_relay_httpflv_bench_flv;
+static size_t                       ngx_live_relay_httpflv_bench_len;
+
+
+static double
+ngx_live_relay_httpflv_bench_now(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ngx_int_t
+ngx_live_relay_httpflv_bench_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+    ngx_chain_t *in)
+{
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_live_relay_httpflv_bench_load(char *name)
+{
+    FILE           *fp;
+    long            size;
+
+    fp = fopen(name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "open %s failed\n", name);
+        return NGX_ERROR;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    ngx_live_relay_httpflv_bench_flv = malloc(size > 0 ? size : 1);
+    if (ngx_live_relay_httpflv_bench_flv == NULL
+        || fread(ngx_live_relay_httpflv_bench_flv, 1, size, fp)
+           != (size_t) size)
+    {
+        fprintf(stderr, "read %s failed\n", name);
+        fclose(fp);
+        return NGX_ERROR;
+    }
+
+    ngx_live_relay_httpflv_bench_len = size;
+
+    fclose(fp);
+
+    return NGX_OK;
+}
+
+
+/* 25 video and 43 aac tags per second, sizes as ngx_rtmp_mpegts_bench */
+static ngx_int_t
+ngx_live_relay_httpflv_bench_synthetic(void)
+{
+    u_char         *p, *last;
+    ngx_uint_t      i, n;
+    uint32_t        size, timestamp;
+    u_char          type;
+
+    p = malloc(NGX_LIVE_RELAY_HTTPFLV_BENCH_SIZE + 65536);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_live_relay_httpflv_bench_flv = p;
+    last = p + NGX_LIVE_RELAY_HTTPFLV_BENCH_SIZE;
+
+    /* flv header with audio and video, first previous tag size */
+    p = ngx_cpymem(p, "FLV\x01\x05\x00\x00\x00\x09\x00\x00\x00\x00", 13);
+
+    for (i = 0; p < last; ++i) {
+        n = i % 68;
+
+        if (n < 25) {
+            type = NGX_RTMP_MSG_VIDEO;
+            size = n == 0 ? 60000 : 3000 + (n * 997) % 9000;
+            timestamp = i / 68 * 1000 + n * 40;
+
+        } else {
+            type = NGX_RTMP_MSG_AUDIO;
+            size = 180 + (n * 37) % 400;
+            timestamp = i / 68 * 1000 + (n - 25) * 23;
+        }
+
+        *p++ = type;
+        *p++ = (u_char) (size >> 16);
+        *p++ = (u_char) (size >> 8);
+        *p++ = (u_char) size;
+        *p++ = (u_char) (timestamp >> 16);
+        *p++ = (u_char) (timestamp >> 8);
+        *p++ = (u_char) timestamp;
+        *p++ = (u_char) (timestamp >> 24);
+        *p++ = 0;
+        *p++ = 0;
+        *p++ = 0;
+
+        ngx_memset(p, (u_char) i, size);
+        p += size;
+
+        *p++ = (u_char) ((size + 11) >> 24);
+        *p++ = (u_char) ((size + 11) >> 16);
+        *p++ = (u_char) ((size + 11) >> 8);
+        *p++ = (u_char) (size + 11);
+    }
+
+    ngx_live_relay_httpflv_bench_len = p - ngx_live_relay_httpflv_bench_flv;
+
+    return NGX_OK;
+}
+
+
+/* one pull of whole input, body is read in buffers of size */
+static ngx_int_t
+ngx_live_relay_httpflv_bench_run(ngx_flag_t fast, size_t size,
+    ngx_live_relay_httpflv_bench_result_t *res)
+{
+    ngx_rtmp_session_t     *s;
+    ngx_rtmp_stream_t      *st;
+    ngx_chain_t             ref;
+    ngx_buf_t               b, refbuf;
+    u_char                 *p, *last;
+    ngx_int_t               n;
+
+    s = ngx_live_relay_httpflv_bench_session;
+    st = &s->in_streams[0];
+
+    s->flv_state = flv_header_F;
+    s->flv_first_pts = 0;
+    ngx_memzero(&st->hdr, sizeof(ngx_rtmp_header_t));
+    st->len = 0;
+
+    ngx_memzero(&refbuf, sizeof(ngx_buf_t));
+    refbuf.memory = 1;
+    ref.buf = &refbuf;
+
+    ngx_memzero(res, sizeof(ngx_live_relay_httpflv_bench_result_t));
+
+    p = ngx_live_relay_httpflv_bench_flv;
+    last = p + ngx_live_relay_httpflv_bench_len;
+
+    for (/* void */; p < last; p += size) {
+        ngx_memzero(&b, sizeof(ngx_buf_t));
+        b.start = p;
+        b.pos = p;
+        b.last = p + ngx_min(size, (size_t) (last - p));
+        b.end = b.last;
+        b.memory = 1;
+
+        /* as ngx_live_relay_httpflv_recv_body */
+        while (b.pos != b.last) {
+            n = NGX_DECLINED;
+
+            if (fast) {
+                n = ngx_live_relay_httpflv_parse_fast(s, &b, &ref);
+            }
+
+            if (n == NGX_DECLINED) {
+                n = ngx_live_relay_httpflv_parse(s, &b);
+            }
+
+            if (n == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (n == NGX_AGAIN) {
+                continue;
+            }
+
+            ++res->tags;
+            res->bytes += st->hdr.mlen;
+            res->sum = res->sum * 31 + st->hdr.type + st->hdr.timestamp
+                     + st->hdr.mlen;
+
+            if (n == NGX_OK) {
+                ngx_put_chainbufs(st->in);
+                st->in = NULL;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_live_relay_httpflv_bench_result_t   res[2];
+    size_t                                  sizes[] = { 4096, 16384, 65536 };
+    char                                   *names[] = { "state", "fast" };
+    ngx_uint_t                              rounds, i, m, r;
+    double                                  start, elapsed;
+
+    rounds = argc > 1 ? (ngx_uint_t) atoi(argv[1]) : 10;
+
+    if (argc > 2) {
+        if (ngx_live_relay_httpflv_bench_load(argv[2]) != NGX_OK) {
+            return 1;
+        }
+
+    } else if (ngx_live_relay_httpflv_bench_synthetic() != NGX_OK) {
+        return 1;
+    }
+
+    ngx_live_relay_httpflv_bench_session = ngx_rtmp_bench_session(
+                                        &ngx_live_relay_httpflv_bench_log,
+                                        ngx_live_relay_httpflv_bench_av, 1);
+    if (ngx_live_relay_httpflv_bench_session == NULL) {
+        fprintf(stderr, "create session failed\n");
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for (m = 0; m < 2; ++m) {
+            if (ngx_live_relay_httpflv_bench_run(m, sizes[i], &res[m])
+                != NGX_OK)
+            {
+                fprintf(stderr, "%s: parse failed, read %u\n",
+                        names[m], (unsigned) sizes[i]);
+                return 1;
+            }
+        }
+
+        if (res[0].tags != res[1].tags || res[0].bytes != res[1].bytes
+            || res[0].sum != res[1].sum)
+        {
+            fprintf(stderr, "mismatch, read %u, tags: %u %u\n",
+                    (unsigned) sizes[i], (unsigned) res[0].tags,
+                    (unsigned) res[1].tags);
+            return 1;
+        }
+    }
+
+    printf("tags: %u  bytes: %lu\n", (unsigned) res[0].tags,
+           (unsigned long) ngx_live_relay_httpflv_bench_len);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        for (m = 0; m < 2; ++m) {
+            start = ngx_live_relay_httpflv_bench_now();
+
+            for (r = 0; r < rounds; ++r) {
+                ngx_live_relay_httpflv_bench_run(m, sizes[i], &res[m]);
+            }
+
+            elapsed = ngx_live_relay_httpflv_bench_now() - start;
+
+            printf("%-6s read: %6u  time: %.3fs  MB/s: %.1f\n", names[m],
+                   (unsigned) sizes[i], elapsed,
+                   (double) ngx_live_relay_httpflv_bench_len * rounds
+                   / elapsed / 1024 / 1024);
+        }
+    }
+
+    return 0;
+}
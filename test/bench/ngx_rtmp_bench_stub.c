@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Minimal nginx core for microbenchmarks linked with translation units of
+ * this module, only symbols they refer to are defined here, the rest comes
+ * from objects of nginx build.
+ *
+ * nginx must be configured without --with-debug, or ngx_log_debug refers to
+ * more of core.
+ *
+ * ngx_rtmp_bench_session makes a session of ngx_rtmp_handler.c on a fake
+ * connection, bytes it sends can be captured in wire and fed back to it.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include "ngx_rtmp.h"
+#include "ngx_rtmp_monitor_module.h"
+#include "ngx_rtmp_wheel.h"
+#include "ngx_rtmp_bench_stub.h"
+
+
+#define NGX_RTMP_BENCH_MAX_STREAMS      32
+#define NGX_RTMP_BENCH_OUT_QUEUE        256
+#define NGX_RTMP_BENCH_MERGE_FRAME      32
+
+
+/* codec ctx of session is s->ctx[0], see ngx_rtmp_kernel_bench_mp4_init */
+ngx_module_t  ngx_rtmp_codec_module;
+
+/* all rtmp modules have ctx_index 0, conf of session is core conf only */
+ngx_module_t  ngx_rtmp_core_module;
+ngx_uint_t    ngx_rtmp_max_module = 1;
+
+/* conf of ngx_rtmp_shared_module is conf_ctx[0] */
+extern ngx_module_t  ngx_rtmp_shared_module;
+ngx_module_t  ngx_live_module;
+
+
+volatile ngx_cycle_t           *ngx_cycle;
+volatile ngx_msec_t             ngx_current_msec;
+volatile ngx_time_t            *ngx_cached_time;
+ngx_event_actions_t             ngx_event_actions;
+
+
+ngx_buf_t                       ngx_rtmp_bench_wire;
+ngx_flag_t                      ngx_rtmp_bench_capture;
+ngx_uint_t                      ngx_rtmp_bench_finalized;
+
+
+static ngx_cycle_t              ngx_rtmp_bench_cycle;
+static ngx_time_t               ngx_rtmp_bench_time;
+static void                    *ngx_rtmp_bench_conf_ctx[1];
+
+static ngx_rtmp_core_main_conf_t    ngx_rtmp_bench_cmcf;
+static ngx_rtmp_core_srv_conf_t     ngx_rtmp_bench_cscf;
+static ngx_rtmp_core_app_conf_t     ngx_rtmp_bench_cacf;
+static void                        *ngx_rtmp_bench_main_conf[1];
+static void                        *ngx_rtmp_bench_srv_conf[1];
+static void                        *ngx_rtmp_bench_app_conf[1];
+
+static ngx_connection_t         ngx_rtmp_bench_connection;
+static ngx_event_t              ngx_rtmp_bench_read;
+static ngx_event_t              ngx_rtmp_bench_write;
+
+
+#if (NGX_HAVE_VARIADIC_MACROS)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+#else
+
+void
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+#endif
+
+
+/* event module is not initialized, connection is always ready */
+
+ngx_int_t
+ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_handle_write_event(ngx_event_t *wev, size_t lowat)
+{
+    return NGX_OK;
+}
+
+
+/* rtmp modules out of ngx_rtmp_handler.c */
+
+void
+ngx_rtmp_finalize_session(ngx_rtmp_session_t *s)
+{
+    ++ngx_rtmp_bench_finalized;
+}
+
+
+ngx_int_t
+ngx_rtmp_send_ack(ngx_rtmp_session_t *s, uint32_t seq)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_rtmp_send_ping_request(ngx_rtmp_session_t *s, uint32_t timestamp)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_rtmp_monitor_frame(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+    ngx_chain_t *in, ngx_flag_t is_header, ngx_flag_t publishing)
+{
+}
+
+
+void
+ngx_rtmp_wheel_add_timer(ngx_event_t *ev, ngx_msec_t timer)
+{
+}
+
+
+/* fake connection, peer reads everything sent and writes from wire */
+
+static ssize_t
+ngx_rtmp_bench_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_buf_t                  *b;
+
+    b = &ngx_rtmp_bench_wire;
+
+    if (b->pos == b->last) {
+        return NGX_AGAIN;
+    }
+
+    size = ngx_min(size, (size_t) (b->last - b->pos));
+    ngx_memcpy(buf, b->pos, size);
+    b->pos += size;
+
+    return size;
+}
+
+
+static ngx_chain_t *
+ngx_rtmp_bench_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    ngx_buf_t                  *b;
+    size_t                      size;
+
+    b = &ngx_rtmp_bench_wire;
+
+    for (/* void */; in; in = in->next) {
+        size = in->buf->last - in->buf->pos;
+
+        if (ngx_rtmp_bench_capture) {
+            if ((size_t) (b->end - b->last) < size) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            b->last = ngx_cpymem(b->last, in->buf->pos, size);
+        }
+
+        c->sent += size;
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_rtmp_bench_cycle_init(ngx_log_t *log)
+{
+    ngx_core_module_t          *cm;
+    void                       *conf;
+
+    ngx_pagesize = getpagesize();
+
+    ngx_cached_time = &ngx_rtmp_bench_time;
+
+    ngx_rtmp_bench_cycle.log = log;
+    ngx_rtmp_bench_cycle.conf_ctx = (void ****) ngx_rtmp_bench_conf_ctx;
+    ngx_rtmp_bench_cycle.pool = ngx_create_pool(4096, log);
+    if (ngx_rtmp_bench_cycle.pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_cycle = &ngx_rtmp_bench_cycle;
+
+#if (nginx_version >= 1007005)
+    /* ngx_rtmp_send_message posts write event */
+    ngx_queue_init(&ngx_posted_events);
+#endif
+
+    /* frames are allocated and recycled by ngx_rtmp_shared_module */
+    ngx_rtmp_shared_module.index = 0;
+    cm = ngx_rtmp_shared_module.ctx;
+
+    conf = cm->create_conf(&ngx_rtmp_bench_cycle);
+    if (conf == NULL
+        || cm->init_conf(&ngx_rtmp_bench_cycle, conf) != NGX_CONF_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_rtmp_bench_conf_ctx[0] = conf;
+
+    return NGX_OK;
+}
+
+
+ngx_rtmp_session_t *
+ngx_rtmp_bench_session(ngx_log_t *log, ngx_rtmp_handler_pt av, size_t wire)
+{
+    ngx_rtmp_session_t         *s;
+    ngx_connection_t           *c;
+    ngx_pool_t                 *pool;
+    ngx_array_t                *events;
+
+    if (ngx_cycle == NULL && ngx_rtmp_bench_cycle_init(log) != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_rtmp_bench_wire.start = malloc(wire);
+    if (ngx_rtmp_bench_wire.start == NULL) {
+        return NULL;
+    }
+    ngx_rtmp_bench_wire.pos = ngx_rtmp_bench_wire.start;
+    ngx_rtmp_bench_wire.last = ngx_rtmp_bench_wire.start;
+    ngx_rtmp_bench_wire.end = ngx_rtmp_bench_wire.start + wire;
+
+    /* as rtmp application with default settings except size of queues */
+    ngx_rtmp_bench_cscf.chunk_size = NGX_RTMP_BENCH_CHUNK_SIZE;
+    ngx_rtmp_bench_cscf.max_streams = NGX_RTMP_BENCH_MAX_STREAMS;
+    ngx_rtmp_bench_cscf.max_message = 1024 * 1024;
+    ngx_rtmp_bench_cscf.play_time_fix = 1;
+    ngx_rtmp_bench_cscf.publish_time_fix = 1;
+    ngx_rtmp_bench_cscf.timeout = 60000;
+    ngx_rtmp_bench_cscf.out_queue = NGX_RTMP_BENCH_OUT_QUEUE;
+    ngx_rtmp_bench_cscf.out_cork = NGX_RTMP_BENCH_OUT_QUEUE / 8;
+
+    ngx_rtmp_bench_cacf.merge_frame = NGX_RTMP_BENCH_MERGE_FRAME;
+
+    /* audio and video messages received go to av, others are dropped */
+    events = ngx_rtmp_bench_cmcf.events;
+    events[NGX_RTMP_MSG_AUDIO].elts = ngx_pcalloc(ngx_cycle->pool,
+                                                  sizeof(ngx_rtmp_handler_pt));
+    if (events[NGX_RTMP_MSG_AUDIO].elts == NULL) {
+        return NULL;
+    }
+
+    *(ngx_rtmp_handler_pt *) events[NGX_RTMP_MSG_AUDIO].elts = av;
+    events[NGX_RTMP_MSG_AUDIO].nelts = 1;
+    events[NGX_RTMP_MSG_AUDIO].size = sizeof(ngx_rtmp_handler_pt);
+    events[NGX_RTMP_MSG_AUDIO].nalloc = 1;
+    events[NGX_RTMP_MSG_VIDEO] = events[NGX_RTMP_MSG_AUDIO];
+
+    ngx_rtmp_bench_main_conf[0] = &ngx_rtmp_bench_cmcf;
+    ngx_rtmp_bench_srv_conf[0] = &ngx_rtmp_bench_cscf;
+    ngx_rtmp_bench_app_conf[0] = &ngx_rtmp_bench_cacf;
+
+    /* as ngx_rtmp_create_session */
+    pool = ngx_create_pool(4096, log);
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    s = ngx_pcalloc(pool, sizeof(ngx_rtmp_session_t));
+    if (s == NULL) {
+        return NULL;
+    }
+
+    s->pool = pool;
+    s->log = log;
+    s->main_conf = ngx_rtmp_bench_main_conf;
+    s->srv_conf = ngx_rtmp_bench_srv_conf;
+    s->app_conf = ngx_rtmp_bench_app_conf;
+
+    s->ctx = ngx_pcalloc(pool, sizeof(void *) * ngx_rtmp_max_module);
+    if (s->ctx == NULL) {
+        return NULL;
+    }
+
+    s->out_queue = ngx_rtmp_bench_cscf.out_queue;
+    s->out_cork = ngx_rtmp_bench_cscf.out_cork;
+    s->in_streams = ngx_pcalloc(pool, sizeof(ngx_rtmp_stream_t)
+                                      * ngx_rtmp_bench_cscf.max_streams);
+    if (s->in_streams == NULL) {
+        return NULL;
+    }
+
+#if (nginx_version >= 1007005)
+    ngx_queue_init(&s->posted_dry_events);
+#endif
+
+    s->timeout = ngx_rtmp_bench_cscf.timeout;
+    s->live_type = NGX_RTMP_LIVE;
+
+    /* as ngx_rtmp_init_session, peer sets the same chunk size */
+    if (ngx_rtmp_set_chunk_size(s, ngx_rtmp_bench_cscf.chunk_size)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    c = &ngx_rtmp_bench_connection;
+    c->data = s;
+    c->log = log;
+    c->pool = pool;
+    c->read = &ngx_rtmp_bench_read;
+    c->write = &ngx_rtmp_bench_write;
+    c->recv = ngx_rtmp_bench_recv;
+    c->send_chain = ngx_rtmp_bench_send_chain;
+
+    c->read->data = c;
+    c->read->log = log;
+    c->write->data = c;
+    c->write->log = log;
+
+    s->connection = c;
+
+    /* install handlers of ngx_rtmp_handler.c, nothing to read yet */
+    ngx_rtmp_cycle(s);
+
+    if (ngx_rtmp_bench_finalized) {
+        return NULL;
+    }
+
+    return s;
+}
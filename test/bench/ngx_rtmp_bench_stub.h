@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+#ifndef _NGX_RTMP_BENCH_STUB_H_INCLUDED_
+#define _NGX_RTMP_BENCH_STUB_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp.h"
+
+
+#define NGX_RTMP_BENCH_CHUNK_SIZE       4096
+
+
+/*
+ * bytes sent by session of ngx_rtmp_bench_session are appended to wire
+ * when capture is set, bytes between pos and last of wire are received
+ */
+extern ngx_buf_t                    ngx_rtmp_bench_wire;
+extern ngx_flag_t                   ngx_rtmp_bench_capture;
+
+/* times of ngx_rtmp_finalize_session called */
+extern ngx_uint_t                   ngx_rtmp_bench_finalized;
+
+
+/*
+ * paras:
+ *      log: log of session and fake cycle
+ *      av: handler of audio and video messages received
+ *      wire: capacity of wire in bytes
+ * return:
+ *      session with chunk size NGX_RTMP_BENCH_CHUNK_SIZE on fake
+ *      connection which is always ready, NULL for error
+ */
+ngx_rtmp_session_t *ngx_rtmp_bench_session(ngx_log_t *log,
+        ngx_rtmp_handler_pt av, size_t wire);
+
+
+#endif
@@ -0,0 +1,1080 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Microbenchmark suite of protocol and muxing kernels, runs translation
+ * units of this module on canned inputs, linked with
+ * ngx_rtmp_bench_stub.c instead of nginx core:
+ *
+ *      amf_write       connect command to chain, ngx_rtmp_amf.c
+ *      amf_read        connect command from chain, ngx_rtmp_amf.c
+ *      ts_frames       1s of 25fps video and aac, hls/ngx_rtmp_mpegts.c
+ *      mp4_moov        init segment of avc track, dash/ngx_rtmp_mp4.c
+ *      mp4_moof        moof and mdat header of 1s, dash/ngx_rtmp_mp4.c
+ *      chunk_encode    1s of frames queued and sent as rtmp chunks,
+ *                      ngx_rtmp_handler.c ngx_rtmp_prepare_out_chain
+ *      chunk_decode    rtmp chunks of chunk_encode received, ngx_rtmp_recv
+ *      rtmp_frame      1s of frames copied into shared frames and released,
+ *                      ngx_rtmp_shared_module.c
+ *      ts_append       1s of frames copied into shared mpegts frames and
+ *                      released, ngx_mpegts_shared_append_chain
+ *
+ * rtmp kernels run on a session of ngx_rtmp_bench_session, with chunk size
+ * 4096 and 32 frames merged in a send.
+ *
+ * Output of every kernel is checked once before benchmark. Each kernel
+ * runs at least -t msec, reported as ns/op and MB/s of bytes produced or
+ * consumed per op.
+ *
+ * Results can be saved as baseline with -w, and compared with baseline by
+ * -b, exit status is 2 if any kernel is slower than baseline by more than
+ * -r percent, baseline is machine specific, make it on the machine which
+ * runs comparison. Exit status is 1 if baseline has none of kernels run.
+ *
+ * build with configured nginx source:
+ *      NGX_SRC=/path/to/nginx ./build.sh
+ * run:
+ *      ./ngx_rtmp_kernel_bench [-t msec] [-b baseline] [-w baseline]
+ *          [-r percent] [kernel ...]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include "ngx_rtmp.h"
+#include "ngx_rtmp_amf.h"
+#include "ngx_rtmp_codec_module.h"
+#include "ngx_rtmp_mpegts.h"
+#include "ngx_rtmp_mp4.h"
+#include "ngx_rtmp_streams.h"
+#include "ngx_rtmp_bench_stub.h"
+
+
+#define NGX_RTMP_KERNEL_BENCH_LINKS     64
+#define NGX_RTMP_KERNEL_BENCH_CHUNK     128
+#define NGX_RTMP_KERNEL_BENCH_FRAMES    68
+#define NGX_RTMP_KERNEL_BENCH_SAMPLES   25
+#define NGX_RTMP_KERNEL_BENCH_WIRE      (4 * 1024 * 1024)
+
+/* set by build.sh, recorded in baseline with compiler and cpu */
+#ifndef NGX_RTMP_BENCH_CFLAGS
+#define NGX_RTMP_BENCH_CFLAGS           "unknown"
+#endif
+
+
+typedef ngx_int_t (*ngx_rtmp_kernel_bench_pt)(size_t *bytes);
+
+
+typedef struct {
+    char                           *name;
+    ngx_rtmp_kernel_bench_pt        run;
+    double                          ns;         /* per op */
+    double                          mbps;
+    double                          baseline;   /* ns per op, 0 if none */
+} ngx_rtmp_kernel_bench_t;
+
+
+typedef struct {
+    ngx_rtmp_mpegts_frame_t         f;
+    size_t                          size;
+} ngx_rtmp_kernel_bench_frame_t;
+
+
+static ngx_log_t                    ngx_rtmp_kernel_bench_log;
+
+/* amf, chain of rtmp sized chunks as received or sent */
+static ngx_chain_t                  ngx_rtmp_kernel_bench_links[
+                                        NGX_RTMP_KERNEL_BENCH_LINKS];
+static ngx_buf_t                    ngx_rtmp_kernel_bench_bufs[
+                                        NGX_RTMP_KERNEL_BENCH_LINKS];
+static u_char                       ngx_rtmp_kernel_bench_mem[
+                                        NGX_RTMP_KERNEL_BENCH_LINKS]
+                                        [NGX_RTMP_KERNEL_BENCH_CHUNK];
+static ngx_uint_t                   ngx_rtmp_kernel_bench_nlinks;
+/* first link of amf_write, links before it are input of amf_read */
+static ngx_uint_t                   ngx_rtmp_kernel_bench_wlink;
+static ngx_chain_t                 *ngx_rtmp_kernel_bench_amf;
+
+/* ts */
+static ngx_rtmp_kernel_bench_frame_t
+                                    ngx_rtmp_kernel_bench_frames[
+                                        NGX_RTMP_KERNEL_BENCH_FRAMES];
+static u_char                      *ngx_rtmp_kernel_bench_payload;
+static size_t                       ngx_rtmp_kernel_bench_ts_bytes;
+
+/* mp4 */
+static ngx_rtmp_session_t           ngx_rtmp_kernel_bench_session;
+static ngx_rtmp_codec_ctx_t         ngx_rtmp_kernel_bench_codec;
+static void                        *ngx_rtmp_kernel_bench_ctx[1];
+static ngx_rtmp_frame_t             ngx_rtmp_kernel_bench_avc;
+static ngx_chain_t                  ngx_rtmp_kernel_bench_avc_link;
+static ngx_buf_t                    ngx_rtmp_kernel_bench_avc_buf;
+static ngx_rtmp_mp4_sample_t        ngx_rtmp_kernel_bench_samples[
+                                        NGX_RTMP_KERNEL_BENCH_SAMPLES];
+static u_char                       ngx_rtmp_kernel_bench_box[65536];
+
+/* rtmp, frames of ts kernel as rtmp messages */
+static ngx_rtmp_session_t          *ngx_rtmp_kernel_bench_rtmp;
+static ngx_rtmp_frame_t            *ngx_rtmp_kernel_bench_rtmp_frames[
+                                        NGX_RTMP_KERNEL_BENCH_FRAMES];
+static ngx_chain_t                  ngx_rtmp_kernel_bench_media[
+                                        NGX_RTMP_KERNEL_BENCH_FRAMES];
+static ngx_buf_t                    ngx_rtmp_kernel_bench_media_bufs[
+                                        NGX_RTMP_KERNEL_BENCH_FRAMES];
+static ngx_uint_t                   ngx_rtmp_kernel_bench_nrecv;
+static size_t                       ngx_rtmp_kernel_bench_recv_bytes;
+
+/* baseline 320x240 avcC with sequence header tag prefix */
+static u_char                       ngx_rtmp_kernel_bench_avc_header[] = {
+    0x17, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x42, 0xc0, 0x1e, 0xff, 0xe1, 0x00, 0x09,
+    0x67, 0x42, 0xc0, 0x1e, 0xd9, 0x01, 0x41, 0xfb, 0x01,
+    0x01, 0x00, 0x04, 0x68, 0xce, 0x3c, 0x80
+};
+
+
+/* connect command of flash player */
+static u_char                       ngx_rtmp_kernel_bench_app[32];
+static u_char                       ngx_rtmp_kernel_bench_flashver[32];
+static u_char                       ngx_rtmp_kernel_bench_swf_url[256];
+static u_char                       ngx_rtmp_kernel_bench_tc_url[256];
+static u_char                       ngx_rtmp_kernel_bench_page_url[256];
+static double                       ngx_rtmp_kernel_bench_trans;
+static double                       ngx_rtmp_kernel_bench_acodecs;
+static double                       ngx_rtmp_kernel_bench_vcodecs;
+static double                       ngx_rtmp_kernel_bench_vfunc;
+static double                       ngx_rtmp_kernel_bench_capabilities;
+static u_char                       ngx_rtmp_kernel_bench_cmd[32];
+
+static ngx_rtmp_amf_elt_t           ngx_rtmp_kernel_bench_out_obj[] = {
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("app"),
+      "live", 0 },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("flashVer"),
+      "LNX 9,0,124,2", 0 },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("swfUrl"),
+      "http://www.example.com/player/player.swf", 0 },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("tcUrl"),
+      "rtmp://live.example.com:1935/live", 0 },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("capabilities"),
+      &ngx_rtmp_kernel_bench_capabilities, 0 },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("audioCodecs"),
+      &ngx_rtmp_kernel_bench_acodecs, 0 },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("videoCodecs"),
+      &ngx_rtmp_kernel_bench_vcodecs, 0 },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("videoFunction"),
+      &ngx_rtmp_kernel_bench_vfunc, 0 },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("pageUrl"),
+      "http://www.example.com/live/room/1234567.html", 0 },
+};
+
+static ngx_rtmp_amf_elt_t           ngx_rtmp_kernel_bench_out[] = {
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_null_string,
+      "connect", 0 },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_null_string,
+      &ngx_rtmp_kernel_bench_trans, 0 },
+
+    { NGX_RTMP_AMF_OBJECT,
+      ngx_null_string,
+      ngx_rtmp_kernel_bench_out_obj, sizeof(ngx_rtmp_kernel_bench_out_obj) },
+};
+
+/* same as ngx_rtmp_cmd_connect_init */
+static ngx_rtmp_amf_elt_t           ngx_rtmp_kernel_bench_in_obj[] = {
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("app"),
+      ngx_rtmp_kernel_bench_app, sizeof(ngx_rtmp_kernel_bench_app) },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("flashVer"),
+      ngx_rtmp_kernel_bench_flashver,
+      sizeof(ngx_rtmp_kernel_bench_flashver) },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("swfUrl"),
+      ngx_rtmp_kernel_bench_swf_url, sizeof(ngx_rtmp_kernel_bench_swf_url) },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("tcUrl"),
+      ngx_rtmp_kernel_bench_tc_url, sizeof(ngx_rtmp_kernel_bench_tc_url) },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("audioCodecs"),
+      &ngx_rtmp_kernel_bench_acodecs, sizeof(double) },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_string("videoCodecs"),
+      &ngx_rtmp_kernel_bench_vcodecs, sizeof(double) },
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_string("pageUrl"),
+      ngx_rtmp_kernel_bench_page_url, sizeof(ngx_rtmp_kernel_bench_page_url) },
+};
+
+static ngx_rtmp_amf_elt_t           ngx_rtmp_kernel_bench_in[] = {
+
+    { NGX_RTMP_AMF_STRING,
+      ngx_null_string,
+      ngx_rtmp_kernel_bench_cmd, sizeof(ngx_rtmp_kernel_bench_cmd) },
+
+    { NGX_RTMP_AMF_NUMBER,
+      ngx_null_string,
+      &ngx_rtmp_kernel_bench_trans, 0 },
+
+    { NGX_RTMP_AMF_OBJECT,
+      ngx_null_string,
+      ngx_rtmp_kernel_bench_in_obj, sizeof(ngx_rtmp_kernel_bench_in_obj) },
+};
+
+
+static double
+ngx_rtmp_kernel_bench_now(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* amf */
+
+static ngx_chain_t *
+ngx_rtmp_kernel_bench_alloc(void *arg)
+{
+    ngx_chain_t    *cl;
+    ngx_buf_t      *b;
+
+    if (ngx_rtmp_kernel_bench_nlinks == NGX_RTMP_KERNEL_BENCH_LINKS) {
+        return NULL;
+    }
+
+    cl = &ngx_rtmp_kernel_bench_links[ngx_rtmp_kernel_bench_nlinks];
+    b = &ngx_rtmp_kernel_bench_bufs[ngx_rtmp_kernel_bench_nlinks];
+
+    b->start = ngx_rtmp_kernel_bench_mem[ngx_rtmp_kernel_bench_nlinks];
+    b->end = b->start + NGX_RTMP_KERNEL_BENCH_CHUNK;
+    b->pos = b->start;
+    b->last = b->start;
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    ++ngx_rtmp_kernel_bench_nlinks;
+
+    return cl;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_amf_write(size_t *bytes)
+{
+    ngx_rtmp_amf_ctx_t      act;
+    ngx_chain_t            *cl;
+
+    ngx_rtmp_kernel_bench_nlinks = ngx_rtmp_kernel_bench_wlink;
+
+    ngx_memzero(&act, sizeof(act));
+    act.alloc = ngx_rtmp_kernel_bench_alloc;
+    act.log = &ngx_rtmp_kernel_bench_log;
+
+    if (ngx_rtmp_amf_write(&act, ngx_rtmp_kernel_bench_out,
+                           sizeof(ngx_rtmp_kernel_bench_out)
+                           / sizeof(ngx_rtmp_kernel_bench_out[0]))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    *bytes = 0;
+    for (cl = act.first; cl; cl = cl->next) {
+        *bytes += cl->buf->last - cl->buf->pos;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_amf_read(size_t *bytes)
+{
+    ngx_rtmp_amf_ctx_t      act;
+    ngx_chain_t            *cl;
+
+    ngx_memzero(&act, sizeof(act));
+    act.link = ngx_rtmp_kernel_bench_amf;
+    act.log = &ngx_rtmp_kernel_bench_log;
+
+    if (ngx_rtmp_amf_read(&act, ngx_rtmp_kernel_bench_in,
+                          sizeof(ngx_rtmp_kernel_bench_in)
+                          / sizeof(ngx_rtmp_kernel_bench_in[0]))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    *bytes = 0;
+    for (cl = ngx_rtmp_kernel_bench_amf; cl; cl = cl->next) {
+        *bytes += cl->buf->last - cl->buf->pos;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_amf_init(void)
+{
+    size_t                  bytes;
+
+    ngx_rtmp_kernel_bench_trans = 1;
+    ngx_rtmp_kernel_bench_capabilities = 15;
+    ngx_rtmp_kernel_bench_acodecs = 3575;
+    ngx_rtmp_kernel_bench_vcodecs = 252;
+    ngx_rtmp_kernel_bench_vfunc = 1;
+
+    if (ngx_rtmp_kernel_bench_amf_write(&bytes) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* chain written is input of amf_read, keep it */
+    ngx_rtmp_kernel_bench_amf = ngx_rtmp_kernel_bench_links;
+    ngx_rtmp_kernel_bench_wlink = ngx_rtmp_kernel_bench_nlinks;
+
+    ngx_rtmp_kernel_bench_trans = 0;
+    ngx_rtmp_kernel_bench_acodecs = 0;
+
+    if (ngx_rtmp_kernel_bench_amf_read(&bytes) != NGX_OK
+        || ngx_strcmp(ngx_rtmp_kernel_bench_cmd, "connect") != 0
+        || ngx_strcmp(ngx_rtmp_kernel_bench_tc_url,
+                      "rtmp://live.example.com:1935/live") != 0
+        || ngx_rtmp_kernel_bench_trans != 1
+        || ngx_rtmp_kernel_bench_acodecs != 3575)
+    {
+        fprintf(stderr, "amf: read back mismatch\n");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* ts */
+
+static ssize_t
+ngx_rtmp_kernel_bench_ts_sink(ngx_rtmp_mpegts_file_t *file, u_char *in,
+    size_t in_size)
+{
+    if (in_size % 188 || in[0] != 0x47) {
+        return NGX_ERROR;
+    }
+
+    ngx_rtmp_kernel_bench_ts_bytes += in_size;
+
+    return in_size;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_ts(size_t *bytes)
+{
+    ngx_rtmp_mpegts_file_t          file;
+    ngx_rtmp_kernel_bench_frame_t  *f;
+    ngx_buf_t                       b;
+    ngx_uint_t                      i;
+
+    ngx_memzero(&file, sizeof(file));
+    file.log = &ngx_rtmp_kernel_bench_log;
+    file.whandle = ngx_rtmp_kernel_bench_ts_sink;
+
+    *bytes = 0;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        f = &ngx_rtmp_kernel_bench_frames[i];
+
+        ngx_memzero(&b, sizeof(b));
+        b.start = ngx_rtmp_kernel_bench_payload;
+        b.pos = b.start;
+        b.last = b.start + f->size;
+        b.end = b.last;
+
+        if (ngx_rtmp_mpegts_write_frame(&file, &f->f, &b) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        *bytes += f->size;
+    }
+
+    return NGX_OK;
+}
+
+
+/* 1s of 25fps video with gop 1s and 44.1KHz aac, as ngx_rtmp_mpegts_bench */
+static ngx_int_t
+ngx_rtmp_kernel_bench_ts_init(void)
+{
+    ngx_rtmp_kernel_bench_frame_t  *f;
+    ngx_uint_t                      i;
+    size_t                          bytes;
+
+    f = ngx_rtmp_kernel_bench_frames;
+
+    for (i = 0; i < 25; ++i, ++f) {
+        f->f.pid = 0x100;
+        f->f.sid = 0xe0;
+        f->f.key = (i == 0);
+        f->f.dts = i * 3600;
+        f->f.pts = f->f.dts + (i % 3) * 3600;
+        f->size = f->f.key ? 60000 : 3000 + (i * 997) % 9000;
+    }
+
+    for (i = 0; i < 43; ++i, ++f) {
+        f->f.pid = 0x101;
+        f->f.sid = 0xc0;
+        f->f.dts = i * 2090;
+        f->f.pts = f->f.dts;
+        f->size = 180 + (i * 37) % 400;
+    }
+
+    ngx_rtmp_kernel_bench_payload = malloc(60000);
+    if (ngx_rtmp_kernel_bench_payload == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < 60000; ++i) {
+        ngx_rtmp_kernel_bench_payload[i] = (u_char) (i * 31);
+    }
+
+    ngx_rtmp_kernel_bench_ts_bytes = 0;
+
+    if (ngx_rtmp_kernel_bench_ts(&bytes) != NGX_OK
+        || ngx_rtmp_kernel_bench_ts_bytes < bytes)
+    {
+        fprintf(stderr, "ts: packetize failed\n");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* mp4 */
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_mp4_moov(size_t *bytes)
+{
+    ngx_buf_t               b;
+
+    ngx_memzero(&b, sizeof(b));
+    b.start = ngx_rtmp_kernel_bench_box;
+    b.pos = b.start;
+    b.last = b.start;
+    b.end = b.start + sizeof(ngx_rtmp_kernel_bench_box);
+
+    if (ngx_rtmp_mp4_write_ftyp(&b) != NGX_OK
+        || ngx_rtmp_mp4_write_moov(&ngx_rtmp_kernel_bench_session, &b,
+                                   NGX_RTMP_MP4_VIDEO_TRACK) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    *bytes = b.last - b.pos;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_mp4_moof(size_t *bytes)
+{
+    ngx_buf_t               b;
+    ngx_uint_t              i;
+    size_t                  size;
+
+    ngx_memzero(&b, sizeof(b));
+    b.start = ngx_rtmp_kernel_bench_box;
+    b.pos = b.start;
+    b.last = b.start;
+    b.end = b.start + sizeof(ngx_rtmp_kernel_bench_box);
+
+    size = 0;
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_SAMPLES; ++i) {
+        size += ngx_rtmp_kernel_bench_samples[i].size;
+    }
+
+    if (ngx_rtmp_mp4_write_styp(&b) != NGX_OK
+        || ngx_rtmp_mp4_write_sidx(&b, size, 0, 1000) != NGX_OK
+        || ngx_rtmp_mp4_write_moof(&b, 0, NGX_RTMP_KERNEL_BENCH_SAMPLES,
+                                   ngx_rtmp_kernel_bench_samples,
+                                   NGX_RTMP_MP4_SAMPLE_SIZE
+                                   |NGX_RTMP_MP4_SAMPLE_DURATION
+                                   |NGX_RTMP_MP4_SAMPLE_DELAY
+                                   |NGX_RTMP_MP4_SAMPLE_KEY, 1) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    ngx_rtmp_mp4_write_mdat(&b, size + 8);
+
+    *bytes = b.last - b.pos;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_mp4_init(void)
+{
+    ngx_rtmp_session_t     *s;
+    ngx_rtmp_codec_ctx_t   *ctx;
+    ngx_rtmp_mp4_sample_t  *smp;
+    ngx_uint_t              i;
+    size_t                  bytes;
+    u_char                 *p;
+
+    ngx_rtmp_kernel_bench_avc_buf.start = ngx_rtmp_kernel_bench_avc_header;
+    ngx_rtmp_kernel_bench_avc_buf.pos = ngx_rtmp_kernel_bench_avc_header;
+    ngx_rtmp_kernel_bench_avc_buf.last = ngx_rtmp_kernel_bench_avc_header
+                                    + sizeof(ngx_rtmp_kernel_bench_avc_header);
+    ngx_rtmp_kernel_bench_avc_buf.end = ngx_rtmp_kernel_bench_avc_buf.last;
+
+    ngx_rtmp_kernel_bench_avc_link.buf = &ngx_rtmp_kernel_bench_avc_buf;
+    ngx_rtmp_kernel_bench_avc.chain = &ngx_rtmp_kernel_bench_avc_link;
+
+    ctx = &ngx_rtmp_kernel_bench_codec;
+    ctx->width = 320;
+    ctx->height = 240;
+    ctx->video_codec_id = NGX_RTMP_VIDEO_H264;
+    ctx->avc_header = &ngx_rtmp_kernel_bench_avc;
+
+    /* ngx_rtmp_codec_module in stub has ctx_index 0 */
+    ngx_rtmp_kernel_bench_ctx[0] = ctx;
+
+    s = &ngx_rtmp_kernel_bench_session;
+    s->ctx = ngx_rtmp_kernel_bench_ctx;
+    s->log = &ngx_rtmp_kernel_bench_log;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_SAMPLES; ++i) {
+        smp = &ngx_rtmp_kernel_bench_samples[i];
+        smp->key = (i == 0);
+        smp->size = smp->key ? 60000 : 3000 + (i * 997) % 9000;
+        smp->duration = 40;
+        smp->delay = (i % 3) * 40;
+        smp->timestamp = i * 40;
+    }
+
+    if (ngx_rtmp_kernel_bench_mp4_moov(&bytes) != NGX_OK) {
+        fprintf(stderr, "mp4: write moov failed\n");
+        return NGX_ERROR;
+    }
+
+    /* ftyp then moov, box sizes must add up */
+    p = ngx_rtmp_kernel_bench_box;
+    i = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    p += i;
+    i += (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+    if (i != bytes || ngx_memcmp(p + 4, "moov", 4) != 0) {
+        fprintf(stderr, "mp4: moov size mismatch\n");
+        return NGX_ERROR;
+    }
+
+    if (ngx_rtmp_kernel_bench_mp4_moof(&bytes) != NGX_OK) {
+        fprintf(stderr, "mp4: write moof failed\n");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* rtmp */
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_av(ngx_rtmp_session_t *s, ngx_rtmp_header_t *h,
+    ngx_chain_t *in)
+{
+    ++ngx_rtmp_kernel_bench_nrecv;
+    ngx_rtmp_kernel_bench_recv_bytes += h->mlen;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_chunk_encode(size_t *bytes)
+{
+    ngx_rtmp_session_t     *s;
+    ngx_connection_t       *c;
+    ngx_uint_t              i;
+    off_t                   sent;
+
+    s = ngx_rtmp_kernel_bench_rtmp;
+    c = s->connection;
+    sent = c->sent;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        if (ngx_rtmp_send_message(s, ngx_rtmp_kernel_bench_rtmp_frames[i], 0)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    /* write event posted by ngx_rtmp_send_message, handle it here */
+    if (c->write->posted) {
+        ngx_delete_posted_event(c->write);
+    }
+
+    c->write->handler(c->write);
+
+    *bytes = c->sent - sent;
+
+    return ngx_rtmp_bench_finalized ? NGX_ERROR : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_chunk_decode(size_t *bytes)
+{
+    ngx_connection_t       *c;
+
+    c = ngx_rtmp_kernel_bench_rtmp->connection;
+
+    ngx_rtmp_bench_wire.pos = ngx_rtmp_bench_wire.start;
+
+    c->read->handler(c->read);
+
+    *bytes = ngx_rtmp_bench_wire.last - ngx_rtmp_bench_wire.start;
+
+    return ngx_rtmp_bench_finalized ? NGX_ERROR : NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_rtmp_frame(size_t *bytes)
+{
+    ngx_rtmp_frame_t       *frame;
+    ngx_uint_t              i;
+
+    *bytes = 0;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        frame = ngx_rtmp_shared_alloc_frame(NGX_RTMP_BENCH_CHUNK_SIZE,
+                                            &ngx_rtmp_kernel_bench_media[i], 1);
+        if (frame == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rtmp_shared_free_frame(frame);
+
+        *bytes += ngx_rtmp_kernel_bench_frames[i].size;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_ts_append(size_t *bytes)
+{
+    ngx_mpegts_frame_t     *frame;
+    ngx_uint_t              i;
+
+    *bytes = 0;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        frame = ngx_rtmp_shared_alloc_mpegts_frame(
+                                            &ngx_rtmp_kernel_bench_media[i], 1);
+        if (frame == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rtmp_shared_free_mpegts_frame(frame);
+
+        *bytes += ngx_rtmp_kernel_bench_frames[i].size;
+    }
+
+    return NGX_OK;
+}
+
+
+/* frames of ts_init as rtmp messages, sent once to make input of decode */
+static ngx_int_t
+ngx_rtmp_kernel_bench_rtmp_init(void)
+{
+    ngx_rtmp_kernel_bench_frame_t  *f;
+    ngx_rtmp_frame_t               *frame;
+    ngx_buf_t                      *b;
+    ngx_uint_t                      i;
+    ngx_int_t                       rc;
+    size_t                          bytes, payload;
+
+    ngx_rtmp_kernel_bench_rtmp = ngx_rtmp_bench_session(
+                                            &ngx_rtmp_kernel_bench_log,
+                                            ngx_rtmp_kernel_bench_av,
+                                            NGX_RTMP_KERNEL_BENCH_WIRE);
+    if (ngx_rtmp_kernel_bench_rtmp == NULL) {
+        fprintf(stderr, "rtmp: create session failed\n");
+        return NGX_ERROR;
+    }
+
+    payload = 0;
+
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        f = &ngx_rtmp_kernel_bench_frames[i];
+
+        b = &ngx_rtmp_kernel_bench_media_bufs[i];
+        b->start = ngx_rtmp_kernel_bench_payload;
+        b->pos = b->start;
+        b->last = b->start + f->size;
+        b->end = b->last;
+        b->memory = 1;
+
+        ngx_rtmp_kernel_bench_media[i].buf = b;
+        ngx_rtmp_kernel_bench_media[i].next = NULL;
+
+        frame = ngx_rtmp_shared_alloc_frame(NGX_RTMP_BENCH_CHUNK_SIZE,
+                                            &ngx_rtmp_kernel_bench_media[i], 1);
+        if (frame == NULL) {
+            fprintf(stderr, "rtmp: alloc frame failed\n");
+            return NGX_ERROR;
+        }
+
+        if (f->f.sid == 0xe0) {
+            frame->hdr.csid = NGX_RTMP_CSID_VIDEO;
+            frame->hdr.type = NGX_RTMP_MSG_VIDEO;
+        } else {
+            frame->hdr.csid = NGX_RTMP_CSID_AUDIO;
+            frame->hdr.type = NGX_RTMP_MSG_AUDIO;
+        }
+
+        frame->hdr.msid = NGX_RTMP_MSID;
+        frame->hdr.timestamp = (uint32_t) (f->f.dts / 90);
+        frame->hdr.mlen = f->size;
+        frame->keyframe = f->f.key;
+
+        ngx_rtmp_kernel_bench_rtmp_frames[i] = frame;
+
+        payload += f->size;
+    }
+
+    ngx_rtmp_bench_capture = 1;
+    rc = ngx_rtmp_kernel_bench_chunk_encode(&bytes);
+    ngx_rtmp_bench_capture = 0;
+
+    if (rc != NGX_OK || bytes <= payload
+        || bytes != (size_t) (ngx_rtmp_bench_wire.last
+                              - ngx_rtmp_bench_wire.start))
+    {
+        fprintf(stderr, "rtmp: chunk encode failed\n");
+        return NGX_ERROR;
+    }
+
+    /* every frame is released after sent */
+    for (i = 0; i < NGX_RTMP_KERNEL_BENCH_FRAMES; ++i) {
+        if (ngx_rtmp_kernel_bench_rtmp_frames[i]->ref != 1) {
+            fprintf(stderr, "rtmp: frame not released after sent\n");
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_rtmp_kernel_bench_nrecv = 0;
+    ngx_rtmp_kernel_bench_recv_bytes = 0;
+
+    if (ngx_rtmp_kernel_bench_chunk_decode(&bytes) != NGX_OK
+        || ngx_rtmp_kernel_bench_nrecv != NGX_RTMP_KERNEL_BENCH_FRAMES
+        || ngx_rtmp_kernel_bench_recv_bytes != payload)
+    {
+        fprintf(stderr, "rtmp: chunk decode mismatch\n");
+        return NGX_ERROR;
+    }
+
+    if (ngx_rtmp_kernel_bench_rtmp_frame(&bytes) != NGX_OK
+        || ngx_rtmp_kernel_bench_ts_append(&bytes) != NGX_OK)
+    {
+        fprintf(stderr, "rtmp: alloc shared frame failed\n");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* runner */
+
+static ngx_rtmp_kernel_bench_t      ngx_rtmp_kernel_bench_kernels[] = {
+    { "amf_write", ngx_rtmp_kernel_bench_amf_write, 0, 0, 0 },
+    { "amf_read", ngx_rtmp_kernel_bench_amf_read, 0, 0, 0 },
+    { "ts_frames", ngx_rtmp_kernel_bench_ts, 0, 0, 0 },
+    { "mp4_moov", ngx_rtmp_kernel_bench_mp4_moov, 0, 0, 0 },
+    { "mp4_moof", ngx_rtmp_kernel_bench_mp4_moof, 0, 0, 0 },
+    { "chunk_encode", ngx_rtmp_kernel_bench_chunk_encode, 0, 0, 0 },
+    { "chunk_decode", ngx_rtmp_kernel_bench_chunk_decode, 0, 0, 0 },
+    { "rtmp_frame", ngx_rtmp_kernel_bench_rtmp_frame, 0, 0, 0 },
+    { "ts_append", ngx_rtmp_kernel_bench_ts_append, 0, 0, 0 },
+    { NULL, NULL, 0, 0, 0 }
+};
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_measure(ngx_rtmp_kernel_bench_t *k, double min)
+{
+    ngx_uint_t      i, n;
+    size_t          bytes, total;
+    double          start, elapsed;
+
+    /* warm up */
+    for (i = 0; i < 16; ++i) {
+        if (k->run(&bytes) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    /* double ops until it runs long enough */
+    for (n = 16; ; n *= 2) {
+        total = 0;
+        start = ngx_rtmp_kernel_bench_now();
+
+        for (i = 0; i < n; ++i) {
+            k->run(&bytes);
+            total += bytes;
+        }
+
+        elapsed = ngx_rtmp_kernel_bench_now() - start;
+
+        if (elapsed >= min) {
+            break;
+        }
+    }
+
+    k->ns = elapsed * 1e9 / n;
+    k->mbps = total / elapsed / 1024 / 1024;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_load_baseline(char *name)
+{
+    ngx_rtmp_kernel_bench_t    *k;
+    FILE                       *fp;
+    char                        line[256], kname[64];
+    double                      ns;
+
+    fp = fopen(name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "open %s failed\n", name);
+        return NGX_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || sscanf(line, "%63s %lf", kname, &ns) != 2) {
+            continue;
+        }
+
+        for (k = ngx_rtmp_kernel_bench_kernels; k->name; ++k) {
+            if (ngx_strcmp(k->name, kname) == 0) {
+                k->baseline = ns;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_rtmp_kernel_bench_save_baseline(char *name)
+{
+    ngx_rtmp_kernel_bench_t    *k;
+    FILE                       *fp, *cpu;
+    char                        line[256], *p;
+
+    fp = fopen(name, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "open %s failed\n", name);
+        return NGX_ERROR;
+    }
+
+    fprintf(fp, "# kernel ns/op, made by ngx_rtmp_kernel_bench -w\n");
+
+    /* numbers are only comparable on the same machine and build */
+    cpu = fopen("/proc/cpuinfo", "r");
+    if (cpu) {
+        while (fgets(line, sizeof(line), cpu)) {
+            p = ngx_strchr(line, ':');
+            if (ngx_strncmp(line, "model name", 10) == 0 && p) {
+                fprintf(fp, "# cpu%s", p);
+                break;
+            }
+        }
+
+        fclose(cpu);
+    }
+
+#ifdef __VERSION__
+    fprintf(fp, "# cc: %s\n", __VERSION__);
+#endif
+    fprintf(fp, "# cflags: %s\n", NGX_RTMP_BENCH_CFLAGS);
+
+    for (k = ngx_rtmp_kernel_bench_kernels; k->name; ++k) {
+        if (k->ns > 0) {
+            fprintf(fp, "%s %.1f\n", k->name, k->ns);
+        }
+    }
+
+    fclose(fp);
+
+    return NGX_OK;
+}
+
+
+static ngx_flag_t
+ngx_rtmp_kernel_bench_selected(char **names, ngx_uint_t n, char *name)
+{
+    ngx_uint_t      i;
+
+    if (n == 0) {
+        return 1;
+    }
+
+    for (i = 0; i < n; ++i) {
+        if (ngx_strcmp(names[i], name) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_rtmp_kernel_bench_t    *k;
+    char                       *baseline, *save;
+    double                      min, threshold, delta;
+    ngx_flag_t                  regressed;
+    ngx_uint_t                  compared;
+    int                         ch;
+
+    min = 0.5;
+    threshold = 10;
+    baseline = NULL;
+    save = NULL;
+
+    while ((ch = getopt(argc, argv, "t:b:w:r:")) != -1) {
+        switch (ch) {
+        case 't':
+            min = atof(optarg) / 1000;
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'w':
+            save = optarg;
+            break;
+        case 'r':
+            threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t msec] [-b baseline] [-w baseline]"
+                    " [-r percent] [kernel ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (ngx_rtmp_kernel_bench_amf_init() != NGX_OK
+        || ngx_rtmp_kernel_bench_ts_init() != NGX_OK
+        || ngx_rtmp_kernel_bench_mp4_init() != NGX_OK
+        || ngx_rtmp_kernel_bench_rtmp_init() != NGX_OK)
+    {
+        return 1;
+    }
+
+    if (baseline && ngx_rtmp_kernel_bench_load_baseline(baseline) != NGX_OK) {
+        return 1;
+    }
+
+    regressed = 0;
+    compared = 0;
+
+    for (k = ngx_rtmp_kernel_bench_kernels; k->name; ++k) {
+        if (!ngx_rtmp_kernel_bench_selected(argv + optind,
+                                            argc - optind, k->name))
+        {
+            continue;
+        }
+
+        if (ngx_rtmp_kernel_bench_measure(k, min) != NGX_OK) {
+            fprintf(stderr, "%s failed\n", k->name);
+            return 1;
+        }
+
+        printf("%-12s %10.1f ns/op %10.1f MB/s", k->name, k->ns, k->mbps);
+
+        if (k->baseline > 0) {
+            ++compared;
+
+            delta = (k->ns - k->baseline) * 100 / k->baseline;
+            printf("  baseline %10.1f ns/op %+6.1f%%%s", k->baseline, delta,
+                   delta > threshold ? "  REGRESSION" : "");
+
+            if (delta > threshold) {
+                regressed = 1;
+            }
+
+        } else if (baseline) {
+            printf("  no baseline");
+        }
+
+        printf("\n");
+    }
+
+    /* empty or stale baseline must not pass as no regression */
+    if (baseline && compared == 0) {
+        fprintf(stderr, "%s has none of kernels run, nothing compared\n",
+                baseline);
+        return 1;
+    }
+
+    if (save && ngx_rtmp_kernel_bench_save_baseline(save) != NGX_OK) {
+        return 1;
+    }
+
+    return regressed ? 2 : 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Microbenchmark of ts packetizer, compare template based packetizer in
+ * hls/ngx_rtmp_mpegts_pes.c with the old one which stuffs last packet of
+ * PES by moving header and payload.
+ *
+ * Output of both packetizer are checked to be same before benchmark.
+ *
+ * build with configured nginx source:
+ *      NGX_SRC=/path/to/nginx ./build.sh
+ * run:
+ *      ./ngx_rtmp_mpegts_bench [rounds]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ngx_rtmp_mpegts_pes.h"
+
+
+#define NGX_RTMP_MPEGTS_BENCH_DELAY     63000
+
+
+typedef struct {
+    uint64_t        pts;
+    uint64_t        dts;
+    ngx_uint_t      pid;
+    ngx_uint_t      sid;
+    ngx_uint_t      cc;
+    unsigned        key:1;
+    size_t          size;
+} ngx_rtmp_mpegts_bench_frame_t;
+
+
+/* 1s of 25fps video with gop 1s and 44.1KHz aac, sizes in bytes */
+static ngx_rtmp_mpegts_bench_frame_t    ngx_rtmp_mpegts_bench_frames[68];
+
+
+static u_char *
+ngx_rtmp_mpegts_bench_write_pcr(u_char *p, uint64_t pcr)
+{
+    *p++ = (u_char) (pcr >> 25);
+    *p++ = (u_char) (pcr >> 17);
+    *p++ = (u_char) (pcr >> 9);
+    *p++ = (u_char) (pcr >> 1);
+    *p++ = (u_char) (pcr << 7 | 0x7e);
+    *p++ = 0;
+
+    return p;
+}
+
+
+static u_char *
+ngx_rtmp_mpegts_bench_write_pts(u_char *p, ngx_uint_t fb, uint64_t pts)
+{
+    ngx_uint_t val;
+
+    val = fb << 4 | (((pts >> 30) & 0x07) << 1) | 1;
+    *p++ = (u_char) val;
+
+    val = (((pts >> 15) & 0x7fff) << 1) | 1;
+    *p++ = (u_char) (val >> 8);
+    *p++ = (u_char) val;
+
+    val = (((pts) & 0x7fff) << 1) | 1;
+    *p++ = (u_char) (val >> 8);
+    *p++ = (u_char) val;
+
+    return p;
+}
+
+
+/* packetizer before template based one, keep as baseline */
+static u_char *
+ngx_rtmp_mpegts_bench_old(ngx_rtmp_mpegts_bench_frame_t *f, ngx_buf_t *b,
+    u_char *out)
+{
+    ngx_uint_t  pes_size, header_size, body_size, in_size, stuff_size, flags;
+    u_char     *packet, *p, *base;
+    ngx_int_t   first;
+
+    first = 1;
+
+    while (b->pos < b->last) {
+        packet = out;
+        p = packet;
+
+        f->cc++;
+
+        *p++ = 0x47;
+        *p++ = (u_char) (f->pid >> 8);
+
+        if (first) {
+            p[-1] |= 0x40;
+        }
+
+        *p++ = (u_char) f->pid;
+        *p++ = 0x10 | (f->cc & 0x0f); /* payload */
+
+        if (first) {
+
+            if (f->key) {
+                packet[3] |= 0x20; /* adaptation */
+
+                *p++ = 7;    /* size */
+                *p++ = 0x50; /* random access + PCR */
+
+                p = ngx_rtmp_mpegts_bench_write_pcr(p, f->dts);
+            }
+
+            /* PES header */
+
+            *p++ = 0x00;
+            *p++ = 0x00;
+            *p++ = 0x01;
+            *p++ = (u_char) f->sid;
+
+            header_size = 5;
+            flags = 0x80; /* PTS */
+
+            if (f->dts != f->pts) {
+                header_size += 5;
+                flags |= 0x40; /* DTS */
+            }
+
+            pes_size = (b->last - b->pos) + header_size + 3;
+            if (pes_size > 0xffff) {
+                pes_size = 0;
+            }
+
+            *p++ = (u_char) (pes_size >> 8);
+            *p++ = (u_char) pes_size;
+            *p++ = 0x80; /* H222 */
+            *p++ = (u_char) flags;
+            *p++ = (u_char) header_size;
+
+            p = ngx_rtmp_mpegts_bench_write_pts(p, flags >> 6, f->pts +
+                                                NGX_RTMP_MPEGTS_BENCH_DELAY);
+
+            if (f->dts != f->pts) {
+                p = ngx_rtmp_mpegts_bench_write_pts(p, 1, f->dts +
+                                                NGX_RTMP_MPEGTS_BENCH_DELAY);
+            }
+
+            first = 0;
+        }
+
+        body_size = (ngx_uint_t) (packet + 188 - p);
+        in_size = (ngx_uint_t) (b->last - b->pos);
+
+        if (body_size <= in_size) {
+            ngx_memcpy(p, b->pos, body_size);
+            b->pos += body_size;
+
+        } else {
+            stuff_size = (body_size - in_size);
+
+            if (packet[3] & 0x20) {
+
+                /* has adaptation */
+
+                base = &packet[5] + packet[4];
+                p = ngx_movemem(base + stuff_size, base, p - base);
+                ngx_memset(base, 0xff, stuff_size);
+                packet[4] += (u_char) stuff_size;
+
+            } else {
+
+                /* no adaptation */
+
+                packet[3] |= 0x20;
+                p = ngx_movemem(&packet[4] + stuff_size, &packet[4],
+                                p - &packet[4]);
+
+                packet[4] = (u_char) (stuff_size - 1);
+                if (stuff_size >= 2) {
+                    packet[5] = 0;
+                    ngx_memset(&packet[6], 0xff, stuff_size - 2);
+                }
+            }
+
+            ngx_memcpy(p, b->pos, in_size);
+            b->pos = b->last;
+        }
+
+        out += 188;
+    }
+
+    return out;
+}
+
+
+static u_char *
+ngx_rtmp_mpegts_bench_new(ngx_rtmp_mpegts_bench_frame_t *f, ngx_buf_t *b,
+    u_char *out)
+{
+    ngx_rtmp_mpegts_pes_t   pes;
+
+    ngx_rtmp_mpegts_pes_init(&pes, f->pid, f->sid, f->key, f->dts,
+                             f->pts + NGX_RTMP_MPEGTS_BENCH_DELAY,
+                             f->dts + NGX_RTMP_MPEGTS_BENCH_DELAY,
+                             b->last - b->pos);
+
+    return ngx_rtmp_mpegts_pes_write(&pes, out,
+                                     out + pes.packets * 188, b, &f->cc);
+}
+
+
+typedef u_char *(*ngx_rtmp_mpegts_bench_pt)(ngx_rtmp_mpegts_bench_frame_t *f,
+    ngx_buf_t *b, u_char *out);
+
+
+static void
+ngx_rtmp_mpegts_bench_init_frames(void)
+{
+    ngx_rtmp_mpegts_bench_frame_t  *f;
+    ngx_uint_t                      i;
+
+    f = ngx_rtmp_mpegts_bench_frames;
+
+    for (i = 0; i < 25; ++i, ++f) {
+        f->pid = 0x100;
+        f->sid = 0xe0;
+        f->key = (i == 0);
+        f->dts = i * 3600;
+        f->pts = f->dts + (i % 3) * 3600; /* b frames */
+        f->size = f->key ? 60000 : 3000 + (i * 997) % 9000;
+    }
+
+    for (i = 0; i < 43; ++i, ++f) {
+        f->pid = 0x101;
+        f->sid = 0xc0;
+        f->key = 0;
+        f->dts = i * 2090;
+        f->pts = f->dts;
+        f->size = 180 + (i * 37) % 400;
+    }
+}
+
+
+static ngx_uint_t
+ngx_rtmp_mpegts_bench_run(ngx_rtmp_mpegts_bench_pt packetize, u_char *in,
+    u_char *out, ngx_uint_t rounds)
+{
+    ngx_rtmp_mpegts_bench_frame_t  *f;
+    ngx_buf_t                       b;
+    ngx_uint_t                      i, j, packets;
+    u_char                         *last;
+
+    packets = 0;
+
+    for (i = 0; i < rounds; ++i) {
+        for (j = 0; j < 68; ++j) {
+            f = &ngx_rtmp_mpegts_bench_frames[j];
+
+            b.pos = in;
+            b.last = in + f->size;
+
+            last = packetize(f, &b, out);
+            packets += (last - out) / 188;
+        }
+    }
+
+    return packets;
+}
+
+
+static double
+ngx_rtmp_mpegts_bench_now(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static ngx_int_t
+ngx_rtmp_mpegts_bench_check(u_char *in, u_char *out1, u_char *out2)
+{
+    ngx_rtmp_mpegts_bench_frame_t  *f;
+    ngx_buf_t                       b1, b2;
+    ngx_uint_t                      j, cc;
+    size_t                          size;
+    u_char                         *last1, *last2;
+
+    /* every payload size around packet boundary, with and without PCR */
+    for (size = 1; size < 188 * 4; ++size) {
+        for (j = 0; j < 68; j += 24) {
+            f = &ngx_rtmp_mpegts_bench_frames[j];
+            cc = f->cc;
+
+            b1.pos = in;
+            b1.last = in + size;
+            last1 = ngx_rtmp_mpegts_bench_old(f, &b1, out1);
+
+            f->cc = cc;
+            b2.pos = in;
+            b2.last = in + size;
+            last2 = ngx_rtmp_mpegts_bench_new(f, &b2, out2);
+
+            if (last1 - out1 != last2 - out2 || b1.pos != b2.pos
+                || ngx_memcmp(out1, out2, last1 - out1) != 0)
+            {
+                fprintf(stderr, "mismatch, pid: %u, size: %u\n",
+                        (unsigned) f->pid, (unsigned) size);
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_rtmp_mpegts_bench_pt    packetizers[] = {
+        ngx_rtmp_mpegts_bench_old,
+        ngx_rtmp_mpegts_bench_new
+    };
+    char                       *names[] = { "old", "template" };
+    ngx_uint_t                  rounds, packets, i;
+    u_char                     *in, *out, *out2;
+    double                      start, elapsed;
+
+    rounds = argc > 1 ? (ngx_uint_t) atoi(argv[1]) : 2000;
+
+    in = malloc(60000);
+    out = malloc(60000 / 184 * 188 + 188 * 2);
+    out2 = malloc(60000 / 184 * 188 + 188 * 2);
+    if (in == NULL || out == NULL || out2 == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < 60000; ++i) {
+        in[i] = (u_char) (i * 31);
+    }
+
+    ngx_rtmp_mpegts_bench_init_frames();
+
+    if (ngx_rtmp_mpegts_bench_check(in, out, out2) != NGX_OK) {
+        return 1;
+    }
+
+    for (i = 0; i < 2; ++i) {
+        start = ngx_rtmp_mpegts_bench_now();
+        packets = ngx_rtmp_mpegts_bench_run(packetizers[i], in, out, rounds);
+        elapsed = ngx_rtmp_mpegts_bench_now() - start;
+
+        printf("%-10s packets: %lu  time: %.3fs  packets/s: %.0f  MB/s: %.1f\n",
+               names[i], (unsigned long) packets, elapsed, packets / elapsed,
+               packets * 188 / elapsed / 1024 / 1024);
+    }
+
+    return 0;
+}
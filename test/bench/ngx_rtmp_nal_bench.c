@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Microbenchmark of emulation prevention bytes removal, compare
+ * ngx_rtmp_bit_nal_to_rbsp with the old byte by byte loop in codec module.
+ *
+ * Input is H.264/H.265 annex-b elementary stream files, such as dumped by
+ * ffmpeg -i in.flv -c:v copy -bsf:v h264_mp4toannexb out.h264, NAL units
+ * are split by start code. Random NAL units with emulation prevention
+ * bytes are used if no file given.
+ *
+ * Output of both are checked to be same before benchmark.
+ *
+ * build with configured nginx source:
+ *      NGX_SRC=/path/to/nginx ./build.sh
+ * run:
+ *      ./ngx_rtmp_nal_bench [rounds] [file ...]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ngx_rtmp_bitop.h"
+
+
+#define NGX_RTMP_NAL_BENCH_MAX      1024
+
+
+typedef struct {
+    u_char         *pos;
+    size_t          len;
+} ngx_rtmp_nal_bench_nal_t;
+
+
+static ngx_rtmp_nal_bench_nal_t ngx_rtmp_nal_bench_nals[NGX_RTMP_NAL_BENCH_MAX];
+static ngx_uint_t               ngx_rtmp_nal_bench_nnals;
+static size_t                   ngx_rtmp_nal_bench_bytes;
+
+
+/* loop in ngx_rtmp_codec_parse_hevc_nal_to_rbsp before, keep as baseline */
+static ngx_int_t
+ngx_rtmp_nal_bench_old(u_char *p, u_char *src, size_t len)
+{
+    ngx_uint_t  i, count, rbsp_bytes;
+
+    count = 0;
+    rbsp_bytes = 0;
+    for (i = 0; i < len; ++i) {
+        if (count == 2) { /* already 0x0000 */
+            if (src[i] < 0x03) {
+                return NGX_ERROR;
+            }
+
+            if (src[i] == 0x03 && i + 1 < len && src[i + 1] > 0x03) {
+                return NGX_ERROR;
+            }
+
+            if (src[i] == 0x03) {
+                count = 0;
+                continue;
+            }
+        }
+
+        *p++ = src[i];
+        ++rbsp_bytes;
+        if (src[i] == 0x00) {
+            ++count;
+        } else {
+            count = 0;
+        }
+    }
+
+    return rbsp_bytes;
+}
+
+
+static void
+ngx_rtmp_nal_bench_add(u_char *pos, size_t len)
+{
+    if (len == 0 || ngx_rtmp_nal_bench_nnals == NGX_RTMP_NAL_BENCH_MAX) {
+        return;
+    }
+
+    ngx_rtmp_nal_bench_nals[ngx_rtmp_nal_bench_nnals].pos = pos;
+    ngx_rtmp_nal_bench_nals[ngx_rtmp_nal_bench_nnals].len = len;
+    ngx_rtmp_nal_bench_bytes += len;
+    ++ngx_rtmp_nal_bench_nnals;
+}
+
+
+static ngx_int_t
+ngx_rtmp_nal_bench_load(char *name)
+{
+    FILE       *fp;
+    long        size;
+    u_char     *data, *p, *last, *nal;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "open %s failed\n", name);
+        return NGX_ERROR;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    data = malloc(size);
+    if (data == NULL || fread(data, 1, size, fp) != (size_t) size) {
+        fclose(fp);
+        return NGX_ERROR;
+    }
+
+    fclose(fp);
+
+    /* split by 0x000001, trailing zero of 0x00000001 belongs to no NAL */
+    nal = NULL;
+    last = data + size;
+
+    for (p = data; p + 3 <= last; ++p) {
+        if (p[0] != 0 || p[1] != 0 || p[2] != 1) {
+            continue;
+        }
+
+        if (nal) {
+            ngx_rtmp_nal_bench_add(nal, (p > nal && p[-1] == 0 ? p - 1 : p)
+                                        - nal);
+        }
+
+        p += 2;
+        nal = p + 1;
+    }
+
+    if (nal) {
+        ngx_rtmp_nal_bench_add(nal, last - nal);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_rtmp_nal_bench_random(void)
+{
+    u_char     *p;
+    size_t      len, i;
+    ngx_uint_t  n;
+    u_char      v;
+
+    srand(1);
+
+    for (n = 0; n < 200; ++n) {
+        len = 100 + rand() % 60000;
+
+        p = malloc(len);
+        if (p == NULL) {
+            return;
+        }
+
+        for (i = 0; i < len; ++i) {
+            v = (u_char) (rand() % 8 ? rand() : rand() % 4);
+
+            /* insert emulation prevention byte as encoder does */
+            if (i >= 2 && i + 1 < len && p[i - 1] == 0 && p[i - 2] == 0
+                && v <= 3)
+            {
+                p[i++] = 3;
+            }
+
+            p[i] = v;
+        }
+
+        ngx_rtmp_nal_bench_add(p, len);
+    }
+}
+
+
+static double
+ngx_rtmp_nal_bench_now(void)
+{
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    ngx_int_t   (*kernels[])(u_char *, u_char *, size_t) = {
+        ngx_rtmp_nal_bench_old,
+        ngx_rtmp_bit_nal_to_rbsp
+    };
+    char        *names[] = { "old", "memchr" };
+    ngx_uint_t   rounds, i, r, n;
+    ngx_int_t    rc1, rc2;
+    u_char      *out1, *out2;
+    size_t       max;
+    double       start, elapsed;
+    int          a;
+
+    rounds = argc > 1 ? (ngx_uint_t) atoi(argv[1]) : 100;
+
+    for (a = 2; a < argc; ++a) {
+        if (ngx_rtmp_nal_bench_load(argv[a]) != NGX_OK) {
+            return 1;
+        }
+    }
+
+    if (ngx_rtmp_nal_bench_nnals == 0) {
+        ngx_rtmp_nal_bench_random();
+    }
+
+    max = 0;
+    for (n = 0; n < ngx_rtmp_nal_bench_nnals; ++n) {
+        if (ngx_rtmp_nal_bench_nals[n].len > max) {
+            max = ngx_rtmp_nal_bench_nals[n].len;
+        }
+    }
+
+    out1 = malloc(max + 1);
+    out2 = malloc(max + 1);
+    if (out1 == NULL || out2 == NULL) {
+        return 1;
+    }
+
+    for (n = 0; n < ngx_rtmp_nal_bench_nnals; ++n) {
+        rc1 = ngx_rtmp_nal_bench_old(out1, ngx_rtmp_nal_bench_nals[n].pos,
+                                     ngx_rtmp_nal_bench_nals[n].len);
+        rc2 = ngx_rtmp_bit_nal_to_rbsp(out2, ngx_rtmp_nal_bench_nals[n].pos,
+                                       ngx_rtmp_nal_bench_nals[n].len);
+
+        if (rc1 != rc2 || (rc1 > 0 && ngx_memcmp(out1, out2, rc1) != 0)) {
+            fprintf(stderr, "mismatch in nal %u, %d %d\n",
+                    (unsigned) n, (int) rc1, (int) rc2);
+            return 1;
+        }
+    }
+
+    printf("nals: %u  bytes: %lu\n", (unsigned) ngx_rtmp_nal_bench_nnals,
+           (unsigned long) ngx_rtmp_nal_bench_bytes);
+
+    for (i = 0; i < 2; ++i) {
+        start = ngx_rtmp_nal_bench_now();
+
+        for (r = 0; r < rounds; ++r) {
+            for (n = 0; n < ngx_rtmp_nal_bench_nnals; ++n) {
+                kernels[i](out1, ngx_rtmp_nal_bench_nals[n].pos,
+                           ngx_rtmp_nal_bench_nals[n].len);
+            }
+        }
+
+        elapsed = ngx_rtmp_nal_bench_now() - start;
+
+        printf("%-8s time: %.3fs  MB/s: %.1f\n", names[i], elapsed,
+               ngx_rtmp_nal_bench_bytes * rounds / elapsed / 1024 / 1024);
+    }
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/sh
+
+# build load generator, it depends on libc only
+#   ./build.sh
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -g -Wall}
+
+$CC $CFLAGS -o "$DIR/ngx_rtmp_load" "$DIR/ngx_rtmp_load.c" || exit 1
@@ -0,0 +1,2693 @@
+/*
+ * Copyright (C) AlexWoo(Wu Jie) wj19840501@gmail.com
+ */
+
+
+/*
+ * Load generator for live fan-out over loopback.
+ *
+ * One publisher pushes synthetic or file-sourced FLV over RTMP at given
+ * bitrate, thousands of RTMP, HTTP-FLV, HTTP-TS and HLS players pull the
+ * same stream. Single thread, epoll, no dependency other than libc.
+ *
+ * Synthetic video carries a marker in every frame:
+ *      "LDGN" + 16 hex of wallclock msec when sent + 8 hex of frame seq
+ * players find the marker in RTMP/FLV payloads and in TS PES of video pid,
+ * per-frame latency is receive time minus send time, drops are gaps of seq.
+ * File source has no marker, latency comes from onFI data messages injected
+ * by server when latency_probe is configured in application.
+ *
+ * With -H synthetic publisher changes level_idc of avc header every N gops,
+ * RTMP/FLV players check every keyframe follows the header of its gop, which
+ * catches headers dropped for players of one track, e.g. -t keyframe.
+ *
+ * Output is one line per interval per player type, and a summary at end,
+ * optionally as CSV for scenario.sh.
+ *
+ * build:
+ *      ./build.sh
+ * run:
+ *      ./ngx_rtmp_load -a live -s load -b 2000 -R 1000 -F 1000 -d 60
+ */
+
+
+#define _GNU_SOURCE                 /* memmem */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+
+#define NGX_RTMP_LOAD_PUBLISH           0
+#define NGX_RTMP_LOAD_RTMP              1
+#define NGX_RTMP_LOAD_FLV               2
+#define NGX_RTMP_LOAD_TS                3
+#define NGX_RTMP_LOAD_HLS               4
+#define NGX_RTMP_LOAD_NTYPES            5
+
+/* connection state */
+#define NGX_RTMP_LOAD_CONNECTING        0
+#define NGX_RTMP_LOAD_HANDSHAKE         1
+#define NGX_RTMP_LOAD_CONNECT           2
+#define NGX_RTMP_LOAD_CREATE_STREAM     3
+#define NGX_RTMP_LOAD_START             4   /* publish or play sent */
+#define NGX_RTMP_LOAD_STREAMING         5
+#define NGX_RTMP_LOAD_HTTP_HEADER       6
+#define NGX_RTMP_LOAD_HTTP_BODY         7
+#define NGX_RTMP_LOAD_IDLE              8   /* hls waits for refresh */
+#define NGX_RTMP_LOAD_CLOSED            9
+
+#define NGX_RTMP_LOAD_HANDSHAKE_SIZE    1536
+#define NGX_RTMP_LOAD_CHUNK_SIZE        4096
+#define NGX_RTMP_LOAD_MAX_CSID          64
+#define NGX_RTMP_LOAD_MSID              1
+
+/* publisher is stalled when server does not read this much */
+#define NGX_RTMP_LOAD_MAX_OUT           (4 * 1024 * 1024)
+
+#define NGX_RTMP_LOAD_MARKER            "LDGN"
+#define NGX_RTMP_LOAD_MARKER_LEN        (4 + 16 + 8)
+
+/* level_idc of synthetic avc header, +1 on odd header changes */
+#define NGX_RTMP_LOAD_AVC_LEVEL         30
+
+/* fixed pid of video in ts muxed by ngx_rtmp_mpegts */
+#define NGX_RTMP_LOAD_TS_VIDEO_PID      0x100
+
+/* dump of ngx_rtmp_monitor_module */
+#define NGX_RTMP_LOAD_DUMP_MAGIC        "NRTD"
+#define NGX_RTMP_LOAD_DUMP_VERSION      1
+#define NGX_RTMP_LOAD_DUMP_HEADER       8
+#define NGX_RTMP_LOAD_DUMP_RECORD       12
+
+#define NGX_RTMP_LOAD_HLS_QUEUE         8
+#define NGX_RTMP_LOAD_PATH_LEN          512
+
+/* log-linear histogram of msec, same layout as ngx_rtmp_histogram */
+#define NGX_RTMP_LOAD_HIST_SUB          8
+#define NGX_RTMP_LOAD_HIST_BUCKETS      (8 * 18)
+
+
+typedef struct {
+    u_char                     *data;
+    size_t                      pos;
+    size_t                      len;
+    size_t                      cap;
+} ngx_rtmp_load_buf_t;
+
+
+typedef struct {
+    uint64_t                    count;
+    uint64_t                    max;
+    uint32_t                    buckets[NGX_RTMP_LOAD_HIST_BUCKETS];
+} ngx_rtmp_load_hist_t;
+
+
+typedef struct {
+    uint64_t                    started;
+    uint64_t                    connected;  /* first frame received */
+    uint64_t                    failed;
+    uint64_t                    closed;
+    uint64_t                    bytes;
+    uint64_t                    frames;
+    uint64_t                    drops;
+    uint64_t                    stalls;     /* publisher only */
+    uint64_t                    stale;      /* keyframes of missed header */
+    ngx_rtmp_load_hist_t        latency;
+    ngx_rtmp_load_hist_t        ttff;
+} ngx_rtmp_load_stat_t;
+
+
+typedef struct {
+    uint32_t                    timestamp;
+    uint32_t                    delta;
+    uint32_t                    mlen;
+    uint32_t                    msid;
+    uint8_t                     type;
+    unsigned                    ext:1;
+    ngx_rtmp_load_buf_t         msg;
+} ngx_rtmp_load_cs_t;
+
+
+/* media tag read from file source */
+typedef struct {
+    uint8_t                     type;
+    uint32_t                    timestamp;
+    uint32_t                    arrival;    /* msec, timestamp of flv */
+    u_char                     *data;
+    size_t                      len;
+} ngx_rtmp_load_tag_t;
+
+
+typedef struct ngx_rtmp_load_conn_s  ngx_rtmp_load_conn_t;
+
+struct ngx_rtmp_load_conn_s {
+    int                         fd;
+    int                         type;
+    int                         state;
+    uint64_t                    start;      /* msec when connecting */
+    unsigned                    first:1;    /* first frame received */
+    unsigned                    writable:1;
+
+    ngx_rtmp_load_buf_t         in;
+    ngx_rtmp_load_buf_t         out;
+
+    /* rtmp */
+    uint32_t                    in_chunk;
+    ngx_rtmp_load_cs_t          cs[NGX_RTMP_LOAD_MAX_CSID];
+    double                      trans;
+
+    /* publisher */
+    uint64_t                    epoch;      /* msec when media started */
+    uint64_t                    vseq;
+    uint64_t                    aseq;
+    size_t                      fpos;       /* file source position */
+    unsigned                    floop:1;    /* file source looped */
+    unsigned                    ffirst:1;   /* first tag of loop read */
+    uint32_t                    tfirst;     /* timestamp of first tag */
+    uint32_t                    fbase;      /* timestamp offset of loop */
+    uint32_t                    flast;
+    uint64_t                    afirst;     /* arrival of first tag */
+    uint64_t                    abase;      /* arrival offset of loop */
+    uint64_t                    alast;
+
+    /* player */
+    int64_t                     last_seq;
+    int                         level;      /* of last avc header */
+
+    /* http-flv */
+    unsigned                    flv_header:1;
+
+    /* ts, tail of video pid payload for marker across packets */
+    u_char                      tail[NGX_RTMP_LOAD_MARKER_LEN];
+    size_t                      ntail;
+
+    /* http */
+    int                         status;
+    char                        location[NGX_RTMP_LOAD_PATH_LEN];
+
+    /* hls */
+    char                        playlist[NGX_RTMP_LOAD_PATH_LEN];
+    char                        path[NGX_RTMP_LOAD_PATH_LEN];
+    char                        queue[NGX_RTMP_LOAD_HLS_QUEUE]
+                                     [NGX_RTMP_LOAD_PATH_LEN];
+    int                         nqueue;
+    int64_t                     hls_seq;
+    uint64_t                    refresh;
+    unsigned                    fetch_segment:1;
+};
+
+
+typedef struct {
+    char                       *host;
+    int                         rtmp_port;
+    int                         http_port;
+    char                       *app;
+    char                       *stream;
+    char                       *flv_path;
+    char                       *ts_path;
+    char                       *hls_path;
+    char                       *file;
+    char                       *csv;
+
+    int                         publish;
+    int                         vbitrate;   /* kbps */
+    int                         abitrate;   /* kbps */
+    int                         fps;
+    int                         gop;        /* frames */
+    int                         players[NGX_RTMP_LOAD_NTYPES];
+    int                         rate;       /* connections per second */
+    int                         duration;   /* seconds */
+    int                         interval;   /* report seconds */
+    double                      speed;      /* file source, 0 for no pace */
+    char                       *track;      /* of rtmp and http-flv players */
+    int                         headers;    /* gops per avc header change */
+} ngx_rtmp_load_conf_t;
+
+
+static ngx_rtmp_load_conf_t     ngx_rtmp_load_conf = {
+    "127.0.0.1", 1935, 80, "live", "load", NULL, NULL, NULL, NULL, NULL,
+    1, 1000, 64, 25, 50, { 0, 0, 0, 0, 0 }, 200, 30, 1, 1.0, NULL, 0
+};
+
+static char *ngx_rtmp_load_type_name[] = {
+    "publish", "rtmp", "flv", "ts", "hls"
+};
+
+static ngx_rtmp_load_stat_t     ngx_rtmp_load_stats[NGX_RTMP_LOAD_NTYPES];
+static ngx_rtmp_load_stat_t     ngx_rtmp_load_last[NGX_RTMP_LOAD_NTYPES];
+
+static int                      ngx_rtmp_load_ep;
+static struct sockaddr_in       ngx_rtmp_load_rtmp_addr;
+static struct sockaddr_in       ngx_rtmp_load_http_addr;
+static ngx_rtmp_load_conn_t    *ngx_rtmp_load_publisher;
+static ngx_rtmp_load_conn_t   **ngx_rtmp_load_players;
+static int                      ngx_rtmp_load_nplayers;
+static volatile sig_atomic_t    ngx_rtmp_load_quit;
+static FILE                    *ngx_rtmp_load_csv;
+
+/* file source, whole file in memory */
+static u_char                  *ngx_rtmp_load_file_data;
+static size_t                   ngx_rtmp_load_file_len;
+static size_t                   ngx_rtmp_load_file_start;
+static int                      ngx_rtmp_load_file_dump;
+
+/* synthetic source */
+static u_char                   ngx_rtmp_load_avc_header[64];
+static size_t                   ngx_rtmp_load_avc_header_len;
+static u_char                  *ngx_rtmp_load_frame;
+static size_t                   ngx_rtmp_load_frame_cap;
+
+
+static void ngx_rtmp_load_close(ngx_rtmp_load_conn_t *c, int failed);
+static int ngx_rtmp_load_connect(ngx_rtmp_load_conn_t *c);
+
+
+static uint64_t
+ngx_rtmp_load_msec(void)
+{
+    struct timespec             ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* histogram */
+
+static void
+ngx_rtmp_load_hist_add(ngx_rtmp_load_hist_t *h, uint64_t v)
+{
+    unsigned                    shift, idx;
+
+    if (v < NGX_RTMP_LOAD_HIST_SUB) {
+        idx = v;
+
+    } else {
+        shift = 0;
+        while ((v >> shift) >= 2 * NGX_RTMP_LOAD_HIST_SUB) {
+            ++shift;
+        }
+
+        idx = (shift + 1) * NGX_RTMP_LOAD_HIST_SUB
+            + (v >> shift) - NGX_RTMP_LOAD_HIST_SUB;
+
+        if (idx >= NGX_RTMP_LOAD_HIST_BUCKETS) {
+            idx = NGX_RTMP_LOAD_HIST_BUCKETS - 1;
+        }
+    }
+
+    ++h->buckets[idx];
+    ++h->count;
+
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static uint64_t
+ngx_rtmp_load_hist_percentile(ngx_rtmp_load_hist_t *h, unsigned percent)
+{
+    uint64_t                    rank, n, v;
+    unsigned                    i, shift, m;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    rank = (h->count * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    n = 0;
+    for (i = 0; i < NGX_RTMP_LOAD_HIST_BUCKETS - 1; ++i) {
+        n += h->buckets[i];
+        if (n >= rank) {
+            break;
+        }
+    }
+
+    if (i < NGX_RTMP_LOAD_HIST_SUB) {
+        v = i;
+
+    } else {
+        shift = i / NGX_RTMP_LOAD_HIST_SUB - 1;
+        m = i % NGX_RTMP_LOAD_HIST_SUB + NGX_RTMP_LOAD_HIST_SUB;
+        v = ((uint64_t) (m + 1) << shift) - 1;
+    }
+
+    return v < h->max ? v : h->max;
+}
+
+static void
+ngx_rtmp_load_hist_sub(ngx_rtmp_load_hist_t *dst, ngx_rtmp_load_hist_t *a,
+    ngx_rtmp_load_hist_t *b)
+{
+    unsigned                    i;
+
+    for (i = 0; i < NGX_RTMP_LOAD_HIST_BUCKETS; ++i) {
+        dst->buckets[i] = a->buckets[i] - b->buckets[i];
+    }
+
+    dst->count = a->count - b->count;
+    dst->max = a->max;
+}
+
+
+/* buffers */
+
+static u_char *
+ngx_rtmp_load_buf_reserve(ngx_rtmp_load_buf_t *b, size_t n)
+{
+    u_char                     *p;
+    size_t                      cap;
+
+    /* compact consumed bytes before grow */
+    if (b->pos && b->len + n > b->cap) {
+        memmove(b->data, b->data + b->pos, b->len - b->pos);
+        b->len -= b->pos;
+        b->pos = 0;
+    }
+
+    if (b->len + n > b->cap) {
+        cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n) {
+            cap *= 2;
+        }
+
+        p = realloc(b->data, cap);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        b->data = p;
+        b->cap = cap;
+    }
+
+    return b->data + b->len;
+}
+
+static int
+ngx_rtmp_load_buf_append(ngx_rtmp_load_buf_t *b, const void *data, size_t n)
+{
+    u_char                     *p;
+
+    p = ngx_rtmp_load_buf_reserve(b, n);
+    if (p == NULL) {
+        return -1;
+    }
+
+    memcpy(p, data, n);
+    b->len += n;
+
+    return 0;
+}
+
+static void
+ngx_rtmp_load_buf_free(ngx_rtmp_load_buf_t *b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(ngx_rtmp_load_buf_t));
+}
+
+
+/* byte order */
+
+static u_char *
+ngx_rtmp_load_be(u_char *p, uint64_t v, int n)
+{
+    while (n--) {
+        *p++ = (u_char) (v >> (n * 8));
+    }
+
+    return p;
+}
+
+static uint32_t
+ngx_rtmp_load_get_be(u_char *p, int n)
+{
+    uint32_t                    v;
+
+    v = 0;
+    while (n--) {
+        v = (v << 8) | *p++;
+    }
+
+    return v;
+}
+
+
+/* amf0 */
+
+static u_char *
+ngx_rtmp_load_amf_string(u_char *p, const char *s)
+{
+    size_t                      len;
+
+    len = strlen(s);
+
+    *p++ = 0x02;
+    p = ngx_rtmp_load_be(p, len, 2);
+
+    return (u_char *) memcpy(p, s, len) + len;
+}
+
+static u_char *
+ngx_rtmp_load_amf_number(u_char *p, double d)
+{
+    uint64_t                    v;
+
+    memcpy(&v, &d, 8);
+
+    *p++ = 0x00;
+
+    return ngx_rtmp_load_be(p, v, 8);
+}
+
+static u_char *
+ngx_rtmp_load_amf_key(u_char *p, const char *s)
+{
+    size_t                      len;
+
+    len = strlen(s);
+    p = ngx_rtmp_load_be(p, len, 2);
+
+    return (u_char *) memcpy(p, s, len) + len;
+}
+
+static int
+ngx_rtmp_load_amf_get_number(u_char *p, u_char *last, double *d)
+{
+    uint64_t                    v;
+
+    if (last - p < 9 || *p != 0x00) {
+        return -1;
+    }
+
+    v = ((uint64_t) ngx_rtmp_load_get_be(p + 1, 4) << 32)
+        | ngx_rtmp_load_get_be(p + 5, 4);
+    memcpy(d, &v, 8);
+
+    return 0;
+}
+
+
+/* connection */
+
+static int
+ngx_rtmp_load_flush(ngx_rtmp_load_conn_t *c)
+{
+    ssize_t                     n;
+    struct epoll_event          ee;
+
+    while (c->out.pos < c->out.len) {
+        n = send(c->fd, c->out.data + c->out.pos, c->out.len - c->out.pos,
+                 MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EAGAIN) {
+                break;
+            }
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        c->out.pos += n;
+    }
+
+    if (c->out.pos == c->out.len) {
+        c->out.pos = 0;
+        c->out.len = 0;
+    }
+
+    /* wait writable only when something left */
+    if (c->writable != (c->out.len != 0)) {
+        c->writable = (c->out.len != 0);
+
+        ee.events = EPOLLIN | (c->writable ? EPOLLOUT : 0);
+        ee.data.ptr = c;
+        epoll_ctl(ngx_rtmp_load_ep, EPOLL_CTL_MOD, c->fd, &ee);
+    }
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_send_message(ngx_rtmp_load_conn_t *c, uint32_t csid,
+    uint8_t type, uint32_t msid, uint32_t timestamp, u_char *data, size_t len)
+{
+    u_char                     *p;
+    size_t                      n, chunk;
+    int                         ext;
+
+    ext = timestamp >= 0xffffff;
+
+    /* worst case of headers */
+    n = len + (len / NGX_RTMP_LOAD_CHUNK_SIZE + 1) * (1 + 4) + 12 + 4;
+
+    p = ngx_rtmp_load_buf_reserve(&c->out, n);
+    if (p == NULL) {
+        return -1;
+    }
+
+    *p++ = (u_char) csid;
+    p = ngx_rtmp_load_be(p, ext ? 0xffffff : timestamp, 3);
+    p = ngx_rtmp_load_be(p, len, 3);
+    *p++ = type;
+    /* msid is little endian */
+    *p++ = (u_char) msid;
+    *p++ = (u_char) (msid >> 8);
+    *p++ = (u_char) (msid >> 16);
+    *p++ = (u_char) (msid >> 24);
+
+    if (ext) {
+        p = ngx_rtmp_load_be(p, timestamp, 4);
+    }
+
+    for ( ;; ) {
+        chunk = len < NGX_RTMP_LOAD_CHUNK_SIZE ? len : NGX_RTMP_LOAD_CHUNK_SIZE;
+        memcpy(p, data, chunk);
+        p += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (len == 0) {
+            break;
+        }
+
+        *p++ = (u_char) (0xc0 | csid);
+        if (ext) {
+            p = ngx_rtmp_load_be(p, timestamp, 4);
+        }
+    }
+
+    c->out.len = p - c->out.data;
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_open(ngx_rtmp_load_conn_t *c, struct sockaddr_in *addr)
+{
+    struct epoll_event          ee;
+    int                         fd, one;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (struct sockaddr *) addr, sizeof(*addr)) == -1
+        && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+
+    c->fd = fd;
+    c->state = NGX_RTMP_LOAD_CONNECTING;
+    c->writable = 1;
+
+    ee.events = EPOLLIN | EPOLLOUT;
+    ee.data.ptr = c;
+    if (epoll_ctl(ngx_rtmp_load_ep, EPOLL_CTL_ADD, fd, &ee) == -1) {
+        close(fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+ngx_rtmp_load_shutdown(ngx_rtmp_load_conn_t *c)
+{
+    if (c->fd != -1) {
+        epoll_ctl(ngx_rtmp_load_ep, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    c->in.pos = 0;
+    c->in.len = 0;
+    c->out.pos = 0;
+    c->out.len = 0;
+}
+
+static void
+ngx_rtmp_load_close(ngx_rtmp_load_conn_t *c, int failed)
+{
+    ngx_rtmp_load_stat_t       *st;
+    int                         i;
+
+    if (c->state == NGX_RTMP_LOAD_CLOSED) {
+        return;
+    }
+
+    ngx_rtmp_load_shutdown(c);
+
+    st = &ngx_rtmp_load_stats[c->type];
+    if (failed && !c->first) {
+        ++st->failed;
+    } else {
+        ++st->closed;
+    }
+
+    c->state = NGX_RTMP_LOAD_CLOSED;
+
+    ngx_rtmp_load_buf_free(&c->in);
+    ngx_rtmp_load_buf_free(&c->out);
+    for (i = 0; i < NGX_RTMP_LOAD_MAX_CSID; ++i) {
+        ngx_rtmp_load_buf_free(&c->cs[i].msg);
+    }
+}
+
+
+/* latency and drops */
+
+static void
+ngx_rtmp_load_first(ngx_rtmp_load_conn_t *c)
+{
+    ngx_rtmp_load_stat_t       *st;
+
+    if (c->first) {
+        return;
+    }
+
+    c->first = 1;
+
+    st = &ngx_rtmp_load_stats[c->type];
+    ++st->connected;
+    ngx_rtmp_load_hist_add(&st->ttff, ngx_rtmp_load_msec() - c->start);
+}
+
+static int
+ngx_rtmp_load_hex(u_char *p, int n, uint64_t *v)
+{
+    *v = 0;
+
+    while (n--) {
+        if (*p >= '0' && *p <= '9') {
+            *v = (*v << 4) | (*p - '0');
+        } else if (*p >= 'a' && *p <= 'f') {
+            *v = (*v << 4) | (*p - 'a' + 10);
+        } else {
+            return -1;
+        }
+        ++p;
+    }
+
+    return 0;
+}
+
+/* marker found in video frame */
+static void
+ngx_rtmp_load_marker(ngx_rtmp_load_conn_t *c, u_char *p)
+{
+    ngx_rtmp_load_stat_t       *st;
+    uint64_t                    sent, seq, now;
+
+    if (ngx_rtmp_load_hex(p + 4, 16, &sent) != 0
+        || ngx_rtmp_load_hex(p + 20, 8, &seq) != 0)
+    {
+        return;
+    }
+
+    st = &ngx_rtmp_load_stats[c->type];
+    now = ngx_rtmp_load_msec();
+
+    ngx_rtmp_load_first(c);
+
+    ngx_rtmp_load_hist_add(&st->latency, now > sent ? now - sent : 0);
+
+    if (c->last_seq >= 0 && (int64_t) seq > c->last_seq + 1) {
+        st->drops += seq - c->last_seq - 1;
+    }
+
+    if ((int64_t) seq > c->last_seq) {
+        c->last_seq = seq;
+    }
+}
+
+static void
+ngx_rtmp_load_scan(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    u_char                     *last;
+
+    last = p + len;
+
+    while (last - p >= NGX_RTMP_LOAD_MARKER_LEN) {
+        p = memmem(p, last - p, NGX_RTMP_LOAD_MARKER, 4);
+        if (p == NULL || last - p < NGX_RTMP_LOAD_MARKER_LEN) {
+            return;
+        }
+
+        ngx_rtmp_load_marker(c, p);
+        p += NGX_RTMP_LOAD_MARKER_LEN;
+    }
+}
+
+/* video tag of rtmp or flv, marker is in first NAL of synthetic frame */
+static void
+ngx_rtmp_load_video(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    int64_t                     change;
+
+    conf = &ngx_rtmp_load_conf;
+
+    /* avc sequence header, level_idc is in avcC after 5 bytes of tag */
+    if (len > 8 && (p[0] & 0x0f) == 7 && p[1] == 0) {
+        c->level = p[8];
+        return;
+    }
+
+    ++ngx_rtmp_load_stats[c->type].frames;
+
+    ngx_rtmp_load_scan(c, p, len < 64 ? len : 64);
+
+    if (conf->headers == 0 || conf->file || (p[0] >> 4) != 1
+        || c->last_seq < 0)
+    {
+        return;
+    }
+
+    change = c->last_seq / conf->gop / conf->headers;
+
+    if (c->level != NGX_RTMP_LOAD_AVC_LEVEL + change % 2) {
+        ++ngx_rtmp_load_stats[c->type].stale;
+    }
+}
+
+/* onFI injected by latency_probe */
+static void
+ngx_rtmp_load_data(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    u_char                     *last;
+    double                      epoch;
+    uint64_t                    now;
+
+    last = p + len;
+
+    if (memmem(p, len, "onFI", 4) == NULL) {
+        return;
+    }
+
+    p = memmem(p, len, "epoch", 5);
+    if (p == NULL
+        || ngx_rtmp_load_amf_get_number(p + 5, last, &epoch) != 0)
+    {
+        return;
+    }
+
+    now = ngx_rtmp_load_msec();
+
+    ngx_rtmp_load_first(c);
+    ngx_rtmp_load_hist_add(&ngx_rtmp_load_stats[c->type].latency,
+                           now > (uint64_t) epoch ? now - (uint64_t) epoch
+                                                  : 0);
+}
+
+/* flv tags in aggregate message or flv stream, return bytes consumed */
+static size_t
+ngx_rtmp_load_flv_tag(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    size_t                      size;
+
+    if (len < 11) {
+        return 0;
+    }
+
+    size = ngx_rtmp_load_get_be(p + 1, 3);
+    if (len < 11 + size + 4) {
+        return 0;
+    }
+
+    switch (p[0] & 0x1f) {
+    case 9:
+        ngx_rtmp_load_video(c, p + 11, size);
+        break;
+
+    case 18:
+        ngx_rtmp_load_data(c, p + 11, size);
+        break;
+    }
+
+    return 11 + size + 4;
+}
+
+
+/* rtmp */
+
+static int
+ngx_rtmp_load_connect_cmd(ngx_rtmp_load_conn_t *c)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    u_char                      buf[1024], *p;
+    char                        tcurl[512];
+
+    conf = &ngx_rtmp_load_conf;
+
+    snprintf(tcurl, sizeof(tcurl), "rtmp://%s:%d/%s",
+             conf->host, conf->rtmp_port, conf->app);
+
+    /* set chunk size */
+    p = ngx_rtmp_load_be(buf, NGX_RTMP_LOAD_CHUNK_SIZE, 4);
+    if (ngx_rtmp_load_send_message(c, 2, 1, 0, 0, buf, p - buf) != 0) {
+        return -1;
+    }
+
+    p = ngx_rtmp_load_amf_string(buf, "connect");
+    p = ngx_rtmp_load_amf_number(p, 1);
+    *p++ = 0x03;
+    p = ngx_rtmp_load_amf_key(p, "app");
+    p = ngx_rtmp_load_amf_string(p, conf->app);
+    p = ngx_rtmp_load_amf_key(p, "flashVer");
+    p = ngx_rtmp_load_amf_string(p, "LNX 9,0,124,2");
+    p = ngx_rtmp_load_amf_key(p, "tcUrl");
+    p = ngx_rtmp_load_amf_string(p, tcurl);
+    p = ngx_rtmp_load_amf_key(p, "audioCodecs");
+    p = ngx_rtmp_load_amf_number(p, 3575);
+    p = ngx_rtmp_load_amf_key(p, "videoCodecs");
+    p = ngx_rtmp_load_amf_number(p, 252);
+    p = ngx_rtmp_load_be(p, 0x000009, 3);
+
+    c->state = NGX_RTMP_LOAD_CONNECT;
+
+    return ngx_rtmp_load_send_message(c, 3, 20, 0, 0, buf, p - buf);
+}
+
+static int
+ngx_rtmp_load_create_stream_cmd(ngx_rtmp_load_conn_t *c)
+{
+    u_char                      buf[64], *p;
+
+    p = ngx_rtmp_load_amf_string(buf, "createStream");
+    p = ngx_rtmp_load_amf_number(p, 2);
+    *p++ = 0x05;
+
+    c->state = NGX_RTMP_LOAD_CREATE_STREAM;
+
+    return ngx_rtmp_load_send_message(c, 3, 20, 0, 0, buf, p - buf);
+}
+
+static int
+ngx_rtmp_load_start_cmd(ngx_rtmp_load_conn_t *c)
+{
+    u_char                      buf[1024], *p;
+    char                        name[512];
+
+    if (c->type == NGX_RTMP_LOAD_PUBLISH) {
+        p = ngx_rtmp_load_amf_string(buf, "publish");
+        p = ngx_rtmp_load_amf_number(p, 0);
+        *p++ = 0x05;
+        p = ngx_rtmp_load_amf_string(p, ngx_rtmp_load_conf.stream);
+        p = ngx_rtmp_load_amf_string(p, "live");
+
+    } else {
+        p = ngx_rtmp_load_amf_string(buf, "play");
+        p = ngx_rtmp_load_amf_number(p, 0);
+        *p++ = 0x05;
+
+        if (ngx_rtmp_load_conf.track) {
+            snprintf(name, sizeof(name), "%s?track=%s",
+                     ngx_rtmp_load_conf.stream, ngx_rtmp_load_conf.track);
+            p = ngx_rtmp_load_amf_string(p, name);
+
+        } else {
+            p = ngx_rtmp_load_amf_string(p, ngx_rtmp_load_conf.stream);
+        }
+
+        p = ngx_rtmp_load_amf_number(p, -1000);
+    }
+
+    c->state = NGX_RTMP_LOAD_START;
+
+    return ngx_rtmp_load_send_message(c, 8, 20, NGX_RTMP_LOAD_MSID, 0,
+                                      buf, p - buf);
+}
+
+static int
+ngx_rtmp_load_command(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    u_char                     *last;
+    size_t                      n;
+    double                      trans;
+
+    last = p + len;
+
+    if (len < 3 || p[0] != 0x02) {
+        return 0;
+    }
+
+    n = ngx_rtmp_load_get_be(p + 1, 2);
+    if (3 + n > len) {
+        return 0;
+    }
+
+    if (n == sizeof("_error") - 1 && memcmp(p + 3, "_error", n) == 0) {
+        fprintf(stderr, "%s: command error\n",
+                ngx_rtmp_load_type_name[c->type]);
+        return -1;
+    }
+
+    if (n == sizeof("_result") - 1 && memcmp(p + 3, "_result", n) == 0) {
+        if (ngx_rtmp_load_amf_get_number(p + 3 + n, last, &trans) != 0) {
+            return 0;
+        }
+
+        if (trans == 1 && c->state == NGX_RTMP_LOAD_CONNECT) {
+            return ngx_rtmp_load_create_stream_cmd(c);
+        }
+
+        if (trans == 2 && c->state == NGX_RTMP_LOAD_CREATE_STREAM) {
+            return ngx_rtmp_load_start_cmd(c);
+        }
+
+        return 0;
+    }
+
+    if (n == sizeof("onStatus") - 1 && memcmp(p + 3, "onStatus", n) == 0) {
+        if (memmem(p, len, "Failed", 6) || memmem(p, len, "BadName", 7)
+            || memmem(p, len, "NotFound", 8))
+        {
+            fprintf(stderr, "%s: %.*s\n", ngx_rtmp_load_type_name[c->type],
+                    (int) len, p);
+            return -1;
+        }
+
+        if (c->state == NGX_RTMP_LOAD_START) {
+            c->state = NGX_RTMP_LOAD_STREAMING;
+
+            if (c->type == NGX_RTMP_LOAD_PUBLISH) {
+                c->epoch = ngx_rtmp_load_msec();
+                ngx_rtmp_load_first(c);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_message(ngx_rtmp_load_conn_t *c, ngx_rtmp_load_cs_t *cs)
+{
+    u_char                     *p, buf[6];
+    size_t                      len, n;
+
+    p = cs->msg.data;
+    len = cs->msg.len;
+
+    switch (cs->type) {
+    case 1: /* set chunk size */
+        if (len >= 4) {
+            c->in_chunk = ngx_rtmp_load_get_be(p, 4) & 0x7fffffff;
+        }
+        break;
+
+    case 4: /* user control, answer ping request */
+        if (len >= 6 && ngx_rtmp_load_get_be(p, 2) == 6) {
+            ngx_rtmp_load_be(buf, 7, 2);
+            memcpy(buf + 2, p + 2, 4);
+            return ngx_rtmp_load_send_message(c, 2, 4, 0, 0, buf, 6);
+        }
+        break;
+
+    case 8:
+        ++ngx_rtmp_load_stats[c->type].frames;
+        break;
+
+    case 9:
+        ngx_rtmp_load_video(c, p, len);
+        break;
+
+    case 18:
+        ngx_rtmp_load_data(c, p, len);
+        break;
+
+    case 20:
+        return ngx_rtmp_load_command(c, p, len);
+
+    case 22: /* aggregate */
+        while (len) {
+            n = ngx_rtmp_load_flv_tag(c, p, len);
+            if (n == 0) {
+                break;
+            }
+
+            p += n;
+            len -= n;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_chunks(ngx_rtmp_load_conn_t *c)
+{
+    ngx_rtmp_load_cs_t         *cs;
+    u_char                     *p, *last;
+    uint32_t                    csid, v, size;
+    int                         fmt, hsize;
+
+    static int                  hsizes[] = { 11, 7, 3, 0 };
+
+    for ( ;; ) {
+        p = c->in.data + c->in.pos;
+        last = c->in.data + c->in.len;
+
+        if (p == last) {
+            break;
+        }
+
+        fmt = p[0] >> 6;
+        csid = p[0] & 0x3f;
+        p++;
+
+        if (csid == 0) {
+            if (last - p < 1) {
+                break;
+            }
+            csid = 64 + *p++;
+
+        } else if (csid == 1) {
+            if (last - p < 2) {
+                break;
+            }
+            csid = 64 + p[0] + p[1] * 256;
+            p += 2;
+        }
+
+        if (csid >= NGX_RTMP_LOAD_MAX_CSID) {
+            fprintf(stderr, "%s: csid %u not supported\n",
+                    ngx_rtmp_load_type_name[c->type], csid);
+            return -1;
+        }
+
+        cs = &c->cs[csid];
+
+        hsize = hsizes[fmt];
+        if (last - p < hsize) {
+            break;
+        }
+
+        v = 0;
+        if (fmt <= 2) {
+            v = ngx_rtmp_load_get_be(p, 3);
+        }
+
+        if (fmt <= 1) {
+            cs->mlen = ngx_rtmp_load_get_be(p + 3, 3);
+            cs->type = p[6];
+        }
+
+        if (fmt == 0) {
+            cs->msid = p[7] | (p[8] << 8) | (p[9] << 16)
+                       | ((uint32_t) p[10] << 24);
+        }
+
+        p += hsize;
+
+        if (fmt <= 2) {
+            cs->ext = (v == 0xffffff);
+        }
+
+        if (cs->ext) {
+            if (last - p < 4) {
+                break;
+            }
+            v = ngx_rtmp_load_get_be(p, 4);
+            p += 4;
+        }
+
+        if (cs->msg.len == 0) {
+            if (fmt == 0) {
+                cs->timestamp = v;
+                cs->delta = 0;
+
+            } else {
+                if (fmt != 3) {
+                    cs->delta = v;
+                }
+                cs->timestamp += cs->delta;
+            }
+        }
+
+        size = cs->mlen - cs->msg.len;
+        if (size > c->in_chunk) {
+            size = c->in_chunk;
+        }
+
+        if ((uint32_t) (last - p) < size) {
+            break;
+        }
+
+        if (ngx_rtmp_load_buf_append(&cs->msg, p, size) != 0) {
+            return -1;
+        }
+
+        p += size;
+        c->in.pos = p - c->in.data;
+
+        if (cs->msg.len == cs->mlen) {
+            if (ngx_rtmp_load_message(c, cs) != 0) {
+                return -1;
+            }
+            cs->msg.len = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_handshake(ngx_rtmp_load_conn_t *c)
+{
+    u_char                     *s1;
+
+    if (c->in.len - c->in.pos < 1 + 2 * NGX_RTMP_LOAD_HANDSHAKE_SIZE) {
+        return 0;
+    }
+
+    /* C2 echoes S1 */
+    s1 = c->in.data + c->in.pos + 1;
+    if (ngx_rtmp_load_buf_append(&c->out, s1, NGX_RTMP_LOAD_HANDSHAKE_SIZE)
+        != 0)
+    {
+        return -1;
+    }
+
+    c->in.pos += 1 + 2 * NGX_RTMP_LOAD_HANDSHAKE_SIZE;
+
+    return ngx_rtmp_load_connect_cmd(c);
+}
+
+
+/* http */
+
+static int
+ngx_rtmp_load_http_request(ngx_rtmp_load_conn_t *c, const char *path)
+{
+    char                        req[NGX_RTMP_LOAD_PATH_LEN + 256];
+    int                         n;
+
+    n = snprintf(req, sizeof(req),
+                 "GET %s HTTP/1.0\r\n"
+                 "Host: %s:%d\r\n"
+                 "User-Agent: ngx_rtmp_load\r\n"
+                 "\r\n",
+                 path, ngx_rtmp_load_conf.host, ngx_rtmp_load_conf.http_port);
+
+    c->state = NGX_RTMP_LOAD_HTTP_HEADER;
+    c->status = 0;
+    c->location[0] = '\0';
+
+    return ngx_rtmp_load_buf_append(&c->out, req, n);
+}
+
+/* strip scheme and host of absolute url */
+static void
+ngx_rtmp_load_url_path(char *dst, const char *base, const char *url)
+{
+    const char                 *p, *q;
+    size_t                      n;
+
+    if (strncmp(url, "http://", 7) == 0) {
+        p = strchr(url + 7, '/');
+        snprintf(dst, NGX_RTMP_LOAD_PATH_LEN, "%s", p ? p : "/");
+        return;
+    }
+
+    if (url[0] == '/') {
+        snprintf(dst, NGX_RTMP_LOAD_PATH_LEN, "%s", url);
+        return;
+    }
+
+    /* relative to directory of base */
+    q = strchr(base, '?');
+    n = q ? (size_t) (q - base) : strlen(base);
+    for (p = base + n; p != base && p[-1] != '/'; --p) { /* void */ }
+
+    snprintf(dst, NGX_RTMP_LOAD_PATH_LEN, "%.*s%s", (int) (p - base), base,
+             url);
+}
+
+static int
+ngx_rtmp_load_http_header(ngx_rtmp_load_conn_t *c)
+{
+    u_char                     *p, *last, *end, *line, *eol;
+    size_t                      n;
+
+    p = c->in.data + c->in.pos;
+    last = c->in.data + c->in.len;
+
+    end = memmem(p, last - p, "\r\n\r\n", 4);
+    if (end == NULL) {
+        return 0;
+    }
+
+    if (last - p < 12 || memcmp(p, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+
+    c->status = atoi((char *) p + 9);
+
+    for (line = p; line < end; line = eol + 2) {
+        eol = memmem(line, end + 2 - line, "\r\n", 2);
+        if (eol == NULL) {
+            break;
+        }
+
+        if (eol - line > 10 && strncasecmp((char *) line, "Location:", 9) == 0)
+        {
+            line += 9;
+            while (*line == ' ') {
+                ++line;
+            }
+
+            n = eol - line;
+            if (n >= NGX_RTMP_LOAD_PATH_LEN) {
+                n = NGX_RTMP_LOAD_PATH_LEN - 1;
+            }
+
+            memcpy(c->location, line, n);
+            c->location[n] = '\0';
+        }
+    }
+
+    c->in.pos = end + 4 - c->in.data;
+    c->state = NGX_RTMP_LOAD_HTTP_BODY;
+
+    if (c->status == 301 || c->status == 302) {
+        return 0;
+    }
+
+    if (c->status != 200) {
+        fprintf(stderr, "%s: http status %d\n",
+                ngx_rtmp_load_type_name[c->type], c->status);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+ngx_rtmp_load_flv_body(ngx_rtmp_load_conn_t *c)
+{
+    size_t                      n;
+
+    if (!c->flv_header) {
+        if (c->in.len - c->in.pos < 9 + 4) {
+            return 0;
+        }
+
+        if (memcmp(c->in.data + c->in.pos, "FLV", 3) != 0) {
+            return -1;
+        }
+
+        c->in.pos += 9 + 4;
+        c->flv_header = 1;
+    }
+
+    for ( ;; ) {
+        n = ngx_rtmp_load_flv_tag(c, c->in.data + c->in.pos,
+                                  c->in.len - c->in.pos);
+        if (n == 0) {
+            break;
+        }
+
+        c->in.pos += n;
+    }
+
+    return 0;
+}
+
+/* payload of video pid, markers may cross ts packets */
+static void
+ngx_rtmp_load_ts_payload(ngx_rtmp_load_conn_t *c, u_char *p, size_t len)
+{
+    u_char                      buf[2 * NGX_RTMP_LOAD_MARKER_LEN];
+    size_t                      n;
+
+    /* marker across previous and this packet */
+    n = len < NGX_RTMP_LOAD_MARKER_LEN ? len : NGX_RTMP_LOAD_MARKER_LEN;
+    memcpy(buf, c->tail, c->ntail);
+    memcpy(buf + c->ntail, p, n);
+    if (c->ntail) {
+        ngx_rtmp_load_scan(c, buf, c->ntail + n);
+    }
+
+    /* whole marker in tail is scanned before, scan rest of packet */
+    if (len > n) {
+        ngx_rtmp_load_scan(c, p, len);
+    }
+
+    n = len < NGX_RTMP_LOAD_MARKER_LEN - 1 ? len : NGX_RTMP_LOAD_MARKER_LEN - 1;
+    memcpy(c->tail, p + len - n, n);
+    c->ntail = n;
+}
+
+static int
+ngx_rtmp_load_ts_body(ngx_rtmp_load_conn_t *c)
+{
+    u_char                     *p;
+    unsigned                    pid, afc, off;
+
+    while (c->in.len - c->in.pos >= 188) {
+        p = c->in.data + c->in.pos;
+        c->in.pos += 188;
+
+        if (p[0] != 0x47) {
+            return -1;
+        }
+
+        pid = ((p[1] & 0x1f) << 8) | p[2];
+        if (pid != NGX_RTMP_LOAD_TS_VIDEO_PID) {
+            continue;
+        }
+
+        /* payload unit start of video pes is a frame */
+        if (p[1] & 0x40) {
+            ++ngx_rtmp_load_stats[c->type].frames;
+        }
+
+        afc = (p[3] >> 4) & 0x03;
+        off = 4;
+        if (afc & 0x02) {
+            off += 1 + p[4];
+        }
+
+        if (!(afc & 0x01) || off >= 188) {
+            continue;
+        }
+
+        ngx_rtmp_load_ts_payload(c, p + off, 188 - off);
+    }
+
+    return 0;
+}
+
+
+/* hls */
+
+static void
+ngx_rtmp_load_hls_playlist(ngx_rtmp_load_conn_t *c)
+{
+    char                       *p, *line, *eol;
+    int64_t                     seq, mseq;
+    uint64_t                    target;
+    int                         n, first;
+
+    /* body of playlist, terminate for parsing */
+    if (ngx_rtmp_load_buf_append(&c->in, "", 1) != 0) {
+        return;
+    }
+
+    p = (char *) c->in.data + c->in.pos;
+
+    /* master playlist, follow first variant */
+    line = strstr(p, "#EXT-X-STREAM-INF");
+    if (line) {
+        line = strchr(line, '\n');
+        if (line) {
+            ++line;
+            eol = strpbrk(line, "\r\n");
+            if (eol) {
+                *eol = '\0';
+            }
+
+            ngx_rtmp_load_url_path(c->playlist, c->playlist, line);
+            c->refresh = 0;
+        }
+
+        return;
+    }
+
+    mseq = 0;
+    line = strstr(p, "#EXT-X-MEDIA-SEQUENCE:");
+    if (line) {
+        mseq = atoll(line + sizeof("#EXT-X-MEDIA-SEQUENCE:") - 1);
+    }
+
+    target = 1;
+    line = strstr(p, "#EXT-X-TARGETDURATION:");
+    if (line) {
+        target = atoi(line + sizeof("#EXT-X-TARGETDURATION:") - 1);
+    }
+
+    /* count segments to start from live edge */
+    n = 0;
+    for (line = p; *line; line = eol) {
+        eol = line + strcspn(line, "\r\n");
+        if (line != eol && *line != '#') {
+            ++n;
+        }
+        eol += strspn(eol, "\r\n");
+    }
+
+    first = c->hls_seq < 0;
+    seq = mseq;
+    for (line = p; *line; line = eol) {
+        eol = line + strcspn(line, "\r\n");
+        if (line == eol || *line == '#') {
+            eol += strspn(eol, "\r\n");
+            continue;
+        }
+
+        if (*eol) {
+            *eol++ = '\0';
+        }
+        eol += strspn(eol, "\r\n");
+
+        if ((first && seq == mseq + n - 1) || (!first && seq > c->hls_seq)) {
+            if (c->nqueue < NGX_RTMP_LOAD_HLS_QUEUE) {
+                ngx_rtmp_load_url_path(c->queue[c->nqueue++], c->playlist,
+                                       line);
+            }
+            c->hls_seq = seq;
+        }
+
+        ++seq;
+    }
+
+    c->refresh = ngx_rtmp_load_msec() + target * 1000 / 2;
+}
+
+/* fetch next segment, or playlist if due */
+static int
+ngx_rtmp_load_hls_next(ngx_rtmp_load_conn_t *c)
+{
+    const char                 *path;
+    int                         i;
+
+    if (c->nqueue) {
+        snprintf(c->path, sizeof(c->path), "%s", c->queue[0]);
+        for (i = 1; i < c->nqueue; ++i) {
+            memcpy(c->queue[i - 1], c->queue[i], NGX_RTMP_LOAD_PATH_LEN);
+        }
+        --c->nqueue;
+
+        c->fetch_segment = 1;
+        path = c->path;
+
+    } else if (ngx_rtmp_load_msec() >= c->refresh) {
+        c->fetch_segment = 0;
+        path = c->playlist;
+
+    } else {
+        c->state = NGX_RTMP_LOAD_IDLE;
+        return 0;
+    }
+
+    if (ngx_rtmp_load_open(c, &ngx_rtmp_load_http_addr) != 0) {
+        return -1;
+    }
+
+    return ngx_rtmp_load_http_request(c, path);
+}
+
+/* hls response complete when server closed */
+static int
+ngx_rtmp_load_hls_done(ngx_rtmp_load_conn_t *c)
+{
+    if (c->status == 301 || c->status == 302) {
+        ngx_rtmp_load_url_path(c->playlist, c->playlist, c->location);
+        c->refresh = 0;
+
+    } else if (c->status != 200) {
+        return -1;
+
+    } else if (c->fetch_segment) {
+        ngx_rtmp_load_ts_body(c);
+
+    } else {
+        ngx_rtmp_load_hls_playlist(c);
+    }
+
+    ngx_rtmp_load_shutdown(c);
+    c->ntail = 0;
+
+    return ngx_rtmp_load_hls_next(c);
+}
+
+
+/* synthetic source */
+
+typedef struct {
+    u_char                     *data;
+    size_t                      bit;
+} ngx_rtmp_load_bits_t;
+
+static void
+ngx_rtmp_load_put_bits(ngx_rtmp_load_bits_t *b, uint32_t v, int n)
+{
+    while (n--) {
+        if (v >> n & 1) {
+            b->data[b->bit / 8] |= 0x80 >> (b->bit % 8);
+        }
+        ++b->bit;
+    }
+}
+
+static void
+ngx_rtmp_load_put_ue(ngx_rtmp_load_bits_t *b, uint32_t v)
+{
+    int                         n;
+
+    ++v;
+    for (n = 0; (v >> n) > 1; ++n) { /* void */ }
+
+    ngx_rtmp_load_put_bits(b, 0, n);
+    ngx_rtmp_load_put_bits(b, v, n + 1);
+}
+
+/* trailing bits, return bytes */
+static size_t
+ngx_rtmp_load_put_trailing(ngx_rtmp_load_bits_t *b)
+{
+    ngx_rtmp_load_put_bits(b, 1, 1);
+
+    return (b->bit + 7) / 8;
+}
+
+/* avcC of baseline 320x240, frames are not decodable, only muxable */
+static void
+ngx_rtmp_load_init_avc_header(int level)
+{
+    u_char                      sps[32], pps[16], *p;
+    ngx_rtmp_load_bits_t        b;
+    size_t                      nsps, npps;
+
+    memset(sps, 0, sizeof(sps));
+    b.data = sps;
+    b.bit = 0;
+
+    ngx_rtmp_load_put_bits(&b, 0x67, 8);    /* nal header */
+    ngx_rtmp_load_put_bits(&b, 66, 8);      /* profile_idc baseline */
+    ngx_rtmp_load_put_bits(&b, 0xc0, 8);    /* constraint flags */
+    ngx_rtmp_load_put_bits(&b, level, 8);   /* level_idc */
+    ngx_rtmp_load_put_ue(&b, 0);            /* seq_parameter_set_id */
+    ngx_rtmp_load_put_ue(&b, 0);            /* log2_max_frame_num - 4 */
+    ngx_rtmp_load_put_ue(&b, 2);            /* pic_order_cnt_type */
+    ngx_rtmp_load_put_ue(&b, 1);            /* max_num_ref_frames */
+    ngx_rtmp_load_put_bits(&b, 0, 1);       /* gaps_in_frame_num_allowed */
+    ngx_rtmp_load_put_ue(&b, 19);           /* pic_width_in_mbs - 1 */
+    ngx_rtmp_load_put_ue(&b, 14);           /* pic_height_in_map_units - 1 */
+    ngx_rtmp_load_put_bits(&b, 1, 1);       /* frame_mbs_only */
+    ngx_rtmp_load_put_bits(&b, 1, 1);       /* direct_8x8_inference */
+    ngx_rtmp_load_put_bits(&b, 0, 1);       /* frame_cropping */
+    ngx_rtmp_load_put_bits(&b, 0, 1);       /* vui_parameters_present */
+    nsps = ngx_rtmp_load_put_trailing(&b);
+
+    memset(pps, 0, sizeof(pps));
+    b.data = pps;
+    b.bit = 0;
+
+    ngx_rtmp_load_put_bits(&b, 0x68, 8);    /* nal header */
+    ngx_rtmp_load_put_ue(&b, 0);            /* pic_parameter_set_id */
+    ngx_rtmp_load_put_ue(&b, 0);            /* seq_parameter_set_id */
+    ngx_rtmp_load_put_bits(&b, 0, 2);       /* cabac, bottom_field_order */
+    ngx_rtmp_load_put_ue(&b, 0);            /* num_slice_groups - 1 */
+    ngx_rtmp_load_put_ue(&b, 0);            /* num_ref_idx_l0 - 1 */
+    ngx_rtmp_load_put_ue(&b, 0);            /* num_ref_idx_l1 - 1 */
+    ngx_rtmp_load_put_bits(&b, 0, 3);       /* weighted pred and bipred */
+    ngx_rtmp_load_put_ue(&b, 0);            /* pic_init_qp - 26, se(0) */
+    ngx_rtmp_load_put_ue(&b, 0);            /* pic_init_qs - 26, se(0) */
+    ngx_rtmp_load_put_ue(&b, 0);            /* chroma_qp_index_offset */
+    ngx_rtmp_load_put_bits(&b, 4, 3);       /* deblocking control only */
+    npps = ngx_rtmp_load_put_trailing(&b);
+
+    p = ngx_rtmp_load_avc_header;
+    *p++ = 0x17;                            /* keyframe, avc */
+    *p++ = 0x00;                            /* sequence header */
+    p = ngx_rtmp_load_be(p, 0, 3);          /* composition time */
+    *p++ = 0x01;                            /* configurationVersion */
+    *p++ = sps[1];
+    *p++ = sps[2];
+    *p++ = sps[3];
+    *p++ = 0xff;                            /* 4 bytes nalu length */
+    *p++ = 0xe1;                            /* 1 sps */
+    p = ngx_rtmp_load_be(p, nsps, 2);
+    p = (u_char *) memcpy(p, sps, nsps) + nsps;
+    *p++ = 0x01;                            /* 1 pps */
+    p = ngx_rtmp_load_be(p, npps, 2);
+    p = (u_char *) memcpy(p, pps, npps) + npps;
+
+    ngx_rtmp_load_avc_header_len = p - ngx_rtmp_load_avc_header;
+}
+
+static size_t
+ngx_rtmp_load_video_frame(ngx_rtmp_load_conn_t *c, int key)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    u_char                     *p;
+    size_t                      size;
+    char                        marker[NGX_RTMP_LOAD_MARKER_LEN + 1];
+
+    conf = &ngx_rtmp_load_conf;
+
+    /* keyframes are 4 times of others in gop */
+    size = (size_t) conf->vbitrate * 1000 / 8 * conf->gop / conf->fps
+           / (conf->gop + 3);
+    if (key) {
+        size *= 4;
+    }
+
+    if (size < 5 + 4 + 1 + NGX_RTMP_LOAD_MARKER_LEN) {
+        size = 5 + 4 + 1 + NGX_RTMP_LOAD_MARKER_LEN;
+    }
+
+    if (size > ngx_rtmp_load_frame_cap) {
+        p = realloc(ngx_rtmp_load_frame, size);
+        if (p == NULL) {
+            return 0;
+        }
+
+        ngx_rtmp_load_frame = p;
+        ngx_rtmp_load_frame_cap = size;
+    }
+
+    p = ngx_rtmp_load_frame;
+    *p++ = key ? 0x17 : 0x27;
+    *p++ = 0x01;                            /* nalu */
+    p = ngx_rtmp_load_be(p, 0, 3);
+    p = ngx_rtmp_load_be(p, size - 5 - 4, 4);
+    *p++ = key ? 0x65 : 0x41;               /* idr or non-idr slice */
+
+    snprintf(marker, sizeof(marker), NGX_RTMP_LOAD_MARKER "%016llx%08llx",
+             (unsigned long long) ngx_rtmp_load_msec(),
+             (unsigned long long) (c->vseq & 0xffffffff));
+    p = (u_char *) memcpy(p, marker, NGX_RTMP_LOAD_MARKER_LEN)
+        + NGX_RTMP_LOAD_MARKER_LEN;
+
+    /* no start code emulation in filler */
+    memset(p, 0x5a, size - (p - ngx_rtmp_load_frame));
+
+    return size;
+}
+
+static int
+ngx_rtmp_load_synthetic(ngx_rtmp_load_conn_t *c, uint64_t elapsed)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    u_char                      abuf[2048];
+    uint64_t                    vts, ats;
+    size_t                      size;
+    int                         key;
+
+    conf = &ngx_rtmp_load_conf;
+
+    for ( ;; ) {
+        vts = c->vseq * 1000 / conf->fps;
+        /* aac frame is 1024 samples of 44100 */
+        ats = conf->abitrate ? c->aseq * 1024 * 1000 / 44100 : (uint64_t) -1;
+
+        if (vts > elapsed && ats > elapsed) {
+            return 0;
+        }
+
+        if (c->out.len > NGX_RTMP_LOAD_MAX_OUT) {
+            ++ngx_rtmp_load_stats[c->type].stalls;
+            return 0;
+        }
+
+        if (vts <= ats) {
+            key = (c->vseq % conf->gop == 0);
+
+            /* header change before keyframe of every N gops */
+            if (key && conf->headers && c->vseq
+                && c->vseq / conf->gop % conf->headers == 0)
+            {
+                ngx_rtmp_load_init_avc_header(NGX_RTMP_LOAD_AVC_LEVEL
+                    + c->vseq / conf->gop / conf->headers % 2);
+
+                if (ngx_rtmp_load_send_message(c, 6, 9, NGX_RTMP_LOAD_MSID,
+                                               vts, ngx_rtmp_load_avc_header,
+                                               ngx_rtmp_load_avc_header_len)
+                    != 0)
+                {
+                    return -1;
+                }
+            }
+
+            size = ngx_rtmp_load_video_frame(c, key);
+            if (size == 0
+                || ngx_rtmp_load_send_message(c, 6, 9, NGX_RTMP_LOAD_MSID,
+                                              vts, ngx_rtmp_load_frame, size)
+                   != 0)
+            {
+                return -1;
+            }
+
+            ++c->vseq;
+            ++ngx_rtmp_load_stats[c->type].frames;
+            continue;
+        }
+
+        size = (size_t) conf->abitrate * 1000 / 8 * 1024 / 44100;
+        if (size < 3) {
+            size = 3;
+        }
+
+        if (size > sizeof(abuf)) {
+            size = sizeof(abuf);
+        }
+
+        memset(abuf, 0x5a, size);
+        abuf[0] = 0xaf;                     /* aac 44100 16bit stereo */
+        abuf[1] = 0x01;                     /* raw */
+
+        if (ngx_rtmp_load_send_message(c, 4, 8, NGX_RTMP_LOAD_MSID, ats,
+                                       abuf, size) != 0)
+        {
+            return -1;
+        }
+
+        ++c->aseq;
+    }
+}
+
+static int
+ngx_rtmp_load_synthetic_headers(ngx_rtmp_load_conn_t *c)
+{
+    /* aac lc 44100 stereo */
+    static u_char               aac[] = { 0xaf, 0x00, 0x12, 0x10 };
+
+    if (ngx_rtmp_load_send_message(c, 6, 9, NGX_RTMP_LOAD_MSID, 0,
+                                   ngx_rtmp_load_avc_header,
+                                   ngx_rtmp_load_avc_header_len) != 0)
+    {
+        return -1;
+    }
+
+    if (ngx_rtmp_load_conf.abitrate == 0) {
+        return 0;
+    }
+
+    return ngx_rtmp_load_send_message(c, 4, 8, NGX_RTMP_LOAD_MSID, 0,
+                                      aac, sizeof(aac));
+}
+
+
+/*
+ * file source, flv tags are sent at their timestamps, dump records of
+ * ngx_rtmp_monitor_module at their arrival times, both looped
+ *
+ * dump file, see ngx_rtmp_monitor_module.h:
+ *      header: "NRTD" version(1) reserved(3)
+ *      record: arrival(4) type(1) timestamp(4) size(3) data(size)
+ */
+
+static int
+ngx_rtmp_load_file_tag(size_t pos, ngx_rtmp_load_tag_t *tag, size_t *next)
+{
+    u_char                     *p;
+    size_t                      left;
+
+    p = ngx_rtmp_load_file_data + pos;
+    left = ngx_rtmp_load_file_len - pos;
+
+    if (ngx_rtmp_load_file_dump) {
+        if (left < NGX_RTMP_LOAD_DUMP_RECORD) {
+            return -1;
+        }
+
+        tag->arrival = ngx_rtmp_load_get_be(p, 4);
+        tag->type = p[4];
+        tag->timestamp = ngx_rtmp_load_get_be(p + 5, 4);
+        tag->len = ngx_rtmp_load_get_be(p + 9, 3);
+        tag->data = p + NGX_RTMP_LOAD_DUMP_RECORD;
+
+        *next = pos + NGX_RTMP_LOAD_DUMP_RECORD + tag->len;
+
+    } else {
+        if (left < 11) {
+            return -1;
+        }
+
+        tag->type = p[0] & 0x1f;
+        tag->len = ngx_rtmp_load_get_be(p + 1, 3);
+        tag->timestamp = ngx_rtmp_load_get_be(p + 4, 3)
+                         | ((uint32_t) p[7] << 24);
+        tag->arrival = tag->timestamp;
+        tag->data = p + 11;
+
+        *next = pos + 11 + tag->len + 4;
+    }
+
+    return *next <= ngx_rtmp_load_file_len ? 0 : -1;
+}
+
+static int
+ngx_rtmp_load_file(ngx_rtmp_load_conn_t *c, uint64_t elapsed)
+{
+    ngx_rtmp_load_tag_t         tag;
+    uint64_t                    clock, at;
+    size_t                      next;
+    double                      speed;
+
+    speed = ngx_rtmp_load_conf.speed;
+    clock = speed > 0 ? (uint64_t) (elapsed * speed) : (uint64_t) -1;
+
+    for ( ;; ) {
+        if (ngx_rtmp_load_file_tag(c->fpos, &tag, &next) != 0) {
+            /* no frame at all, checked in ngx_rtmp_load_read_file */
+            if (c->fpos == ngx_rtmp_load_file_start) {
+                return -1;
+            }
+
+            /* loop, keep timestamps and arrival times increasing */
+            c->fpos = ngx_rtmp_load_file_start;
+            c->fbase = c->flast + 40;
+            c->abase = c->alast + 40;
+            c->floop = 1;
+            c->ffirst = 0;
+            continue;
+        }
+
+        if (!c->ffirst) {
+            c->ffirst = 1;
+            c->tfirst = tag.timestamp;
+            c->afirst = tag.arrival;
+        }
+
+        at = c->abase;
+        if (tag.arrival > c->afirst) {
+            at += tag.arrival - c->afirst;
+        }
+
+        if (at > clock) {
+            return 0;
+        }
+
+        if (c->out.len > NGX_RTMP_LOAD_MAX_OUT) {
+            ++ngx_rtmp_load_stats[c->type].stalls;
+            return 0;
+        }
+
+        c->fpos = next;
+        c->alast = at;
+        /* timestamp jumps of source are kept */
+        c->flast = c->fbase + (tag.timestamp - c->tfirst);
+
+        /* codec headers and metadata sent only in first loop */
+        if (c->floop
+            && (tag.type == 18 || (tag.len > 1 && tag.data[1] == 0)))
+        {
+            continue;
+        }
+
+        if (tag.type != 8 && tag.type != 9 && tag.type != 18) {
+            continue;
+        }
+
+        if (ngx_rtmp_load_send_message(c, tag.type == 18 ? 5
+                                          : (tag.type == 8 ? 4 : 6),
+                                       tag.type, NGX_RTMP_LOAD_MSID, c->flast,
+                                       tag.data, tag.len) != 0)
+        {
+            return -1;
+        }
+
+        if (tag.type == 9) {
+            ++ngx_rtmp_load_stats[c->type].frames;
+        }
+    }
+}
+
+static int
+ngx_rtmp_load_read_file(const char *name)
+{
+    FILE                       *f;
+    long                        n;
+    ngx_rtmp_load_tag_t         tag;
+    size_t                      pos, next;
+
+    f = fopen(name, "rb");
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    ngx_rtmp_load_file_data = malloc(n);
+    if (ngx_rtmp_load_file_data == NULL
+        || fread(ngx_rtmp_load_file_data, 1, n, f) != (size_t) n)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    ngx_rtmp_load_file_len = n;
+
+    if (n >= NGX_RTMP_LOAD_DUMP_HEADER
+        && memcmp(ngx_rtmp_load_file_data, NGX_RTMP_LOAD_DUMP_MAGIC, 4) == 0)
+    {
+        if (ngx_rtmp_load_file_data[4] != NGX_RTMP_LOAD_DUMP_VERSION) {
+            fprintf(stderr, "%s: dump version %d not supported\n", name,
+                    ngx_rtmp_load_file_data[4]);
+            return -1;
+        }
+
+        ngx_rtmp_load_file_dump = 1;
+        ngx_rtmp_load_file_start = NGX_RTMP_LOAD_DUMP_HEADER;
+
+    } else if (n < 13 || memcmp(ngx_rtmp_load_file_data, "FLV", 3) != 0) {
+        fprintf(stderr, "%s: neither flv nor dump\n", name);
+        return -1;
+
+    } else {
+        ngx_rtmp_load_file_start = 9 + 4;
+    }
+
+    /*
+     * codec headers and metadata are skipped after first loop, without any
+     * audio or video frame replay would never advance, or spin with -x 0
+     */
+    for (pos = ngx_rtmp_load_file_start;
+         ngx_rtmp_load_file_tag(pos, &tag, &next) == 0;
+         pos = next)
+    {
+        if ((tag.type == 8 || tag.type == 9)
+            && !(tag.len > 1 && tag.data[1] == 0))
+        {
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "%s: no audio or video frame\n", name);
+
+    return -1;
+}
+
+static int
+ngx_rtmp_load_publish(ngx_rtmp_load_conn_t *c, uint64_t now)
+{
+    if (c->state != NGX_RTMP_LOAD_STREAMING) {
+        return 0;
+    }
+
+    if (c->vseq == 0 && c->fpos == 0) {
+        if (ngx_rtmp_load_file_data) {
+            c->fpos = ngx_rtmp_load_file_start;
+        } else if (ngx_rtmp_load_synthetic_headers(c) != 0) {
+            return -1;
+        }
+    }
+
+    if (ngx_rtmp_load_file_data) {
+        return ngx_rtmp_load_file(c, now - c->epoch);
+    }
+
+    return ngx_rtmp_load_synthetic(c, now - c->epoch);
+}
+
+
+/* events */
+
+static int
+ngx_rtmp_load_connected(ngx_rtmp_load_conn_t *c)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    u_char                      c0c1[1 + NGX_RTMP_LOAD_HANDSHAKE_SIZE];
+    char                        path[NGX_RTMP_LOAD_PATH_LEN];
+    int                         err;
+    socklen_t                   len;
+
+    conf = &ngx_rtmp_load_conf;
+
+    len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+        return -1;
+    }
+
+    switch (c->type) {
+    case NGX_RTMP_LOAD_PUBLISH:
+    case NGX_RTMP_LOAD_RTMP:
+        /* plain handshake, zero version in C1 */
+        memset(c0c1, 0, sizeof(c0c1));
+        c0c1[0] = 0x03;
+        c->state = NGX_RTMP_LOAD_HANDSHAKE;
+        c->in_chunk = 128;
+        return ngx_rtmp_load_buf_append(&c->out, c0c1, sizeof(c0c1));
+
+    case NGX_RTMP_LOAD_FLV:
+        if (conf->track) {
+            snprintf(path, sizeof(path), "%s%ctrack=%s", conf->flv_path,
+                     strchr(conf->flv_path, '?') ? '&' : '?', conf->track);
+
+        } else {
+            snprintf(path, sizeof(path), "%s", conf->flv_path);
+        }
+        break;
+
+    case NGX_RTMP_LOAD_TS:
+        snprintf(path, sizeof(path), "%s", conf->ts_path);
+        break;
+
+    default: /* NGX_RTMP_LOAD_HLS */
+        snprintf(path, sizeof(path), "%s",
+                 c->fetch_segment ? c->path : c->playlist);
+        break;
+    }
+
+    return ngx_rtmp_load_http_request(c, path);
+}
+
+static int
+ngx_rtmp_load_body(ngx_rtmp_load_conn_t *c)
+{
+    switch (c->type) {
+    case NGX_RTMP_LOAD_FLV:
+        return ngx_rtmp_load_flv_body(c);
+
+    case NGX_RTMP_LOAD_TS:
+        return ngx_rtmp_load_ts_body(c);
+
+    default: /* hls parsed when response complete */
+        return 0;
+    }
+}
+
+static int
+ngx_rtmp_load_process(ngx_rtmp_load_conn_t *c)
+{
+    switch (c->state) {
+    case NGX_RTMP_LOAD_HANDSHAKE:
+        if (ngx_rtmp_load_handshake(c) != 0) {
+            return -1;
+        }
+
+        if (c->state == NGX_RTMP_LOAD_HANDSHAKE) {
+            return 0;
+        }
+
+        return ngx_rtmp_load_chunks(c);
+
+    case NGX_RTMP_LOAD_CONNECT:
+    case NGX_RTMP_LOAD_CREATE_STREAM:
+    case NGX_RTMP_LOAD_START:
+    case NGX_RTMP_LOAD_STREAMING:
+        return ngx_rtmp_load_chunks(c);
+
+    case NGX_RTMP_LOAD_HTTP_HEADER:
+        if (ngx_rtmp_load_http_header(c) != 0) {
+            return -1;
+        }
+
+        if (c->state == NGX_RTMP_LOAD_HTTP_HEADER) {
+            return 0;
+        }
+
+        return ngx_rtmp_load_body(c);
+
+    case NGX_RTMP_LOAD_HTTP_BODY:
+        return ngx_rtmp_load_body(c);
+    }
+
+    return 0;
+}
+
+static void
+ngx_rtmp_load_read(ngx_rtmp_load_conn_t *c)
+{
+    u_char                     *p;
+    ssize_t                     n;
+
+    for ( ;; ) {
+        p = ngx_rtmp_load_buf_reserve(&c->in, 65536);
+        if (p == NULL) {
+            ngx_rtmp_load_close(c, 1);
+            return;
+        }
+
+        n = recv(c->fd, p, 65536, 0);
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+
+        if (n <= 0) {
+            /* hls requests end with connection close */
+            if (n == 0 && c->type == NGX_RTMP_LOAD_HLS
+                && c->state == NGX_RTMP_LOAD_HTTP_BODY)
+            {
+                if (ngx_rtmp_load_hls_done(c) != 0) {
+                    ngx_rtmp_load_close(c, 1);
+                }
+                return;
+            }
+
+            ngx_rtmp_load_close(c, 1);
+            return;
+        }
+
+        c->in.len += n;
+        ngx_rtmp_load_stats[c->type].bytes += n;
+
+        if (ngx_rtmp_load_process(c) != 0) {
+            ngx_rtmp_load_close(c, 1);
+            return;
+        }
+
+        /* keep whole hls response for parsing at close */
+        if (c->in.pos == c->in.len) {
+            c->in.pos = 0;
+            c->in.len = 0;
+        }
+    }
+}
+
+static void
+ngx_rtmp_load_event(ngx_rtmp_load_conn_t *c, uint32_t events)
+{
+    if (c->state == NGX_RTMP_LOAD_CONNECTING) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            ngx_rtmp_load_close(c, 1);
+            return;
+        }
+
+        if (!(events & EPOLLOUT)) {
+            return;
+        }
+
+        if (ngx_rtmp_load_connected(c) != 0) {
+            ngx_rtmp_load_close(c, 1);
+            return;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ngx_rtmp_load_read(c);
+        if (c->state == NGX_RTMP_LOAD_CLOSED || c->fd == -1) {
+            return;
+        }
+    }
+
+    if (ngx_rtmp_load_flush(c) != 0) {
+        ngx_rtmp_load_close(c, 1);
+    }
+}
+
+static int
+ngx_rtmp_load_connect(ngx_rtmp_load_conn_t *c)
+{
+    c->start = ngx_rtmp_load_msec();
+    c->last_seq = -1;
+    c->hls_seq = -1;
+
+    ++ngx_rtmp_load_stats[c->type].started;
+
+    if (c->type == NGX_RTMP_LOAD_HLS) {
+        snprintf(c->playlist, sizeof(c->playlist), "%s",
+                 ngx_rtmp_load_conf.hls_path);
+        c->fetch_segment = 0;
+    }
+
+    return ngx_rtmp_load_open(c,
+                              c->type <= NGX_RTMP_LOAD_RTMP
+                              ? &ngx_rtmp_load_rtmp_addr
+                              : &ngx_rtmp_load_http_addr);
+}
+
+
+/* report */
+
+static void
+ngx_rtmp_load_report(uint64_t elapsed, int final)
+{
+    ngx_rtmp_load_stat_t       *st, *last;
+    ngx_rtmp_load_hist_t        lat;
+    uint64_t                    active;
+    double                      secs, mbps;
+    int                         type;
+
+    static ngx_rtmp_load_stat_t zero;
+
+    secs = final ? elapsed / 1000.0 : ngx_rtmp_load_conf.interval;
+
+    for (type = 0; type < NGX_RTMP_LOAD_NTYPES; ++type) {
+        st = &ngx_rtmp_load_stats[type];
+        last = &ngx_rtmp_load_last[type];
+
+        if (st->started == 0) {
+            continue;
+        }
+
+        /* rates and latency of this interval, of whole run when final */
+        if (final) {
+            lat = st->latency;
+            last = &zero;
+        } else {
+            ngx_rtmp_load_hist_sub(&lat, &st->latency, &last->latency);
+        }
+
+        active = st->connected - st->closed;
+        if (st->closed > st->connected) {
+            active = 0;
+        }
+
+        mbps = (st->bytes - last->bytes) * 8 / secs / 1000000;
+
+        printf("%s%6.1fs %-7s players %llu/%llu fail %llu"
+               " %8.2f Mbps %8.0f fps drop %llu",
+               final ? "total " : "", elapsed / 1000.0,
+               ngx_rtmp_load_type_name[type],
+               (unsigned long long) active,
+               (unsigned long long) st->started,
+               (unsigned long long) st->failed, mbps,
+               (st->frames - last->frames) / secs,
+               (unsigned long long) (st->drops - last->drops));
+
+        if (type == NGX_RTMP_LOAD_PUBLISH) {
+            printf(" stall %llu", (unsigned long long) st->stalls);
+
+        } else {
+            printf(" latency p50 %llu p99 %llu max %llu"
+                   " ttff p50 %llu p99 %llu",
+                   (unsigned long long) ngx_rtmp_load_hist_percentile(&lat,
+                                                                      50),
+                   (unsigned long long) ngx_rtmp_load_hist_percentile(&lat,
+                                                                      99),
+                   (unsigned long long) lat.max,
+                   (unsigned long long) ngx_rtmp_load_hist_percentile(
+                       &st->ttff, 50),
+                   (unsigned long long) ngx_rtmp_load_hist_percentile(
+                       &st->ttff, 99));
+
+            if (ngx_rtmp_load_conf.headers) {
+                printf(" stale %llu", (unsigned long long) st->stale);
+            }
+        }
+
+        printf("\n");
+
+        if (ngx_rtmp_load_csv) {
+            fprintf(ngx_rtmp_load_csv,
+                    "%.1f,%s,%s,%llu,%llu,%.2f,%.0f,%llu,%llu,%llu,%llu,"
+                    "%llu,%llu,%llu\n",
+                    elapsed / 1000.0, final ? "total" : "interval",
+                    ngx_rtmp_load_type_name[type],
+                    (unsigned long long) active,
+                    (unsigned long long) st->failed, mbps,
+                    (st->frames - last->frames) / secs,
+                    (unsigned long long) (st->drops - last->drops),
+                    (unsigned long long) st->stalls,
+                    (unsigned long long) ngx_rtmp_load_hist_percentile(&lat,
+                                                                      50),
+                    (unsigned long long) ngx_rtmp_load_hist_percentile(&lat,
+                                                                      99),
+                    (unsigned long long) lat.max,
+                    (unsigned long long) ngx_rtmp_load_hist_percentile(
+                        &st->ttff, 50),
+                    (unsigned long long) ngx_rtmp_load_hist_percentile(
+                        &st->ttff, 99));
+        }
+    }
+
+    fflush(stdout);
+
+    if (!final) {
+        memcpy(ngx_rtmp_load_last, ngx_rtmp_load_stats,
+               sizeof(ngx_rtmp_load_stats));
+    }
+}
+
+
+/* setup */
+
+static int
+ngx_rtmp_load_addr(struct sockaddr_in *sin, const char *host, int port)
+{
+    struct addrinfo             hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return -1;
+    }
+
+    memcpy(sin, res->ai_addr, sizeof(*sin));
+    sin->sin_port = htons(port);
+
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+static char *
+ngx_rtmp_load_default_path(const char *suffix)
+{
+    char                       *p;
+    size_t                      n;
+
+    n = strlen(ngx_rtmp_load_conf.app) + strlen(ngx_rtmp_load_conf.stream)
+        + strlen(suffix) + 3;
+
+    p = malloc(n);
+    if (p) {
+        snprintf(p, n, "/%s/%s%s", ngx_rtmp_load_conf.app,
+                 ngx_rtmp_load_conf.stream, suffix);
+    }
+
+    return p;
+}
+
+static void
+ngx_rtmp_load_usage(void)
+{
+    fprintf(stderr,
+        "usage: ngx_rtmp_load [options]\n"
+        "  -h host          server address, default 127.0.0.1\n"
+        "  -p port          rtmp port, default 1935\n"
+        "  -P port          http port, default 80\n"
+        "  -a app           application, default live\n"
+        "  -s stream        stream name, default load\n"
+        "  -i file          publish flv or dump file of monitor module in loop\n"
+        "                   instead of synthetic\n"
+        "  -x speed         replay speed of file, 2 for 2x, 0 for as fast as\n"
+        "                   possible, default 1\n"
+        "  -n               no publisher, play stream published by others\n"
+        "  -b kbps          synthetic video bitrate, default 1000\n"
+        "  -A kbps          synthetic aac bitrate, 0 for no audio,"
+        " default 64\n"
+        "  -f fps           synthetic frame rate, default 25\n"
+        "  -g frames        synthetic gop, default 50\n"
+        "  -H gops          change synthetic avc header every gops, players\n"
+        "                   count keyframes after a missed change as stale,\n"
+        "                   exit status is 2 if any\n"
+        "  -R n             rtmp players\n"
+        "  -F n             http-flv players\n"
+        "  -T n             http-ts players\n"
+        "  -L n             hls players\n"
+        "  -t track         rtmp and http-flv players play track, audio,\n"
+        "                   video or keyframe\n"
+        "  --flv-path path  http-flv uri, default /app/stream\n"
+        "  --ts-path path   http-ts uri, default /app/stream\n"
+        "  --hls-path path  hls uri, default /app/stream.m3u8\n"
+        "  -r n             players connected per second, default 200\n"
+        "  -d seconds       duration, default 30\n"
+        "  -I seconds       report interval, default 1\n"
+        "  -o file.csv      append reports as csv\n");
+}
+
+static int
+ngx_rtmp_load_options(int argc, char **argv)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    int                         ch;
+
+    static struct option        longopts[] = {
+        { "flv-path", required_argument, NULL, 1 },
+        { "ts-path",  required_argument, NULL, 2 },
+        { "hls-path", required_argument, NULL, 3 },
+        { "help",     no_argument,       NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    conf = &ngx_rtmp_load_conf;
+
+    while ((ch = getopt_long(argc, argv, "h:p:P:a:s:i:nb:A:f:g:R:F:T:L:r:d:"
+                             "I:o:x:t:H:", longopts, NULL)) != -1)
+    {
+        switch (ch) {
+        case 'h': conf->host = optarg; break;
+        case 'p': conf->rtmp_port = atoi(optarg); break;
+        case 'P': conf->http_port = atoi(optarg); break;
+        case 'a': conf->app = optarg; break;
+        case 's': conf->stream = optarg; break;
+        case 'i': conf->file = optarg; break;
+        case 'n': conf->publish = 0; break;
+        case 'b': conf->vbitrate = atoi(optarg); break;
+        case 'A': conf->abitrate = atoi(optarg); break;
+        case 'f': conf->fps = atoi(optarg); break;
+        case 'g': conf->gop = atoi(optarg); break;
+        case 'R': conf->players[NGX_RTMP_LOAD_RTMP] = atoi(optarg); break;
+        case 'F': conf->players[NGX_RTMP_LOAD_FLV] = atoi(optarg); break;
+        case 'T': conf->players[NGX_RTMP_LOAD_TS] = atoi(optarg); break;
+        case 'L': conf->players[NGX_RTMP_LOAD_HLS] = atoi(optarg); break;
+        case 'r': conf->rate = atoi(optarg); break;
+        case 'd': conf->duration = atoi(optarg); break;
+        case 'I': conf->interval = atoi(optarg); break;
+        case 'x': conf->speed = atof(optarg); break;
+        case 'o': conf->csv = optarg; break;
+        case 't': conf->track = optarg; break;
+        case 'H': conf->headers = atoi(optarg); break;
+        case 1: conf->flv_path = optarg; break;
+        case 2: conf->ts_path = optarg; break;
+        case 3: conf->hls_path = optarg; break;
+        default:
+            ngx_rtmp_load_usage();
+            return -1;
+        }
+    }
+
+    if (conf->fps <= 0 || conf->gop <= 0 || conf->rate <= 0
+        || conf->interval <= 0 || conf->vbitrate < 0 || conf->abitrate < 0
+        || conf->speed < 0 || conf->headers < 0)
+    {
+        ngx_rtmp_load_usage();
+        return -1;
+    }
+
+    if (conf->flv_path == NULL) {
+        conf->flv_path = ngx_rtmp_load_default_path("");
+    }
+
+    if (conf->ts_path == NULL) {
+        conf->ts_path = ngx_rtmp_load_default_path("");
+    }
+
+    if (conf->hls_path == NULL) {
+        conf->hls_path = ngx_rtmp_load_default_path(".m3u8");
+    }
+
+    return 0;
+}
+
+static void
+ngx_rtmp_load_signal(int signo)
+{
+    ngx_rtmp_load_quit = 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    ngx_rtmp_load_conf_t       *conf;
+    ngx_rtmp_load_conn_t       *c;
+    struct epoll_event          events[512];
+    struct rlimit               rl;
+    uint64_t                    start, now, next_report, stop;
+    int                         i, n, type, total, next, due;
+
+    if (ngx_rtmp_load_options(argc, argv) != 0) {
+        return 1;
+    }
+
+    conf = &ngx_rtmp_load_conf;
+
+    if (ngx_rtmp_load_addr(&ngx_rtmp_load_rtmp_addr, conf->host,
+                           conf->rtmp_port) != 0
+        || ngx_rtmp_load_addr(&ngx_rtmp_load_http_addr, conf->host,
+                              conf->http_port) != 0)
+    {
+        return 1;
+    }
+
+    if (conf->file && ngx_rtmp_load_read_file(conf->file) != 0) {
+        return 1;
+    }
+
+    ngx_rtmp_load_init_avc_header(NGX_RTMP_LOAD_AVC_LEVEL);
+
+    if (conf->csv) {
+        ngx_rtmp_load_csv = fopen(conf->csv, "a");
+        if (ngx_rtmp_load_csv == NULL) {
+            perror(conf->csv);
+            return 1;
+        }
+    }
+
+    /* thousands of players */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, ngx_rtmp_load_signal);
+    signal(SIGTERM, ngx_rtmp_load_signal);
+
+    ngx_rtmp_load_ep = epoll_create1(0);
+    if (ngx_rtmp_load_ep == -1) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    total = 0;
+    for (type = NGX_RTMP_LOAD_RTMP; type < NGX_RTMP_LOAD_NTYPES; ++type) {
+        total += conf->players[type];
+    }
+
+    ngx_rtmp_load_players = calloc(total + 1, sizeof(ngx_rtmp_load_conn_t *));
+    if (ngx_rtmp_load_players == NULL) {
+        return 1;
+    }
+
+    /* interleave types so every type ramps up together */
+    n = 0;
+    for (i = 0; n < total; ++i) {
+        for (type = NGX_RTMP_LOAD_RTMP; type < NGX_RTMP_LOAD_NTYPES; ++type) {
+            if (i >= conf->players[type]) {
+                continue;
+            }
+
+            c = calloc(1, sizeof(ngx_rtmp_load_conn_t));
+            if (c == NULL) {
+                return 1;
+            }
+
+            c->fd = -1;
+            c->type = type;
+            ngx_rtmp_load_players[n++] = c;
+        }
+    }
+
+    ngx_rtmp_load_nplayers = n;
+
+    start = ngx_rtmp_load_msec();
+
+    if (conf->publish) {
+        c = calloc(1, sizeof(ngx_rtmp_load_conn_t));
+        if (c == NULL) {
+            return 1;
+        }
+
+        c->fd = -1;
+        c->type = NGX_RTMP_LOAD_PUBLISH;
+        ngx_rtmp_load_publisher = c;
+
+        if (ngx_rtmp_load_connect(c) != 0) {
+            perror("connect publisher");
+            return 1;
+        }
+    }
+
+    next = 0;
+    next_report = start + conf->interval * 1000;
+    stop = start + (uint64_t) conf->duration * 1000;
+
+    while (!ngx_rtmp_load_quit) {
+        n = epoll_wait(ngx_rtmp_load_ep, events,
+                       sizeof(events) / sizeof(events[0]), 5);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (i = 0; i < n; ++i) {
+            ngx_rtmp_load_event(events[i].data.ptr, events[i].events);
+        }
+
+        now = ngx_rtmp_load_msec();
+
+        /* publisher paced by media timestamps */
+        c = ngx_rtmp_load_publisher;
+        if (c && c->state != NGX_RTMP_LOAD_CLOSED) {
+            if (ngx_rtmp_load_publish(c, now) != 0
+                || ngx_rtmp_load_flush(c) != 0)
+            {
+                ngx_rtmp_load_close(c, 1);
+            }
+
+            if (c->state == NGX_RTMP_LOAD_CLOSED) {
+                fprintf(stderr, "publisher closed\n");
+            }
+        }
+
+        /* ramp players, wait for publisher to start */
+        if (c == NULL || c->state == NGX_RTMP_LOAD_STREAMING) {
+            due = (int) ((now - start) * conf->rate / 1000);
+            while (next < ngx_rtmp_load_nplayers && next < due) {
+                if (ngx_rtmp_load_connect(ngx_rtmp_load_players[next]) != 0) {
+                    ngx_rtmp_load_close(ngx_rtmp_load_players[next], 1);
+                }
+                ++next;
+            }
+        }
+
+        /* hls playlist refresh */
+        for (i = 0; i < next; ++i) {
+            c = ngx_rtmp_load_players[i];
+            if (c->state == NGX_RTMP_LOAD_IDLE && now >= c->refresh
+                && ngx_rtmp_load_hls_next(c) != 0)
+            {
+                ngx_rtmp_load_close(c, 1);
+            }
+        }
+
+        if (now >= next_report) {
+            ngx_rtmp_load_report(now - start, 0);
+            next_report += conf->interval * 1000;
+        }
+
+        if (now >= stop) {
+            break;
+        }
+    }
+
+    ngx_rtmp_load_report(ngx_rtmp_load_msec() - start, 1);
+
+    if (ngx_rtmp_load_csv) {
+        fclose(ngx_rtmp_load_csv);
+    }
+
+    for (type = 0; type < NGX_RTMP_LOAD_NTYPES; ++type) {
+        if (ngx_rtmp_load_stats[type].stale) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
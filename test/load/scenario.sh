@@ -0,0 +1,85 @@
+#!/bin/sh
+
+# run steps of scenario file with ngx_rtmp_load, sample cpu and rss of nginx
+# workers every second while steps run
+#   ./scenario.sh scenario.txt /path/to/nginx.pid [outdir]
+#
+# each line of scenario file is a step:
+#   <seconds> <ngx_rtmp_load options>
+# empty lines and lines start with # are ignored
+#
+# outdir/load.csv, each step starts with a "# step" line:
+#   time,kind,type,players,failed,mbps,fps,drops,stalls,
+#   latency_p50,latency_p99,latency_max,ttff_p50,ttff_p99
+# outdir/server.csv:
+#   step,time,pid,cpu,rss_kb
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 scenario nginx.pid [outdir]"
+    exit 1
+fi
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+SCENARIO=$1
+MASTER=$(cat "$2") || exit 1
+OUT=${3:-load-$(date +%Y%m%d-%H%M%S)}
+LOAD=${LOAD:-$DIR/ngx_rtmp_load}
+HZ=$(getconf CLK_TCK)
+
+if [ ! -x "$LOAD" ]; then
+    echo "$LOAD not found, run $DIR/build.sh first"
+    exit 1
+fi
+
+mkdir -p "$OUT" || exit 1
+echo "step,time,pid,cpu,rss_kb" > "$OUT/server.csv"
+
+# cpu ticks of pid, utime + stime
+ticks() {
+    awk '{ print $14 + $15 }' "/proc/$1/stat" 2>/dev/null
+}
+
+sample() {
+    step=$1
+    start=$(date +%s)
+    prev=""
+
+    while :; do
+        now=$(date +%s)
+        cur=""
+
+        for pid in $(pgrep -P "$MASTER"); do
+            t=$(ticks "$pid")
+            [ -z "$t" ] && continue
+            cur="$cur $pid:$t"
+
+            last=$(echo "$prev" | tr ' ' '\n' | awk -F: -v p="$pid" \
+                   '$1 == p { print $2 }')
+            [ -z "$last" ] && continue
+
+            rss=$(awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status")
+            echo "$step,$((now - start)),$pid,$(((t - last) * 100 / HZ)),$rss"
+        done >> "$OUT/server.csv"
+
+        prev=$cur
+        sleep 1
+    done
+}
+
+step=0
+grep -v '^[[:space:]]*\(#\|$\)' "$SCENARIO" | while read -r secs args; do
+    step=$((step + 1))
+    echo "step $step: ${secs}s $args"
+    echo "# step $step: ${secs}s $args" >> "$OUT/load.csv"
+
+    sample $step &
+    sampler=$!
+
+    # shellcheck disable=SC2086
+    "$LOAD" -d "$secs" -o "$OUT/load.csv" $args || echo "step $step: exit $?"
+
+    kill $sampler 2>/dev/null
+    wait $sampler 2>/dev/null
+done
+
+echo "results in $OUT"